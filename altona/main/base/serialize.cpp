@@ -15,6 +15,7 @@
 #include "base/system.hpp"
 
 static const sInt sSerMaxBytes = 0x10000;
+static const sInt sSerAheadBytes = 0x20000;
 #define sSerMaxAlign 16        // just good alignment
 
 /****************************************************************************/
@@ -392,6 +393,14 @@ sReader::sReader()
 
   ROCount = 0;
 
+  Ahead[0] = Ahead[1] = 0;
+  AheadHandle[0] = AheadHandle[1] = -1;
+  AheadSize[0] = AheadSize[1] = 0;
+  AheadIndex = 0;
+  AheadUsed = 0;
+  AheadOffset = 0;
+  AheadLeft = 0;
+
 #if STATICMEM
   ROL = sSerLink.ROL;
 #else
@@ -401,6 +410,8 @@ sReader::sReader()
 
 sReader::~sReader()
 {
+  if(File)
+    EndAhead();           // End() was not called
 #if !STATICMEM
   sFreeMem(Buffer);
   sFreeMem(ROL);
@@ -424,6 +435,18 @@ void sReader::Begin(sFile *file)
     BufferSize = sSerMaxBytes*3+sSerMaxAlign;
     Buffer = (sU8 *)sAllocMem(BufferSize,64,0);
     Data = CheckEnd = LoadEnd = Buffer;
+    if(File->CanReadAsync() && ReadLeft>sSerMaxBytes*2)
+    {
+      AheadOffset = File->GetOffset();
+      AheadLeft = ReadLeft;
+      for(sInt i=0;i<2;i++)
+      {
+        Ahead[i] = (sU8 *)sAllocMem(sSerAheadBytes,64,0);
+        IssueAhead(i);
+      }
+      AheadIndex = 0;
+      AheadUsed = 0;
+    }
     Check();
   }
   else
@@ -445,6 +468,7 @@ void sReader::Begin(sFile *file)
 
 sBool sReader::End()
 {
+  EndAhead();
 #if !STATICMEM
   sFreeMem(Buffer);
   Buffer = 0;
@@ -492,7 +516,7 @@ void sReader::Check()
       load = ReadLeft;
     if(load>0)
     {
-      if(!File->Read(LoadEnd,load))
+      if(!Load(LoadEnd,load))
         Ok = 0;
       LoadEnd += load;
       ReadLeft -= load;
@@ -512,6 +536,64 @@ void sReader::Check()
   }
 }
 
+void sReader::IssueAhead(sInt i)
+{
+  AheadSize[i] = sMin<sS64>(AheadLeft,sSerAheadBytes);
+  AheadHandle[i] = -1;
+  if(AheadSize[i]>0)
+  {
+    AheadHandle[i] = File->BeginRead(AheadOffset,AheadSize[i],Ahead[i],sFP_NORMAL);
+    AheadOffset += AheadSize[i];
+    AheadLeft -= AheadSize[i];
+  }
+}
+
+void sReader::EndAhead()
+{
+  for(sInt i=0;i<2;i++)
+  {
+    if(AheadHandle[i]>=0)
+      File->EndRead(AheadHandle[i]);
+    AheadHandle[i] = -1;
+    AheadSize[i] = 0;
+    sFreeMem(Ahead[i]);
+    Ahead[i] = 0;
+  }
+  AheadLeft = 0;
+}
+
+sBool sReader::Load(sU8 *dest,sDInt size)
+{
+  if(!Ahead[0])
+    return File->Read(dest,size);
+
+  while(size>0)
+  {
+    sInt i = AheadIndex;
+    if(AheadSize[i]==0)
+      return 0;
+    if(AheadHandle[i]>=0)
+    {
+      File->EndRead(AheadHandle[i]);
+      AheadHandle[i] = -1;
+    }
+
+    sDInt copy = sMin(size,AheadSize[i]-AheadUsed);
+    sCopyMem(dest,Ahead[i]+AheadUsed,copy);
+    dest += copy;
+    size -= copy;
+    AheadUsed += copy;
+
+    if(AheadUsed==AheadSize[i])   // buffer is empty, refill it and switch
+    {
+      IssueAhead(i);
+      AheadIndex = 1-i;
+      AheadUsed = 0;
+    }
+  }
+  return 1;
+}
+
 void sReader::DebugPeek(sInt count)
 {
   const sU32 *ptr = (const sU32 *)Data;
@@ -128,6 +128,20 @@ class sReader
   void **ROL;
   sInt ROCount;
 
+  // read-ahead for files that can read asynchronously: two buffers, one
+  // is copied from while the other one is loading
+  sU8 *Ahead[2];
+  sFileReadHandle AheadHandle[2]; // -1 = nothing pending
+  sDInt AheadSize[2];
+  sInt AheadIndex;                // buffer we copy from
+  sDInt AheadUsed;
+  sS64 AheadOffset;               // file offset of next request
+  sS64 AheadLeft;                 // bytes not yet requested
+
+  void IssueAhead(sInt i);
+  void EndAhead();
+  sBool Load(sU8 *dest,sDInt size);
+
 public:
   sBool DontMap;          // for debug purposes
   sReader();
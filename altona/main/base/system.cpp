@@ -385,6 +385,11 @@ sS64 sFile::GetSize()
   return 0;
 }
 
+sBool sFile::CanReadAsync()
+{
+  return 0;
+}
+
 sFileReadHandle sFile::BeginRead(sS64 offset,sDInt size, void *destbuffer, sFilePriorityFlags prio)
 {
   sFatal(L"asynchronous io not supported");
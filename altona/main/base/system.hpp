@@ -422,6 +422,9 @@ class sThreadEvent
 #if sPLATFORM==sPLAT_LINUX || sPLATFORM==sPLAT_IOS
   volatile sU32 Signaled;
   sBool ManualReset;
+#if sPLATFORM==sPLAT_LINUX
+  void *Cond;                     // pthread mutex and condition variable
+#endif
 #else
   void *EventHandle;
 #endif
@@ -493,6 +496,7 @@ inline void sWriteBarrier() { _WriteBarrier(); }
 inline void sReadBarrier() { _ReadBarrier(); }
 
 // these functions return the NEW value after the operation was done on the memory address
+// (except sAtomicSwap and sAtomicCmpSwap, which return the old value. sAtomicCmpSwap only stores if *p==cmp)
 
 inline sU32 sAtomicAdd(volatile sU32 *p,sInt i) { sU32 e = _InterlockedExchangeAdd((volatile long *)p,i); return e+i; }
 inline sU32 sAtomicInc(volatile sU32 *p) { return _InterlockedIncrement((long *)p); }
@@ -501,13 +505,15 @@ inline sU64 sAtomicAdd(volatile sU64 *p,sInt i) { sU64 e = _InterlockedExchangeA
 inline sU64 sAtomicInc(volatile sU64 *p) { return _InterlockedIncrement64((__int64 *)p); }
 inline sU64 sAtomicDec(volatile sU64 *p) { return _InterlockedDecrement64((__int64 *)p); }
 inline sU32 sAtomicSwap(volatile sU32 *p, sU32 i) { return _InterlockedExchange((long*)p,i); }
+inline sU32 sAtomicCmpSwap(volatile sU32 *p, sU32 val, sU32 cmp) { return _InterlockedCompareExchange((long*)p,val,cmp); }
 
 #endif
 
 #if sCONFIG_COMPILER_GCC
 
-inline void sWriteBarrier() { /*__sync_syncronize();*/ }
-inline void sReadBarrier() { /*__sync_syncronize();*/ }
+// compiler barriers, like the msvc ones. x86 doesn't reorder stores with stores or loads with loads
+inline void sWriteBarrier() { __asm__ __volatile__("" ::: "memory"); }
+inline void sReadBarrier() { __asm__ __volatile__("" ::: "memory"); }
 inline sU32 sAtomicAdd(volatile sU32 *p,sU32 i) { return __sync_add_and_fetch(p,i); }
 inline sU32 sAtomicInc(volatile sU32 *p) { return __sync_add_and_fetch(p,1); }
 inline sU32 sAtomicDec(volatile sU32 *p) { return __sync_add_and_fetch(p,-1); }
@@ -515,6 +521,7 @@ inline sU64 sAtomicAdd(volatile sU64 *p,sU64 i) { return __sync_add_and_fetch(p,
 inline sU64 sAtomicInc(volatile sU64 *p) { return __sync_add_and_fetch(p,1); }
 inline sU64 sAtomicDec(volatile sU64 *p) { return __sync_add_and_fetch(p,-1); }
 inline sU32 sAtomicSwap(volatile sU32 *p, sU32 val) { return __sync_lock_test_and_set(p,val); }   // full swap supported?
+inline sU32 sAtomicCmpSwap(volatile sU32 *p, sU32 val, sU32 cmp) { return __sync_val_compare_and_swap(p,cmp,val); }
 
 #endif
 
@@ -532,6 +539,7 @@ sU64 sAtomicAdd(volatile sU64 *p,sU64 i);
 sU64 sAtomicInc(volatile sU64 *p);
 sU64 sAtomicDec(volatile sU64 *p);
 sU32 sAtomicSwap(volatile sU32 *p,sU32 val);
+sU32 sAtomicCmpSwap(volatile sU32 *p,sU32 val,sU32 cmp);
 
 #endif
 
@@ -554,6 +562,13 @@ static inline sU32 sAtomicSwap(volatile sU32 *p, sU32 val)
   return prev;
 }
 
+static inline sU32 sAtomicCmpSwap(volatile sU32 *p, sU32 val, sU32 cmp)
+{
+  sU32 prev;
+  do prev = __builtin_cellAtomicLockLine32((sU32*)p); while(prev==cmp && !__builtin_cellAtomicStoreConditional32((sU32*)p,val));
+  return prev;
+}
+
 #endif
 
 #if sCONFIG_COMPILER_ARM
@@ -569,6 +584,7 @@ inline sU64 sAtomicAdd(volatile sU64 *p,sU64 i) { return *p+i; }
 inline sU64 sAtomicInc(volatile sU64 *p) { return *p+1; }
 inline sU64 sAtomicDec(volatile sU64 *p) { return *p-1; }
 inline sU32 sAtomicSwap(volatile sU32 *p, sU32 val) { sU32 i = *p; *p = val; return i; }   // full swap supported?
+inline sU32 sAtomicCmpSwap(volatile sU32 *p, sU32 val, sU32 cmp) { sU32 i = *p; if(i==cmp) *p = val; return i; }
 
 #endif
 
@@ -824,6 +840,7 @@ public:
 
   // asynchronous interface. expect this to be unimplemented for certain file handlers
   // normal on disk files and uncompressed files from a pack file should work tho.
+  virtual sBool CanReadAsync();                         // 0 = BeginRead() will fail
   virtual sFileReadHandle BeginRead(sS64 offset,sDInt size,void *destbuffer=0, sFilePriorityFlags prio=sFP_NORMAL);  // begin reading
   virtual sBool DataAvailable(sFileReadHandle handle);  // data valid?
   virtual void *GetData(sFileReadHandle handle);  // access data (only valid if you didn't specify the buffer yourself!)
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <wchar.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <string.h>
 
 #include <sys/types.h>
@@ -493,8 +494,63 @@ sBool sExecuteOpen(const sChar *file)
 
 /****************************************************************************/
 
+// asynchronous reads are done by a few worker threads with pread(), so
+// they don't interfere with the file offset of synchronous reads.
+// there is one queue per priority. background reads never occupy the
+// last free worker, so normal and realtime reads don't wait behind them.
+
 class sRootFileHandler : public sFileHandler
 {
+  friend class sRootFile;
+
+  static const sInt MAX_READENTRIES=128;
+  static const sInt MAX_THREADS=4;
+
+  enum ReadState
+  {
+    RS_FREE = 0,
+    RS_QUEUED,
+    RS_BUSY,
+    RS_DONE,
+  };
+
+  struct ReadEntry
+  {
+    int File;
+    sS64 Offset;
+    sDInt Size;
+    sU8 *Dest;
+    sU8 *Buffer;              // allocated here when the caller gave no buffer
+    sFilePriorityFlags Prio;
+    sInt State;
+    sBool Ok;
+    sInt Next;                // free list or queue
+  };
+
+  pthread_mutex_t Mutex;
+  pthread_cond_t WorkCond;
+  pthread_cond_t DoneCond;
+  ReadEntry ReadEntries[MAX_READENTRIES];
+  sInt FirstFreeEntry;
+  sInt QueueFirst[3];         // indexed by sFilePriorityFlags
+  sInt QueueLast[3];
+  sInt BackgroundBusy;
+  sThread *Threads[MAX_THREADS];
+  sInt ThreadCount;
+
+  sInt AllocReadHandle();
+  void FreeReadHandle(sInt h);
+  sInt Dequeue();
+  void Work(sThread *thread);
+  static void ReadThread(sThread *thread,void *user);
+
+  sInt BeginRead(int file,sS64 offset,sDInt size,void *dest,sFilePriorityFlags prio);
+  sBool DataAvailable(sInt h);
+  void *GetData(sInt h);
+  void EndRead(sInt h);
+public:
+  sRootFileHandler();
+  ~sRootFileHandler();
   sFile *Create(const sChar *name,sFileAccess access);
   sBool Exists(const sChar *name);
 };
@@ -524,6 +580,12 @@ public:
   sS64 GetOffset();
   sBool SetSize(sS64);
   sS64 GetSize();
+
+  sBool CanReadAsync();
+  sFileReadHandle BeginRead(sS64 offset,sDInt size,void *destbuffer, sFilePriorityFlags prio);
+  sBool DataAvailable(sFileReadHandle handle);
+  void *GetData(sFileReadHandle handle);
+  void EndRead(sFileReadHandle handle);
 };
 
 static void sAddRootFilesystem()
@@ -720,6 +782,253 @@ sS64 sRootFile::GetSize()
 
 /****************************************************************************/
 
+sBool sRootFile::CanReadAsync()
+{
+  return Access==sFA_READ || Access==sFA_READRANDOM || Access==sFA_READWRITE;
+}
+
+sFileReadHandle sRootFile::BeginRead(sS64 offset,sDInt size,void *destbuffer, sFilePriorityFlags prio)
+{
+  sVERIFY(File!=-1);
+  sVERIFY(offset>=0 && offset+size<=Size);
+  return Handler->BeginRead(File,offset,size,destbuffer,prio);
+}
+
+sBool sRootFile::DataAvailable(sFileReadHandle handle)
+{
+  return Handler->DataAvailable(handle);
+}
+
+void *sRootFile::GetData(sFileReadHandle handle)
+{
+  return Handler->GetData(handle);
+}
+
+void sRootFile::EndRead(sFileReadHandle handle)
+{
+  Handler->EndRead(handle);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Asynchronous Reads                                                 ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void sRootFileHandler::ReadThread(sThread *thread,void *user)
+{
+  ((sRootFileHandler *)user)->Work(thread);
+}
+
+sRootFileHandler::sRootFileHandler()
+{
+  pthread_mutex_init(&Mutex,0);
+  pthread_cond_init(&WorkCond,0);
+  pthread_cond_init(&DoneCond,0);
+
+  sClear(ReadEntries);
+  for(sInt i=0;i<MAX_READENTRIES-1;i++)
+    ReadEntries[i].Next = i+1;
+  ReadEntries[MAX_READENTRIES-1].Next = -1;
+  FirstFreeEntry = 0;
+  for(sInt i=0;i<3;i++)
+    QueueFirst[i] = QueueLast[i] = -1;
+  BackgroundBusy = 0;
+  ThreadCount = 0;      // started on first BeginRead()
+}
+
+sRootFileHandler::~sRootFileHandler()
+{
+  pthread_mutex_lock(&Mutex);
+  for(sInt i=0;i<ThreadCount;i++)
+    Threads[i]->Terminate();
+  pthread_cond_broadcast(&WorkCond);
+  pthread_mutex_unlock(&Mutex);
+
+  for(sInt i=0;i<ThreadCount;i++)
+    delete Threads[i];
+
+  for(sInt i=0;i<MAX_READENTRIES;i++)
+    sDeleteArray(ReadEntries[i].Buffer);
+
+  pthread_cond_destroy(&DoneCond);
+  pthread_cond_destroy(&WorkCond);
+  pthread_mutex_destroy(&Mutex);
+}
+
+// all of these are called with Mutex held
+
+sInt sRootFileHandler::AllocReadHandle()
+{
+  sInt e = FirstFreeEntry;
+  if(e<0) sFatal(L"sRootFileHandler: out of async read entries!\n");
+  FirstFreeEntry = ReadEntries[e].Next;
+  ReadEntries[e].Next = -1;
+  return e;
+}
+
+void sRootFileHandler::FreeReadHandle(sInt h)
+{
+  sVERIFY(ReadEntries[h].State!=RS_FREE); // avoid double deletes
+  ReadEntries[h].State = RS_FREE;
+  ReadEntries[h].Next = FirstFreeEntry;
+  FirstFreeEntry = h;
+}
+
+sInt sRootFileHandler::Dequeue()
+{
+  sInt prio;
+  if(QueueFirst[sFP_REALTIME]>=0)
+    prio = sFP_REALTIME;
+  else if(QueueFirst[sFP_NORMAL]>=0)
+    prio = sFP_NORMAL;
+  else if(QueueFirst[sFP_BACKGROUND]>=0 && BackgroundBusy<ThreadCount-1)
+    prio = sFP_BACKGROUND;
+  else
+    return -1;
+
+  sInt e = QueueFirst[prio];
+  QueueFirst[prio] = ReadEntries[e].Next;
+  if(QueueFirst[prio]<0)
+    QueueLast[prio] = -1;
+  ReadEntries[e].Next = -1;
+  return e;
+}
+
+void sRootFileHandler::Work(sThread *thread)
+{
+  pthread_mutex_lock(&Mutex);
+  for(;;)
+  {
+    sInt e = Dequeue();
+    if(e<0)
+    {
+      if(!thread->CheckTerminate())
+        break;
+      pthread_cond_wait(&WorkCond,&Mutex);
+      continue;
+    }
+
+    ReadEntry &re = ReadEntries[e];
+    re.State = RS_BUSY;
+    sBool background = (re.Prio==sFP_BACKGROUND);
+    if(background)
+      BackgroundBusy++;
+    pthread_mutex_unlock(&Mutex);
+
+    // pread may return less than asked for, so loop
+
+    sBool ok = 1;
+    sU8 *dest = re.Dest;
+    sS64 offset = re.Offset;
+    sDInt left = re.Size;
+    while(left>0)
+    {
+      ssize_t rd = pread64(re.File,dest,sMin<sDInt>(left,0x40000000),offset);
+      if(rd<0 && errno==EINTR)
+        continue;
+      if(rd<=0)
+      {
+        ok = 0;
+        break;
+      }
+      dest += rd;
+      offset += rd;
+      left -= rd;
+    }
+
+    pthread_mutex_lock(&Mutex);
+    if(background)
+      BackgroundBusy--;
+    re.Ok = ok;
+    re.State = RS_DONE;
+    pthread_cond_broadcast(&DoneCond);
+    if(background)
+      pthread_cond_signal(&WorkCond);     // queued background reads may go now
+  }
+  pthread_mutex_unlock(&Mutex);
+}
+
+sInt sRootFileHandler::BeginRead(int file,sS64 offset,sDInt size,void *dest,sFilePriorityFlags prio)
+{
+  sVERIFY(prio>=sFP_BACKGROUND && prio<=sFP_REALTIME);
+  pthread_mutex_lock(&Mutex);
+
+  if(ThreadCount==0)
+  {
+    ThreadCount = sClamp(sGetCPUCount()/2,2,MAX_THREADS);
+    for(sInt i=0;i<ThreadCount;i++)
+    {
+      Threads[i] = new sThread(ReadThread,0,0x4000,this);
+      sString<64> name;
+      sSPrintF(name,L"FileRead%d",i);
+      Threads[i]->GetContext()->ThreadName = name;
+    }
+  }
+
+  sInt e = AllocReadHandle();
+  ReadEntry &re = ReadEntries[e];
+  re.File = file;
+  re.Offset = offset;
+  re.Size = size;
+  re.Buffer = dest ? 0 : new sU8[size];
+  re.Dest = dest ? (sU8 *)dest : re.Buffer;
+  re.Prio = prio;
+  re.State = RS_QUEUED;
+  re.Ok = 0;
+
+  if(QueueLast[prio]>=0)
+    ReadEntries[QueueLast[prio]].Next = e;
+  else
+    QueueFirst[prio] = e;
+  QueueLast[prio] = e;
+
+  pthread_cond_signal(&WorkCond);
+  pthread_mutex_unlock(&Mutex);
+  return e;
+}
+
+sBool sRootFileHandler::DataAvailable(sInt h)
+{
+  sVERIFY(h>=0 && h<MAX_READENTRIES);
+  pthread_mutex_lock(&Mutex);
+  ReadEntry &re = ReadEntries[h];
+  sVERIFY(re.State!=RS_FREE);
+  sBool done = (re.State==RS_DONE);
+  sBool ok = re.Ok;
+  pthread_mutex_unlock(&Mutex);
+
+  if(done && !ok)
+    sFatal(L"sRootFile: read error during async io!\n");
+  return done;
+}
+
+void *sRootFileHandler::GetData(sInt h)
+{
+  sVERIFY(h>=0 && h<MAX_READENTRIES);
+  return DataAvailable(h) ? ReadEntries[h].Buffer : 0;
+}
+
+void sRootFileHandler::EndRead(sInt h)
+{
+  sVERIFY(h>=0 && h<MAX_READENTRIES);
+  pthread_mutex_lock(&Mutex);
+  ReadEntry &re = ReadEntries[h];
+  sVERIFY(re.State!=RS_FREE);
+  while(re.State!=RS_DONE)
+    pthread_cond_wait(&DoneCond,&Mutex);
+  sBool ok = re.Ok;
+
+  sDeleteArray(re.Buffer);
+  FreeReadHandle(h);
+  pthread_mutex_unlock(&Mutex);
+
+  if(!ok)
+    sFatal(L"sRootFile: read error during async io!\n");
+}
+
+/****************************************************************************/
+
 sBool sLoadDir(sArray<sDirEntry> &list,const sChar *path,const sChar *pattern)
 {
   if(!pattern) pattern = L"*";
@@ -1152,81 +1461,86 @@ void sThreadLock::Unlock()
 
 /****************************************************************************/
 
-// THIS IS UNTESTED, MAY CONTAIN BUGS AND IS DEFINITELY INEFFICIENT.
-// It's also outright dangerous on anything that's not x86!
+struct sThreadEventCond
+{
+  pthread_mutex_t Mutex;
+  pthread_cond_t Cond;
+};
 
 sThreadEvent::sThreadEvent(sBool manual)
 {
   Signaled = 0;
   ManualReset = manual;
-  
-  sLogF(L"system",L"WARNING! This program uses sThreadEvents on Linux. They are currently UNTESTED, probably DANGEROUS and most likely also INEFFICIENT.\n");
+
+  sThreadEventCond *c = new sThreadEventCond;
+  pthread_mutex_init(&c->Mutex,0);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+  pthread_cond_init(&c->Cond,&attr);
+  pthread_condattr_destroy(&attr);
+  Cond = c;
 }
 
 sThreadEvent::~sThreadEvent()
 {
+  sThreadEventCond *c = (sThreadEventCond *)Cond;
+  pthread_cond_destroy(&c->Cond);
+  pthread_mutex_destroy(&c->Mutex);
+  delete c;
 }
 
 sBool sThreadEvent::Wait(sInt timeout)
 {
-  if(ManualReset) // manual reset
+  sThreadEventCond *c = (sThreadEventCond *)Cond;
+
+  timespec end;
+  if(timeout>0)
   {
-    if(timeout == -1) // okay, just wait forever
+    clock_gettime(CLOCK_MONOTONIC,&end);
+    end.tv_sec += timeout/1000;
+    end.tv_nsec += (timeout%1000)*1000000;
+    if(end.tv_nsec>=1000000000)
     {
-      while(!Signaled)
-        pthread_yield();
-        
-      return sTRUE;
+      end.tv_sec++;
+      end.tv_nsec -= 1000000000;
     }
-    
-    sInt start = sGetTime();
-    sU32 tDiff;
-    sBool okay = sFALSE;
-    do
-    {
-      okay = Signaled;
-      tDiff = sU32(sGetTime()-start);
-      if(!okay && sU32(timeout) > tDiff) // not signaled, not yet timed out
-        pthread_yield();
-    }
-    while(!okay && sU32(timeout) > tDiff);
-    
-    return okay;
   }
-  else // automatic reset
+
+  pthread_mutex_lock(&c->Mutex);
+  while(!Signaled && timeout!=0)
   {
-    if(timeout == -1) // okay, just wait forever
-    {
-      sU32 gotit;
-      while((gotit = sAtomicSwap(&Signaled,0)) == 0)
-        pthread_yield();
-        
-      return sTRUE;
-    }
-    
-    sInt start = sGetTime();
-    sU32 tDiff,gotit;
-    do
-    {
-      gotit = sAtomicSwap(&Signaled,0);
-      tDiff = sU32(sGetTime()-start);
-      if(!gotit && sU32(timeout) > tDiff) // haven't got it, not timed out
-        pthread_yield();
-    }
-    while(!gotit && sU32(timeout) > tDiff);
-    
-    return gotit == 1;
+    if(timeout<0)
+      pthread_cond_wait(&c->Cond,&c->Mutex);
+    else if(pthread_cond_timedwait(&c->Cond,&c->Mutex,&end)==ETIMEDOUT)
+      break;
   }
+  sBool gotit = Signaled;
+  if(gotit && !ManualReset)
+    Signaled = 0;
+  pthread_mutex_unlock(&c->Mutex);
+
+  return gotit;
 }
 
 void sThreadEvent::Signal()
 {
+  sThreadEventCond *c = (sThreadEventCond *)Cond;
+  pthread_mutex_lock(&c->Mutex);
   Signaled = 1;
+  if(ManualReset)
+    pthread_cond_broadcast(&c->Cond);
+  else
+    pthread_cond_signal(&c->Cond);
+  pthread_mutex_unlock(&c->Mutex);
 }
 
 void sThreadEvent::Reset()
 {
+  sThreadEventCond *c = (sThreadEventCond *)Cond;
+  pthread_mutex_lock(&c->Mutex);
   Signaled = 0;
+  pthread_mutex_unlock(&c->Mutex);
 }
 
 /****************************************************************************/
@@ -1517,6 +1831,16 @@ void sInit(sInt flags,sInt xs,sInt ys)
   // run remaining initializers
   sSetRunlevel(0x100);  
   sUpdateWindow();
+#else
+  // no window, but the blank renderer still needs its dummy buffers so
+  // headless tools can create geometry and textures.
+  sSystemFlags = flags;
+  if(flags & sISF_3D)
+  {
+    PreInitGFX(flags,xs,ys);
+    InitGFX(flags,xs,ys);
+  }
+  sSetRunlevel(0x100);
 #endif
 }
 
@@ -1782,6 +2106,14 @@ static void sXMessageLoop()
   }
   
   XCloseDisplay(dpy);
+#else
+  if(sSystemFlags & sISF_3D)
+  {
+    sSetRunlevel(0x80);
+    sCollect();
+    sCollector(sTRUE);
+    ExitGFX();
+  }
 #endif
 }
 
@@ -2112,20 +2444,26 @@ class sLibcHeap_ : public sMemoryHandler
 public:
   void *Alloc(sPtr size,sInt align,sInt flags)
   {
-//    sAtomicAdd(&sMemoryUsed, (sDInt)size);
     void *ptr;
     align = sMax<sInt>(align,sizeof(void*));
     if(posix_memalign(&ptr,align,size))
       ptr = 0;
+    else
+      __sync_add_and_fetch(&sMemoryUsed,sPtr(malloc_usable_size(ptr)));
     
     return ptr;
   }
   sBool Free(void *ptr)
   {
-//    sAtomicAdd(&sMemoryUsed, -(sDInt)size);
+    if(ptr)
+      __sync_sub_and_fetch(&sMemoryUsed,sPtr(malloc_usable_size(ptr)));
     free(ptr);
     return 1;
   }
+  sPtr MemSize(void *ptr)
+  {
+    return malloc_usable_size(ptr);
+  }
 } sLibcHeap;
 
 static const sInt DebugHeapSize = 16*1024*1024;
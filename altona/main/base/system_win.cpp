@@ -753,6 +753,7 @@ public:
   sBool SetSize(sS64);               
   sS64 GetSize();                    
 
+  sBool CanReadAsync() { return IsOverlapped; }
   sFileReadHandle BeginRead(sS64 offset,sDInt size,void *destbuffer, sFilePriorityFlags prio);  // begin reading
   sBool DataAvailable(sFileReadHandle handle);  // data valid?
   void *GetData(sFileReadHandle handle);  // access data (only valid if you didn't specify the buffer yourself!)
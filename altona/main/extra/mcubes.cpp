@@ -383,9 +383,12 @@ MarchingCubes::MarchingCubes(sInt vertices)
   Scale = 0.5f;
 
   FreeContainers = 0;
-  sClear(Grid);
   ActiveCellsDB = 0;
 
+  Hash.AddMany(HashSize);
+  for(sInt i=0;i<HashSize;i++)
+    Hash[i].Used = 0;
+
   for(sInt i=0;i<256;i++)
   {
     sInt n = 0;
@@ -409,24 +412,9 @@ MarchingCubes::MarchingCubes(sInt vertices)
     }
   }
 
-  sInt vpb = 64*1024;
-
-  sInt n = sMax(16,vertices/vpb+8);
-  GeoBuffers.AddMany(n);
-  for(sInt i=0;i<n;i++)
-  {
-    GeoBuffer *gb = &GeoBuffers[i];
-    gb->Geo = new sGeometry(sGF_INDEX16|sGF_TRILIST,sVertexFormatStandard);
-    gb->VertexMax = vpb;
-    gb->IndexMax = vpb*4;
-    gb->Vertex = 0;
-    gb->Index = 0;
-  }
-  GeoBufferLock = new sThreadLock;
-  GeoBufferUseIndex = 0;
-
-  MaxThreads = 0;
-  ThreadBuffers = 0;
+  GeoBuffersUsed = 0;
+  Sched = 0;
+  VertexHint = vertices;
 }
 
 
@@ -446,9 +434,6 @@ MarchingCubes::~MarchingCubes()
   GeoBuffer *gb;
   sFORALL(GeoBuffers,gb)
     delete gb->Geo;
-  delete GeoBufferLock;
-
-  delete[] ThreadBuffers;
 }
 
 /****************************************************************************/
@@ -485,13 +470,57 @@ MarchingCubes::Container *MarchingCubes::GetContainer()
   return c;
 }
 
-MarchingCubes::GeoBuffer *MarchingCubes::GetGeoBuffer()
+static sINLINE sU32 MCHashCell(sInt x,sInt y,sInt z)
+{
+  return sU32(x)*73856093U ^ sU32(y)*19349663U ^ sU32(z)*83492791U;
+}
+
+MarchingCubes::Container **MarchingCubes::FindCell(sInt x,sInt y,sInt z)
 {
-  GeoBuffer *gb = 0; 
-  sU32 n = sAtomicInc(&GeoBufferUseIndex)-1;
-  if(sInt(n)<GeoBuffers.GetCount())
-    gb = &GeoBuffers[n];
-  return gb;
+  const sU32 mask = Hash.GetCount()-1;
+  sU32 n = MCHashCell(x,y,z) & mask;
+  for(;;)
+  {
+    HashSlot *hs = &Hash[n];
+    if(!hs->Used)
+    {
+      if((HashCells.GetCount()+1)*2 > Hash.GetCount())
+      {
+        GrowHash();
+        return FindCell(x,y,z);
+      }
+      hs->x = x;
+      hs->y = y;
+      hs->z = z;
+      hs->Used = 1;
+      hs->Cell = 0;
+      HashCells.AddTail(n);
+      return &hs->Cell;
+    }
+    if(hs->x==x && hs->y==y && hs->z==z)
+      return &hs->Cell;
+    n = (n+1) & mask;
+  }
+}
+
+void MarchingCubes::GrowHash()
+{
+  sArray<HashSlot> old;
+  sArray<sInt> oldcells;
+  old.Swap(Hash);
+  oldcells.Swap(HashCells);
+
+  sInt size = old.GetCount()*2;
+  Hash.AddMany(size);
+  for(sInt i=0;i<size;i++)
+    Hash[i].Used = 0;
+
+  sInt n;
+  sFORALL(oldcells,n)
+  {
+    const HashSlot *hs = &old[n];
+    *FindCell(hs->x,hs->y,hs->z) = hs->Cell;
+  }
 }
 
 void MCTask(sStsManager *,sStsThread *thread,sInt start,sInt count,void *data)
@@ -504,38 +533,43 @@ void MCTask(sStsManager *,sStsThread *thread,sInt start,sInt count,void *data)
   sSchedMon->End(ti);
 }
 
+void MCCopyTask(sStsManager *,sStsThread *thread,sInt start,sInt count,void *data)
+{
+  MarchingCubes *mc = (MarchingCubes *) data;
+  for(sInt i=start;i<start+count;i++)
+    mc->CopyTask(i);
+}
+
 void MarchingCubes::Begin(sStsManager *sched,sStsWorkload *wl,sInt granularity)
 {
   ActiveCellsDB = 1-ActiveCellsDB;
+  Sched = sched;
 
-  // lock geometry
+  // prepare per thread output
 
-  GeoBuffer *gb;
-  sFORALL(GeoBuffers,gb)
+  sInt threads = sched ? sched->GetThreadCount() : 1;
+  if(ThreadOutputs.GetCount()!=threads)
   {
-    gb->Vertex = 0;
-    gb->Index = 0;
-    gb->Geo->BeginLoadVB(gb->VertexMax,sGD_FRAME,&gb->VP);
-    gb->Geo->BeginLoadIB(gb->IndexMax,sGD_FRAME,&gb->IP);
+    ThreadOutputs.Reset();
+    ThreadOutputs.AddMany(threads);
+    for(sInt i=0;i<threads;i++)
+    {
+      ThreadOutputs[i].Vertices.HintSize(VertexHint/threads);
+      ThreadOutputs[i].Indices.HintSize(VertexHint/threads*4);
+    }
   }
-  GeoBufferUseIndex = 0;
-
-  // prepare scheduling
-
-  if(sched && sched->GetThreadCount() != MaxThreads)
+  ThreadOutput *to;
+  sFORALL(ThreadOutputs,to)
   {
-    delete[] ThreadBuffers;
-    MaxThreads = sched->GetThreadCount();
-    ThreadBuffers = new GeoBuffer *[MaxThreads];
+    to->Vertices.Clear();
+    to->Indices.Clear();
+    to->Cells.Clear();
   }
 
-  // schdedule
+  // schedule
 
   if(sched)
   {
-    for(sInt i=0;i<MaxThreads;i++)
-      ThreadBuffers[i] = 0;
-
     if(ActiveCells[ActiveCellsDB].GetCount()>0)
     {
       sInt n = ActiveCells[ActiveCellsDB].GetCount();
@@ -546,126 +580,168 @@ void MarchingCubes::Begin(sStsManager *sched,sStsWorkload *wl,sInt granularity)
   }
   else
   {
-    GeoBuffer *gb = GetGeoBuffer();
-    const sInt maxvertex = gb->VertexMax - MaxVertex;
-    const sInt maxindex = gb->IndexMax - MaxIndex;
     Container *c;
     sFORALL(ActiveCells[ActiveCellsDB],c)
-    {
-      if(gb->Vertex>=maxvertex || gb->Index>=maxindex)
-      {
-        gb = GetGeoBuffer();
-        if(gb==0)
-          goto out;
-      }
-      RenderCell(gb,c);
-    }
+      RenderCell(&ThreadOutputs[0],c);
   }
-out:;
 }
 
 void MarchingCubes::Render(sVector31 *parts,sInt pn)
 {
   // distribute particles to buckets
 
-  sClear(Grid);
   const sF32 e = Influence/CellSize;
-  sVector30 gspos(1.0f/CellSize/Scale,1.0f/CellSize/Scale,1.0f/CellSize/Scale);
-  sVector31 gtpos((GridSize)*0.5f,(GridSize)*0.5f,(GridSize)*0.5f);
+  const sF32 gs = 1.0f/CellSize/Scale;
+  const sF32 range = 0x100000;    // keep cell coordinates far from overflow
   for(sInt i=0;i<pn;i++)
   {
-    sVector31 pos = sVector30(parts[i])*gspos+gtpos;
-    sInt x = sInt(pos.x);
-    sInt y = sInt(pos.y);
-    sInt z = sInt(pos.z);
-    if(x>=1 && y>=1 && z>=1 && x<GridSize-1 && y<GridSize-1 && z<GridSize-1)
+    sVector31 pos = sVector31(sVector30(parts[i])*gs);
+    if(!(sAbs(pos.x)<range && sAbs(pos.y)<range && sAbs(pos.z)<range))
+      continue;
+    sInt x = sInt(sFFloor(pos.x));
+    sInt y = sInt(sFFloor(pos.y));
+    sInt z = sInt(sFFloor(pos.z));
+
+    sF32 fx = pos.x-x;
+    sF32 fy = pos.y-y;
+    sF32 fz = pos.z-z;
+    sInt bits = 0;
+    if(fx<e) bits |= 0x01;
+    if(fy<e) bits |= 0x02;
+    if(fz<e) bits |= 0x04;
+    if(fx>1-e) bits |= 0x10;
+    if(fy>1-e) bits |= 0x20;
+    if(fz>1-e) bits |= 0x40;
+
+    for(sInt t=0;t<27;t++)
     {
-      sF32 fx = pos.x-x;
-      sF32 fy = pos.y-y;
-      sF32 fz = pos.z-z;
-      sInt bits = 0;
-      if(fx<e) bits |= 0x01;
-      if(fy<e) bits |= 0x02;
-      if(fz<e) bits |= 0x04;
-      if(fx>1-e) bits |= 0x10;
-      if(fy>1-e) bits |= 0x20;
-      if(fz>1-e) bits |= 0x40;
-
-      for(sInt t=0;t<27;t++)
+      if((bits & table[t][0])==table[t][0])
       {
-        if((bits & table[t][0])==table[t][0])
+        Container **g = FindCell(x+table[t][3],y+table[t][2],z+table[t][1]);
+        Container *c = *g;
+        if(c==0 || c->Count==ContainerSize)
         {
-          Container **g = &Grid[z+table[t][1]][y+table[t][2]][x+table[t][3]];
-          Container *c = *g;
-          if(c==0 || c->Count==ContainerSize)
-          {
-            Container *oc = c;
-            c = GetContainer();
-            c->Next = oc;
-            *g = c;
-          }
-          c->Parts[c->Count++] = parts[i];
+          Container *oc = c;
+          c = GetContainer();
+          c->Next = oc;
+          *g = c;
         }
+        c->Parts[c->Count++] = parts[i];
       }
     }
   }
 
-  // collect buckets
+  // collect buckets and clear the hash
     
-  sVector30 spos(CellSize,CellSize,CellSize);
-  sVector31 tpos(-CellSize*(GridSize)*0.5f,-CellSize*(GridSize)*0.5f,-CellSize*(GridSize)*0.5f);
   sVERIFY(ActiveCells[1-ActiveCellsDB].IsEmpty());
-  for(sInt z=0;z<GridSize;z++)
+  sInt n;
+  sFORALL(HashCells,n)
   {
-    for(sInt y=0;y<GridSize;y++)
+    HashSlot *hs = &Hash[n];
+    Container *c = hs->Cell;
+    if(c)
     {
-      for(sInt x=0;x<GridSize;x++)
-      {
-        Container *c = Grid[z][y][x];
-        Grid[z][y][x] = 0;
-        if(c)
-        {
-          sVector30 v(x,y,z);
-          c->Pos = v*spos+tpos;
-          ActiveCells[1-ActiveCellsDB].AddTail(c);
-        }
-      }
+      c->Pos.Init(hs->x*CellSize,hs->y*CellSize,hs->z*CellSize);
+      ActiveCells[1-ActiveCellsDB].AddTail(c);
     }
+    hs->Used = 0;
+    hs->Cell = 0;
   }
+  HashCells.Clear();
 }
 
 void MarchingCubes::MCTask(sInt container,sInt thread)
 {
-  GeoBuffer *gb = ThreadBuffers[thread];
-  if(gb==0 || gb->Vertex >= gb->VertexMax-MaxVertex || gb->Index >= gb->IndexMax-MaxIndex)
-    gb = ThreadBuffers[thread] = GetGeoBuffer();
-  if(gb)
+  Container *c = ActiveCells[ActiveCellsDB][container];
+  RenderCell(&ThreadOutputs[thread],c);
+}
+
+void MarchingCubes::CopyTask(sInt thread)
+{
+  ThreadOutput *to = &ThreadOutputs[thread];
+  CellOutput *co;
+  sFORALL(to->Cells,co)
   {
-    Container *c = ActiveCells[ActiveCellsDB][container];
-    RenderCell(gb,c);
+    if(co->IndexCount==0)
+      continue;
+    GeoBuffer *gb = &GeoBuffers[co->Geo];
+    sCopyMem(gb->VP+co->GeoVertex,to->Vertices.GetData()+co->VertexStart,co->VertexCount*sizeof(sVertexStandard));
+    const sU16 *src = to->Indices.GetData()+co->IndexStart;
+    sU16 *dest = gb->IP+co->GeoIndex;
+    const sInt base = co->GeoVertex;
+    for(sInt i=0;i<co->IndexCount;i++)
+      dest[i] = src[i]+base;
   }
 }
 
-
 void MarchingCubes::End()
 {
   Recycle();
-  GeoBuffer *gb;
-  sFORALL(GeoBuffers,gb)
+
+  // prefix sum over all cells of all threads, starting a new geometry
+  // whenever the 16 bit index range is exhausted.
+
+  GeoBuffer *gb = 0;
+  GeoBuffersUsed = 0;
+  ThreadOutput *to;
+  sFORALL(ThreadOutputs,to)
   {
-    gb->Geo->EndLoadIB(gb->Index);
-    gb->Geo->EndLoadVB(gb->Vertex);
+    CellOutput *co;
+    sFORALL(to->Cells,co)
+    {
+      if(co->IndexCount==0)
+        continue;
+      if(gb==0 || gb->Vertex+co->VertexCount>GeoVertexMax)
+      {
+        if(GeoBuffersUsed==GeoBuffers.GetCount())
+          GeoBuffers.AddMany(1)->Geo = new sGeometry(sGF_INDEX16|sGF_TRILIST,sVertexFormatStandard);
+        gb = &GeoBuffers[GeoBuffersUsed++];
+        gb->Vertex = 0;
+        gb->Index = 0;
+      }
+      co->Geo = GeoBuffersUsed-1;
+      co->GeoVertex = gb->Vertex;
+      co->GeoIndex = gb->Index;
+      gb->Vertex += co->VertexCount;
+      gb->Index += co->IndexCount;
+    }
+  }
+
+  // lock exactly what is needed and copy in parallel
+
+  for(sInt i=0;i<GeoBuffersUsed;i++)
+  {
+    gb = &GeoBuffers[i];
+    gb->Geo->BeginLoadVB(gb->Vertex,sGD_FRAME,&gb->VP);
+    gb->Geo->BeginLoadIB(gb->Index,sGD_FRAME,&gb->IP);
+  }
+
+  if(Sched && GeoBuffersUsed>0)
+  {
+    sStsWorkload *wl = Sched->BeginWorkload();
+    wl->AddTask(wl->NewTask(::MCCopyTask,this,ThreadOutputs.GetCount(),0));
+    wl->Start();
+    wl->Sync();
+    wl->End();
+  }
+  else
+  {
+    for(sInt i=0;i<ThreadOutputs.GetCount();i++)
+      CopyTask(i);
+  }
+
+  for(sInt i=0;i<GeoBuffersUsed;i++)
+  {
+    gb = &GeoBuffers[i];
+    gb->Geo->EndLoadIB();
+    gb->Geo->EndLoadVB();
   }
 }
 
 void MarchingCubes::Draw()
 {
-  GeoBuffer *gb;
-  sFORALL(GeoBuffers,gb)
-  {
-    if(gb->Vertex>0)
-      gb->Geo->Draw();
-  }
+  for(sInt i=0;i<GeoBuffersUsed;i++)
+    GeoBuffers[i].Geo->Draw();
 }
 
 /****************************************************************************/
@@ -771,7 +847,7 @@ static void sINLINE func(const sVector31 &v,sVector4 &pot,const funcinfo &fi)
 }
 #endif
 
-void MarchingCubes::RenderCell(GeoBuffer *gb,Container *con)
+void MarchingCubes::RenderCell(ThreadOutput *to,Container *con)
 {
   const sInt s = CellSize;
   sF32 S = Scale;
@@ -933,8 +1009,12 @@ void MarchingCubes::RenderCell(GeoBuffer *gb,Container *con)
 
   // find and write potential vertices
 
-  sVertexStandard *vp = gb->VP + gb->Vertex;
-  sInt vi = gb->Vertex;
+  CellOutput *co = to->Cells.AddMany(1);
+  co->VertexStart = to->Vertices.GetCount();
+  co->IndexStart = to->Indices.GetCount();
+
+  sVertexStandard *vp = to->Vertices.AddMany(MaxVertex);
+  sInt vi = 0;
 
   for(sInt z=0;z<=s;z++)
   {
@@ -1000,11 +1080,13 @@ void MarchingCubes::RenderCell(GeoBuffer *gb,Container *con)
     }
   }
 
-  gb->Vertex = vi;
+  co->VertexCount = vi;
+  to->Vertices.Resize(co->VertexStart+vi);
 
   // write out indices
 
-  sU16 *ip = gb->IP + gb->Index;
+  sU16 *ip0 = to->Indices.AddMany(MaxIndex);
+  sU16 *ip = ip0;
 
   for(sInt z=0;z<s;z++)
   {
@@ -1030,7 +1112,8 @@ void MarchingCubes::RenderCell(GeoBuffer *gb,Container *con)
     }
   }
 
-  gb->Index = ip - gb->IP;
+  co->IndexCount = ip - ip0;
+  to->Indices.Resize(co->IndexStart+co->IndexCount);
 }
 
 
@@ -31,11 +31,12 @@ public:
   enum MarchingCubesConst
   {
     CellSize = 8,                // a cell holds many cubes 
-    GridSize = 16,                 // a grid hold many cells
+    HashSize = 1024,             // initial size of the cell hash, power of two
     ContainerSize = 64,
 
     MaxVertex = (CellSize+1)*(CellSize+1)*(CellSize+1),
     MaxIndex = (CellSize)*(CellSize)*(CellSize)*15,
+    GeoVertexMax = 0x10000,      // 16 bit indices
   };
 private:
   struct Container
@@ -48,13 +49,33 @@ private:
 
     Container();
   };
+  struct HashSlot                // sparse grid of cells
+  {
+    sInt x,y,z;
+    sBool Used;
+    Container *Cell;
+  };
+  struct CellOutput              // triangles of one cell in a thread buffer
+  {
+    sInt VertexStart;
+    sInt VertexCount;
+    sInt IndexStart;
+    sInt IndexCount;
+    sInt Geo;                    // destination, set in End()
+    sInt GeoVertex;
+    sInt GeoIndex;
+  };
+  struct ThreadOutput            // one per thread, no locking required
+  {
+    sArray<sVertexStandard> Vertices;
+    sArray<sU16> Indices;        // relative to the first vertex of the cell
+    sArray<CellOutput> Cells;
+  };
   struct GeoBuffer
   {
     sGeometry *Geo;
     sInt Vertex;
     sInt Index;
-    sInt VertexMax;
-    sInt IndexMax;
     sVertexStandard *VP;
     sU16 *IP;
   };
@@ -62,7 +83,8 @@ private:
 
   sInt MyTriTable[256][16];
   Container *FreeContainers;
-  Container *Grid[GridSize][GridSize][GridSize];
+  sArray<HashSlot> Hash;
+  sArray<sInt> HashCells;        // used slots, in order of creation
 
 
   sF32 Influence;
@@ -71,18 +93,19 @@ private:
 
 
   sArray<GeoBuffer> GeoBuffers;
+  sInt GeoBuffersUsed;
   sArray<Container *> ActiveCells[2];
   sInt ActiveCellsDB;
-  sU32 GeoBufferUseIndex;
-  sThreadLock *GeoBufferLock;
 
-  GeoBuffer **ThreadBuffers;
-  sInt MaxThreads;
+  sArray<ThreadOutput> ThreadOutputs;
+  sStsManager *Sched;
+  sInt VertexHint;
 
   void Recycle();
   Container *GetContainer();
-  void RenderCell(GeoBuffer *gb,Container *con);
-  GeoBuffer *GetGeoBuffer();
+  Container **FindCell(sInt x,sInt y,sInt z);
+  void GrowHash();
+  void RenderCell(ThreadOutput *to,Container *con);
 public:
   MarchingCubes(sInt vertices = 1024*1024);
   ~MarchingCubes();
@@ -93,6 +116,7 @@ public:
   void Draw();
 
   void MCTask(sInt container,sInt thread);
+  void CopyTask(sInt thread);
 };
 
 /****************************************************************************/
@@ -446,19 +446,38 @@ sInt sHTTPClient::GetSize() { return IsConnected()?Size:-1; }
 
 sHTTPServer::sHTTPServer()
 {
-  for (sInt i=0; i<MAXCONN; i++) FreeList.AddTail(&ConnStore[i]);
+  InitMembers();
 }
 
 sHTTPServer::sHTTPServer(sInt port, const sChar *fileroot)
 {
-  for (sInt i=0; i<MAXCONN; i++) FreeList.AddTail(&ConnStore[i]);
+  InitMembers();
   Init(port,fileroot);
 }
 
+void sHTTPServer::InitMembers()
+{
+  FilesSupported=sFALSE;
+  ConnCount=0;
+  MaxConnections=MAXCONN;
+  MaxPOSTData=MAXPOSTDATA;
+  Poller=0;
+  WorkerCount=2;
+  Workers=0;
+  JobEvent=0;
+}
+
 sHTTPServer::~sHTTPServer()
 {
   while (!ConnList.IsEmpty())
-    HostSocket.CloseConnection(ConnList.RemHead()->Socket);
+    CloseConnection(ConnList.GetHead());
+  while (!FreeList.IsEmpty())
+  {
+    Connection *c=FreeList.RemHead();
+    delete[] c->In;
+    delete[] c->Out;
+    delete c;
+  }
   HostSocket.Disconnect();
 
   while (!URLEntries.IsEmpty())
@@ -550,12 +569,16 @@ void sHTTPServer::ParseRequestLine(Connection *c)
     {
       c->Error=L"";
       c->RetCode=1; // probably http 0.9
+      c->Version=9;
       return;
     }
 
-    // parse HTTP version (must be 1.0 or upwards anyway, so we don't really bother)
+    // parse HTTP version. 1.1 and up keep the connection by default
     cp++;
     if (!sScanMatch(cp,L"HTTP/")) c->RetCode=400;
+    else if (sScanMatch(cp,L"1.0")) c->Version=10;
+    else c->Version=11;
+    c->KeepAlive = c->Version>=11;
     return;
   }
 
@@ -569,13 +592,6 @@ void sHTTPServer::ParseRequestLine(Connection *c)
     }
 
     c->HeadersDone = sTRUE;
-
-    if (c->Method!=CM_POST)
-    {
-      // let's go
-      c->Error=L"OK";
-      c->RetCode=200;
-    }
     return;
   }
 
@@ -590,387 +606,849 @@ void sHTTPServer::ParseRequestLine(Connection *c)
     sCopyString(c->ContentType, cp, 128);
   }
 
+  if (sScanMatch(cp, L"Connection: "))
+  {
+    if (sFindStringI(cp,L"close")>=0) c->KeepAlive=sFALSE;
+    else if (sFindStringI(cp,L"keep-alive")>=0) c->KeepAlive=sTRUE;
+  }
+
+  if (sScanMatch(cp, L"Expect: "))
+  {
+    if (sFindStringI(cp,L"100-continue")>=0) c->Expect100=sTRUE;
+  }
 }
 
-void sHTTPServer::StartServing(Connection *c)
+// everything that belongs to one request. the socket and the buffers
+// stay, and so do pipelined bytes in In
+
+void sHTTPServer::ResetRequest(Connection *c)
 {
-  if (c->RetCode<400)
+  sDelete(c->File);
+  sDelete(c->Hndl);
+  sDeleteArray(c->POSTData);
+  sDeleteAll(c->DataPackets);
+
+  c->State=CS_GETREQUEST;
+  c->RequestLine[0]=0;
+  c->URL[0]=0;
+  c->Error=L"Malformed Request";
+  c->POSTDataSize=0;
+  c->Method=CM_UNKNOWN;
+  c->Version=10;
+  c->KeepAlive=sFALSE;
+  c->RetCode=0;
+  c->HeadersDone=sFALSE;
+  c->ContentLength=0;
+  c->ContentType[0]=0;
+  c->Mem=0;
+  c->MemSize=0;
+
+  c->LineLen=0;
+  c->BodyLeft=0;
+  c->StreamBody=sFALSE;
+  c->Expect100=sFALSE;
+  c->Chunked=sFALSE;
+  c->BodyDone=sFALSE;
+  c->Retry=sFALSE;
+  c->FileLeft=0;
+  c->RetryTime=0;
+  c->JobData=0;
+  c->JobSize=0;
+  c->OutPos=c->OutFill=0;
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Jobs. These run on a worker thread, or inline without workers.     ***/
+/***   They only touch the connection and never its socket.               ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void sHTTPServer::Route(Connection *c, sBool init)
+{
+  recheck:
+  sString<REQLINE> url2=c->URL;
+
+  if (c->Method==CM_GET || c->Method==CM_HEAD)
   {
-    sString<REQLINE> url2=c->URL;
+    sInt qpos=sFindFirstChar(url2,'?');
+    if (qpos>=0) url2[qpos]=0;
+  }
+
+  // try to find URL handler
+  sBool found=sFALSE;
 
-    if (c->Method==CM_GET || c->Method==CM_HEAD)
+  Lock.Lock();
+  URLEntry *e=0;
+  sFORALL_LIST(URLEntries,e)
+  {
+    if (sMatchWildcard(e->Wildcard,url2,sTRUE))
     {
-      sInt qpos=sFindFirstChar(url2,'?');
-      if (qpos>=0) url2[qpos]=0;
+      if (e->HFactory)
+      {
+        c->Hndl = e->HFactory();
+        HandlerResult hr = init ? InitHandler(c) : HR_OK;
+        if (hr==HR_OK)
+          found=sTRUE;
+        else if (hr==HR_REWRITTEN)
+        {
+          Lock.Unlock();
+          goto recheck;
+        }
+      }
+      else if (e->Mem)
+      {
+        found=sTRUE;
+        c->Mem=e->Mem;
+        c->MemSize=e->Size;
+      }
+      else
+      {
+        c->RetCode=500;
+        c->Error=L"Invalid URL Entry";
+      }
     }
+    if (found || c->RetCode>=400) break;
+  }
+  Lock.Unlock();
+
+  if (!found && FilesSupported && c->RetCode<400)
+  {
+    sString<sMAXPATH> path;
+    path=FileRoot;
+    sAppendString(path,url2);
 
-    if (c->Method==CM_GET || c->Method==CM_HEAD || c->Method==CM_POST)
+    sFile *f=sCreateFile(path);
+    if (f)
     {
-      // try to find URL handler
-      recheck:
-      sBool found=sFALSE;
+      c->File=f;
+      c->FileLeft=f->GetSize();
+
+      // serve from a mapped view when we can, that saves a copy
+      if (c->FileLeft<0x7fffffff)
+      {
+        c->Mem=f->Map(0,c->FileLeft);
+        if (c->Mem) c->MemSize=sInt(c->FileLeft);
+      }
+      found=sTRUE;
+    }
+  }
+
+  if (!found && c->RetCode<400)
+  {
+    c->RetCode=404;
+    c->Error=L"Not Found";
+  }
+}
+
+// the handler is deleted unless it returns HR_OK
+
+sHTTPServer::HandlerResult sHTTPServer::InitHandler(Connection *c)
+{
+  HandlerResult hr=c->Hndl->Init(c);
+  if (hr==HR_ERROR)
+  {
+    c->RetCode=500;
+    c->Error=L"Handler Error";
+  }
+  if (hr!=HR_OK)
+    sDelete(c->Hndl);
+  return hr;
+}
+
+void sHTTPServer::StartResponse(Connection *c)
+{
+  if (c->Version==9)
+  {
+    // no header, and the end of the document is the end of the connection
+    c->KeepAlive=sFALSE;
+    c->NextState=CS_SERVE;
+    Fill(c);
+    return;
+  }
 
-      URLEntry *e=0;
-      sFORALL_LIST(URLEntries,e)
+  sString<1024> str;
+  sSPrintF(str,L"HTTP/1.%d %d %s\r\n",c->Version>=11?1:0,c->RetCode,c->Error);
+
+  if (c->RetCode>=400)
+  {
+    // we encountered an error. too sad.
+    sString<256> body;
+    if (c->Method!=CM_HEAD) sSPrintF(body,L"<html><body><h1>%d %s</h1>Sorry.<br><i>Altona Web Server</i></body></html>",c->RetCode,c->Error);
+    sSPrintF(sGetAppendDesc(str),L"Content-Length: %d\r\nConnection: close\r\n\r\n%s",sGetStringLen(body),body);
+    c->KeepAlive=sFALSE;
+    c->BodyDone=sTRUE;
+    sDelete(c->Hndl);
+    sDelete(c->File);
+    c->Mem=0;
+    c->MemSize=0;
+  }
+  else
+  {
+    sString<1024> extra;
+    if (c->Hndl) c->Hndl->GetAdditionalHeaders(extra);
+
+    // the connection can only stay if the client can tell where the
+    // document ends
+    if (c->Mem || c->File)
+      sSPrintF(sGetAppendDesc(str),L"Content-Length: %d\r\n",c->Mem ? c->MemSize : sInt(c->FileLeft));
+    else if (sFindStringI(extra,L"Content-Length:")<0 && c->Method!=CM_HEAD)
+    {
+      if (c->Version>=11)
       {
-        if (sMatchWildcard(e->Wildcard,url2,sTRUE))
+        c->Chunked=sTRUE;
+        sAppendString(sGetAppendDesc(str),L"Transfer-Encoding: chunked\r\n");
+      }
+      else
+        c->KeepAlive=sFALSE;
+    }
+
+    sAppendString(sGetAppendDesc(str),c->KeepAlive ? L"Connection: keep-alive\r\n" : L"Connection: close\r\n");
+    sAppendString(str,extra);
+    sAppendString(sGetAppendDesc(str),L"\r\n");
+
+    if (c->Method==CM_HEAD)
+    {
+      c->BodyDone=sTRUE;
+      c->Mem=0;
+      c->MemSize=0;
+    }
+  }
+
+  sInt len=sGetStringLen(str);
+  sCopyString((sChar8*)c->Out,str,IOBUFFER);
+  c->OutPos=0;
+  c->OutFill=sMin(len,IOBUFFER);
+  c->NextState=CS_SERVE;
+
+  // small documents go out with the header
+  Fill(c);
+}
+
+void sHTTPServer::Fill(Connection *c)
+{
+  c->Retry=sFALSE;
+  if (c->BodyDone || c->Mem) return;   // Send() writes Mem directly
+
+  if (c->OutPos==c->OutFill) c->OutPos=c->OutFill=0;
+  if (c->OutPos>0 && c->OutFill>IOBUFFER/2)
+  {
+    sCopyMem(c->Out,c->Out+c->OutPos,c->OutFill-c->OutPos);
+    c->OutFill-=c->OutPos;
+    c->OutPos=0;
+  }
+
+  static const sInt CHUNKHEAD=10;     // "xxxxxxxx\r\n"
+  static const sInt CHUNKTAIL=7;      // "\r\n" and "0\r\n\r\n"
+  sInt room=IOBUFFER-c->OutFill;
+  if (c->Chunked) room-=CHUNKHEAD+CHUNKTAIL;
+  if (room<=0) return;
+
+  sU8 *dest=c->Out+c->OutFill+(c->Chunked?CHUNKHEAD:0);
+  sInt n=0;
+
+  if (c->File)
+  {
+    n=sInt(sMin<sS64>(room,c->FileLeft));
+    if (n>0 && !c->File->Read(dest,n))
+    {
+      // too late for an error code
+      c->KeepAlive=sFALSE;
+      c->FileLeft=n=0;
+    }
+    c->FileLeft-=n;
+    if (c->FileLeft<=0) c->BodyDone=sTRUE;
+  }
+  else if (c->Hndl)
+  {
+    if (!c->Hndl->DataAvailable())
+    {
+      c->Retry=sTRUE;
+      return;
+    }
+    n=c->Hndl->GetData(dest,room);
+    if (!n) c->BodyDone=sTRUE;
+  }
+  else
+    c->BodyDone=sTRUE;
+
+  if (c->Chunked)
+  {
+    if (n)
+    {
+      sChar8 *h=(sChar8*)c->Out+c->OutFill;
+      for (sInt i=0; i<8; i++)
+        h[i]="0123456789abcdef"[(n>>(28-4*i))&15];
+      h[8]='\r'; h[9]='\n';
+      c->OutFill+=CHUNKHEAD+n;
+      c->Out[c->OutFill++]='\r';
+      c->Out[c->OutFill++]='\n';
+    }
+    if (c->BodyDone)
+    {
+      sCopyMem(c->Out+c->OutFill,"0\r\n\r\n",5);
+      c->OutFill+=5;
+    }
+  }
+  else
+    c->OutFill+=n;
+}
+
+void sHTTPServer::RunJob(Connection *c)
+{
+  switch (c->Job)
+  {
+  case JOB_HEADERS:
+    if (c->RetCode<400)
+    {
+      if (c->Method==CM_POST && c->ContentLength>0)
+      {
+        // streaming handlers see the request before the body
+        Route(c,sFALSE);
+        if (c->Hndl && c->Hndl->StreamRequestBody())
         {
-          if (e->HFactory)
-          {
-            Handler *h = e->HFactory();
-            switch (h->Init(c))
-            {
-            case HR_OK:
-              found=sTRUE;
-              c->Hndl=h;
-              break;
-            case HR_IGNORE:
-              delete h;
-              break;
-            case HR_ERROR:
-              delete h;
-              c->RetCode=500;
-              c->Error=L"Handler Error";
-              break;           
-            case HR_REWRITTEN:
-              delete h;
-              goto recheck;
-            }
-          }
-          else if (e->Mem)
-          {
-            found=sTRUE;
-            c->Mem=e->Mem;
-            c->MemSize=e->Size;
-          }
-          else
+          c->StreamBody=sTRUE;
+          if (InitHandler(c)!=HR_OK && c->RetCode<400)
           {
             c->RetCode=500;
-            c->Error=L"Invalid URL Entry";
+            c->Error=L"Handler Error";
           }
         }
-        if (found || c->RetCode>=400) break;
-      }
-
-      if (!found && FilesSupported)
-      {
-        static sString<sMAXPATH> path;
-        path=FileRoot;
-        sAppendString(path,url2);
+        else if (c->ContentLength>MaxPOSTData)
+        {
+          c->RetCode=400;
+          c->Error=L"POST payload too big";
+        }
+        else
+        {
+          sDelete(c->Hndl);
+          c->Mem=0;
+          c->MemSize=0;
+          sDelete(c->File);
+
+          // We allocate one byte more and add a null-terminator
+          // at the end, which makes it easier to work with strings as post data.
+          c->POSTData=new sChar[c->ContentLength+1];
+          c->POSTData[c->ContentLength]=0;
+          c->POSTDataSize=0;
+        }
 
-        sFile *f=sCreateFile(path);
-        if (f)
+        if (c->RetCode<400)
         {
-          c->File=f;
-          found=sTRUE;
+          c->BodyLeft=c->ContentLength;
+          c->NextState=CS_GETBODY;
+          break;
         }
       }
+      else if (c->RetCode!=1)
+      {
+        c->Error=L"OK";
+        c->RetCode=200;
+        Route(c,sTRUE);
+      }
+      else
+        Route(c,sTRUE);
+    }
+    StartResponse(c);
+    break;
+
+  case JOB_BODY:
+    if (!c->Hndl->PutData(c->JobData,c->JobSize))
+    {
+      // the client keeps sending, so the connection can't be reused
+      c->RetCode=500;
+      c->Error=L"Handler Error";
+      StartResponse(c);
+      break;
+    }
+    c->NextState=CS_GETBODY;
+    if (c->BodyLeft==0)
+    {
+      c->Error=L"OK";
+      c->RetCode=200;
+      StartResponse(c);
+    }
+    break;
 
-      if (!found && c->RetCode<400)
+  case JOB_BODYDONE:
+    {
+      const sChar *pct = c->ContentType;
+      sString<64> Boundary;
+      sString<64> Boundary2;
+      sString<64> Boundary3;
+      // todo: this should be a lot more generalized.
+      if (sScanMatch(pct, L"multipart/form-data; boundary="))
       {
-        c->RetCode=404;
-        c->Error=L"Not Found";
+        sCopyString(Boundary, pct);
+        Boundary2.PrintF(L"--%s\r\n", Boundary);
+        Boundary3.PrintF(L"--%s--\r\n", Boundary);
+        Boundary.Add(L"\r\n");
+        sInt offs=0;
+        sInt result = sFindString(c->POSTData+offs, Boundary2);
+        offs+=result;
+        offs+=Boundary2.Count();
+        while (offs<c->ContentLength)
+        {
+          sInt next = sFindString(c->POSTData+offs, Boundary2);
+          if (next<0) next = c->ContentLength-offs;
+          DataPacket *packet = new DataPacket(c->POSTData+offs, next);
+          packet->Parse();
+          c->DataPackets.AddTail(packet);
+
+          result = next;
+          offs+=result;
+          offs+=Boundary2.Count();
+        }
+      } else {
+        DataPacket *packet = new DataPacket(c->POSTData, c->ContentLength);
+        c->DataPackets.AddTail(packet);
       }
+
+      // let's go
+      c->Error=L"OK";
+      c->RetCode = 200;
+      Route(c,sTRUE);
+      StartResponse(c);
     }
-    else
+    break;
+
+  case JOB_FILL:
+    c->NextState=CS_SERVE;
+    Fill(c);
+    break;
+  }
+}
+
+void sHTTPServer::WorkerFunc(sThread *t, void *user)
+{
+  sHTTPServer *s=(sHTTPServer *)user;
+
+  while (t->CheckTerminate())
+  {
+    s->JobLock.Lock();
+    Connection *c = s->JobQueue.IsEmpty() ? 0 : s->JobQueue.RemHead();
+    s->JobLock.Unlock();
+
+    if (!c)
     {
-      c->RetCode=400;
-      c->Error=L"Unsupported Method";
+      s->JobEvent->Wait(100);
+      continue;
     }
 
+    s->RunJob(c);
+
+    s->JobLock.Lock();
+    s->DoneQueue.AddTail(c);
+    s->JobLock.Unlock();
+    s->Poller->Wake();
   }
+}
 
-  sBool doclose=sFALSE;
-  if (c->Method==CM_HEAD) doclose=sTRUE;
+/****************************************************************************/
+/***                                                                      ***/
+/***   Serving thread                                                     ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void sHTTPServer::UpdatePoll(Connection *c, sInt flags)
+{
+  if (c->Dead || flags==c->PollFlags) return;
+  Poller->Modify(c->Socket,flags,c);
+  c->PollFlags=flags;
+}
+
+void sHTTPServer::Schedule(Connection *c, JobKind job)
+{
+  UpdatePoll(c,0);
+  c->Job=job;
+  c->State=CS_WORK;
 
-  if (c->RetCode>=200)
+  if (!WorkerCount)
   {
-    sString<1024> str;
-    sSPrintF(str,L"HTTP/1.0 %d %s\r\n",c->RetCode,c->Error);
+    RunJob(c);
+    FinishJob(c);
+    return;
+  }
 
-    if (c->File)
-      sSPrintF(sGetAppendDesc(str),L"Content-Length: %d\r\n",c->File->GetSize());
-    else if (c->Mem && c->MemSize)
-      sSPrintF(sGetAppendDesc(str),L"Content-Length: %d\r\n",c->MemSize);
+  JobLock.Lock();
+  JobQueue.AddTail(c);
+  JobLock.Unlock();
+  JobEvent->Signal();
+}
 
-    sSPrintF(sGetAppendDesc(str),L"Connection: close\r\n");
+void sHTTPServer::FinishJob(Connection *c)
+{
+  c->State=ConnState(c->NextState);
+  if (c->Dead)
+  {
+    c->Socket->Disconnect();
+    return;
+  }
 
-    // we encountered an error. too sad.
-    if (c->RetCode>=400)
+  if (c->State==CS_GETBODY)
+  {
+    if (c->Expect100 && c->BodyLeft==c->ContentLength)
+    {
+      static const sChar8 cont[]="HTTP/1.1 100 Continue\r\n\r\n";
+      c->Socket->WriteAll(cont,sizeof(cont)-1);
+    }
+    UpdatePoll(c,sSocketPoller::SP_READ);
+    Parse(c);
+  }
+  else if (c->State==CS_SERVE)
+  {
+    if (c->Retry)
+      c->RetryTime=sGetTime()+10;
+    else
+      Send(c);
+  }
+}
+
+void sHTTPServer::Accept()
+{
+  for (;;)
+  {
+    sTCPSocket *s=HostSocket.Accept();
+    if (!s) return;
+
+    if (ConnCount>=MaxConnections)
+    {
+      sLogF(L"http",L"out of connections\n");
+      HostSocket.CloseConnection(s);
+      continue;
+    }
+
+    Connection *c;
+    if (!FreeList.IsEmpty())
     {
-      if (c->Method!=CM_HEAD) sSPrintF(sGetAppendDesc(str),L"\r\n<html><body><h1>%d %s</h1>Sorry.<br><i>Altona Web Server</i></body></html>",c->RetCode,c->Error);
-      doclose=sTRUE;
+      c=FreeList.RemTail();
     }
     else
     {
-      // add additional header lines here
-      if (c->Hndl) c->Hndl->GetAdditionalHeaders(sGetAppendDesc(str));
-      sAppendString(sGetAppendDesc(str),L"\r\n");
+      c=new Connection;
+      c->POSTData=0;
+      c->Hndl=0;
+      c->File=0;
+      c->In=new sU8[IOBUFFER];
+      c->Out=new sU8[IOBUFFER];
     }
+    //sDPrintF(L"[http] new connection %08x\n",(sDInt)c);
+    ConnList.AddTail(c);
+    ConnCount++;
+
+    c->Socket=s;
+    c->Dead=sFALSE;
+    c->InPos=c->InFill=0;
+    c->LastActive=sGetTime();
+    ResetRequest(c);
+
+    s->SetNonBlocking(sTRUE);
+    s->SetNagle(sFALSE);
+    c->PollFlags=sSocketPoller::SP_READ;
+    if (!Poller->Add(s,c->PollFlags,c))
+      s->Disconnect();
+  }
+}
+
+void sHTTPServer::CloseConnection(Connection *c)
+{
+  //sDPrintF(L"[http] closing %08x\n",(sDInt)c);
+  sVERIFY(c->State!=CS_WORK);
+  if (Poller && !c->Dead) Poller->Remove(c->Socket);
+  ResetRequest(c);
+  HostSocket.CloseConnection(c->Socket);
+  ConnList.Rem(c);
+  FreeList.AddTail(c);
+  ConnCount--;
+}
 
-    // send header
-    sChar8 str8[1024];
-    sCopyString(str8,str,1024);
-    c->Socket->WriteAll(str8,sGetStringLen(str));
+void sHTTPServer::ReadRequest(Connection *c)
+{
+  if (c->InPos>0)
+  {
+    sCopyMem(c->In,c->In+c->InPos,c->InFill-c->InPos);
+    c->InFill-=c->InPos;
+    c->InPos=0;
   }
 
-  if (doclose)
-    c->Socket->Disconnect();
+  sDInt read;
+  if (c->Socket->Read(c->In+c->InFill,IOBUFFER-c->InFill,read))
+  {
+    if (!read)
+    {
+      c->Socket->Disconnect();  // end of stream
+      return;
+    }
+    c->InFill+=sInt(read);
+    c->LastActive=sGetTime();
+  }
   else
-    c->State=CS_SERVE;
+  {
+    if (!c->Socket->WouldBlock()) c->Socket->Disconnect();
+    return;
+  }
 
+  Parse(c);
 }
 
-/****************************************************************************/
+// consume what we have in In. leftovers stay for the next request
 
-sBool sHTTPServer::Run(sThread *t)
+void sHTTPServer::Parse(Connection *c)
 {
-  sBool aborted = sFALSE;
-  if (!HostSocket.IsConnected()) return sFALSE;
-
-  Lock.Lock();
+  while (c->InPos<c->InFill)
+  {
+    if (c->State==CS_GETREQUEST)
+    {
+      sInt ch=c->In[c->InPos++];
 
-  sTCPSocket **readset=new sTCPSocket*[MAXCONN];
-  sTCPSocket **writeset=new sTCPSocket*[MAXCONN];
+      // parse the request line 
+      if (ch==10)
+      {
+        sInt op=c->LineLen;
+        c->RequestLine[op--]=0;
+        while (op>=0 && c->RequestLine[op]<32) c->RequestLine[op--]=0;
+        c->LineLen=0;
 
-  while (HostSocket.IsConnected() && (!t || t->CheckTerminate())) 
-  {
-    //static sInt test=0;
-    //sDPrintF(L"tick %d\n",test++);
+        // a stray empty line between pipelined requests is fine
+        if (c->Method==CM_UNKNOWN && !c->RequestLine[0]) continue;
 
-    // step 1: make list of readable/writable sockets
-    sInt nreads=0;
-    sInt nwrites=0;
-    Connection *c;
-    sFORALL_LIST(ConnList,c)
+        ParseRequestLine(c);
+        if (c->RetCode || c->HeadersDone)
+        {
+          Schedule(c,JOB_HEADERS);
+          return;
+        }
+      }
+      else if (c->LineLen<REQLINE-1)
+      {
+        c->RequestLine[c->LineLen++]=ch;
+      }
+    }
+    else if (c->State==CS_GETBODY)
     {
-      if (c->State == CS_GETREQUEST) readset[nreads++]=c->Socket;
+      sInt chunk=sMin(c->InFill-c->InPos,c->BodyLeft);
+      if (c->StreamBody)
+      {
+        c->JobData=c->In+c->InPos;
+        c->JobSize=chunk;
+        c->InPos+=chunk;
+        c->BodyLeft-=chunk;
+        Schedule(c,JOB_BODY);
+        return;
+      }
+
+      for (sInt i=0; i<chunk; i++)
+        c->POSTData[c->POSTDataSize++]=c->In[c->InPos++];
+      c->BodyLeft-=chunk;
+      if (!c->BodyLeft)
+      {
+        Schedule(c,JOB_BODYDONE);
+        return;
+      }
+    }
+    else
+      return;
+  }
+}
 
-      if (c->State == CS_SERVE) 
+void sHTTPServer::Send(Connection *c)
+{
+  for (;;)
+  {
+    const sU8 *src;
+    sInt size;
+    if (c->OutPos<c->OutFill)
+    {
+      src=c->Out+c->OutPos;
+      size=c->OutFill-c->OutPos;
+    }
+    else if (c->Mem && c->MemSize>0)
+    {
+      src=c->Mem;
+      size=c->MemSize;
+    }
+    else if (c->BodyDone || c->Mem)
+    {
+      ResponseDone(c);
+      return;
+    }
+    else if (WorkerCount)
+    {
+      // out of data, let the handler or file fill up
+      Schedule(c,JOB_FILL);
+      return;
+    }
+    else
+    {
+      Fill(c);
+      if (c->Retry)
       {
-        if (c->File || c->Mem || (c->Hndl && c->Hndl->DataAvailable()))
-          writeset[nwrites++]=c->Socket;
+        c->RetryTime=sGetTime()+10;
+        return;
       }
+      continue;
+    }
+
+    sDInt written;
+    if (!c->Socket->Write(src,size,written))
+    {
+      if (c->Socket->WouldBlock())
+        UpdatePoll(c,sSocketPoller::SP_WRITE);
+      else
+        c->Socket->Disconnect();
+      return;
+    }
+
+    if (c->OutPos<c->OutFill)
+      c->OutPos+=sInt(written);
+    else
+    {
+      c->Mem+=written;
+      c->MemSize-=sInt(written);
     }
+    c->LastActive=sGetTime();
+  }
+}
+
+void sHTTPServer::ResponseDone(Connection *c)
+{
+  if (!c->KeepAlive)
+  {
+    c->Socket->Disconnect();
+    return;
+  }
+
+  ResetRequest(c);
+  UpdatePoll(c,sSocketPoller::SP_READ);
+  Parse(c);
+}
+
+/****************************************************************************/
+
+sBool sHTTPServer::Run(sThread *t)
+{
+  if (!HostSocket.IsConnected()) return sFALSE;
+
+  sSocketPoller poller;
+  Poller=&poller;
+  HostSocket.SetNonBlocking(sTRUE);
+  Poller->Add(&HostSocket,sSocketPoller::SP_READ,&HostSocket);
+
+  if (WorkerCount)
+  {
+    JobEvent=new sThreadEvent;
+    Workers=new sThread*[WorkerCount];
+    for (sInt i=0; i<WorkerCount; i++)
+      Workers[i]=new sThread(WorkerFunc,0,0,this);
+  }
 
-    Lock.Unlock();
+  static const sInt MAXEVENTS=64;
+  sSocketPoller::Event events[MAXEVENTS];
+  sBool ok=sTRUE;
+  sBool retry=sFALSE;
 
-    sTCPSocket *newconn;
-    if (!HostSocket.WaitForEvents(nreads,readset,nwrites,writeset,&newconn, 100))
+  while (HostSocket.IsConnected() && (!t || t->CheckTerminate())) 
+  {
+    // handlers that had nothing to say are asked again soon
+    sInt n=Poller->Wait(events,MAXEVENTS,retry ? 10 : 100);
+    if (n<0)
     {
       sDPrintF(L"httpd wtf\n");
-      aborted = sTRUE;
+      ok=sFALSE;
       break;
     }
 
-    Lock.Lock();
-
-    if (newconn) // new connection?
+    for (sInt i=0; i<n; i++)
     {
+      if (events[i].User==&HostSocket)
+      {
+        Accept();
+        continue;
+      }
 
-      if (!FreeList.IsEmpty())
+      Connection *c=(Connection *)events[i].User;
+      if (events[i].Flags&sSocketPoller::SP_ERROR)
       {
-        c = FreeList.RemTail();
-        //sDPrintF(L"[http] new connection %08x\n",(sDInt)c);
-        sSetMem(c,0,sizeof(Connection));
-        c->Socket = newconn;
-        c->Error=L"Malformed Request";
-        c->State=CS_GETREQUEST;
-        c->Method=CM_UNKNOWN;
-        c->HeadersDone = sFALSE;
-        c->ContentLength = 0;
-        c->DataPackets.Clear();
-        c->POSTData=0;
-
-        ConnList.AddTail(c);
+        if (c->State==CS_WORK)
+        {
+          // the worker still has it, and the poller would keep reporting
+          Poller->Remove(c->Socket);
+          c->Dead=sTRUE;
+        }
+        else
+          c->Socket->Disconnect();
       }
-      else
+      else if (c->State==CS_GETREQUEST || c->State==CS_GETBODY)
+        ReadRequest(c);
+      else if (c->State==CS_SERVE)
       {
-        sLogF(L"http",L"out of connections\n");
-        HostSocket.CloseConnection(newconn);
+        UpdatePoll(c,0);
+        Send(c);
       }
-
     }
 
-    // read set: retrieve request lines
-    for (sInt i=0; i<nreads; i++)
+    // collect finished jobs
+    if (WorkerCount)
     {
-      sFORALL_LIST(ConnList,c) if (c->Socket==readset[i])
-      {
-        //sDPrintF(L"[http] read ready %08x\n",(sDInt)c);
-        sChar8 buffer[REQLINE];
-        sDInt read;
-        if (c->Socket->Read(buffer,REQLINE,read))
-        {
-          sInt op=sGetStringLen(c->RequestLine);
-          for (sInt ip=0; ip<read; ip++)
-          {
-            sInt ch=buffer[ip];
-            if ( (c->Method!=CM_POST) || (!c->HeadersDone) )
-            {
-              // parse the request line 
-              if (ch==10)
-              {
-                c->RequestLine[op--]=0;
-                while (op>=0 && c->RequestLine[op]<32) c->RequestLine[op--]=0;
-                if (!c->RetCode) 
-                {
-                  ParseRequestLine(c);
-                  if (c->RetCode) StartServing(c);
-                }
-                op=0;
-              }
-              else
-              {
-                if (op<(REQLINE-1))
-                {
-                  c->RequestLine[op++]=ch;
-                }
-              }
-            } else {
-              // init POST data of not happened yet            
-              if (!c->POSTData)
-              {
-                if (c->ContentLength>MAXPOSTDATA)
-                {
-                  c->Error=L"POST payload too big";
-                  c->RetCode = 400;
-                  StartServing(c);
-                  break;
-                }
-                // We allocate one byte more and add a null-terminator
-                // at the end, which makes it easier to work with strings as post data.
-                c->POSTData=new sChar[c->ContentLength+1];
-                c->POSTData[c->ContentLength]=0;
-                c->POSTDataSize=0;
-              }
-
-              // parse the POST data
-              c->POSTData[c->POSTDataSize++] = ch;
-              if (c->POSTDataSize==c->ContentLength)
-              {
-                // let's go
-                c->Error=L"OK";
-                c->RetCode = 200;
-                const sChar *pct = c->ContentType;
-                sString<64> Boundary;
-                sString<64> Boundary2;
-                sString<64> Boundary3;
-                // todo: this should be a lot more generalized.
-                if (sScanMatch(pct, L"multipart/form-data; boundary="))
-                {
-                  sCopyString(Boundary, pct);
-                  Boundary2.PrintF(L"--%s\r\n", Boundary);
-                  Boundary3.PrintF(L"--%s--\r\n", Boundary);
-                  Boundary.Add(L"\r\n");
-                  sInt offs=0;
-                  sInt result = sFindString(c->POSTData+offs, Boundary2);
-                  offs+=result;
-                  offs+=Boundary2.Count();
-                  while (offs<c->ContentLength)
-                  {
-                    sInt next = sFindString(c->POSTData+offs, Boundary2);
-                    if (next<0) next = c->ContentLength-offs;
-                    DataPacket *packet = new DataPacket(c->POSTData+offs, next);
-                    packet->Parse();
-                    c->DataPackets.AddTail(packet);
-
-                    result = next;
-                    offs+=result;
-                    offs+=Boundary2.Count();
-                  }
-                } else {
-                  DataPacket *packet = new DataPacket(c->POSTData, c->ContentLength);
-                  c->DataPackets.AddTail(packet);
-                }
-                if (c->RetCode) StartServing(c);
-              }
-            }
-          }
-          c->RequestLine[op]=0;
-        }
-        break;
-      }
+      sDList<Connection,&Connection::JobLink> done;
+      JobLock.Lock();
+      while (!DoneQueue.IsEmpty())
+        done.AddTail(DoneQueue.RemHead());
+      JobLock.Unlock();
+      while (!done.IsEmpty())
+        FinishJob(done.RemHead());
     }
 
-    // write set: serve
-    for (sInt i=0; i<nwrites; i++)
+    // retries, idle connections and discarding of old connections
+    sInt time=sGetTime();
+    retry=sFALSE;
+    Connection *c = ConnList.GetHead();
+    while (!ConnList.IsEnd(c))
     {
-      sFORALL_LIST(ConnList,c) if (c->Socket==writeset[i])
+      Connection *next = ConnList.GetNext(c);
+      if (c->State!=CS_WORK)
       {
-        //sDPrintF(L"[http] write ready %08x\n",(sDInt)c);
-        if (c->Hndl)
+        if (!c->Socket->IsConnected())
+          CloseConnection(c);
+        else if (c->State==CS_SERVE && c->RetryTime)
         {
-          sInt read=c->Hndl->GetData(Temp,1024);
-          if (read)
+          if (time>=c->RetryTime)
           {
-            // ok, this may block, but who cares
-            c->Socket->WriteAll(Temp,read);            
+            c->RetryTime=0;
+            Schedule(c,JOB_FILL);
           }
-          else
-            c->Socket->Disconnect();
+          retry=sTRUE;
         }
-        else if (c->Mem)
-        {
-          if (c->MemSize)
-          {
-            sInt chunk=sMin(4096,c->MemSize);
-            sDInt written;
-            c->Socket->Write(c->Mem,chunk,written);
-            c->Mem+=written;
-            c->MemSize-=written;
-          }
-          else
-            c->Socket->Disconnect();
-        }
-        else if (c->File)
-        {
-          sInt offs=c->File->GetOffset();
-          sInt size=c->File->GetSize();
-          if (offs<size)
-          {
-            sInt chunk=sMin(4096,size-offs);
-            c->File->Read(Temp,chunk);
-            sDInt written;
-            c->Socket->Write(Temp,chunk,written);
-            if (written<chunk) 
-              c->File->SetOffset(offs+written);
-            offs+=written;
-          }
-          else
-            c->Socket->Disconnect();
-        }
-        break;
+        else if ((c->State==CS_GETREQUEST || c->State==CS_GETBODY) && time-c->LastActive>KEEPALIVE)
+          CloseConnection(c);
       }
+      c=next;
     }
+  }
 
-    // check connection status and discard old connections
-    c = ConnList.GetHead();
-    while (!ConnList.IsEnd(c))
+  // workers finish what they have
+  if (WorkerCount)
+  {
+    for (sInt i=0; i<WorkerCount; i++)
+      delete Workers[i];
+    sDeleteArray(Workers);
+    sDelete(JobEvent);
+
+    while (!JobQueue.IsEmpty())
+      DoneQueue.AddTail(JobQueue.RemHead());
+    while (!DoneQueue.IsEmpty())
     {
-      Connection *next = ConnList.GetNext(c);
-      if (!c->Socket->IsConnected())
-      {
-        //sDPrintF(L"[http] closing %08x\n",(sDInt)c);
-        sDelete(c->File);
-        sDelete(c->Hndl);
-        sDeleteArray(c->POSTData);
-        sDeleteAll(c->DataPackets);
-        HostSocket.CloseConnection(c->Socket);
-        ConnList.Rem(c);
-        FreeList.AddTail(c);
-      }
-      c=next;
+      Connection *c=DoneQueue.RemHead();
+      c->State=CS_DONE;
     }
   }
 
-  delete[] readset;
-  delete[] writeset;
-
-  if(!aborted)
-    Lock.Unlock();
+  while (!ConnList.IsEmpty())
+    CloseConnection(ConnList.GetHead());
+  Poller->Remove(&HostSocket);
+  Poller=0;
 
-  return sTRUE;
+  return ok;
 }
 
 /****************************************************************************/
@@ -1236,6 +1714,7 @@ sInt sParsePOSTData(const sHTTPServer::Connection *c, sURLParam *params, sInt ma
   sInt qpos;
 
   const sHTTPServer::DataPacket *dp;
+  if (c->DataPackets.IsEmpty()) return 0;   // streamed body
   dp=c->DataPackets.GetHead();
   while (1)
   {
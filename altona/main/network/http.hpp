@@ -130,6 +130,15 @@ public:
   // newly-added stuff will have highest priority if multiple wildcards match
   void AddStaticPage(const sChar *wildcard, const void *ptr, sInt length);
   void AddHandler(const sChar *wildcard, HandlerCreateFunc factory);
+
+  // handlers run on this many worker threads, so a slow handler doesn't
+  // stall other connections. 0 runs them on the thread that calls Run().
+  // handlers that share state should use 1. call before Run().
+  void SetWorkerCount(sInt count) { WorkerCount=count; }
+
+  // limits for buffered POST bodies and for open connections
+  void SetMaxPOSTData(sInt bytes) { MaxPOSTData=bytes; }
+  void SetMaxConnections(sInt count) { MaxConnections=count; }
   
   // serve. The thread specified will be checked for termination
   sBool Run(sThread *t);
@@ -137,15 +146,19 @@ public:
   /****************************************************************************/
   // semi-public interface for handlers
 
-  static const sInt MAXCONN=64;
+  static const sInt MAXCONN=256;            // default for SetMaxConnections()
   static const sInt REQLINE=1024;
-  static const sInt MAXPOSTDATA=1024*1024;
+  static const sInt MAXPOSTDATA=1024*1024;  // default for SetMaxPOSTData()
+  static const sInt IOBUFFER=16384;         // per connection, in and out
+  static const sInt KEEPALIVE=5000;         // ms an idle connection stays open
 
   enum ConnState
   {
     CS_GETREQUEST,
     CS_SERVE,
     CS_DONE,
+    CS_GETBODY,
+    CS_WORK,        // a worker thread has the connection
   };
 
   enum ConnMethod
@@ -191,6 +204,8 @@ public:
     sInt  POSTDataSize;
 
     ConnMethod Method;
+    sInt Version;     // 9, 10 or 11 for HTTP/0.9, 1.0, 1.1
+    sBool KeepAlive;  // client wants to send more requests
 
     sInt RetCode; // HTTP result code, or 0:unknown / 1:HTTP 0.9
     sBool HeadersDone;
@@ -205,6 +220,32 @@ public:
     sInt MemSize; 
 
     sDNode Link;
+
+    // no need to look here
+
+    sInt Job;
+    sInt NextState;
+    sInt LineLen;
+    sInt BodyLeft;          // request body bytes still to come
+    sBool StreamBody;       // request body goes to Hndl->PutData()
+    sBool Expect100;
+    sBool Chunked;          // response body is sent in chunked encoding
+    sBool BodyDone;         // response body is complete
+    sBool Retry;            // handler had no data yet
+    sBool Dead;             // socket failed while a worker had it
+    sS64 FileLeft;
+    sInt LastActive;
+    sInt RetryTime;
+    sInt PollFlags;
+
+    sU8 *In;
+    sInt InPos,InFill;
+    const sU8 *JobData;     // part of In for PutData()
+    sInt JobSize;
+    sU8 *Out;
+    sInt OutPos,OutFill;
+
+    sDNode JobLink;
   };
 
   enum HandlerResult
@@ -235,6 +276,12 @@ public:
     // get next chunk of data
     // returns length, 0 means end of document
     virtual sInt GetData(sU8 *buffer, sInt len)=0;
+
+    // return sTRUE to get the request body in pieces through PutData()
+    // instead of Connection::POSTData. Init() is then called before the
+    // body arrives, and there is no size limit.
+    virtual sBool StreamRequestBody() { return sFALSE; }
+    virtual sBool PutData(const sU8 *buffer, sInt len) { return sTRUE; }
   };
 
 
@@ -311,7 +358,13 @@ public:
 
 private:
 
-  sU8 Temp[4096];
+  enum JobKind
+  {
+    JOB_HEADERS,      // route the request, start body or response
+    JOB_BODY,         // pass JobData to Hndl->PutData()
+    JOB_BODYDONE,     // buffered body is complete
+    JOB_FILL,         // get more response data into Out
+  };
 
   struct URLEntry
   {
@@ -335,15 +388,44 @@ private:
   sString<sMAXPATH> FileRoot;
 
   sDList<Connection,&Connection::Link> ConnList;
-  Connection ConnStore[MAXCONN];
   sDList<Connection,&Connection::Link> FreeList;
+  sInt ConnCount;
+  sInt MaxConnections;
+  sInt MaxPOSTData;
 
-  sThreadLock Lock;
-
-  void ParseRequestLine(Connection *c);
-  void StartServing(Connection *c);
+  sThreadLock Lock;             // URLEntries
 
+  sSocketPoller *Poller;
+  sInt WorkerCount;
+  sThread **Workers;
+  sThreadLock JobLock;          // JobQueue, DoneQueue
+  sThreadEvent *JobEvent;
+  sDList<Connection,&Connection::JobLink> JobQueue;
+  sDList<Connection,&Connection::JobLink> DoneQueue;
 
+  void InitMembers();
+  void ParseRequestLine(Connection *c);
+  void ResetRequest(Connection *c);
+
+  // serving thread
+  void Accept();
+  void CloseConnection(Connection *c);
+  void ReadRequest(Connection *c);
+  void Parse(Connection *c);
+  void Send(Connection *c);
+  void ResponseDone(Connection *c);
+  void Schedule(Connection *c, JobKind job);
+  void FinishJob(Connection *c);
+  void UpdatePoll(Connection *c, sInt flags);
+
+  // worker threads (or the serving thread)
+  void RunJob(Connection *c);
+  void Route(Connection *c, sBool init);
+  HandlerResult InitHandler(Connection *c);
+  void StartResponse(Connection *c);
+  void Fill(Connection *c);
+
+  static void WorkerFunc(sThread *t, void *user);
 };
 
 sInt sParseURL(const sChar *url, const sStringDesc &base, sURLParam *params, sInt maxparams);
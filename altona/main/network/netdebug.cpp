@@ -14,6 +14,7 @@
 #include "base/graphics.hpp"
 #include "util/image.hpp"
 #include "util/perfmon.hpp"
+#include "util/perftrace.hpp"
 #include "network/sockets.hpp"
 #include "network/http.hpp"
 
@@ -907,6 +908,126 @@ namespace sNetDebug
   /****************************************************************************/
   /****************************************************************************/
 
+  // chrome trace events from sPerfTrace. 
+  // /trace.json?frames=n   the last n frames, 0 for all that is left
+  // /trace.json?stream=s   everything that happens in the next s seconds
+
+  class TraceJSON : public sHTTPServer::Handler
+  {
+  public:
+    sPerfTraceCursor Cursor;
+    sTextBuffer Text;
+    sInt TextPos;
+    sInt StreamEnd;
+    sInt NextPoll;
+    sBool Finished;
+
+    sHTTPServer::HandlerResult Init(sHTTPServer::Connection *conn)
+    {
+      sURLParam params[4];
+      sString<sHTTPServer::REQLINE> base;
+      sInt np=sParseURL(conn->URL,base,params,sCOUNTOF(params));
+      sInt frames=60;
+      sInt stream=0;
+      for (sInt i=0; i<np; i++)
+      {
+        if (!sCmpString(params[i].Name,L"frames")) frames=params[i].ValI;
+        if (!sCmpString(params[i].Name,L"stream")) stream=params[i].ValI;
+      }
+
+      TextPos=0;
+      NextPoll=0;
+      Finished=sFALSE;
+      Text.Print(L"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+      if (stream>0)
+      {
+        Cursor.Since=sGetTimeUS();
+        StreamEnd=sGetTime()+stream*1000;
+      }
+      else
+      {
+        Cursor.Since=sPerfTraceFrameStart(frames);
+        sPerfTraceWrite(Text,Cursor);
+        Text.Print(L"\n]}\n");
+        Finished=sTRUE;
+      }
+      return sHTTPServer::HR_OK;
+    }
+
+    sBool DataAvailable()
+    {
+      if (TextPos<Text.GetCount() || Finished) return sTRUE;
+
+      // poll the rings ten times a second
+      sInt time=sGetTime();
+      if (time<NextPoll) return sFALSE;
+      NextPoll=time+100;
+
+      Text.Clear();
+      TextPos=0;
+      sPerfTraceWrite(Text,Cursor);
+      if (time>=StreamEnd)
+      {
+        Text.Print(L"\n]}\n");
+        Finished=sTRUE;
+      }
+      return TextPos<Text.GetCount() || Finished;
+    }
+
+    sInt GetData(sU8 *buffer, sInt len)
+    {
+      const sChar *text=Text.Get();
+      sInt n=sMin(len,Text.GetCount()-TextPos);
+      for (sInt i=0; i<n; i++)
+        buffer[i]=sU8(text[TextPos+i]);
+      TextPos+=n;
+      return n;
+    }
+
+    void GetAdditionalHeaders(const sStringDesc &str)
+    {
+      sSPrintF(str,L"Content-Type: application/json\r\n");
+      if (Finished)
+        sSPrintF(sGetAppendDesc(str),L"Content-Length: %d\r\nContent-Disposition: attachment; filename=trace.json\r\n",Text.GetCount());
+    }
+
+    static Handler *Factory() { return new TraceJSON; }
+  };
+
+  struct TracePage : public sHTTPServer::SimpleHandler
+  {
+    sHTTPServer::HandlerResult WriteDocument(const sChar *URL)
+    {
+      WriteHTMLHeader(L"trace",L"/style.css");
+
+      sInt dump=GetParamI(L"dump",0);
+      if (dump>0)
+      {
+        sString<64> name;
+        name.PrintF(L"trace_%d.json",sGetTime());
+        if (sPerfTraceDump(name,dump))
+          PrintF(L"<p>written to %s</p>",name);
+        else
+          PrintF(L"<p>could not write %s</p>",name);
+      }
+
+      PrintF(L"<h2>Trace</h2><p>open these in chrome://tracing or ui.perfetto.dev</p><ul>");
+      PrintF(L"<li><a href=\"/trace.json?frames=60\">last 60 frames</a></li>");
+      PrintF(L"<li><a href=\"/trace.json?frames=0\">everything in the buffers</a></li>");
+      PrintF(L"<li><a href=\"/trace.json?stream=10\">record the next 10 seconds</a></li>");
+      PrintF(L"<li><a href=\"%s?dump=60\">write the last 60 frames to a file on the target</a></li>",URL);
+      PrintF(L"</ul>");
+
+      WriteHTMLFooter();
+      return sHTTPServer::HR_OK;
+    }
+
+    static Handler *Factory() { return new TracePage; }
+  };
+
+  /****************************************************************************/
+  /****************************************************************************/
+
   // read me!
   struct JustAnExample : public sHTTPServer::SimpleHandler
   {
@@ -1042,11 +1163,16 @@ namespace sNetDebug
 #endif
     if (sPerfMonInited())
       Plugins->AddTail(Plugin(L"Switches/Values", L"/perf", PerfStats::Factory));
+    if (sPerfTraceInited())
+      Plugins->AddTail(Plugin(L"Trace", L"/trace", TracePage::Factory));
 
     HTTPD = new sHTTPServer;
+    HTTPD->SetWorkerCount(1);   // the plugins share static state
     HTTPD->AddStaticPage(L"/",Frameset,sizeof(Frameset));
     HTTPD->AddStaticPage(L"/style.css",Stylesheet,sizeof(Stylesheet)-1); // omit the trailing zero byte
     HTTPD->AddHandler(L"/menubar",MenuBar::Factory);
+    if (sPerfTraceInited())
+      HTTPD->AddHandler(L"/trace.json",TraceJSON::Factory);
 
     DebugView::StaticInit();
 #if sRENDERER!=sRENDER_BLANK
@@ -101,6 +101,11 @@ public:
   // you're doing and why!
   void SetNagle(sBool enable);
 
+  // non-blocking mode: Read() and Write() fail without disconnecting when
+  // they would have to wait. WouldBlock() tells this apart from real errors.
+  void SetNonBlocking(sBool enable);
+  sBool WouldBlock();
+
   // convenience functions
   sBool ReadAll(void *buffer, sDInt bytes);
   sBool WriteAll(const void *buffer, sDInt bytes);
@@ -118,6 +123,7 @@ protected:
 
   friend class sTCPClientSocket;
   friend class sTCPHostSocket;
+  friend class sSocketPoller;
 
   struct Private;
   Private *P;
@@ -163,17 +169,57 @@ public:
   // closes connection, discards socket object
   void CloseConnection(sTCPSocket *&connection);
 
+  // accept one pending connection. use this when the host socket is
+  // watched by a sSocketPoller. returns 0 if there was none.
+  sTCPSocket *Accept();
+
   // host sockets can neither read nor write themselves
   sBool Write(const void *, sDInt, sDInt &) { return sFALSE; }
   sBool Read(void *, sDInt, sDInt &) { return sFALSE; }
 
   sTCPHostSocket();
   virtual ~sTCPHostSocket();
+};
 
-private:
+/****************************************************************************/
 
-  sTCPSocket *Accept();
+// waits for many sockets at once. this is epoll on linux and select()
+// everywhere else. Wake() may be called from any thread to make a
+// pending Wait() return early.
+
+class sSocketPoller
+{
+public:
 
+  enum PollFlags
+  {
+    SP_READ   = 0x0001,
+    SP_WRITE  = 0x0002,
+    SP_ERROR  = 0x0004,   // only returned: hangup or error
+  };
+
+  struct Event
+  {
+    void *User;
+    sInt Flags;
+  };
+
+  sSocketPoller();
+  ~sSocketPoller();
+
+  // flags may be 0 to keep the socket registered but silent
+  sBool Add(sTCPSocket *socket, sInt flags, void *user);
+  sBool Modify(sTCPSocket *socket, sInt flags, void *user);
+  void Remove(sTCPSocket *socket);
+
+  // returns number of events, -1 on error. timeout in ms, -1 is infinite
+  sInt Wait(Event *events, sInt max, sInt timeout);
+  void Wake();
+
+private:
+
+  struct Private;
+  Private *P;
 };
 
 /****************************************************************************/
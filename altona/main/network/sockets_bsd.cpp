@@ -70,6 +70,8 @@ sADDSUBSYSTEM(Network,0x14,sInitNetwork,sExitNetwork);
 #define sINVALID_SOCKET INVALID_SOCKET
 #define sSOCKET_ERROR SOCKET_ERROR
 #define sFD_SET(fd,set,nfds) {FD_SET(fd,set);nfds++;}
+#define sNET_WOULDBLOCK(err) ((err)==WSAEWOULDBLOCK)
+#define sNET_SENDFLAGS 0
 
 typedef int socklen_t;
 
@@ -93,10 +95,15 @@ sNetworkStatus sGetNetworkStatus()
 #include <unistd.h>
 #include <netdb.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #define sINVALID_SOCKET -1
 #define sSOCKET_ERROR ((ssize_t)-1)
 #define sFD_SET(fd,set,nfds) {FD_SET(fd,set);nfds=sMax(nfds,(fd)+1);}
+#define sNET_WOULDBLOCK(err) ((err)==EAGAIN || (err)==EWOULDBLOCK)
+#define sNET_SENDFLAGS MSG_NOSIGNAL   // a closed peer is an error, not a signal
 #define closesocket close
 
 static void sPrintNetError(sInt error, const sStringDesc &str)
@@ -184,6 +191,14 @@ struct sTCPSocket::Private
   sockaddr_in Address;
   sockaddr_in LocalAddress;
   sBool Connected;
+  sBool Blocked;          // last Read()/Write() would have blocked
+
+  // returns sTRUE if the error only means "try again later"
+  sBool CheckWouldBlock()
+  {
+    Blocked = sNET_WOULDBLOCK(sNETGETERR);
+    return Blocked;
+  }
 
   void HandleError()
   {
@@ -318,9 +333,11 @@ sBool sTCPSocket::Write(const void *buffer, sDInt size, sDInt &written)
   sInt truncSize = (sInt) size;
   sVERIFY(truncSize == size);
 
-  sInt res = send(P->Socket,(const char*)buffer,truncSize,0);
+  P->Blocked = sFALSE;
+  sInt res = send(P->Socket,(const char*)buffer,truncSize,sNET_SENDFLAGS);
   if (res==sSOCKET_ERROR)
   {
+    if (P->CheckWouldBlock()) return sFALSE;
     P->HandleError();
     TransferError |= 2;
     return sFALSE;
@@ -343,10 +360,12 @@ sBool sTCPSocket::Read(void *buffer, sDInt size, sDInt &read)
   sInt truncSize = (sInt) size;
   sVERIFY(truncSize == size);
 
+  P->Blocked = sFALSE;
   sInt res = recv(P->Socket,(char*)buffer,truncSize,0);
   
   if (res==sSOCKET_ERROR)
   {
+    if (P->CheckWouldBlock()) return sFALSE;
     P->HandleError();
     return sFALSE;
   }
@@ -362,7 +381,25 @@ void sTCPSocket::SetNagle(sBool enable)
   if (!IsConnected()) return;
 
   sU32 optval=enable?0:1;
-  setsockopt(P->Socket,SOL_SOCKET,TCP_NODELAY,(char*)&optval,sizeof(optval));
+  setsockopt(P->Socket,IPPROTO_TCP,TCP_NODELAY,(char*)&optval,sizeof(optval));
+}
+
+void sTCPSocket::SetNonBlocking(sBool enable)
+{
+  if (P->Socket==sINVALID_SOCKET) return;
+
+#if sPLATFORM==sPLAT_WINDOWS
+  u_long mode=enable?1:0;
+  ioctlsocket(P->Socket,FIONBIO,&mode);
+#else
+  int flags=fcntl(P->Socket,F_GETFL,0);
+  fcntl(P->Socket,F_SETFL,enable?(flags|O_NONBLOCK):(flags&~O_NONBLOCK));
+#endif
+}
+
+sBool sTCPSocket::WouldBlock()
+{
+  return P->Blocked;
 }
 
 /****************************************************************************/
@@ -595,6 +632,7 @@ sTCPSocket* sTCPHostSocket::Accept()
   sNET_SOCKTYPE s=accept(P->Socket,(sockaddr*)&addr,&len);
   if (s==sINVALID_SOCKET)
   {
+    if (P->CheckWouldBlock()) return 0;
     P->HandleError();
     return 0;
   }
@@ -611,6 +649,235 @@ sTCPSocket* sTCPHostSocket::Accept()
 }
 
 
+/****************************************************************************/
+/****************************************************************************/
+
+#if sPLATFORM==sPLAT_LINUX
+
+struct sSocketPoller::Private
+{
+  sNET_CLASS
+
+  int Epoll;
+  int WakeFd;             // eventfd, registered with a 0 pointer
+};
+
+static sU32 sPollToEpoll(sInt flags)
+{
+  sU32 ev=0;
+  if (flags&sSocketPoller::SP_READ) ev|=EPOLLIN;
+  if (flags&sSocketPoller::SP_WRITE) ev|=EPOLLOUT;
+  return ev;
+}
+
+sSocketPoller::sSocketPoller()
+{
+  P = new Private;
+  P->Epoll=epoll_create1(EPOLL_CLOEXEC);
+  P->WakeFd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+
+  epoll_event ev;
+  sClear(ev);
+  ev.events=EPOLLIN;
+  ev.data.ptr=0;
+  epoll_ctl(P->Epoll,EPOLL_CTL_ADD,P->WakeFd,&ev);
+}
+
+sSocketPoller::~sSocketPoller()
+{
+  close(P->WakeFd);
+  close(P->Epoll);
+  delete P;
+}
+
+sBool sSocketPoller::Add(sTCPSocket *socket, sInt flags, void *user)
+{
+  sVERIFY(user);
+  epoll_event ev;
+  sClear(ev);
+  ev.events=sPollToEpoll(flags);
+  ev.data.ptr=user;
+  return epoll_ctl(P->Epoll,EPOLL_CTL_ADD,socket->P->Socket,&ev)==0;
+}
+
+sBool sSocketPoller::Modify(sTCPSocket *socket, sInt flags, void *user)
+{
+  sVERIFY(user);
+  epoll_event ev;
+  sClear(ev);
+  ev.events=sPollToEpoll(flags);
+  ev.data.ptr=user;
+  return epoll_ctl(P->Epoll,EPOLL_CTL_MOD,socket->P->Socket,&ev)==0;
+}
+
+void sSocketPoller::Remove(sTCPSocket *socket)
+{
+  epoll_event ev;
+  sClear(ev);
+  epoll_ctl(P->Epoll,EPOLL_CTL_DEL,socket->P->Socket,&ev);
+}
+
+sInt sSocketPoller::Wait(Event *events, sInt max, sInt timeout)
+{
+  static const sInt MAXEV=64;
+  epoll_event ev[MAXEV];
+
+  sInt res=epoll_wait(P->Epoll,ev,sMin(max,MAXEV),timeout);
+  if (res<0)
+    return (errno==EINTR)?0:-1;
+
+  sInt n=0;
+  for (sInt i=0; i<res; i++)
+  {
+    if (!ev[i].data.ptr)
+    {
+      sU64 dummy;
+      while (read(P->WakeFd,&dummy,sizeof(dummy))>0) {}
+      continue;
+    }
+
+    Event &e=events[n++];
+    e.User=ev[i].data.ptr;
+    e.Flags=0;
+    if (ev[i].events&EPOLLIN) e.Flags|=SP_READ;
+    if (ev[i].events&EPOLLOUT) e.Flags|=SP_WRITE;
+    if (ev[i].events&(EPOLLERR|EPOLLHUP)) e.Flags|=SP_ERROR;
+  }
+  return n;
+}
+
+void sSocketPoller::Wake()
+{
+  sU64 one=1;
+  write(P->WakeFd,&one,sizeof(one));
+}
+
+#else // select() fallback
+
+struct sSocketPoller::Private
+{
+  sNET_CLASS
+
+  struct Entry
+  {
+    sTCPSocket *Socket;
+    sInt Flags;
+    void *User;
+  };
+
+  static const sInt MAXENTRIES=FD_SETSIZE;
+  Entry Entries[MAXENTRIES];
+  sInt Count;
+  volatile sBool Woken;
+
+  sInt Find(sTCPSocket *s) { for (sInt i=0; i<Count; i++) if (Entries[i].Socket==s) return i; return -1; }
+};
+
+sSocketPoller::sSocketPoller()
+{
+  P = new Private;
+  P->Count=0;
+  P->Woken=sFALSE;
+}
+
+sSocketPoller::~sSocketPoller()
+{
+  delete P;
+}
+
+sBool sSocketPoller::Add(sTCPSocket *socket, sInt flags, void *user)
+{
+  sVERIFY(user);
+  if (P->Count==Private::MAXENTRIES || P->Find(socket)>=0) return sFALSE;
+  Private::Entry &e=P->Entries[P->Count++];
+  e.Socket=socket;
+  e.Flags=flags;
+  e.User=user;
+  return sTRUE;
+}
+
+sBool sSocketPoller::Modify(sTCPSocket *socket, sInt flags, void *user)
+{
+  sInt i=P->Find(socket);
+  if (i<0) return sFALSE;
+  P->Entries[i].Flags=flags;
+  P->Entries[i].User=user;
+  return sTRUE;
+}
+
+void sSocketPoller::Remove(sTCPSocket *socket)
+{
+  sInt i=P->Find(socket);
+  if (i>=0)
+    P->Entries[i]=P->Entries[--P->Count];
+}
+
+sInt sSocketPoller::Wait(Event *events, sInt max, sInt timeout)
+{
+  // select() can't be woken up, so wait in small slices
+
+  sInt start=sGetTime();
+  for(;;)
+  {
+    fd_set readset, writeset, errset;
+    sInt nfds=0;
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+    FD_ZERO(&errset);
+    for (sInt i=0; i<P->Count; i++)
+    {
+      Private::Entry &e=P->Entries[i];
+      if (e.Flags&SP_READ) sFD_SET(e.Socket->P->Socket,&readset,nfds);
+      if (e.Flags&SP_WRITE) sFD_SET(e.Socket->P->Socket,&writeset,nfds);
+      if (e.Flags) sFD_SET(e.Socket->P->Socket,&errset,nfds);
+    }
+
+    sInt slice=10;
+    if (timeout>=0) slice=sClamp(timeout-(sGetTime()-start),0,slice);
+
+    sInt res=0;
+    if (nfds)
+    {
+      timeval tv;
+      tv.tv_sec=0;
+      tv.tv_usec=slice*1000;
+      res=select(nfds,&readset,&writeset,&errset,&tv);
+      if (res==sSOCKET_ERROR) return -1;
+    }
+    else
+      sSleep(slice);
+
+    sInt n=0;
+    for (sInt i=0; i<P->Count && n<max && res>0; i++)
+    {
+      Private::Entry &e=P->Entries[i];
+      sInt flags=0;
+      if (FD_ISSET(e.Socket->P->Socket,&readset)) flags|=SP_READ;
+      if (FD_ISSET(e.Socket->P->Socket,&writeset)) flags|=SP_WRITE;
+      if (FD_ISSET(e.Socket->P->Socket,&errset)) flags|=SP_ERROR;
+      if (flags)
+      {
+        events[n].User=e.User;
+        events[n].Flags=flags;
+        n++;
+      }
+    }
+
+    if (n || P->Woken || (timeout>=0 && sGetTime()-start>=timeout))
+    {
+      P->Woken=sFALSE;
+      return n;
+    }
+  }
+}
+
+void sSocketPoller::Wake()
+{
+  P->Woken=sTRUE;
+}
+
+#endif
+
 /****************************************************************************/
 /****************************************************************************/
 
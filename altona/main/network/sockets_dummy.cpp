@@ -99,6 +99,15 @@ void sTCPSocket::SetNagle(sBool enable)
 {
 }
 
+void sTCPSocket::SetNonBlocking(sBool enable)
+{
+}
+
+sBool sTCPSocket::WouldBlock()
+{
+  return sFALSE;
+}
+
 /****************************************************************************/
 
 sTCPClientSocket::sTCPClientSocket()
@@ -155,6 +164,41 @@ sTCPSocket* sTCPHostSocket::Accept()
 {
   return 0;
 }
+
+/****************************************************************************/
+
+sSocketPoller::sSocketPoller()
+{
+  P=0;
+}
+
+sSocketPoller::~sSocketPoller()
+{
+}
+
+sBool sSocketPoller::Add(sTCPSocket *socket, sInt flags, void *user)
+{
+  return sFALSE;
+}
+
+sBool sSocketPoller::Modify(sTCPSocket *socket, sInt flags, void *user)
+{
+  return sFALSE;
+}
+
+void sSocketPoller::Remove(sTCPSocket *socket)
+{
+}
+
+sInt sSocketPoller::Wait(Event *events, sInt max, sInt timeout)
+{
+  return -1;
+}
+
+void sSocketPoller::Wake()
+{
+}
+
 /****************************************************************************/
 /****************************************************************************/
 
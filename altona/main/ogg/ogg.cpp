@@ -24,6 +24,7 @@ sOGGDecoder::sOGGDecoder()
 
 sOGGDecoder::~sOGGDecoder() 
 {
+  Shutdown();
   if(dec)
     stb_vorbis_close(dec);
 }
@@ -50,4 +51,34 @@ sInt sOGGDecoder::GetTuneLength()
   return stb_vorbis_stream_length_in_samples(dec);
 }
 
+// every segment gets its own decoder on the same memory. stb_vorbis_seek()
+// finds the page and decodes up to the exact sample.
+
+void *sOGGDecoder::OpenSegment(sInt start)
+{
+  int error = 0;
+  stb_vorbis *seg = stb_vorbis_open_memory(Stream,StreamSize,&error,0);
+  if(seg && start>0)
+  {
+    stb_vorbis_get_error(seg);      // clear
+    stb_vorbis_seek(seg,start);     // returns 0 on success and on failure
+    if(stb_vorbis_get_error(seg)!=VORBIS__no_error)
+    {
+      stb_vorbis_close(seg);
+      seg = 0;
+    }
+  }
+  return seg;
+}
+
+sInt sOGGDecoder::RenderSegment(void *seg,sS16 *buffer,sInt samples)
+{
+  return stb_vorbis_get_samples_short_interleaved((stb_vorbis *)seg,2,buffer,samples*2);
+}
+
+void sOGGDecoder::CloseSegment(void *seg)
+{
+  stb_vorbis_close((stb_vorbis *)seg);
+}
+
 /****************************************************************************/
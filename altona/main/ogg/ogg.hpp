@@ -35,6 +35,10 @@ public:
   sBool Init(sInt songnr);
   sInt Render(sS16 *stream,sInt samples);
   sInt GetTuneLength();
+
+  void *OpenSegment(sInt start);
+  sInt RenderSegment(void *seg,sS16 *buffer,sInt samples);
+  void CloseSegment(void *seg);
 };
 
 /****************************************************************************/
@@ -0,0 +1,387 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "util/audioanalysis.hpp"
+#include "util/taskscheduler.hpp"
+
+sAudioTrack *sCurrentAudioTrack = 0;
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Real FFT                                                           ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+sRealFFT::sRealFFT()
+{
+  Size = 0;
+  Half = 0;
+  BitRev = 0;
+  Twiddle = 0;
+  Split = 0;
+}
+
+sRealFFT::~sRealFFT()
+{
+  delete[] BitRev;
+  delete[] Twiddle;
+  delete[] Split;
+}
+
+void sRealFFT::Init(sInt size)
+{
+  sVERIFY(size>=4 && (size & (size-1))==0);
+  if(size==Size) return;
+
+  delete[] BitRev;
+  delete[] Twiddle;
+  delete[] Split;
+
+  Size = size;
+  Half = size/2;
+  BitRev = new sInt[Half];
+  Twiddle = new sComplex[Half/2];
+  Split = new sComplex[Half];
+
+  sInt bits = sFindLowerPower(Half);
+  for(sInt i=0;i<Half;i++)
+  {
+    sInt r = 0;
+    for(sInt b=0;b<bits;b++)
+      if(i & (1<<b))
+        r |= 1<<(bits-1-b);
+    BitRev[i] = r;
+  }
+  for(sInt i=0;i<Half/2;i++)
+    Twiddle[i].Init(sFCos(sPI2F*i/Half),-sFSin(sPI2F*i/Half));
+  for(sInt i=0;i<Half;i++)
+    Split[i].Init(sFCos(sPI2F*i/Size),-sFSin(sPI2F*i/Size));
+}
+
+void sRealFFT::Transform(const sF32 *in,sComplex *out,sComplex *z) const
+{
+  // pack even/odd samples as one complex signal, in bit reversed order
+
+  for(sInt i=0;i<Half;i++)
+    z[BitRev[i]].Init(in[i*2+0],in[i*2+1]);
+
+  // radix 2 butterflies
+
+  for(sInt len=2;len<=Half;len*=2)
+  {
+    sInt h = len/2;
+    sInt step = Half/len;
+    for(sInt s=0;s<Half;s+=len)
+    {
+      for(sInt k=0;k<h;k++)
+      {
+        const sComplex &w = Twiddle[k*step];
+        sComplex &a = z[s+k];
+        sComplex &b = z[s+k+h];
+        sF32 tr = w.r*b.r - w.i*b.i;
+        sF32 ti = w.r*b.i + w.i*b.r;
+        b.r = a.r - tr;
+        b.i = a.i - ti;
+        a.r += tr;
+        a.i += ti;
+      }
+    }
+  }
+
+  // split into the spectrum of the real signal
+
+  out[0].Init(z[0].r+z[0].i,0);
+  out[Half].Init(z[0].r-z[0].i,0);
+  for(sInt k=1;k<Half;k++)
+  {
+    const sComplex &a = z[k];
+    const sComplex &b = z[Half-k];
+    sF32 er = 0.5f*(a.r+b.r);     // even part: (a+conj(b))/2
+    sF32 ei = 0.5f*(a.i-b.i);
+    sF32 or_ = 0.5f*(a.i+b.i);    // odd part: (a-conj(b))/2i
+    sF32 oi = 0.5f*(b.r-a.r);
+    const sComplex &w = Split[k];
+    out[k].Init(er + w.r*or_ - w.i*oi,ei + w.r*oi + w.i*or_);
+  }
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Analysis Track                                                     ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+struct sAudioTrackHeader
+{
+  sU32 Magic;
+  sInt Version;
+  sInt SampleRate;
+  sInt Samples;
+  sInt FFTSize;
+  sInt Hop;
+  sInt Frames;
+  sInt Channels;
+  sF32 Scale[sATC_MAX];
+};
+
+static const sU32 sAudioTrackMagic = sMAKE4('A','T','R','K');
+static const sInt sAudioTrackVersion = 1;
+
+sAudioTrack::sAudioTrack()
+{
+  Data = 0;
+  Clear();
+}
+
+sAudioTrack::~sAudioTrack()
+{
+  if(sCurrentAudioTrack==this)
+    sCurrentAudioTrack = 0;
+  delete[] Data;
+}
+
+void sAudioTrack::Clear()
+{
+  sDeleteArray(Data);
+  SampleRate = 44100;
+  Samples = 0;
+  FFTSize = 0;
+  Hop = 1;
+  Frames = 0;
+  FramesPerSecond = 0;
+  FramesPerBeat = 0;
+  for(sInt i=0;i<sATC_MAX;i++)
+    Scale[i] = 0;
+}
+
+/****************************************************************************/
+
+struct sAudioAnalyzeJob
+{
+  const sS16 *Data;
+  sInt Samples;
+  sInt Hop;
+  sInt Frames;
+  sInt BlockSize;
+  const sRealFFT *FFT;
+  const sF32 *Window;
+  sInt BandStart[sATC_BANDS+1];
+  sF32 *Raw;                      // Frames*sATC_MAX, onset is filled later
+};
+
+static void sAudioAnalyzeTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  sAudioAnalyzeJob *job = (sAudioAnalyzeJob *) data;
+  sInt size = job->FFT->GetSize();
+  sF32 *in = new sF32[size];
+  sComplex *scratch = new sComplex[size/2];
+  sComplex *spec = new sComplex[size/2+1];
+
+  sInt f0 = start*job->BlockSize;
+  sInt f1 = sMin(job->Frames,(start+count)*job->BlockSize);
+  for(sInt f=f0;f<f1;f++)
+  {
+    // frame f is centered on sample f*hop
+
+    sInt first = f*job->Hop - size/2;
+    sF32 sum = 0;
+    for(sInt i=0;i<size;i++)
+    {
+      sInt smp = first+i;
+      sF32 v = 0;
+      if(smp>=0 && smp<job->Samples)
+        v = (job->Data[smp*2+0] + job->Data[smp*2+1]) * (0.5f/32768.0f);
+      sum += v*v;
+      in[i] = v*job->Window[i];
+    }
+
+    job->FFT->Transform(in,spec,scratch);
+
+    sF32 *raw = job->Raw + f*sATC_MAX;
+    raw[sATC_RMS] = sFSqrt(sum/size);
+    raw[sATC_ONSET] = 0;
+    for(sInt b=0;b<sATC_BANDS;b++)
+    {
+      sF32 e = 0;
+      for(sInt k=job->BandStart[b];k<job->BandStart[b+1];k++)
+        e += spec[k].r*spec[k].r + spec[k].i*spec[k].i;
+      raw[sATC_BAND0+b] = sFSqrt(e/(job->BandStart[b+1]-job->BandStart[b]));
+    }
+  }
+
+  delete[] in;
+  delete[] scratch;
+  delete[] spec;
+}
+
+void sAudioTrack::Analyze(const sS16 *data,sInt samples,sInt rate,sInt fftsize,sInt hop)
+{
+  Clear();
+  sVERIFY(fftsize>=4*sATC_BANDS);
+  if(!data || samples<=0)
+    return;
+
+  SampleRate = rate;
+  Samples = samples;
+  FFTSize = fftsize;
+  Hop = hop;
+  Frames = samples/hop+1;
+  FramesPerSecond = sF32(rate)/hop;
+
+  sRealFFT fft;
+  fft.Init(fftsize);
+  sF32 *window = new sF32[fftsize];
+  for(sInt i=0;i<fftsize;i++)
+    window[i] = 0.5f - 0.5f*sFCos(sPI2F*i/fftsize);
+
+  sAudioAnalyzeJob job;
+  job.Data = data;
+  job.Samples = samples;
+  job.Hop = hop;
+  job.Frames = Frames;
+  job.BlockSize = 64;
+  job.FFT = &fft;
+  job.Window = window;
+  job.Raw = new sF32[Frames*sATC_MAX];
+
+  // log spaced bands from 40hz to 16khz, at least one bin each
+
+  sInt bins = fftsize/2;
+  sInt last = 0;
+  for(sInt b=0;b<=sATC_BANDS;b++)
+  {
+    sF32 hz = 40.0f*sFPow(16000.0f/40.0f,sF32(b)/sATC_BANDS);
+    sInt bin = sInt(hz*fftsize/rate+0.5f);
+    job.BandStart[b] = last = sClamp(bin,last+1,bins+1-sATC_BANDS+b);
+  }
+
+  sInt blocks = (Frames+job.BlockSize-1)/job.BlockSize;
+  if(sSched && blocks>1)
+  {
+    sStsWorkload *wl = sSched->BeginWorkload();
+    wl->AddTask(wl->NewTask(sAudioAnalyzeTask,&job,blocks,0));
+    wl->Start();
+    wl->Sync();
+    wl->End();
+  }
+  else
+  {
+    sAudioAnalyzeTask(0,0,0,blocks,&job);
+  }
+
+  // onset: rectified change of log band energies
+
+  for(sInt f=1;f<Frames;f++)
+  {
+    sF32 *cur = job.Raw + f*sATC_MAX;
+    sF32 *prev = cur - sATC_MAX;
+    sF32 flux = 0;
+    for(sInt b=0;b<sATC_BANDS;b++)
+      flux += sMax(0.0f,sFLog(1+cur[sATC_BAND0+b]) - sFLog(1+prev[sATC_BAND0+b]));
+    cur[sATC_ONSET] = flux;
+  }
+
+  // normalize and quantize
+
+  for(sInt f=0;f<Frames;f++)
+    for(sInt c=0;c<sATC_MAX;c++)
+      Scale[c] = sMax(Scale[c],job.Raw[f*sATC_MAX+c]);
+
+  Data = new sU8[Frames*sATC_MAX];
+  for(sInt f=0;f<Frames;f++)
+  {
+    for(sInt c=0;c<sATC_MAX;c++)
+    {
+      sF32 v = Scale[c]>0 ? job.Raw[f*sATC_MAX+c]/Scale[c] : 0;
+      Data[f*sATC_MAX+c] = sClamp(sInt(v*255+0.5f),0,255);
+    }
+  }
+
+  delete[] job.Raw;
+  delete[] window;
+}
+
+/****************************************************************************/
+
+sBool sAudioTrack::Load(const sChar *name)
+{
+  Clear();
+
+  sDInt size = 0;
+  sU8 *file = sLoadFile(name,size);
+  if(!file)
+    return 0;
+
+  sBool ok = 0;
+  sAudioTrackHeader hdr;
+  if(size>=sInt(sizeof(hdr)))
+  {
+    sCopyMem(&hdr,file,sizeof(hdr));
+    if(hdr.Magic==sAudioTrackMagic && hdr.Version==sAudioTrackVersion
+      && hdr.Channels==sATC_MAX && hdr.Frames>0 && hdr.Hop>0
+      && size>=sDInt(sizeof(hdr))+sDInt(hdr.Frames)*sATC_MAX)
+    {
+      SampleRate = hdr.SampleRate;
+      Samples = hdr.Samples;
+      FFTSize = hdr.FFTSize;
+      Hop = hdr.Hop;
+      Frames = hdr.Frames;
+      FramesPerSecond = sF32(SampleRate)/Hop;
+      sCopyMem(Scale,hdr.Scale,sizeof(Scale));
+      Data = new sU8[Frames*sATC_MAX];
+      sCopyMem(Data,file+sizeof(hdr),Frames*sATC_MAX);
+      ok = 1;
+    }
+  }
+
+  delete[] file;
+  return ok;
+}
+
+sBool sAudioTrack::Save(const sChar *name) const
+{
+  if(!Data)
+    return 0;
+
+  sAudioTrackHeader hdr;
+  hdr.Magic = sAudioTrackMagic;
+  hdr.Version = sAudioTrackVersion;
+  hdr.SampleRate = SampleRate;
+  hdr.Samples = Samples;
+  hdr.FFTSize = FFTSize;
+  hdr.Hop = Hop;
+  hdr.Frames = Frames;
+  hdr.Channels = sATC_MAX;
+  sCopyMem(hdr.Scale,Scale,sizeof(Scale));
+
+  sFile *file = sCreateFile(name,sFA_WRITE);
+  if(!file)
+    return 0;
+  sBool ok = file->Write(&hdr,sizeof(hdr)) && file->Write(Data,Frames*sATC_MAX);
+  ok = file->Close() && ok;
+  delete file;
+  return ok;
+}
+
+/****************************************************************************/
+
+sF32 sAudioTrack::SampleFrame(sInt channel,sF32 frame) const
+{
+  if(!Data || channel<0 || channel>=sATC_MAX || !(frame>=0))
+    return 0;
+
+  sInt f = sInt(frame);
+  if(f>=Frames)
+    return 0;
+  sF32 t = frame-f;
+  sF32 a = Data[f*sATC_MAX+channel];
+  sF32 b = f+1<Frames ? Data[(f+1)*sATC_MAX+channel] : 0;
+  return (a+(b-a)*t)*(1.0f/255.0f);
+}
+
+/****************************************************************************/
+
@@ -0,0 +1,102 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_UTIL_AUDIOANALYSIS_HPP
+#define FILE_UTIL_AUDIOANALYSIS_HPP
+
+#include "base/types.hpp"
+#include "base/math.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Real FFT                                                           ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// forward fft of size real values, done as a complex fft of half the size.
+// bit reversal and twiddle tables are built once in Init() and are only
+// read by Transform(), so one sRealFFT can be shared by many threads.
+
+class sRealFFT
+{
+  sInt Size;
+  sInt Half;
+  sInt *BitRev;                   // Half entries
+  sComplex *Twiddle;              // exp(-2pi i k/Half), Half/2 entries
+  sComplex *Split;                // exp(-2pi i k/Size), Half entries
+public:
+  sRealFFT();
+  ~sRealFFT();
+  void Init(sInt size);
+  sInt GetSize() const { return Size; }
+
+  // out gets Size/2+1 bins, scratch needs Size/2 entries
+  void Transform(const sF32 *in,sComplex *out,sComplex *scratch) const;
+};
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Analysis Track                                                     ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// once per soundtrack we run a windowed fft over the whole song and keep
+// a few values per frame, quantized to 8 bit and normalized to 0..1:
+// rms, onset strength (spectral flux) and the energies of log-spaced bands.
+// sampling is two table lookups, cheap enough to do from every script.
+
+enum sAudioTrackChannel
+{
+  sATC_RMS = 0,
+  sATC_ONSET = 1,
+  sATC_BAND0 = 2,                 // lowest band, bands go up from here
+
+  sATC_BANDS = 8,
+  sATC_MAX = sATC_BAND0+sATC_BANDS,
+};
+
+class sAudioTrack
+{
+  sInt SampleRate;
+  sInt Samples;
+  sInt FFTSize;
+  sInt Hop;
+  sInt Frames;
+  sU8 *Data;                      // Frames*sATC_MAX
+  sF32 Scale[sATC_MAX];           // value of 1.0 before normalization
+  sF32 FramesPerSecond;
+  sF32 FramesPerBeat;
+
+  void Clear();
+public:
+  sAudioTrack();
+  ~sAudioTrack();
+
+  // stereo interleaved 16 bit samples, as in App->MusicData
+  void Analyze(const sS16 *data,sInt samples,sInt rate=44100,sInt fftsize=1024,sInt hop=512);
+  sBool Load(const sChar *name);
+  sBool Save(const sChar *name) const;
+
+  void SetBeatsPerSecond(sF32 bps) { FramesPerBeat = bps>0 ? FramesPerSecond/bps : 0; }
+  sInt GetFrameCount() const { return Frames; }
+  sF32 GetScale(sInt channel) const { return Scale[channel]; }
+
+  // linear interpolation between frames, 0 outside of the song
+  sF32 SampleFrame(sInt channel,sF32 frame) const;
+  sF32 SampleTime(sInt channel,sF32 seconds) const { return SampleFrame(channel,seconds*FramesPerSecond); }
+  sF32 SampleBeat(sInt channel,sF32 beat) const { return SampleFrame(channel,beat*FramesPerBeat); }
+};
+
+// the track of the current soundtrack, owned by whoever loaded the music.
+// scripts sample this with audio(channel,beat).
+
+extern sAudioTrack *sCurrentAudioTrack;
+
+/****************************************************************************/
+
+#endif // FILE_UTIL_AUDIOANALYSIS_HPP
+
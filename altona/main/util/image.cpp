@@ -18,6 +18,7 @@
 #include "base/serialize.hpp"
 #include "base/math.hpp"
 #include "util/image.hpp"
+#include "util/noise.hpp"
 
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -2002,20 +2003,57 @@ sF32 sPerlin2DFixed(sF32 x,sF32 y,sInt start,sInt octaves,sF32 falloff,sInt mode
   return sum;
 }
 
-void sImage::Perlin(sInt start,sInt octaves,sF32 falloff,sInt mode,sInt seed,sF32 amount)
+struct sImagePerlinJob
 {
-  sU32 *data = Data;
-  sF32 sx = sF32(1<<start)/SizeX;
-  sF32 sy = sF32(1<<start)/SizeY;
-  for(sInt y=0;y<SizeY;y++)
+  sImage *Image;
+  sF32 sx,sy;
+  sInt Start,Octaves,Mode,Seed;
+  sF32 Falloff,Amount;
+};
+
+static void sImagePerlinRows(sInt y0,sInt y1,void *user)
+{
+  sImagePerlinJob *job = (sImagePerlinJob *) user;
+  sInt sizex = job->Image->SizeX;
+  sF32 *xs = new sF32[sizex*3];
+  sF32 *ys = xs+sizex;
+  sF32 *val = ys+sizex;
+
+  for(sInt x=0;x<sizex;x++)
+    xs[x] = x*job->sx;
+
+  for(sInt y=y0;y<y1;y++)
   {
-    for(sInt x=0;x<SizeX;x++)
+    sF32 fy = y*job->sy;
+    for(sInt x=0;x<sizex;x++)
+      ys[x] = fy;
+    sPerlin2DOctavesBatch(sizex,xs,ys,job->Start,job->Octaves,job->Falloff,job->Mode,job->Seed,val);
+
+    sU32 *data = job->Image->Data+y*sizex;
+    for(sInt x=0;x<sizex;x++)
     {
-      sF32 val = (sPerlin2DFixed(x*sx,y*sy,start,octaves,falloff,mode,seed)*amount+0.5f);
-      sInt c = sClamp(sInt(val*255),0,255);
-      *data++ = 0xff000000 | (c<<16) | (c<<8) | c;
+      sInt c = sClamp(sInt((val[x]*job->Amount+0.5f)*255),0,255);
+      data[x] = 0xff000000 | (c<<16) | (c<<8) | c;
     }
   }
+
+  delete[] xs;
+}
+
+void sImage::Perlin(sInt start,sInt octaves,sF32 falloff,sInt mode,sInt seed,sF32 amount)
+{
+  sImagePerlinJob job;
+  job.Image = this;
+  job.sx = sF32(1<<start)/SizeX;
+  job.sy = sF32(1<<start)/SizeY;
+  job.Start = start;
+  job.Octaves = octaves;
+  job.Mode = mode;
+  job.Seed = seed;
+  job.Falloff = falloff;
+  job.Amount = amount;
+
+  sNoiseParallel(SizeY,16,sImagePerlinRows,&job);
 }
 
 
@@ -32,56 +32,435 @@ sMusicPlayer::sMusicPlayer()
   RewindSize = 0;
   RewindPos = 0;
   PlayPos = 0;
+  Segments = 0;
+  SegmentCount = 0;
+  NextSegment = 0;
+  SegmentsFinished = 0;
+  DecodeThreads = 0;
+  DecodeThreadCount = 0;
+  DecodeEvent = 0;
+  CacheSourceSize = 0;
+  CacheFile = 0;
+  CacheData = 0;
 }
 
 sMusicPlayer::~sMusicPlayer()
 {
-  if(sMusicPlayerPtr==this)
-    sClearSoundHandler();
+  Shutdown();                       // only a safety net, subclasses call it first
   if(StreamDelete)
     delete[] Stream;
   if(RewindBuffer)
     delete[] RewindBuffer;
 }
 
-sBool sMusicPlayer::LoadAndCache(const sChar *name)
+/****************************************************************************/
+/***                                                                      ***/
+/***   Background decoding and cache file                                 ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// the cache file is a header, a table of block offsets and the blocks.
+// each block holds one segment, channel after channel, as the residual of
+// a second order predictor (zigzag and 7 bit variable length).
+
+enum
 {
-  sString<4096> buffer;
-  sDInt size;
-  sU8 *mem;
+  sMP_SEGMENT = 0x40000,            // samples per segment, about 6 seconds
+  sMP_CHUNK = 4096,                 // decode this many samples between signals
+  sMP_SLACK = 44100,                // GetTuneLength() may be a bit short
+  sMP_CACHEMAGIC = 0x5a4d4350,      // 'PCMZ'
+  sMP_CACHEVERSION = 1,
+};
 
-  buffer = name;
-  buffer.Add(L".raw");
+struct sMusicCacheHeader
+{
+  sU32 Magic;
+  sU32 Version;
+  sU32 SourceSize;                  // size of the compressed tune, 0 = don't check
+  sU32 Samples;
+  sU32 SegmentSamples;
+  sU32 SegmentCount;
+  // sU32 Offsets[SegmentCount+1] follow
+};
 
-  mem = sLoadFile(buffer,size);
-  if(mem)
+static sU8 *sMusicPackBlock(sU8 *d,const sS16 *s,sInt count)
+{
+  for(sInt c=0;c<2;c++)
   {
-    RewindBuffer = (sS16 *)mem;
-    RewindSize = size/4;
-    RewindPos = size/4;
-    sVERIFY(Stream==0);
-    Status = 3;
-    return sTRUE;
+    sInt p1 = 0;
+    sInt p2 = 0;
+    for(sInt i=0;i<count;i++)
+    {
+      sInt v = s[i*2+c];
+      sInt r = v-(2*p1-p2);
+      sU32 z = (sU32(r)<<1)^sU32(r>>31);
+      while(z>=0x80)
+      {
+        *d++ = sU8(z|0x80);
+        z >>= 7;
+      }
+      *d++ = sU8(z);
+      p2 = p1;
+      p1 = v;
+    }
+  }
+  return d;
+}
+
+// returns 0 if the block is shorter than count samples
+
+static sBool sMusicUnpackBlock(const sU8 *s,const sU8 *end,sS16 *d,sInt count)
+{
+  for(sInt c=0;c<2;c++)
+  {
+    sInt p1 = 0;
+    sInt p2 = 0;
+    for(sInt i=0;i<count;i++)
+    {
+      sU32 z = 0;
+      sInt shift = 0;
+      sU8 b;
+      do
+      {
+        if(s>=end || shift>28)
+          return 0;
+        b = *s++;
+        z |= sU32(b&0x7f)<<shift;
+        shift += 7;
+      }
+      while(b&0x80);
+      sInt v = sInt(z>>1)^-sInt(z&1);
+      v += 2*p1-p2;
+      d[i*2+c] = sS16(v);
+      p2 = p1;
+      p1 = v;
+    }
+  }
+  return 1;
+}
+
+sBool sMusicPlayer::LoadCache(const sChar *name,sU32 sourcesize)
+{
+  CacheFile = sCreateFile(name,sFA_READRANDOM);
+  if(!CacheFile)
+    return 0;
+
+  sS64 size = CacheFile->GetSize();
+  const sU8 *data = CacheFile->MapAll();
+  const sMusicCacheHeader *hdr = (const sMusicCacheHeader *) data;
+  sBool ok = data && size>=sS64(sizeof(sMusicCacheHeader))
+    && hdr->Magic==sMP_CACHEMAGIC && hdr->Version==sMP_CACHEVERSION
+    && (sourcesize==0 || hdr->SourceSize==0 || hdr->SourceSize==sourcesize)
+    && hdr->Samples>0 && hdr->SegmentSamples>0
+    && hdr->SegmentCount==(hdr->Samples+hdr->SegmentSamples-1)/hdr->SegmentSamples
+    && size>=sS64(sizeof(sMusicCacheHeader)+(hdr->SegmentCount+1)*sizeof(sU32));
+  if(ok)
+  {
+    // blocks must follow the offset table, in order, inside the file
+
+    const sU32 *offsets = (const sU32 *)(hdr+1);
+    ok = offsets[0]>=sizeof(sMusicCacheHeader)+(hdr->SegmentCount+1)*sizeof(sU32);
+    for(sU32 i=0;i<hdr->SegmentCount && ok;i++)
+      ok = offsets[i]<=offsets[i+1];
+    ok = ok && offsets[hdr->SegmentCount]<=size;
+  }
+  if(!ok)
+  {
+    sDelete(CacheFile);
+    return 0;
+  }
+
+  CacheData = data;
+  StartDecoding(hdr->Samples,hdr->SegmentSamples);
+  return 1;
+}
+
+// RewindSize is the end of the tune now. never write a partial tune.
+
+void sMusicPlayer::SaveCache()
+{
+  sInt count = 0;
+  while(count<SegmentCount && Segments[count].Start<RewindSize)
+  {
+    Segment *seg = &Segments[count];
+    if(seg->Decoded<sMin<sInt>(seg->Count,RewindSize-seg->Start))
+      return;
+    count++;
+  }
+  if(count==0)
+    return;
+
+  sMusicCacheHeader hdr;
+  hdr.Magic = sMP_CACHEMAGIC;
+  hdr.Version = sMP_CACHEVERSION;
+  hdr.SourceSize = CacheSourceSize;
+  hdr.Samples = RewindSize;
+  hdr.SegmentSamples = Segments[0].Count;
+  hdr.SegmentCount = count;
+
+  sU32 *offsets = new sU32[count+1];
+  sU8 *block = new sU8[hdr.SegmentSamples*2*3];   // 3 bytes per value worst case
+  sFile *file = sCreateFile(CacheName,sFA_WRITE);
+  if(file)
+  {
+    sBool ok = 1;
+    offsets[0] = sizeof(hdr)+(count+1)*sizeof(sU32);
+    ok &= file->SetOffset(offsets[0]);
+    for(sInt i=0;i<count && ok;i++)
+    {
+      Segment *seg = &Segments[i];
+      sU8 *end = sMusicPackBlock(block,RewindBuffer+seg->Start*2,sMin<sInt>(seg->Decoded,hdr.Samples-seg->Start));
+      ok &= file->Write(block,end-block);
+      offsets[i+1] = offsets[i]+sU32(end-block);
+    }
+    ok &= file->SetOffset(0);
+    ok &= file->Write(&hdr,sizeof(hdr));
+    ok &= file->Write(offsets,(count+1)*sizeof(sU32));
+    ok &= file->Close();
+    delete file;
+    if(!ok)
+      sDeleteFile(CacheName);
+  }
+  delete[] block;
+  delete[] offsets;
+}
+
+void sMusicPlayer::DecodeSegment(sThread *thread,Segment *seg)
+{
+  sS16 *dest = RewindBuffer+seg->Start*2;
+
+  if(CacheData)
+  {
+    // a damaged block plays as silence. LoadCache() checked the offsets.
+
+    const sU32 *offsets = (const sU32 *)(CacheData+sizeof(sMusicCacheHeader));
+    sInt n = sInt(seg-Segments);
+    if(!sMusicUnpackBlock(CacheData+offsets[n],CacheData+offsets[n+1],dest,seg->Count))
+      sSetMem(dest,0,seg->Count*4);
+    seg->Decoded = seg->Count;
   }
   else
   {
-    if(Load(name))
+    // without segment decoders there is only one segment, use Render().
+    // if a later segment fails to seek, start at the nearest earlier
+    // segment that can be seeked to and skip ahead to ours.
+
+    void *handle = OpenSegment(seg->Start);
+    sInt skip = 0;
+    for(Segment *prev=seg-1;!handle && prev>=Segments;prev--)
     {
-      Start(0);
-      size = GetTuneLength() * 5;     // 25% safety for unrelyable GetTuneLength()
-      mem = new sU8[size];
-      size = Render((sS16 *)mem,size/4)*4;
-      RewindBuffer = (sS16 *)mem;
-      RewindSize = size/4;
-      RewindPos = size/4;
-      sSaveFile(buffer,mem,size);
-      return sTRUE;
+      handle = OpenSegment(prev->Start);
+      skip = seg->Start-prev->Start;
     }
-    else
+    while(handle && skip>0 && thread->CheckTerminate())
     {
-      return sFALSE;
+      sS16 scratch[sMP_CHUNK*2];
+      sInt n = RenderSegment(handle,scratch,sMin<sInt>(sMP_CHUNK,skip));
+      if(n<=0)
+      {
+        CloseSegment(handle);
+        handle = 0;
+        break;
+      }
+      skip -= n;
     }
+    while(seg->Decoded<seg->Count && (handle || seg->Start==0) && thread->CheckTerminate())
+    {
+      sInt n = sMin<sInt>(sMP_CHUNK,seg->Count-seg->Decoded);
+      n = handle ? RenderSegment(handle,dest+seg->Decoded*2,n) : Render(dest+seg->Decoded*2,n);
+      if(n<=0)
+        break;
+      seg->Decoded += n;
+      DecodeEvent->Signal();
+    }
+    if(handle)
+      CloseSegment(handle);
   }
+
+  if(!thread->CheckTerminate())
+    return;
+
+  // the last one finds the end of the tune before it reports Finished, so
+  // RewindSize is final once all segments are.
+
+  sBool last = sAtomicInc(&SegmentsFinished)==sU32(SegmentCount);
+  sBool complete = 1;
+  if(last)
+  {
+    // the tune ends at the first short segment. if any later segment has
+    // samples, decoding failed in the middle of the tune.
+
+    sInt i = 0;
+    while(i<SegmentCount && Segments[i].Decoded==Segments[i].Count)
+      i++;
+    if(i<SegmentCount)
+    {
+      RewindSize = Segments[i].Start+Segments[i].Decoded;
+      RewindPos = RewindSize;
+      for(i++;i<SegmentCount;i++)
+        if(Segments[i].Decoded>0)
+          complete = 0;
+    }
+  }
+  seg->Finished = 1;
+  DecodeEvent->Signal();
+
+  if(last && complete && !CacheName.IsEmpty())
+    SaveCache();
+}
+
+void sMusicPlayer::DecodeThread(sThread *thread,void *user)
+{
+  sMusicPlayer *mp = (sMusicPlayer *) user;
+  while(thread->CheckTerminate())
+  {
+    sInt n = sAtomicInc(&mp->NextSegment)-1;
+    if(n>=mp->SegmentCount)
+      break;
+    mp->DecodeSegment(thread,&mp->Segments[n]);
+  }
+}
+
+void sMusicPlayer::StartDecoding(sInt samples,sInt segsize)
+{
+  RewindBuffer = new sS16[samples*2];
+  RewindSize = samples;
+  RewindPos = samples;
+
+  SegmentCount = (samples+segsize-1)/segsize;
+  Segments = new Segment[SegmentCount];
+  for(sInt i=0;i<SegmentCount;i++)
+  {
+    Segments[i].Start = i*segsize;
+    Segments[i].Count = sMin(segsize,samples-i*segsize);
+    Segments[i].Decoded = 0;
+    Segments[i].Finished = 0;
+  }
+  NextSegment = 0;
+  SegmentsFinished = 0;
+  DecodeEvent = new sThreadEvent;
+
+  DecodeThreadCount = sClamp(sGetCPUCount()-1,1,SegmentCount);
+  DecodeThreads = new sThread*[DecodeThreadCount];
+  for(sInt i=0;i<DecodeThreadCount;i++)
+    DecodeThreads[i] = new sThread(DecodeThread,0,0x40000,this);
+}
+
+// the sound handler and the decode threads call virtual functions. when
+// the base destructor runs, the subclass is already gone, so subclasses
+// must call this first in their destructor. calling it again does nothing.
+
+void sMusicPlayer::Shutdown()
+{
+  if(sMusicPlayerPtr==this)
+  {
+    sClearSoundHandler();
+    sMusicPlayerPtr = 0;
+  }
+  EndDecoding();
+}
+
+void sMusicPlayer::EndDecoding()
+{
+  for(sInt i=0;i<DecodeThreadCount;i++)
+    delete DecodeThreads[i];
+  delete[] DecodeThreads;
+  DecodeThreads = 0;
+  DecodeThreadCount = 0;
+  sDelete(DecodeEvent);
+  delete[] Segments;
+  Segments = 0;
+  SegmentCount = 0;
+  CacheData = 0;
+  sDelete(CacheFile);
+}
+
+// how much of [start..end) is decoded, without waiting. returns end of tune
+// if that comes earlier, RewindSize otherwise. if decoding has not reached
+// end yet, pending is set and the result is meaningless.
+
+sInt sMusicPlayer::GetDecoded(sInt start,sInt end,sBool &pending)
+{
+  pending = 0;
+  if(!Segments || SegmentCount==0)
+    return RewindSize;
+
+  sInt segsize = Segments[0].Count;
+  sInt first = sMax(0,start/segsize);
+  sInt last = sMin(SegmentCount-1,(end-1)/segsize);
+  for(sInt i=first;i<=last;i++)
+  {
+    Segment *seg = &Segments[i];
+    sInt need = sMin(end,seg->Start+seg->Count)-seg->Start;
+    if(seg->Decoded<need)
+    {
+      pending = !seg->Finished;
+      return seg->Start+seg->Decoded;   // read after Finished
+    }
+  }
+  return RewindSize;
+}
+
+// same, but wait until [start..end) is decoded. not for the sound thread.
+
+sInt sMusicPlayer::WaitDecoded(sInt start,sInt end)
+{
+  sBool pending;
+  sInt result = GetDecoded(start,end,pending);
+  while(pending)
+  {
+    DecodeEvent->Wait(1);
+    result = GetDecoded(start,end,pending);
+  }
+  return result;
+}
+
+/****************************************************************************/
+
+sBool sMusicPlayer::LoadAndCache(const sChar *name)
+{
+  sU32 sourcesize = 0;
+  sFile *file = sCreateFile(name);
+  if(file)
+  {
+    sourcesize = sU32(file->GetSize());
+    delete file;
+  }
+
+  // the decode threads look at CacheName when they are done, so it must
+  // be empty while they unpack the mapped cache file
+
+  sString<4096> cachename;
+  cachename = name;
+  cachename.Add(L".pcmz");
+  CacheName = L"";
+  if(LoadCache(cachename,sourcesize))
+  {
+    Status = 3;
+    return sTRUE;
+  }
+  CacheName = cachename;
+
+  if(!Load(name) || !Start(0))
+    return sFALSE;
+  CacheSourceSize = sourcesize;
+
+  sInt length = GetTuneLength();
+  if(length<=0)
+    return sFALSE;
+
+  void *seg = OpenSegment(0);
+  if(seg)
+  {
+    CloseSegment(seg);
+    StartDecoding(length+sMP_SLACK,sMP_SEGMENT);
+  }
+  else
+  {
+    length += length/4;             // 25% safety for unrelyable GetTuneLength()
+    StartDecoding(length,length);
+  }
+  return sTRUE;
 }
 
 sBool sMusicPlayer::Load(const sChar *name)
@@ -160,9 +539,18 @@ sBool sMusicPlayer::Handler(sS16 *buffer,sInt samples,sInt vol)
   result = 1;
   if(Status==3)
   {
-    if(RewindBuffer)
+    sBool pending = 0;
+    sInt end = RewindBuffer ? GetDecoded(PlayPos,PlayPos+samples,pending) : 0;
+    if(pending)
+    {
+      // background decoding has not caught up. the sound thread must not
+      // wait, so play silence and try again with the next buffer.
+
+      sSetMem(buffer,0,samples*4);
+    }
+    else if(RewindBuffer)
     {
-      if(PlayPos+samples < RewindSize)
+      if(PlayPos+samples < end)
       {
         while(RewindPos<PlayPos+samples && result)
         {
@@ -19,6 +19,7 @@
 #endif
 
 #include "base/types.hpp"
+#include "base/system.hpp"
 
 /****************************************************************************/
 
@@ -26,13 +27,46 @@ class sMusicPlayer
 {
 private:
   sS16 *RewindBuffer;               // remember all rendered samples
-  sInt RewindSize;                  // max size in samples
+  volatile sInt RewindSize;         // max size in samples
   sInt RewindPos;                   // up to this sample the buffer has been rendered
+
+  // background decoding for LoadAndCache(). the tune is split into
+  // segments that are decoded in parallel into the rewind buffer.
+
+  struct Segment
+  {
+    sInt Start;                     // first sample
+    sInt Count;                     // max samples
+    volatile sInt Decoded;          // samples available
+    volatile sBool Finished;        // Decoded will not change any more
+  };
+  Segment *Segments;
+  sInt SegmentCount;
+  volatile sU32 NextSegment;        // next segment to hand out to a thread
+  volatile sU32 SegmentsFinished;
+  sThread **DecodeThreads;
+  sInt DecodeThreadCount;
+  sThreadEvent *DecodeEvent;        // signaled whenever some samples are decoded
+  sString<4096> CacheName;          // write cache file here when done
+  sU32 CacheSourceSize;
+  sFile *CacheFile;                 // compressed cache file, mapped
+  const sU8 *CacheData;
+
+  static void DecodeThread(sThread *,void *);
+  void DecodeSegment(sThread *,Segment *seg);
+  void StartDecoding(sInt samples,sInt segsize);
+  void EndDecoding();
+  sInt GetDecoded(sInt start,sInt end,sBool &pending);
+  sInt WaitDecoded(sInt start,sInt end);
+  sBool LoadCache(const sChar *name,sU32 sourcesize);
+  void SaveCache();
 protected:
   sU8 *Stream;                      // the loaded data
   sInt StreamSize;
   sBool StreamDelete;
 
+  void Shutdown();                  // call first in the destructor of subclasses
+
 public:
   sInt Status;                      // 0=error, 1=ready, 2=pause, 3=playing
   sInt PlayPos;                     // current position for continuing rendering
@@ -41,7 +75,8 @@ public:
   virtual ~sMusicPlayer();
   sBool Load(const sChar *name);    // load from file, memory is deleted automatically
   sBool Load(sU8 *data,sInt size);  // load from buffer, memory is not deleted automatically
-  sBool LoadAndCache(const sChar *name);
+  sBool LoadAndCache(const sChar *name);   // decode in background, playback may start immediately
+  void WaitCache() { WaitDecoded(0,RewindSize); }   // wait until LoadAndCache() is done
   sInt GetCacheSamples() { return RewindSize; }
   sS16 *GetCacheData() { return RewindBuffer; }
   sBool IsPlaying() { return Status==3; }
@@ -54,6 +89,13 @@ public:
   virtual sBool Init(sInt songnr)=0;
   virtual sInt Render(sS16 *buffer,sInt samples)=0;   // return number of samples actually rendered, 0 for eof
   virtual sInt GetTuneLength() = 0; // in samples
+
+  // independent decoders starting at a sample position, for decoding in
+  // parallel. they may only read the stream. OpenSegment() returns 0 if this
+  // is not supported, then LoadAndCache() decodes with Render() on one thread.
+  virtual void *OpenSegment(sInt start) { return 0; }
+  virtual sInt RenderSegment(void *seg,sS16 *buffer,sInt samples) { return 0; }
+  virtual void CloseSegment(void *seg) {}
 };
 
 /****************************************************************************/
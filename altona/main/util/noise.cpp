@@ -0,0 +1,294 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "base/types.hpp"
+#include "base/math.hpp"
+#include "util/noise.hpp"
+#include "util/simd_float.hpp"
+#include "util/taskscheduler.hpp"
+
+// tables from base/math.cpp
+
+extern sF32 sPerlinRandom2D[256][2];
+extern sF32 sPerlinRandom3D[256][3];
+extern sInt sPerlinPermute[512];
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Four samples at once                                               ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// the integer part (hashing and gradient lookup) is done per lane, the
+// float part is done with SSE in exactly the order of the scalar code.
+
+#if sSIMD_INTRINSICS
+
+static void sPerlin2D4(const sInt *x,const sInt *y,sInt mask,sInt seed,sF32 *out)
+{
+  sALIGNED(sF32,t[2][4],16);
+  sALIGNED(sF32,g[4][2][4],16);   // corner, component, lane
+
+  for(sInt l=0;l<4;l++)
+  {
+    sInt vx0 = (x[l]>>16) & mask; sInt vx1 = (vx0+1) & mask; t[0][l] = (x[l]&0xffff)/65536.0f;
+    sInt vy0 = (y[l]>>16) & mask; sInt vy1 = (vy0+1) & mask; t[1][l] = (y[l]&0xffff)/65536.0f;
+    sInt v[4];
+    v[0] = sPerlinPermute[((vx0))+sPerlinPermute[((vy0))^seed]];
+    v[1] = sPerlinPermute[((vx1))+sPerlinPermute[((vy0))^seed]];
+    v[2] = sPerlinPermute[((vx0))+sPerlinPermute[((vy1))^seed]];
+    v[3] = sPerlinPermute[((vx1))+sPerlinPermute[((vy1))^seed]];
+    for(sInt c=0;c<4;c++)
+    {
+      g[c][0][l] = sPerlinRandom2D[v[c]][0];
+      g[c][1][l] = sPerlinRandom2D[v[c]][1];
+    }
+  }
+
+  const sSSE one = sVecLoadScalar(1.0f);
+  const sSSE six = sVecLoadScalar(6.0f);
+  const sSSE ten = sVecLoadScalar(10.0f);
+  const sSSE fifteen = sVecLoadScalar(15.0f);
+
+  sSSE tx = sVecLoad(t[0]);
+  sSSE ty = sVecLoad(t[1]);
+  sSSE tx1 = sVecSub(tx,one);
+  sSSE ty1 = sVecSub(ty,one);
+
+  sSSE f00 = sVecAdd(sVecMul(sVecLoad(g[0][0]),tx ),sVecMul(sVecLoad(g[0][1]),ty ));
+  sSSE f01 = sVecAdd(sVecMul(sVecLoad(g[1][0]),tx1),sVecMul(sVecLoad(g[1][1]),ty ));
+  sSSE f10 = sVecAdd(sVecMul(sVecLoad(g[2][0]),tx ),sVecMul(sVecLoad(g[2][1]),ty1));
+  sSSE f11 = sVecAdd(sVecMul(sVecLoad(g[3][0]),tx1),sVecMul(sVecLoad(g[3][1]),ty1));
+
+  tx = sVecMul(sVecMul(sVecMul(tx,tx),tx),sVecAdd(ten,sVecMul(tx,sVecSub(sVecMul(six,tx),fifteen))));
+  ty = sVecMul(sVecMul(sVecMul(ty,ty),ty),sVecAdd(ten,sVecMul(ty,sVecSub(sVecMul(six,ty),fifteen))));
+
+  sSSE f0 = sVecAdd(f00,sVecMul(sVecSub(f01,f00),tx));
+  sSSE f1 = sVecAdd(f10,sVecMul(sVecSub(f11,f10),tx));
+  sVecStoreU(sVecAdd(f0,sVecMul(sVecSub(f1,f0),ty)),out);
+}
+
+static void sPerlin3D4(const sInt *x,const sInt *y,const sInt *z,sInt mask,sInt seed,sF32 *out)
+{
+  sALIGNED(sF32,t[3][4],16);
+  sALIGNED(sF32,g[8][3][4],16);   // corner, component, lane
+
+  for(sInt l=0;l<4;l++)
+  {
+    sInt vx0 = (x[l]>>16) & mask; sInt vx1 = (vx0+1) & mask; t[0][l] = (x[l]&0xffff)/65536.0f;
+    sInt vy0 = (y[l]>>16) & mask; sInt vy1 = (vy0+1) & mask; t[1][l] = (y[l]&0xffff)/65536.0f;
+    sInt vz0 = (z[l]>>16) & mask; sInt vz1 = (vz0+1) & mask; t[2][l] = (z[l]&0xffff)/65536.0f;
+    sInt v[8];
+    v[0] = sPerlinPermute[vx0+sPerlinPermute[vy0+sPerlinPermute[vz0^seed]]];
+    v[1] = sPerlinPermute[vx1+sPerlinPermute[vy0+sPerlinPermute[vz0^seed]]];
+    v[2] = sPerlinPermute[vx0+sPerlinPermute[vy1+sPerlinPermute[vz0^seed]]];
+    v[3] = sPerlinPermute[vx1+sPerlinPermute[vy1+sPerlinPermute[vz0^seed]]];
+    v[4] = sPerlinPermute[vx0+sPerlinPermute[vy0+sPerlinPermute[vz1^seed]]];
+    v[5] = sPerlinPermute[vx1+sPerlinPermute[vy0+sPerlinPermute[vz1^seed]]];
+    v[6] = sPerlinPermute[vx0+sPerlinPermute[vy1+sPerlinPermute[vz1^seed]]];
+    v[7] = sPerlinPermute[vx1+sPerlinPermute[vy1+sPerlinPermute[vz1^seed]]];
+    for(sInt c=0;c<8;c++)
+    {
+      g[c][0][l] = sPerlinRandom3D[v[c]][0];
+      g[c][1][l] = sPerlinRandom3D[v[c]][1];
+      g[c][2][l] = sPerlinRandom3D[v[c]][2];
+    }
+  }
+
+  const sSSE one = sVecLoadScalar(1.0f);
+  const sSSE six = sVecLoadScalar(6.0f);
+  const sSSE ten = sVecLoadScalar(10.0f);
+  const sSSE fifteen = sVecLoadScalar(15.0f);
+
+  sSSE tx = sVecLoad(t[0]);
+  sSSE ty = sVecLoad(t[1]);
+  sSSE tz = sVecLoad(t[2]);
+  sSSE tx1 = sVecSub(tx,one);
+  sSSE ty1 = sVecSub(ty,one);
+  sSSE tz1 = sVecSub(tz,one);
+
+#define CORNER(c,a,b,d) sVecAdd(sVecAdd(sVecMul(sVecLoad(g[c][0]),a),sVecMul(sVecLoad(g[c][1]),b)),sVecMul(sVecLoad(g[c][2]),d))
+  sSSE f000 = CORNER(0,tx ,ty ,tz );
+  sSSE f001 = CORNER(1,tx1,ty ,tz );
+  sSSE f010 = CORNER(2,tx ,ty1,tz );
+  sSSE f011 = CORNER(3,tx1,ty1,tz );
+  sSSE f100 = CORNER(4,tx ,ty ,tz1);
+  sSSE f101 = CORNER(5,tx1,ty ,tz1);
+  sSSE f110 = CORNER(6,tx ,ty1,tz1);
+  sSSE f111 = CORNER(7,tx1,ty1,tz1);
+#undef CORNER
+
+  tx = sVecMul(sVecMul(sVecMul(tx,tx),tx),sVecAdd(ten,sVecMul(tx,sVecSub(sVecMul(six,tx),fifteen))));
+  ty = sVecMul(sVecMul(sVecMul(ty,ty),ty),sVecAdd(ten,sVecMul(ty,sVecSub(sVecMul(six,ty),fifteen))));
+  tz = sVecMul(sVecMul(sVecMul(tz,tz),tz),sVecAdd(ten,sVecMul(tz,sVecSub(sVecMul(six,tz),fifteen))));
+
+  sSSE f00 = sVecAdd(f000,sVecMul(sVecSub(f001,f000),tx));
+  sSSE f01 = sVecAdd(f010,sVecMul(sVecSub(f011,f010),tx));
+  sSSE f10 = sVecAdd(f100,sVecMul(sVecSub(f101,f100),tx));
+  sSSE f11 = sVecAdd(f110,sVecMul(sVecSub(f111,f110),tx));
+
+  sSSE f0 = sVecAdd(f00,sVecMul(sVecSub(f01,f00),ty));
+  sSSE f1 = sVecAdd(f10,sVecMul(sVecSub(f11,f10),ty));
+
+  sVecStoreU(sVecAdd(f0,sVecMul(sVecSub(f1,f0),tz)),out);
+}
+
+#endif
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Batch functions                                                    ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void sPerlin2DBatch(sInt count,const sInt *x,const sInt *y,sInt mask,sInt seed,sF32 *out)
+{
+  mask &= 255;
+  sInt i = 0;
+#if sSIMD_INTRINSICS
+  for(;i+4<=count;i+=4)
+    sPerlin2D4(x+i,y+i,mask,seed,out+i);
+#endif
+  for(;i<count;i++)
+    out[i] = sPerlin2D(x[i],y[i],mask,seed);
+}
+
+void sPerlin3DBatch(sInt count,const sInt *x,const sInt *y,const sInt *z,sInt mask,sInt seed,sF32 *out)
+{
+  mask &= 255;
+  sInt i = 0;
+#if sSIMD_INTRINSICS
+  for(;i+4<=count;i+=4)
+    sPerlin3D4(x+i,y+i,z+i,mask,seed,out+i);
+#endif
+  for(;i<count;i++)
+    out[i] = sPerlin3D(x[i],y[i],z[i],mask,seed);
+}
+
+/****************************************************************************/
+
+// octave sums work on blocks of this many samples, to keep temporaries on
+// the stack
+
+enum { sNOISE_BLOCK = 256 };
+
+void sPerlin2DOctavesBatch(sInt count,const sF32 *x,const sF32 *y,sInt start,sInt octaves,sF32 falloff,sInt mode,sInt seed,sF32 *out)
+{
+  sInt xi[sNOISE_BLOCK],yi[sNOISE_BLOCK];
+  sInt xs[sNOISE_BLOCK],ys[sNOISE_BLOCK];
+  sF32 val[sNOISE_BLOCK];
+
+  for(sInt b=0;b<count;b+=sNOISE_BLOCK)
+  {
+    sInt n = sMin<sInt>(sNOISE_BLOCK,count-b);
+    for(sInt j=0;j<n;j++)
+    {
+      xi[j] = sInt(x[b+j]*0x10000);
+      yi[j] = sInt(y[b+j]*0x10000);
+      out[b+j] = 0;
+    }
+
+    sF32 amp = 1.0f;
+    for(sInt i=start;i<start+octaves && i<8;i++)
+    {
+      for(sInt j=0;j<n;j++)
+      {
+        xs[j] = xi[j]<<i;
+        ys[j] = yi[j]<<i;
+      }
+      sPerlin2DBatch(n,xs,ys,(1<<i)-1,seed,val);
+      for(sInt j=0;j<n;j++)
+      {
+        sF32 v = val[j];
+        if(mode&1)
+          v = (sF32)sFAbs(v)*2-1;
+        if(mode&2)
+          v = (sF32)sFSin(v*sPI2F);
+        out[b+j] += v * amp;
+      }
+      amp *= falloff;
+    }
+  }
+}
+
+void sPerlin3DOctavesBatch(sInt count,const sInt *x,const sInt *y,const sInt *z,sInt octaves,sF32 amp,sF32 falloff,sInt seed,sF32 *out)
+{
+  sInt xs[sNOISE_BLOCK],ys[sNOISE_BLOCK],zs[sNOISE_BLOCK];
+  sF32 val[sNOISE_BLOCK];
+
+  for(sInt b=0;b<count;b+=sNOISE_BLOCK)
+  {
+    sInt n = sMin<sInt>(sNOISE_BLOCK,count-b);
+    for(sInt j=0;j<n;j++)
+    {
+      xs[j] = x[b+j];
+      ys[j] = y[b+j];
+      zs[j] = z[b+j];
+      out[b+j] = 0;
+    }
+
+    sF32 a = amp;
+    for(sInt i=0;i<octaves;i++)
+    {
+      sPerlin3DBatch(n,xs,ys,zs,255,seed,val);
+      for(sInt j=0;j<n;j++)
+      {
+        out[b+j] += a * val[j];
+        xs[j] *= 2;
+        ys[j] *= 2;
+        zs[j] *= 2;
+      }
+      a *= falloff;
+    }
+  }
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Parallel helper                                                    ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+struct sNoiseParallelJob
+{
+  sNoiseBlockFunc Func;
+  void *User;
+  sInt Count;
+  sInt BlockSize;
+};
+
+static void sNoiseParallelTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  sNoiseParallelJob *job = (sNoiseParallelJob *) data;
+  for(sInt i=start;i<start+count;i++)
+    (*job->Func)(i*job->BlockSize,sMin(job->Count,(i+1)*job->BlockSize),job->User);
+}
+
+void sNoiseParallel(sInt count,sInt blocksize,sNoiseBlockFunc func,void *user)
+{
+  sNoiseParallelJob job;
+  job.Func = func;
+  job.User = user;
+  job.Count = count;
+  job.BlockSize = blocksize;
+
+  sInt blocks = (count+blocksize-1)/blocksize;
+  if(sSched==0 || blocks<=1)
+  {
+    sNoiseParallelTask(0,0,0,blocks,&job);
+    return;
+  }
+
+  sStsWorkload *wl = sSched->BeginWorkload();
+  wl->AddTask(wl->NewTask(sNoiseParallelTask,&job,blocks,0));
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
+
+/****************************************************************************/
+
@@ -0,0 +1,52 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_UTIL_NOISE_HPP
+#define FILE_UTIL_NOISE_HPP
+
+#include "base/types.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Batch Perlin Noise                                                 ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// these evaluate the perlin noise from base/math.hpp for many samples at
+// once, four at a time with SSE. the results are bit-identical to calling
+// the scalar functions for every sample (as long as the compiler does not
+// fuse multiply-adds in the scalar code).
+// coordinates are 16:16 fixed point, like sPerlin2D(sInt,..)
+
+void sPerlin2DBatch(sInt count,const sInt *x,const sInt *y,sInt mask,sInt seed,sF32 *out);
+void sPerlin3DBatch(sInt count,const sInt *x,const sInt *y,const sInt *z,sInt mask,sInt seed,sF32 *out);
+
+// sum of octaves as in sImage::Perlin(): octave i in [start..start+octaves)
+// uses (x<<i,y<<i) with mask (1<<i)-1. coordinates are floats, 1.0 = one
+// noise cell. mode is the same as for sPerlin2D(sF32,..)
+
+void sPerlin2DOctavesBatch(sInt count,const sF32 *x,const sF32 *y,sInt start,sInt octaves,sF32 falloff,sInt mode,sInt seed,sF32 *out);
+
+// sum of octaves as in the mesh noise operator: octave i uses (x,y,z)<<i
+// with mask 255, the amplitude starts at amp and is multiplied by falloff
+// after each octave.
+
+void sPerlin3DOctavesBatch(sInt count,const sInt *x,const sInt *y,const sInt *z,sInt octaves,sF32 amp,sF32 falloff,sInt seed,sF32 *out);
+
+/****************************************************************************/
+
+// split [0..count) into blocks and call func(start,end,user) for each block
+// on all threads of sSched. runs on the calling thread if there is no
+// scheduler or only one block. only call this from the main thread.
+
+typedef void (*sNoiseBlockFunc)(sInt start,sInt end,void *user);
+void sNoiseParallel(sInt count,sInt blocksize,sNoiseBlockFunc func,void *user);
+
+/****************************************************************************/
+
+#endif // FILE_UTIL_NOISE_HPP
+
@@ -13,6 +13,7 @@
 #include "base/graphics.hpp"
 #include "util/shaders.hpp"
 #include "util/painter.hpp"
+#include "util/perftrace.hpp"
 
 /****************************************************************************/
 
@@ -699,8 +700,21 @@ void sPerfRemThread(sThreadContext *ctx)
 /***                                                                      ***/
 /****************************************************************************/
 
+// the trace works without the overlay, but only for the calling thread
+
+static void Trace(sThreadContext *tid, sInt kind, const void *name, sBool name8, sU32 color)
+{
+  if (!sPerfTraceInited()) return;
+  sThreadContext *self=sGetThreadContext();
+  if (tid && tid!=self) return;
+  Thread *t=(Thread*)self->PerfData;
+  if (t && t->MuteCount) return;
+  sPerfTraceEvent(kind,name,name8,color);
+}
+
 void sPerfEnter(const sChar *name, sU32 color, sThreadContext *tid)
 {
+  Trace(tid,sPTK_BEGIN,name,0,color);
   if (!sPerfMon::Inited) return;
 
   if (!tid) tid=sGetThreadContext();
@@ -725,6 +739,7 @@ void sPerfEnter(const sChar *name, sU32 color, sThreadContext *tid)
 
 void sPerfEnter(const sChar8 *name, sU32 color, sThreadContext* tid)
 {
+  Trace(tid,sPTK_BEGIN,name,1,color);
   if (!sPerfMon::Inited) return;
 
   if (!tid) tid=sGetThreadContext();
@@ -749,6 +764,7 @@ void sPerfEnter(const sChar8 *name, sU32 color, sThreadContext* tid)
 
 void sPerfSet(const sChar *name, sU32 color, sThreadContext *tid)
 {
+  Trace(tid,sPTK_MARK,name,0,color);
   if (!sPerfMon::Inited) return;
   sU64 time = sGetTimeUS()-StartTime;
 
@@ -769,6 +785,7 @@ void sPerfSet(const sChar *name, sU32 color, sThreadContext *tid)
 
 void sPerfLeave(sThreadContext* tid)
 {
+  Trace(tid,sPTK_END,0,0,0);
   if (!sPerfMon::Inited) return;
   sU64 time = sGetTimeUS()-StartTime;
 
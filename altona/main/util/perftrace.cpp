@@ -0,0 +1,404 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "util/perftrace.hpp"
+
+#if sPERFMON_ENABLED
+
+#include "base/system.hpp"
+#include "base/graphics.hpp"
+#include "base/types2.hpp"
+
+/****************************************************************************/
+
+namespace sPerfTrace
+{
+  static const sInt MAXRINGS=sPerfTraceCursor::MAXRINGS;
+  static const sInt TASKTID=1000;       // tid of scheduler thread 0 in the trace
+
+  struct Event
+  {
+    sU64 Time;
+    const void *Name;
+    sU32 Color;
+    sU32 Duration;                      // tasks only
+    sU8 Kind;
+    sU8 Name8;
+    sU8 Track;                          // tasks: scheduler thread
+  };
+
+  // one writer, any number of readers. readers copy events out and
+  // afterwards check that the writer didn't lap them.
+
+  struct Ring
+  {
+    Event *Events;
+    volatile sU32 Write;
+    sInt Tid;
+    sString<64> Name;
+  };
+
+  static sBool Inited=sFALSE;
+  static sBool Running=sFALSE;          // subsystem is up, RingTls is valid
+  static sInt RingSize;
+  static sU32 RingMask;
+  static sPtr RingTls;
+  static sThreadLock *Lock;
+  static Ring *Rings[MAXRINGS];
+  static volatile sInt NumRings;
+  static Ring *TaskRing;
+  static sU64 StartTime;
+
+  static sInt MaxFrames;
+  static sU64 *FrameStarts;
+  static volatile sU32 FrameCount;
+
+  static sU64 HitchTime;                // us, 0 for off
+  static sString<sMAXPATH> HitchPath;
+  static sInt HitchFrames;
+  static sInt HitchCount;
+  static sU64 LastHitch;
+  static volatile sU64 DumpSince;
+  static sThreadEvent *DumpEvent;
+  static sThread *DumpThread;
+
+  /****************************************************************************/
+
+  static sU8 *Alloc(sDInt size)
+  {
+    sU8 *ptr=0;
+
+    sPushMemLeakDesc(L"PerfTrace");
+
+    if (sIsMemTypeAvailable(sAMF_DEBUG))
+      ptr = (sU8*)sAllocMem(size,8,sAMF_DEBUG);
+
+    if (!ptr) ptr=(sU8*)sAllocMem(size,8,0);
+
+    sPopMemLeakDesc();
+
+    return ptr;
+  }
+
+  static Ring *NewRing(const sChar *name)
+  {
+    Ring *r=0;
+    Lock->Lock();
+    if (NumRings<MAXRINGS)
+    {
+      r=(Ring*)Alloc(sizeof(Ring));
+      sClear(*r);
+      r->Events=(Event*)Alloc(RingSize*sizeof(Event));
+      r->Tid=NumRings+1;
+      sCopyString(r->Name,name,64);
+      Rings[NumRings]=r;
+      sWriteBarrier();
+      NumRings++;
+    }
+    Lock->Unlock();
+    if (!r)
+      sLogF(L"perf",L"trace: too many threads, <%s> is not traced\n",name);
+    return r;
+  }
+
+  static Ring *GetRing()
+  {
+    static Ring Full;
+    Ring **slot=sGetTls<Ring *>(RingTls);
+    if (!*slot)
+    {
+      *slot=NewRing(sGetThreadContext()->ThreadName);
+      if (!*slot) *slot=&Full;
+    }
+    return *slot==&Full ? 0 : *slot;
+  }
+
+  static inline void Push(Ring *r, sInt kind, const void *name, sBool name8, sU32 color, sU64 time, sU32 duration=0, sInt track=0)
+  {
+    Event &e=r->Events[r->Write&RingMask];
+    e.Time=time;
+    e.Name=name;
+    e.Color=color;
+    e.Duration=duration;
+    e.Kind=kind;
+    e.Name8=name8;
+    e.Track=track;
+    sWriteBarrier();
+    r->Write=r->Write+1;
+  }
+
+  /****************************************************************************/
+
+  static void PrintName(sTextBuffer &tb, const void *name, sBool name8)
+  {
+    if (!name) return;
+    const sChar *n16=(const sChar *)name;
+    const sChar8 *n8=(const sChar8 *)name;
+    for (sInt i=0; ; i++)
+    {
+      sInt c = name8 ? sU8(n8[i]) : n16[i];
+      if (!c) break;
+      if (c=='"' || c=='\\') tb.PrintChar('\\');
+      if (c>=32) tb.PrintChar(c);
+    }
+  }
+
+  static void Separator(sTextBuffer &tb, sPerfTraceCursor &cursor)
+  {
+    if (cursor.Count++) tb.Print(L",\n");
+  }
+
+  static sBool Dump(const sChar *filename, sPerfTraceCursor &cursor)
+  {
+    sTextBuffer tb;
+    tb.Print(L"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    sPerfTraceWrite(tb,cursor);
+    tb.Print(L"\n]}\n");
+    return sSaveTextAnsi(filename,tb.Get());
+  }
+
+  static void DumpThreadFunc(sThread *t, void *user)
+  {
+    while (t->CheckTerminate())
+    {
+      if (!DumpEvent->Wait(100)) continue;
+
+      sString<sMAXPATH> name;
+      sSPrintF(name,L"%s_%04d.json",HitchPath,HitchCount++);
+
+      sPerfTraceCursor cursor;
+      cursor.Since=DumpSince;
+      if (Dump(name,cursor))
+        sLogF(L"perf",L"frame hitch, trace written to <%s>\n",name);
+      else
+        sLogF(L"perf",L"frame hitch, could not write <%s>\n",name);
+    }
+  }
+
+  /****************************************************************************/
+
+  static void FrameHook(void *user)
+  {
+    sU64 now=sGetTimeUS();
+    sU32 n=FrameCount;
+    sU64 last = n ? FrameStarts[(n-1)%MaxFrames] : now;
+    FrameStarts[n%MaxFrames]=now;
+    sWriteBarrier();
+    FrameCount=n+1;
+
+    Ring *r=GetRing();
+    if (r) Push(r,sPTK_FRAME,L"frame",0,0,now);
+
+    if (HitchTime && now-last>HitchTime && (!LastHitch || now-LastHitch>10000000))
+    {
+      LastHitch=now;
+      DumpSince=sPerfTraceFrameStart(HitchFrames);
+      DumpEvent->Signal();
+    }
+  }
+
+  static void Init()
+  {
+    if (!Inited) return;
+
+    RingTls=sAllocTls(sizeof(Ring *),sizeof(Ring *));
+    TaskRing=NewRing(L"scheduler");
+    StartTime=sGetTimeUS();
+    sPreFlipHook->Add(FrameHook);
+
+    DumpEvent=new sThreadEvent;
+    DumpThread=new sThread(DumpThreadFunc,-1,0,0);
+    Running=sTRUE;
+  }
+
+  static void Exit()
+  {
+    if (!Inited) return;
+    Inited=sFALSE;
+    Running=sFALSE;
+
+    sDelete(DumpThread);
+    sDelete(DumpEvent);
+    sPreFlipHook->Rem(FrameHook);
+
+    for (sInt i=0; i<NumRings; i++)
+    {
+      sFreeMem(Rings[i]->Events);
+      sFreeMem(Rings[i]);
+      Rings[i]=0;
+    }
+    NumRings=0;
+    TaskRing=0;
+    sFreeMem(FrameStarts);
+    FrameStarts=0;
+    sDelete(Lock);
+  }
+};
+
+using namespace sPerfTrace;
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Interface                                                          ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void sAddPerfTrace(sInt ringsize, sInt frames)
+{
+  RingSize=1;
+  while (RingSize<ringsize) RingSize*=2;
+  RingMask=RingSize-1;
+  MaxFrames=sMax(frames,2);
+  FrameStarts=(sU64*)Alloc(MaxFrames*sizeof(sU64));
+  FrameCount=0;
+  NumRings=0;
+  Lock=new sThreadLock;
+  Inited=sTRUE;
+  sAddSubsystem(L"PerfTrace",0xe0,sPerfTrace::Init,sPerfTrace::Exit);
+}
+
+sBool sPerfTraceInited() { return Inited; }
+
+void sSetPerfTraceHitch(sF32 ms, const sChar *path, sInt frames)
+{
+  HitchTime=sU64(sMax(ms,0.0f)*1000.0f);
+  HitchPath=path;
+  HitchFrames=frames;
+}
+
+sBool sPerfTraceDump(const sChar *filename, sInt frames)
+{
+  if (!Inited) return sFALSE;
+  sPerfTraceCursor cursor;
+  cursor.Since=sPerfTraceFrameStart(frames);
+  return Dump(filename,cursor);
+}
+
+sU64 sPerfTraceFrameStart(sInt frames)
+{
+  sU32 n=FrameCount;
+  sReadBarrier();
+  if (!Inited || frames<=0 || !n) return 0;
+
+  // the frame n-1 is still running, so one more
+  sInt back=sMin<sInt>(frames+1,sMin<sInt>(n,MaxFrames));
+  return FrameStarts[(n-back)%MaxFrames];
+}
+
+void sPerfTraceEvent(sInt kind, const void *name, sBool name8, sU32 color)
+{
+  if (!Running) return;
+  Ring *r=GetRing();
+  if (r) Push(r,kind,name,name8,color,sGetTimeUS());
+}
+
+// called by whoever flips sStsPerfMon, which is only one thread
+
+void sPerfTraceTask(sInt thread, sU64 start, sU64 end, sU32 color)
+{
+  if (!Running || !TaskRing) return;
+  Push(TaskRing,sPTK_TASK,0,0,color,start,sU32(end-start),thread);
+}
+
+/****************************************************************************/
+
+void sPerfTraceWrite(sTextBuffer &tb, sPerfTraceCursor &cursor)
+{
+  if (!Inited) return;
+
+  sInt nr=NumRings;
+  sReadBarrier();
+
+  // thread names first. the scheduler threads get theirs when they show up
+
+  for (; cursor.Rings<nr; cursor.Rings++)
+  {
+    Ring *r=Rings[cursor.Rings];
+    if (r==TaskRing) continue;
+    Separator(tb,cursor);
+    tb.PrintF(L"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",r->Tid);
+    PrintName(tb,(const sChar *)r->Name,0);
+    tb.Print(L"\"}}");
+  }
+
+  Event *copy=(Event*)Alloc(RingSize*sizeof(Event));
+
+  for (sInt i=0; i<nr; i++)
+  {
+    Ring *r=Rings[i];
+    sU32 write=r->Write;
+    sReadBarrier();
+
+    sU32 start=cursor.Pos[i];
+    if (sInt(write-start)>RingSize) start=write-RingSize;
+    for (sU32 j=start; j!=write; j++)
+      copy[j-start]=r->Events[j&RingMask];
+
+    // everything the writer may have touched in the meantime is garbage
+    sReadBarrier();
+    sU32 now=r->Write;
+    sU32 first=start;
+    if (sInt(now-RingSize+1-start)>0)
+    {
+      first=now-RingSize+1;
+      cursor.Open[i]=0;
+    }
+
+    for (sU32 j=first; sInt(write-j)>0; j++)
+    {
+      const Event &e=copy[j-start];
+      if (e.Time<cursor.Since) continue;
+      sS64 ts=sS64(e.Time-StartTime);
+
+      switch (e.Kind)
+      {
+      case sPTK_BEGIN:
+        cursor.Open[i]++;
+        Separator(tb,cursor);
+        tb.Print(L"{\"name\":\"");
+        PrintName(tb,e.Name,e.Name8);
+        tb.PrintF(L"\",\"ph\":\"B\",\"ts\":%d,\"pid\":1,\"tid\":%d}",ts,r->Tid);
+        break;
+
+      case sPTK_END:
+        if (!cursor.Open[i]) break;
+        cursor.Open[i]--;
+        Separator(tb,cursor);
+        tb.PrintF(L"{\"ph\":\"E\",\"ts\":%d,\"pid\":1,\"tid\":%d}",ts,r->Tid);
+        break;
+
+      case sPTK_MARK:
+      case sPTK_FRAME:
+        Separator(tb,cursor);
+        tb.Print(L"{\"name\":\"");
+        PrintName(tb,e.Name,e.Name8);
+        tb.PrintF(L"\",\"ph\":\"i\",\"s\":\"%s\",\"ts\":%d,\"pid\":1,\"tid\":%d}",e.Kind==sPTK_FRAME?L"g":L"t",ts,r->Tid);
+        break;
+
+      case sPTK_TASK:
+        if (!(cursor.Tasks[e.Track/32]&(1<<(e.Track&31))))
+        {
+          cursor.Tasks[e.Track/32]|=1<<(e.Track&31);
+          Separator(tb,cursor);
+          tb.PrintF(L"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"tasks %d\"}}",TASKTID+e.Track,e.Track);
+        }
+        Separator(tb,cursor);
+        tb.PrintF(L"{\"name\":\"task %06x\",\"ph\":\"X\",\"ts\":%d,\"dur\":%d,\"pid\":1,\"tid\":%d}",e.Color&0xffffff,ts,e.Duration,TASKTID+e.Track);
+        break;
+      }
+    }
+
+    cursor.Pos[i]=write;
+  }
+
+  sFreeMem(copy);
+}
+
+#endif
+
+/****************************************************************************/
+
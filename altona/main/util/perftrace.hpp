@@ -0,0 +1,97 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_UTIL_PERFTRACE_HPP
+#define FILE_UTIL_PERFTRACE_HPP
+
+#include "base/types.hpp"
+#include "util/perfmon.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Performance Trace                                                  ***/
+/***                                                                      ***/
+/****************************************************************************/
+/***                                                                      ***/
+/***   Records sPerfEnter() / sPerfLeave() scopes and the task boxes of   ***/
+/***   sStsPerfMon into a ring per thread, without locks, and writes      ***/
+/***   them in the chrome trace event format (chrome://tracing or         ***/
+/***   ui.perfetto.dev). Unlike the perfmon overlay this needs neither a  ***/
+/***   screen nor a keyboard: get it over netdebug (/trace), dump it      ***/
+/***   from code, or let it dump itself when a frame takes too long.     ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+#if sPERFMON_ENABLED
+
+// put this into sMain(). ringsize is the number of events kept per thread,
+// frames how many frame starts are remembered for "the last n frames".
+void sAddPerfTrace(sInt ringsize=0x4000, sInt frames=256);
+
+sBool sPerfTraceInited();
+
+// write the last frames to a file. 0 frames means everything in the rings
+sBool sPerfTraceDump(const sChar *filename, sInt frames=0);
+
+// dump the last frames automatically when a frame takes longer than ms.
+// files are called <path>_0000.json and so on, at most one every 10 seconds.
+// ms=0 turns this off.
+void sSetPerfTraceHitch(sF32 ms, const sChar *path=L"hitch", sInt frames=30);
+
+/****************************************************************************/
+
+// for streaming: remembers what was already written
+
+struct sPerfTraceCursor
+{
+  static const sInt MAXRINGS=64;
+  sU64 Since;                     // skip events before this (sGetTimeUS)
+  sU32 Pos[MAXRINGS];
+  sInt Open[MAXRINGS];            // drop sPerfLeave() of scopes we didn't see start
+  sInt Rings;                     // rings that already have a name
+  sU32 Tasks[8];                  // scheduler threads that have a name
+  sInt Count;                     // events written
+
+  sPerfTraceCursor() { sClear(*this); }
+};
+
+// time of the start of the frame n frames ago, for sPerfTraceCursor::Since
+sU64 sPerfTraceFrameStart(sInt frames);
+
+// append the events since the cursor as json objects, separated by ",\n".
+// starts with a ',' if the cursor says something was written before.
+// the document around is {"traceEvents":[ ... ]}, see sPerfTraceDump().
+void sPerfTraceWrite(class sTextBuffer &tb, sPerfTraceCursor &cursor);
+
+/****************************************************************************/
+
+// internal, feeding the rings
+
+enum sPerfTraceKind
+{
+  sPTK_BEGIN = 1,
+  sPTK_END,
+  sPTK_MARK,
+  sPTK_FRAME,
+  sPTK_TASK,
+};
+
+void sPerfTraceEvent(sInt kind, const void *name, sBool name8, sU32 color);
+void sPerfTraceTask(sInt thread, sU64 start, sU64 end, sU32 color);
+
+#else
+
+sINLINE void sAddPerfTrace(sInt ringsize=0, sInt frames=0) {}
+sINLINE sBool sPerfTraceInited() { return 0; }
+sINLINE sBool sPerfTraceDump(const sChar *filename, sInt frames=0) { return 0; }
+sINLINE void sSetPerfTraceHitch(sF32 ms, const sChar *path=0, sInt frames=0) {}
+
+#endif
+
+/****************************************************************************/
+
+#endif // FILE_UTIL_PERFTRACE_HPP
@@ -9,35 +9,12 @@
 
 #include "rasterizer.hpp"
 #include "util/image.hpp"
-#include "util/algorithms.hpp"
+#include "util/scratch.hpp"
+#include "util/taskscheduler.hpp"
+#include "util/simd_float.hpp"
 
 /****************************************************************************/
 
-static const sInt OVERSAMPLE_YF = 4; // more is probably overkill
-static const sInt OVERSAMPLE_Y = 1<<OVERSAMPLE_YF;
-
-static const sInt FIXSHIFT = 12;
-static const sInt FIXSCALE = 1 << FIXSHIFT;
-static const sInt SCALE_X = 1 << FIXSHIFT;
-static const sInt SCALE_Y = (1 << FIXSHIFT) * OVERSAMPLE_Y;
-
-/****************************************************************************/
-
-static sInt sCeilFix(sInt x)
-{
-  return (x + (1 << FIXSHIFT)-1) >> FIXSHIFT;
-}
-
-sINLINE sInt sMulShift12(sInt var_a,sInt var_b)
-{
-  return sInt((sS64(var_a) * var_b) >> 12);
-}
-
-sINLINE sInt sDivShift12(sInt var_a,sInt var_b)
-{
-  return sInt((sS64(var_a) << 12) / var_b);
-}
-
 sINLINE sU32 FadePixel(sU32 a,sU32 b,sInt fade) // fade in 0..256
 {
   // ye olde double blend tricke.
@@ -54,18 +31,26 @@ sINLINE sU32 FadePixel(sU32 a,sU32 b,sInt fade) // fade in 0..256
   return rb | ag;
 }
 
+sINLINE sU8 DistanceToByte(sF32 d,sF32 scale)   // d>0 inside
+{
+  return sU8(sClamp<sInt>(sInt((0.5f+d*scale)*255.0f+0.5f),0,255));
+}
+
 /****************************************************************************/
 
+sVectorRasterizer::sVectorRasterizer(sInt sizex,sInt sizey)
+{
+  SizeX = sizex;
+  SizeY = sizey;
+  Target = 0;
+  Pos.Init(0,0);
+}
+
 sVectorRasterizer::sVectorRasterizer(sImage *target)
   : Target(target)
 {
-  Head = &EHead;
-  Head->x = -0x80000000LL;
-  Head->dx = 0;
-
-  TargetHeight = (target->SizeY * OVERSAMPLE_Y) << FIXSHIFT;
-  MinY = TargetHeight >> FIXSHIFT;
-  MaxY = 0;
+  SizeX = target->SizeX;
+  SizeY = target->SizeY;
   Pos.Init(0,0);
 }
 
@@ -74,59 +59,49 @@ void sVectorRasterizer::MoveTo(const sVector2 &pos)
   Pos = pos;
 }
 
-void sVectorRasterizer::Edge(const sVector2& a, const sVector2& b)
+void sVectorRasterizer::AddSegment(sF32 x0,sF32 y0,sF32 x1,sF32 y1)
 {
-  sInt x1 = sInt(a.x * SCALE_X), y1 = sInt(a.y * SCALE_Y);
-  sInt x2 = sInt(b.x * SCALE_X), y2 = sInt(b.y * SCALE_Y);
-  sInt dir = 1;
-  sInt dx;
-
-  Pos = b;
-
-  if(y1 > y2)
-  {
-    sSwap(x1, x2);
-    sSwap(y1, y2);
-    dir = -1;
-  }
-
-  sInt iy1 = sCeilFix(y1), iy2 = sCeilFix(y2);
-  if(iy1 == iy2) // horizontal edge, skip
+  if(y0==y1)                      // no area
     return;
 
-  if(y2 - y1 >= FIXSCALE)
-    dx = sDivShift12(x2-x1, y2-y1);
-  else
-    dx = sMulShift12(x2-x1, (1<<28)/(y2-y1));
+  Segment *s = Segments.AddMany(1);
+  s->x0 = x0;
+  s->y0 = y0;
+  s->x1 = x1;
+  s->y1 = y1;
+}
 
-  // y clip
-  if(y1 < 0)
-  {
-    x1 += sMulShift12(dx, 0 - y1);
-    y1 = iy1 = 0;
-  }
-  
-  if(y2 > TargetHeight)
+void sVectorRasterizer::Edge(const sVector2& a, const sVector2& b)
+{
+  // split at the left and right border. the parts outside are moved onto
+  // the border: they don't cover pixels but still count for the winding.
+
+  sF32 w = sF32(SizeX);
+  sF32 dx = b.x-a.x;
+  sF32 dy = b.y-a.y;
+  sF32 t[4];
+  sInt n = 0;
+
+  t[n++] = 0.0f;
+  if((a.x<0.0f) != (b.x<0.0f))
+    t[n++] = -a.x/dx;
+  if((a.x<w) != (b.x<w))
+    t[n++] = (w-a.x)/dx;
+  if(n==3 && t[1]>t[2])
+    sSwap(t[1],t[2]);
+  t[n++] = 1.0f;
+
+  for(sInt i=0;i<n-1;i++)
   {
-    x2 += sMulShift12(dx, TargetHeight - y2);
-    y2 = TargetHeight;
-    iy2 = TargetHeight >> FIXSHIFT;
-  }
+    sF32 x0 = a.x+dx*t[i];
+    sF32 x1 = (i==n-2) ? b.x : a.x+dx*t[i+1];
+    sF32 y0 = a.y+dy*t[i];
+    sF32 y1 = (i==n-2) ? b.y : a.y+dy*t[i+1];
 
-  if(iy1 >= iy2) // if degenerate after clip, just skip
-    return;
+    AddSegment(sClamp(x0,0.0f,w),y0,sClamp(x1,0.0f,w),y1);
+  }
 
-  // build edge
-  EdgeRec *e = Edges.AddMany(1);
-  e->Prev = e->Next = 0;
-  e->x = x1 + sMulShift12(dx, (iy1 << 12) - y1); // subpixel correction? of course.
-  e->dx = dx;
-  e->y1 = iy1;
-  e->y2 = iy2;
-  e->dir = dir;
-
-  MinY = sMin(MinY, iy1);
-  MaxY = sMax(MaxY, iy2);
+  Pos = b;                        // a may be Pos
 }
 
 void sVectorRasterizer::BezierEdge(const sVector2& a, const sVector2& b, const sVector2& c, const sVector2& d)
@@ -150,140 +125,396 @@ void sVectorRasterizer::BezierEdge(const sVector2& a, const sVector2& b, const s
   }
 }
 
-void sVectorRasterizer::RasterizeAll(sU32 color,sInt fillConvention)
+void sVectorRasterizer::Clear()
+{
+  Segments.Clear();
+  BandStart.Clear();
+  BandList.Clear();
+  Pos.Init(0,0);
+}
+
+/****************************************************************************/
+
+// sort the segments into bands of rows
+
+void sVectorRasterizer::Bin()
 {
-  Head->Prev = Head->Next = Head;
-  sIntroSort(sAll(Edges));
-
-  EdgeRec *ei = Edges.GetData(), *ee = Edges.GetData()+Edges.GetCount();
-  sInt windingMask = (fillConvention == sVRFC_EVENODD) ? 1 : -1;
-  sInt endY = sAlign(MaxY,OVERSAMPLE_Y); // make sure we always resolve the last row
-  sInt width = Target->SizeX;
-  
-  sInt coverSize = width * OVERSAMPLE_Y; 
-  sU8* cover = new sU8[coverSize];
-  sU8* coverEnd = cover + coverSize;
-  sU8* cp = cover + (MinY & (OVERSAMPLE_Y - 1)) * width;
-  sU32* op = Target->Data + (MinY / OVERSAMPLE_Y) * width;
-
-  sSetMem(cover, 0, coverSize);
-
-  for(sInt y=MinY;y<endY;y++)
+  sInt bands = (SizeY+BAND-1)/BAND;
+  sInt sc = Segments.GetCount();
+  sScratchScope scratch;
+  sInt *first = scratch.Alloc<sInt>(sc+1);
+  sInt *last = scratch.Alloc<sInt>(sc+1);
+
+  BandStart.Resize(bands+1);
+  for(sInt i=0;i<=bands;i++)
+    BandStart[i] = 0;
+
+  for(sInt i=0;i<sc;i++)
   {
-    EdgeRec *e, *en;
+    const Segment *s = &Segments[i];
+    sF32 y0 = sMin(s->y0,s->y1);
+    sF32 y1 = sMax(s->y0,s->y1);
+    first[i] = 1;
+    last[i] = 0;
+    if(y1<0.0f || y0>=sF32(SizeY))
+      continue;
+    first[i] = sClamp<sInt>(sInt(sRoundDown(y0))/BAND,0,bands-1);
+    last[i] = sClamp<sInt>(sInt(sRoundDown(y1))/BAND,0,bands-1);
+    for(sInt b=first[i];b<=last[i];b++)
+      BandStart[b+1]++;
+  }
+  for(sInt b=0;b<bands;b++)
+    BandStart[b+1] += BandStart[b];
+
+  BandList.Resize(BandStart[bands]);
+  sInt *fill = scratch.Alloc<sInt>(bands+1);
+  for(sInt b=0;b<bands;b++)
+    fill[b] = BandStart[b];
+  for(sInt i=0;i<sc;i++)
+    for(sInt b=first[i];b<=last[i];b++)
+      BandList[fill[b]++] = i;
+}
+
+// add the signed area of every segment to the cells it crosses. the sum of
+// a row up to a pixel is its coverage. rows of the band only, cells up to
+// SizeX+1 are written.
 
-    // advance all x coordinates, remove "expired" edges, re-sort active edge list on the way
-    for(e = Head->Next; e != Head; e = en)
+void sVectorRasterizer::Accumulate(sInt band,sF32 *acc,sInt stride) const
+{
+  sF32 by0 = sF32(band*BAND);
+  sF32 by1 = sF32(sMin<sInt>(band*BAND+BAND,SizeY));
+  sF32 w = sF32(SizeX);
+
+  for(sInt i=BandStart[band];i<BandStart[band+1];i++)
+  {
+    const Segment *s = &Segments[BandList[i]];
+    sF32 x0 = s->x0, y0 = s->y0, x1 = s->x1, y1 = s->y1;
+    sF32 dir = 1.0f;
+    if(y0>y1)
     {
-      en = e->Next;
+      sSwap(x0,x1);
+      sSwap(y0,y1);
+      dir = -1.0f;
+    }
+    sF32 ys = sMax(y0,by0);
+    sF32 ye = sMin(y1,by1);
+    if(ys>=ye)
+      continue;
+
+    sF32 dxdy = (x1-x0)/(y1-y0);
+    sF32 x = x0+(ys-y0)*dxdy;
+    sInt yi0 = sInt(ys);
+    sInt yi1 = sInt(sRoundUp(ye));
 
-      if(y < e->y2) // edge is still active
+    for(sInt y=yi0;y<yi1;y++)
+    {
+      sF32 *a = acc + (y-band*BAND)*stride;
+      sF32 dy = sMin(sF32(y+1),ye) - sMax(sF32(y),ys);
+      sF32 xn = sClamp(x+dxdy*dy,0.0f,w);
+      sF32 d = dy*dir;
+      x = sClamp(x,0.0f,w);
+
+      sF32 xa = sMin(x,xn);
+      sF32 xb = sMax(x,xn);
+      sF32 xaf = sRoundDown(xa);
+      sInt xai = sInt(xaf);
+      sInt xbi = sInt(sRoundUp(xb));
+
+      if(xbi<=xai+1)                // within one pixel
       {
-        e->x += e->dx; // step
-        
-        while(e->x < e->Prev->x) // keep everything sorted
-        {
-          // move one step towards the beginning
-          EdgeRec* ep = e->Prev;
-          
-          ep->Prev->Next = e;
-          e->Next->Prev = ep;
-          e->Prev = ep->Prev;
-          ep->Next = e->Next;
-          e->Next = ep;
-          ep->Prev = e;
-        }
+        sF32 xm = 0.5f*(x+xn)-xaf;
+        a[xai] += d-d*xm;
+        a[xai+1] += d*xm;
       }
-      else // deactivate edge: remove from active edge list
+      else                          // trapezoids at the ends, constant slope between
       {
-        e->Prev->Next = e->Next;
-        e->Next->Prev = e->Prev;
+        sF32 s = 1.0f/(xb-xa);
+        sF32 xa0 = xa-xaf;
+        sF32 a0 = 0.5f*s*(1.0f-xa0)*(1.0f-xa0);
+        sF32 xb0 = xb-sF32(xbi)+1.0f;
+        sF32 am = 0.5f*s*xb0*xb0;
+        a[xai] += d*a0;
+        if(xbi==xai+2)
+        {
+          a[xai+1] += d*(1.0f-a0-am);
+        }
+        else
+        {
+          sF32 a1 = s*(1.5f-xa0);
+          a[xai+1] += d*(a1-a0);
+          for(sInt xi=xai+2;xi<xbi-1;xi++)
+            a[xi] += d*s;
+          sF32 a2 = a1+sF32(xbi-xai-3)*s;
+          a[xbi-1] += d*(1.0f-a2-am);
+        }
+        a[xbi] += d*am;
       }
+      x = xn;
     }
+  }
+}
 
-    // insert new edges if there are any
-    e = Head;
-    while(ei != ee && ei->y1 == y)
-    {
-      // search for insert position
-      while(e != Head->Prev && e->Next->x <= ei->x)
-        e = e->Next;
+// prefix sum over the row and fold with the fill convention, in place.
+// nonzero: min(|a|,1). evenodd: the distance of |a| to the next even number.
 
-      // insert new edge behind e
-      ei->Prev = e;
-      ei->Next = e->Next;
-      e->Next->Prev = ei;
-      e->Next = ei;
+void sVectorRasterizer::Resolve(sF32 *row,sInt fill) const
+{
+  sInt x = 0;
+  sF32 sum = 0.0f;
+
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+  const sSSE one = sVecLoadScalar(1.0f);
+  const sSSE half = sVecLoadScalar(0.5f);
+  const sSSE two = sVecLoadScalar(2.0f);
+  const __m128i absi = _mm_set1_epi32(0x7fffffff);
+  const sSSE absmask = _mm_castsi128_ps(absi);
+  sSSE carry = sVecZero();
+
+  for(;x+4<=SizeX;x+=4)
+  {
+    sSSE v = sVecLoadU(row+x);
+    v = sVecAdd(v,_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v),4)));
+    v = sVecAdd(v,_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v),8)));
+    v = sVecAdd(v,carry);
+    carry = sVecSplat(v,3);
+
+    sSSE c = sVecAnd(v,absmask);
+    if(fill==sVRFC_EVENODD)
+    {
+      sSSE t = _mm_cvtepi32_ps(_mm_cvttps_epi32(sVecMul(c,half)));
+      c = sVecNMSub(t,two,c);
+      c = sVecSub(one,sVecAnd(sVecSub(one,c),absmask));
+    }
+    else
+    {
+      c = sVecMin(c,one);
+    }
+    sVecStoreU(c,row+x);
+  }
+  _mm_store_ss(&sum,carry);
+#endif
 
-      ++ei;
+  for(;x<SizeX;x++)
+  {
+    sum += row[x];
+    sF32 c = sFAbs(sum);
+    if(fill==sVRFC_EVENODD)
+    {
+      c -= 2.0f*sF32(sInt(c*0.5f));
+      c = 1.0f-sFAbs(1.0f-c);
     }
+    else
+    {
+      c = sMin(c,1.0f);
+    }
+    row[x] = c;
+  }
+}
 
-    // go through new active edge list and generate spans on the way
-    sInt winding = 0, lx;
+/****************************************************************************/
 
-    for(e = Head->Next; e != Head; e = e->Next)
-    {
-      if(winding & windingMask)
-      {
-        // clip
-        sInt x0 = sMax(lx, 0);
-        sInt x1 = sMin(e->x, width << 12);
+void sVectorRasterizer::BandCoverage(const Job *job,sInt band,sF32 *acc,sInt stride) const
+{
+  if(BandStart[band]==BandStart[band+1])
+    return;
 
-        if(x1 > x0)
-        {
-          // generate span
-          sInt ix0 = (x0 + 0xfff) >> 12;
-          sInt ix1 = (x1 + 0xfff) >> 12;
-
-          if(ix0 == ix1) // very thin part
-            cp[ix0-1] = sU8(sMin(cp[ix0-1] + ((x1 - x0) >> 4), 255));
-          else // at least one pixel thick
-          {
-            if(x0 & 0xfff)
-              cp[ix0-1] = sU8(sMin(cp[ix0-1] + ((~x0 & 0xfff) >> 4), 255));
-
-            if(x1 & 0xfff)
-            {
-              ix1--;
-              cp[ix1] = sU8(sMin(cp[ix1] + ((x1 & 0xfff) >> 4), 255));
-            }
-
-            while(ix0 < ix1)
-              cp[ix0++] = 255;
-          }
-        }
-      }
+  Accumulate(band,acc,stride);
+  sInt y1 = sMin<sInt>(band*BAND+BAND,SizeY);
+  for(sInt y=band*BAND;y<y1;y++)
+  {
+    sF32 *row = acc + (y-band*BAND)*stride;
+    Resolve(row,job->Fill);
+    job->Func(job->User,y,row,SizeX);
+  }
+}
 
-      winding += e->dir;
-      lx = e->x;
-    }
+void sVectorRasterizer::BandTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Job *job = (Job *) data;
+  sVectorRasterizer *r = job->Rast;
+  sInt stride = r->SizeX+2;
+
+  for(sInt band=start;band<start+count;band++)
+  {
+    sScratchScope scratch;
+    sF32 *acc = scratch.Alloc<sF32>(BAND*stride);
+    sSetMem(acc,0,BAND*stride*sizeof(sF32));
+    r->BandCoverage(job,band,acc,stride);
+  }
+}
+
+void sVectorRasterizer::Run(Job *job)
+{
+  Bin();
 
-    // advance and resolve
-    cp += width;
-    if(cp == coverEnd) // row complete
+  sInt bands = BandStart.GetCount()-1;
+  if(bands<2 || !sSched || sSched->GetThreadCount()<2)
+  {
+    BandTask(0,0,0,bands,job);
+  }
+  else
+  {
+    sStsWorkload *wl = sSched->BeginWorkload();
+    sStsTask *task = wl->NewTask(BandTask,job,bands,0);
+    wl->AddTask(task);
+    wl->Start();
+    wl->Sync();
+    wl->End();
+  }
+
+  Clear();
+}
+
+void sVectorRasterizer::Rasterize(sInt fillConvention,RowFunc func,void *user)
+{
+  Job job;
+  sClear(job);
+  job.Rast = this;
+  job.Fill = fillConvention;
+  job.Func = func;
+  job.User = user;
+  Run(&job);
+}
+
+/****************************************************************************/
+
+struct sVectorRasterizerImage
+{
+  sImage *Target;
+  sU32 Color;
+};
+
+static void RasterizeImageRow(void *user,sInt y,const sF32 *cover,sInt sizex)
+{
+  sVectorRasterizerImage *img = (sVectorRasterizerImage *) user;
+  sU32 *op = img->Target->Data + y*sizex;
+  for(sInt x=0;x<sizex;x++)
+  {
+    sInt fade = sInt(cover[x]*256.0f+0.5f);
+    if(fade)
+      op[x] = FadePixel(op[x],img->Color,fade);
+  }
+}
+
+void sVectorRasterizer::RasterizeAll(sU32 color,sInt fillConvention)
+{
+  sVERIFY(Target);
+
+  sVectorRasterizerImage img;
+  img.Target = Target;
+  img.Color = color;
+  Rasterize(fillConvention,RasterizeImageRow,&img);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Distance field from coverage                                       ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// squared euclidean distance transform of a sampled function, in one
+// dimension (felzenszwalb & huttenlocher). v and z need n+1 entries.
+
+static void sEDT1D(const sF32 *f,sInt n,sF32 *d,sInt *v,sF32 *z)
+{
+  const sF32 inf = 1e20f;
+  sInt k = 0;
+  v[0] = 0;
+  z[0] = -inf;
+  z[1] = inf;
+  for(sInt q=1;q<n;q++)
+  {
+    sF32 s = ((f[q]+sF32(q*q))-(f[v[k]]+sF32(v[k]*v[k])))/sF32(2*q-2*v[k]);
+    while(s<=z[k])
     {
-      for(sInt x=0;x<width;x++)
-      {
-        sU32 sum = 0;
-        for(sInt s=0;s<OVERSAMPLE_Y;s++)
-          sum += cover[x+s*width];
+      k--;
+      s = ((f[q]+sF32(q*q))-(f[v[k]]+sF32(v[k]*v[k])))/sF32(2*q-2*v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = inf;
+  }
+  k = 0;
+  for(sInt q=0;q<n;q++)
+  {
+    while(z[k+1]<sF32(q))
+      k++;
+    sInt p = v[k];
+    d[q] = sF32((q-p)*(q-p))+f[p];
+  }
+}
 
-        sum <<= 8 - OVERSAMPLE_YF;
-        sum += (sum >> (8 + OVERSAMPLE_YF));
+// in place: columns, then rows
 
-        op[x] = FadePixel(op[x], color, sum >> 8);
-      }
+static void sEDT2D(sF32 *img,sInt sizex,sInt sizey,sF32 *f,sF32 *d,sInt *v,sF32 *z)
+{
+  for(sInt x=0;x<sizex;x++)
+  {
+    for(sInt y=0;y<sizey;y++)
+      f[y] = img[y*sizex+x];
+    sEDT1D(f,sizey,d,v,z);
+    for(sInt y=0;y<sizey;y++)
+      img[y*sizex+x] = d[y];
+  }
+  for(sInt y=0;y<sizey;y++)
+  {
+    sF32 *row = img+y*sizex;
+    sCopyMem(f,row,sizex*sizeof(sF32));
+    sEDT1D(f,sizex,row,v,z);
+  }
+}
+
+void sCoverageToSDF(sU8 *data,sInt sizex,sInt sizey,sInt pitch,sF32 spread)
+{
+  if(sizex<=0 || sizey<=0)
+    return;
+
+  const sF32 inf = 1e20f;
+  sInt n = sMax(sizex,sizey)+1;
+  sF32 scale = 0.5f/sMax(spread,0.5f);
 
-      sSetMem(cover, 0, coverSize);
-      cp = cover;
-      op += width;
+  sScratchScope scratch;
+  sF32 *in = scratch.Alloc<sF32>(sizex*sizey);    // to the closest outside pixel
+  sF32 *out = scratch.Alloc<sF32>(sizex*sizey);   // to the closest inside pixel
+  sF32 *f = scratch.Alloc<sF32>(n);
+  sF32 *d = scratch.Alloc<sF32>(n);
+  sF32 *z = scratch.Alloc<sF32>(n+1);
+  sInt *v = scratch.Alloc<sInt>(n);
+
+  for(sInt y=0;y<sizey;y++)
+  {
+    const sU8 *src = data+y*pitch;
+    for(sInt x=0;x<sizex;x++)
+    {
+      sBool inside = src[x]>=128;
+      in[y*sizex+x] = inside ? inf : 0.0f;
+      out[y*sizex+x] = inside ? 0.0f : inf;
     }
   }
 
-  delete[] cover;
-  Edges.Clear();
+  sEDT2D(in,sizex,sizey,f,d,v,z);
+  sEDT2D(out,sizex,sizey,f,d,v,z);
 
-  Pos.Init(0,0);
+  // the outline is halfway between pixel centers, or inside pixels that
+  // are partially covered, where the coverage says how far.
+
+  for(sInt y=0;y<sizey;y++)
+  {
+    sU8 *dest = data+y*pitch;
+    for(sInt x=0;x<sizex;x++)
+    {
+      sInt c = dest[x];
+      sF32 dist;
+      if(c>0 && c<255)
+        dist = sF32(c)/255.0f-0.5f;
+      else if(c>=128)
+        dist = sFSqrt(in[y*sizex+x])-0.5f;
+      else
+        dist = 0.5f-sFSqrt(out[y*sizex+x]);
+      dest[x] = DistanceToByte(dist,scale);
+    }
+  }
 }
 
 /****************************************************************************/
@@ -15,6 +15,8 @@
 /****************************************************************************/
 
 class sImage;
+class sStsManager;
+class sStsThread;
 
 enum sVectorRasterizer_FillConvention
 {
@@ -22,12 +24,15 @@ enum sVectorRasterizer_FillConvention
   sVRFC_NONZERO_WINDING  = 1,  // nonzero winding rule
 };
 
-// Simple vector rasterizer. Renders nicely antialiased outlines of polygons,
-// efficiently.
+// Vector rasterizer. Renders antialiased outlines of polygons with exact
+// area coverage: every edge adds its signed area to the pixels it crosses,
+// a prefix sum over each row gives the coverage. The image is split into
+// bands of rows that are rasterized in parallel on sSched.
 class sVectorRasterizer
 {
 public:
-  sVectorRasterizer(sImage *target);
+  sVectorRasterizer(sInt sizex,sInt sizey);
+  sVectorRasterizer(sImage *target);          // for RasterizeAll()
 
   // Move cursor to specific position
   void MoveTo(const sVector2 &pos);
@@ -41,34 +46,63 @@ public:
   // Add a cubic bezier edge to be rasterized
   void BezierEdge(const sVector2 &a,const sVector2 &b,const sVector2 &c,const sVector2 &d);
 
-  // Rasterize everything currently specified with the given fill convention and color.
-  // This also clears all active draw commands.
-  void RasterizeAll(sU32 color, sInt fillConvention); 
+  // Coverage 0..1 of one row. Called from several threads at once, but
+  // only once per row. Bands of rows without edges are skipped.
+  typedef void (*RowFunc)(void *user,sInt y,const sF32 *cover,sInt sizex);
+
+  // All of these clear the edges when done.
+
+  // Rasterize everything with the given fill convention, pass the rows to func
+  void Rasterize(sInt fillConvention,RowFunc func,void *user);
+
+  // Rasterize everything into the target image with the given color.
+  void RasterizeAll(sU32 color, sInt fillConvention);
+
+  void Clear();
 
 private:
-  struct EdgeRec
+  enum
+  {
+    BAND = 32,                    // rows per task
+  };
+  struct Segment
+  {
+    sF32 x0,y0,x1,y1;
+  };
+  struct Job
   {
-    EdgeRec *Prev,*Next;    // Linked list
-    sInt x,dx;              // fixed point
-    sInt y1,y2;             // y1<y2
-    sInt dir;               // original direction (for winding calc)
-
-    sBool operator <(const EdgeRec &b) const
-    {
-      return y1 < b.y1 || y1 == b.y1 && x < b.x;
-    }
+    sVectorRasterizer *Rast;
+    sInt Fill;
+    RowFunc Func;
+    void *User;
   };
 
-  EdgeRec EHead,*Head;
-  sArray<EdgeRec> Edges;
-  sInt MinY,MaxY;
+  sArray<Segment> Segments;
+  sArray<sInt> BandStart;         // BandList[BandStart[b]..BandStart[b+1]-1] touch band b
+  sArray<sInt> BandList;
+  sInt SizeX,SizeY;
   sVector2 Pos;
-
   sImage *Target;
-  sInt TargetHeight; // in scaled, fixed-point units
+
+  void AddSegment(sF32 x0,sF32 y0,sF32 x1,sF32 y1);
+  void Bin();
+  void Run(Job *job);
+  void Accumulate(sInt band,sF32 *acc,sInt stride) const;
+  void Resolve(sF32 *row,sInt fill) const;
+  void BandCoverage(const Job *job,sInt band,sF32 *acc,sInt stride) const;
+  static void BandTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data);
 };
 
 /****************************************************************************/
 
+// Distance field from an antialiased coverage mask, in place, for images
+// that have no outlines (like glyphs rendered by the os): 128 on the
+// outline, 255 spread pixels inside and more, 0 spread pixels outside and
+// more.
+
+void sCoverageToSDF(sU8 *data,sInt sizex,sInt sizey,sInt pitch,sF32 spread);
+
+/****************************************************************************/
+
 #endif // FILE_UTIL_RASTERIZER_HPP
 
@@ -60,6 +60,43 @@ sBool sScannerSourceFile::Load(const sChar *filename)
   File = sCreateFile(filename,sFA_READ);
   if(!File)
     return 0;
+  Filename = filename;
+
+  // small and medium files are mapped and converted in one go, so there is
+  // nothing left to do for Refill() and no remainder to copy around.
+
+  sS64 size = File->GetSize();
+  const sU8 *map = (size>=2 && size<=sScanner::WholeFileSize) ? File->MapAll() : 0;
+  if(map)
+  {
+    sInt chars;
+    if(map[0]==0xff && map[1]==0xfe)        // utf-16 little endian
+    {
+      chars = sInt(size/2-1);
+      ScanBuffer = new sChar[chars+1];
+      for(sInt i=0;i<chars;i++)
+        ScanBuffer[i] = map[2+i*2] | (map[3+i*2]<<8);
+    }
+    else if(map[0]==0xfe && map[1]==0xff)   // utf-16 big endian
+    {
+      chars = sInt(size/2-1);
+      ScanBuffer = new sChar[chars+1];
+      for(sInt i=0;i<chars;i++)
+        ScanBuffer[i] = (map[2+i*2]<<8) | map[3+i*2];
+    }
+    else                                    // 8bit -> 16 bit
+    {
+      chars = sInt(size);
+      ScanBuffer = new sChar[chars+1];
+      for(sInt i=0;i<chars;i++)
+        ScanBuffer[i] = map[i];
+    }
+    ScanBuffer[chars] = 0;
+    ScanPtr = ScanBuffer;
+    CharsLeftInFile = 0;
+    sDelete(File);
+    return 1;
+  }
 
   ScanBuffer = new sChar[sScanner::BufferSize+1];
   ScanBuffer[sScanner::BufferSize] = 0;
@@ -98,13 +135,15 @@ sBool sScannerSourceFile::Load(const sChar *filename)
     CharsLeftInFile -= 2;
     break;
   }
-  
-  Filename = filename;
+
   return 1;
 }
 
 sBool sScannerSourceFile::Refill()
 {
+  if(!File)
+    return 1;
+
   sInt left = ScanBuffer+sScanner::BufferSize-ScanPtr;
   if(left<sScanner::LineSize)
   {
@@ -190,6 +229,7 @@ void sScanner::Init()
   Flags = sSF_CPPCOMMENT;
   TokensSym.Clear();
   TokensName.Clear();
+  TokensDirty = 1;
 };
 
 void sScanner::Stop()
@@ -198,6 +238,8 @@ void sScanner::Stop()
   ValI = 0;
   ValF = 0;
   Name = L"";
+  NameStart = L"";
+  NameLength = 0;
   String = L"";
   ValueString = L"";
   ValueSuffix = L"";
@@ -209,6 +251,63 @@ void sScanner::Stop()
 void sScanner::SortTokens()
 {
   sSortDown(TokensSym,&ScannerToken::Length);
+
+  // symbols: bucket by first character, keeping the longest match first
+
+  const ScannerToken *st;
+  sClear(SymFirst);
+  sFORALL(TokensSym,st)
+    if(st->Length>0 && st->Name[0]<256)
+      SymFirst[st->Name[0]+1]++;
+  for(sInt i=0;i<256;i++)
+    SymFirst[i+1] += SymFirst[i];
+  SymTable.Clear();
+  SymTable.AddMany(SymFirst[256]);
+  sInt fill[256];
+  sCopyMem(fill,SymFirst,sizeof(fill));
+  SymWide.Clear();
+  sFORALL(TokensSym,st)
+  {
+    if(st->Length>0 && st->Name[0]<256)
+      SymTable[fill[st->Name[0]]++] = st;
+    else if(st->Length>0)
+      SymWide.AddTail(st);
+  }
+
+  // names: open hashing, the first token added wins
+
+  sInt size = 16;
+  while(size<TokensName.GetCount()*2)
+    size *= 2;
+  NameTable.Clear();
+  NameTable.AddMany(size);
+  for(sInt i=0;i<size;i++)
+    NameTable[i] = 0;
+  sFORALL(TokensName,st)
+  {
+    if(FindName(st->Name,st->Length))
+      continue;
+    sInt h = sHashString(st->Name,st->Length)&(size-1);
+    while(NameTable[h])
+      h = (h+1)&(size-1);
+    NameTable[h] = st;
+  }
+
+  TokensDirty = 0;
+}
+
+const sScanner::ScannerToken *sScanner::FindName(const sChar *name,sInt len)
+{
+  sInt mask = NameTable.GetCount()-1;
+  sInt h = sHashString(name,len)&mask;
+  const ScannerToken *st;
+  while((st=NameTable[h])!=0)
+  {
+    if(st->Length==len && sCmpMem(st->Name,name,len*sizeof(sChar))==0)
+      return st;
+    h = (h+1)&mask;
+  }
+  return 0;
 }
 
 void sScanner::Start(const sChar *text)
@@ -282,6 +381,7 @@ void sScanner::AddToken(const sChar *name,sInt token)
     TokensName.AddTail(tok);
   else
     TokensSym.AddTail(tok);
+  TokensDirty = 1;
 }
 
 void sScanner::RemoveToken(const sChar *name)
@@ -292,6 +392,7 @@ void sScanner::RemoveToken(const sChar *name)
     if (sCmpString(name, tok->Name) == 0)
     {
       TokensName.Rem(*tok);
+      TokensDirty = 1;
       return;
     }
   }
@@ -300,6 +401,7 @@ void sScanner::RemoveToken(const sChar *name)
     if (sCmpString(name, tok->Name) == 0)
     {
       TokensSym.Rem(*tok);
+      TokensDirty = 1;
       return;
     }
   }
@@ -432,10 +534,13 @@ sInt sScanner::Scan()
   static const sInt MaxValLen = sCOUNTOF(ValueString);
 
   sInt newline;
-  ScannerToken *st;
+  const ScannerToken *st;
   sString<256> &bp = ValueString;
   sInt bi=0;
 
+  if(TokensDirty)
+    SortTokens();
+
   Token = sTOK_ERROR;
   ValI = 0;
   ValF = 0;
@@ -594,13 +699,30 @@ morespace:
 
   // token?
 
-  sFORALL(TokensSym,st)           // this is a performance hotspot! make it table driven!
+  if(*s<256)
   {
-    if(sCmpMem(s,st->Name,st->Length*sizeof(sChar))==0)
+    for(sInt i=SymFirst[*s];i<SymFirst[*s+1];i++)
     {
-      Token = st->Token;
-      s += st->Length;
-      goto ende;
+      st = SymTable[i];
+      if(sCmpMem(s,st->Name,st->Length*sizeof(sChar))==0)
+      {
+        Token = st->Token;
+        s += st->Length;
+        goto ende;
+      }
+    }
+  }
+  else
+  {
+    for(sInt i=0;i<SymWide.GetCount();i++)   // rare, keep the linear scan
+    {
+      st = SymWide[i];
+      if(sCmpMem(s,st->Name,st->Length*sizeof(sChar))==0)
+      {
+        Token = st->Token;
+        s += st->Length;
+        goto ende;
+      }
     }
   }
 
@@ -729,26 +851,24 @@ morespace:
      (*s>=0xa0 && *s<=0xff && (Flags&sSF_UMLAUTS)) ||
      *s=='_')
   {
-    sInt i = 0;
+    const sChar *name = s;
     while((*s>='a' && *s<='z') || 
           (*s>='A' && *s<='Z') ||
           (*s>='0' && *s<='9') || 
           (*s>=0xa0 && *s<=0xff && (Flags&sSF_UMLAUTS)) ||
           *s=='_')
     {
-      TempString[i++]=*s++;
+      s++;
     }
-    Name.Init(TempString,i);
+    NameStart = name;
+    NameLength = sInt(s-name);
+    if(!(Flags & sSF_NOINTERN))
+      Name.Init(name,NameLength);
     Token = sTOK_NAME;
 
-    sFORALL(TokensName,st)
-    {
-      if(sCmpString(Name,st->Name)==0)
-      {
-        Token = st->Token;
-        break;
-      }
-    }
+    st = FindName(name,NameLength);
+    if(st)
+      Token = st->Token;
     goto ende;
   }
 
@@ -897,7 +1017,7 @@ ende:
 
 void sScanner::Print(sTextBuffer &tb)
 {
-  ScannerToken *st;
+  const ScannerToken *st;
   switch(Token)
   {
   case sTOK_END:
@@ -913,7 +1033,8 @@ void sScanner::Print(sTextBuffer &tb)
     tb.PrintF(L"%f ",ValF);
     break;
   case sTOK_NAME:
-    tb.PrintF(L"%s ",Name);
+    tb.Print(NameStart,NameLength);
+    tb.Print(L" ");
     break;
   case sTOK_STRING:
     tb.PrintF(L"\"%s\" ",String);
@@ -1140,7 +1261,10 @@ sBool sScanner::ScanName(sPoolString &ps)
   sBool r;
   if(Token==sTOK_NAME)
   {
-    ps = Name;
+    if(Flags & sSF_NOINTERN)
+      ps.Init(NameStart,NameLength);
+    else
+      ps = Name;
     r = 1;
   }
   else
@@ -1185,7 +1309,10 @@ sBool sScanner::ScanNameOrString(sPoolString &ps)
   sBool r;
   if(Token==sTOK_NAME)
   {
-    ps = Name;
+    if(Flags & sSF_NOINTERN)
+      ps.Init(NameStart,NameLength);
+    else
+      ps = Name;
     r = 1;
   }
   else if(Token==sTOK_STRING)
@@ -1275,7 +1402,15 @@ sBool sScanner::IfToken(sInt tok)
 
 sBool sScanner::IfName(const sPoolString name)
 {
-  if(Token==sTOK_NAME && Name == name)
+  sBool match = 0;
+  if(Token==sTOK_NAME)
+  {
+    if(Flags & sSF_NOINTERN)
+      match = sGetStringLen(name)==NameLength && sCmpMem(name,NameStart,NameLength*sizeof(sChar))==0;
+    else
+      match = (Name == name);
+  }
+  if(match)
   {
     Scan();
     return 1;
@@ -1312,7 +1447,7 @@ namespace sScannerUtil
   {
     switch(scan->Token)
     {
-    case sTOK_NAME:   scan->Error(L"unexpected identifier \"%s\"",scan->Name); break;
+    case sTOK_NAME:   scan->Error(L"unexpected identifier \"%s\"",sPoolString(scan->NameStart,scan->NameLength)); break;
     case sTOK_STRING: scan->Error(L"unexpected string\n"); break;
     default:          scan->Error(L"unexpected token\n"); break;
     }
@@ -71,7 +71,7 @@ public:
 
 class sScannerSourceFile : public sScannerSource
 {
-  sFile *File;
+  sFile *File;                       // 0 when the whole file was converted in Load()
   sChar *ScanBuffer;                 // buffer for portion of file
   sInt UnicodeConversion;            // when loading from file: 1=ascii->unicode, 2=unicode byteswap
   sS64 CharsLeftInFile;
@@ -90,6 +90,7 @@ public:
     BufferSize = 128*1024,          // size of scanbuffer lookahead
     LineSize = 32*1024,            // size of line (so much must be in scanbuffer before each token)
     Alignment = 64,               // when copying around scanbuffer remainder, use this alignment
+    WholeFileSize = 64*1024*1024, // files up to this size (in bytes) are mapped and converted at once
   };
 
 private:
@@ -121,6 +122,16 @@ public:
   sArray<ScannerToken> TokensSym;                       // symbol tokens: << != && ...
   sArray<ScannerToken> TokensName;                      // name tokens: do for while ...
 
+private:
+  sInt SymFirst[257];             // TokensSym bucketed by first character: SymTable[SymFirst[c]..SymFirst[c+1]]
+  sArray<const ScannerToken *> SymTable;
+  sArray<const ScannerToken *> SymWide;                 // TokensSym starting with a character >=256, longest first
+  sArray<const ScannerToken *> NameTable;               // hashtable for TokensName, size is a power of 2
+  sBool TokensDirty;              // rebuild tables before next Scan()
+  const ScannerToken *FindName(const sChar *name,sInt len);
+
+public:
+
   sScanner();
   ~sScanner();
   void Init();                                          // full initialisation, delete all tokens
@@ -154,7 +165,9 @@ public:
   sInt Token;
   sInt ValI;
   sF32 ValF;
-  sPoolString Name;
+  sPoolString Name;               // not set for sSF_NOINTERN
+  const sChar *NameStart;         // sTOK_NAME in scan buffer, valid until next Scan() or DirtyPeek()
+  sInt NameLength;
   sPoolString String;
   sString<256> ValueString;       // exact character representation of sTOK_INT or sTOK_FLOAT
   sString<256> ValueSuffix;       // optional suffix after number, like in "10u" or "40ull"
@@ -237,6 +250,7 @@ enum sScannerFlags
   sSF_MERGESTRINGS  = 0x0080,     // merge two sTOK_STRING when using ScanString().
   sSF_QUIET         = 0x0100,     // do not print errors automatically
   sSF_CPP           = 0x0200,     // c preprocessor #line and #error
+  sSF_NOINTERN      = 0x0400,     // do not add names to the string pool. use NameStart / NameLength
 };
 
 /****************************************************************************/
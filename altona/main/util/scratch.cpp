@@ -0,0 +1,197 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "util/scratch.hpp"
+#include "base/system.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Arena                                                              ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+sScratchArena::sScratchArena(sPtr blocksize)
+{
+  First = 0;
+  Current = 0;
+  Ptr = 0;
+  BlockSize = blocksize;
+  Used = 0;
+  Peak = 0;
+  HighWater = 0;
+  Reserved = 0;
+  NextArena = 0;
+}
+
+sScratchArena::~sScratchArena()
+{
+  Block *b = First;
+  while(b)
+  {
+    Block *n = b->Next;
+    sFreeMem(b->Start);
+    delete b;
+    b = n;
+  }
+}
+
+sU8 *sScratchArena::Alloc(sPtr size,sInt align)
+{
+  // fits into current block?
+
+  if(Current)
+  {
+    sU8 *p = sAlign(Ptr,align);
+    if(p+size<=Current->End)
+    {
+      Used += (p-Ptr)+size;
+      Ptr = p+size;
+      Peak = sMax(Peak,Used);
+      return p;
+    }
+  }
+
+  // blocks after the current one are free, find one that is big enough
+
+  Block *b = Current ? Current->Next : First;
+  while(b && sAlign(b->Start,align)+size>b->End)
+    b = b->Next;
+
+  if(!b)
+  {
+    sPtr bs = sMax(BlockSize,sAlign(size+align,BlockSize));
+    b = new Block;
+    b->Start = (sU8 *) sAllocMem(bs,16,0);
+    b->End = b->Start+bs;
+    if(Current)
+    {
+      b->Next = Current->Next;
+      Current->Next = b;
+    }
+    else
+    {
+      b->Next = First;
+      First = b;
+    }
+    Reserved += bs;
+  }
+
+  sU8 *p = sAlign(b->Start,align);
+  Used += (p-b->Start)+size;
+  Current = b;
+  Ptr = p+size;
+  Peak = sMax(Peak,Used);
+  return p;
+}
+
+sPtr sScratchArena::Reset(sPtr keep)
+{
+  sPtr peak = Peak;
+  HighWater = sMax(HighWater,Peak);
+  Current = 0;
+  Ptr = 0;
+  Used = 0;
+  Peak = 0;
+
+  // blocks beyond keep bytes go back to the heap
+
+  sPtr total = 0;
+  Block **link = &First;
+  while(*link)
+  {
+    Block *b = *link;
+    sPtr bs = b->End-b->Start;
+    if(total+bs<=keep)
+    {
+      total += bs;
+      link = &b->Next;
+    }
+    else
+    {
+      *link = b->Next;
+      Reserved -= bs;
+      sFreeMem(b->Start);
+      delete b;
+    }
+  }
+
+  return peak;
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Per Thread                                                         ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+static sPtr ScratchTls;
+static sThreadLock *ScratchLock;
+static sScratchArena *ScratchArenas;
+
+static void sInitScratch()
+{
+  ScratchTls = sAllocTls(sizeof(sScratchArena *),sizeof(sScratchArena *));
+  ScratchLock = new sThreadLock;
+  ScratchArenas = 0;
+}
+
+static void sExitScratch()
+{
+  while(ScratchArenas)
+  {
+    sScratchArena *a = ScratchArenas;
+    ScratchArenas = a->NextArena;
+    delete a;
+  }
+  sDelete(ScratchLock);
+}
+
+sADDSUBSYSTEM(Scratch,0x18,sInitScratch,sExitScratch);
+
+/****************************************************************************/
+
+sScratchArena *sGetScratch()
+{
+  sVERIFY(ScratchLock);
+  sScratchArena **slot = sGetTls<sScratchArena *>(ScratchTls);
+  if(!*slot)
+  {
+    sScratchArena *a = new sScratchArena;
+    ScratchLock->Lock();
+    a->NextArena = ScratchArenas;
+    ScratchArenas = a;
+    ScratchLock->Unlock();
+    *slot = a;
+  }
+  return *slot;
+}
+
+sPtr sResetScratch(sPtr keep)
+{
+  sPtr peak = 0;
+  ScratchLock->Lock();
+  for(sScratchArena *a=ScratchArenas;a;a=a->NextArena)
+    peak += a->Reset(keep);
+  ScratchLock->Unlock();
+  return peak;
+}
+
+void sGetScratchStats(sScratchStats &stats)
+{
+  sClear(stats);
+  ScratchLock->Lock();
+  for(sScratchArena *a=ScratchArenas;a;a=a->NextArena)
+  {
+    stats.Arenas++;
+    stats.HighWater += sMax(a->GetHighWater(),a->GetPeak());
+    stats.Reserved += a->GetReserved();
+  }
+  ScratchLock->Unlock();
+}
+
+/****************************************************************************/
+
@@ -0,0 +1,108 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_UTIL_SCRATCH_HPP
+#define FILE_UTIL_SCRATCH_HPP
+
+#include "base/types.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Scratch Memory                                                     ***/
+/***                                                                      ***/
+/****************************************************************************/
+/***                                                                      ***/
+/***   Every thread has an arena for temporaries that do not outlive a    ***/
+/***   bigger unit of work, like one operator in wz4.                     ***/
+/***   + allocation is a pointer bump, there is no free                   ***/
+/***   + blocks are kept after a reset, so the heap only sees growth      ***/
+/***   - constructors / destructors are not called                        ***/
+/***   - memory is only valid until the enclosing sScratchScope ends or   ***/
+/***     the owner of the unit of work calls sResetScratch()              ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+class sScratchArena
+{
+  struct Block
+  {
+    sU8 *Start;
+    sU8 *End;
+    Block *Next;
+  };
+  Block *First;
+  Block *Current;
+  sU8 *Ptr;                       // next free byte in Current
+  sPtr BlockSize;
+  sPtr Used;                      // bytes handed out since last reset
+  sPtr Peak;                      // max Used since last reset
+  sPtr HighWater;                 // max Used ever
+  sPtr Reserved;                  // sum of all block sizes
+public:
+  struct Mark
+  {
+    Block *B;
+    sU8 *Ptr;
+    sPtr Used;
+  };
+
+  sScratchArena *NextArena;       // list of all arenas, see sResetScratch()
+
+  sScratchArena(sPtr blocksize=1024*1024);
+  ~sScratchArena();
+
+  sU8 *Alloc(sPtr size,sInt align=16);
+  template <typename T> T *Alloc(sPtr n) { return (T *) Alloc(sizeof(T)*n,sMax<sInt>(sALIGNOF(T),16)); }
+
+  Mark GetMark() const { Mark m; m.B = Current; m.Ptr = Ptr; m.Used = Used; return m; }
+  void Release(const Mark &m) { Current = m.B; Ptr = m.Ptr; Used = m.Used; }
+  sPtr Reset(sPtr keep);          // free everything, keep blocks up to keep bytes. returns peak
+
+  sPtr GetUsed() const { return Used; }
+  sPtr GetPeak() const { return Peak; }
+  sPtr GetHighWater() const { return HighWater; }
+  sPtr GetReserved() const { return Reserved; }
+};
+
+/****************************************************************************/
+
+// the arena of the calling thread, created on first use
+
+sScratchArena *sGetScratch();
+
+// allocations inside the scope are freed when it ends. use this for
+// temporaries in code that is also called outside of operators.
+
+class sScratchScope
+{
+  sScratchArena *Arena;
+  sScratchArena::Mark Mark;
+public:
+  sScratchScope() { Arena = sGetScratch(); Mark = Arena->GetMark(); }
+  ~sScratchScope() { Arena->Release(Mark); }
+  template <typename T> T *Alloc(sPtr n) { return Arena->Alloc<T>(n); }
+};
+
+// reset the arenas of all threads. only call this when no other thread
+// is using scratch memory, like between two operators.
+// returns the sum of the peak usage of all arenas since the last reset.
+
+sPtr sResetScratch(sPtr keep=64*1024*1024);
+
+struct sScratchStats
+{
+  sInt Arenas;
+  sPtr HighWater;                 // sum of all arenas
+  sPtr Reserved;
+};
+
+void sGetScratchStats(sScratchStats &stats);
+
+/****************************************************************************/
+
+#endif // FILE_UTIL_SCRATCH_HPP
+
@@ -40,6 +40,7 @@ static sINLINE sSSE sVecZero()                          { return _mm_setzero_ps(
 static sINLINE sSSE sVecLoad(const void *ptr)           { return _mm_load_ps((sF32*) ptr); }
 static sINLINE sSSE sVecLoadU(const void *ptr)          { return _mm_loadu_ps((sF32*) ptr); }
 static sINLINE sSSE sVecLoadScalar(sF32 x)              { return _mm_set1_ps(x); }
+static sINLINE sSSE sVecSet(sF32 x,sF32 y,sF32 z,sF32 w) { return _mm_setr_ps(x,y,z,w); }
 static sINLINE void sVecStore(sSSE vec,void *ptr)       { _mm_store_ps((sF32*) ptr,vec); }
 static sINLINE void sVecStoreU(sSSE vec,void *ptr)      { _mm_storeu_ps((sF32*) ptr,vec); }
 #define sVecStoreElem(v,ptr,i)                          (_mm_store_ss((sF32*) (ptr),_mm_shuffle_ps(v,v,(i)*0x55)))
@@ -69,6 +70,8 @@ static sINLINE sSSE sVecMAdd(sSSE a,sSSE b,sSSE c)      { return _mm_add_ps(_mm_
 static sINLINE sSSE sVecNMSub(sSSE a,sSSE b,sSSE c)     { return _mm_sub_ps(c,_mm_mul_ps(a,b)); }
 static sINLINE sSSE sVecRcp(sSSE a)                     { return _mm_rcp_ps(a); }
 static sINLINE sSSE sVecRSqrt(sSSE a)                   { return _mm_rsqrt_ps(a); }
+static sINLINE sSSE sVecSqrt(sSSE a)                    { return _mm_sqrt_ps(a); }
+static sINLINE sSSE sVecDiv(sSSE a,sSSE b)              { return _mm_div_ps(a,b); }
 static sINLINE sSSE sVecMax(sSSE a,sSSE b)              { return _mm_max_ps(a,b); }
 static sINLINE sSSE sVecMin(sSSE a,sSSE b)              { return _mm_min_ps(a,b); }
 
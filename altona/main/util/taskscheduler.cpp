@@ -9,6 +9,7 @@
 #include "util/taskscheduler.hpp"
 #include "base/graphics.hpp"
 #include "util/shaders.hpp"
+#include "util/perftrace.hpp"
 
 static sU32 StatSpin;
 static sU32 StatLock;
@@ -918,6 +919,8 @@ sStsPerfMon::sStsPerfMon()
     OldDatas[i] = new Entry[DataCount];
   }
   Enable = 1;
+  TimeStart = OldStart = OldEnd = sGetTimeStamp();
+  TimeStartUS = OldStartUS = OldEndUS = sGetTimeUS();
 
   Geo = new sGeometry(sGF_QUADLIST,sVertexFormatBasic);
   Mtrl = new sSimpleMaterial;
@@ -956,6 +959,7 @@ void sStsPerfMon::FlipFrame()
 {
   sInt **c = Counters;
   Entry **d = Datas;
+  sBool swapped = 0;
 
   Enable = 0;
   sWriteBarrier();
@@ -979,10 +983,56 @@ void sStsPerfMon::FlipFrame()
     sWriteBarrier();
     OldStart = TimeStart;
     OldEnd = TimeStart = sGetTimeStamp();
+    OldStartUS = TimeStartUS;
+    OldEndUS = TimeStartUS = sGetTimeUS();
+    swapped = 1;
   }
 
   sWriteBarrier();
   Enable = 1;
+
+  if(swapped)
+    ExportTrace();
+}
+
+// the boxes of the frame that just ended go to the trace. timestamps may
+// be cpu ticks, so they are mapped linearly onto the frame in microseconds
+
+void sStsPerfMon::ExportTrace()
+{
+#if sPERFMON_ENABLED
+  if(!sPerfTraceInited() || OldEnd<=OldStart) return;
+
+  sF64 scale = sF64(OldEndUS-OldStartUS)/sF64(OldEnd-OldStart);
+  for(sInt i=0;i<ThreadCount;i++)
+  {
+    sInt max = *OldCounters[i];
+    if(max>=DataCount) continue;
+
+    Entry *d = OldDatas[i];
+    sU32 start[16];
+    sU32 color[16];
+    sInt depth = 0;
+    for(sInt j=0;j<max;j++)
+    {
+      if(d[j].Color)
+      {
+        if(depth<16)
+        {
+          start[depth] = d[j].Timestamp;
+          color[depth] = d[j].Color;
+        }
+        depth++;
+      }
+      else if(depth>0)
+      {
+        depth--;
+        if(depth<16)
+          sPerfTraceTask(i,OldStartUS+sU64(start[depth]*scale),OldStartUS+sU64(d[j].Timestamp*scale),color[depth]);
+      }
+    }
+  }
+#endif
 }
 
 /****************************************************************************/
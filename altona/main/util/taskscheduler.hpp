@@ -272,6 +272,9 @@ class sStsPerfMon
   sU64 OldStart;
   sU64 OldEnd;
   sU64 TimeStart;
+  sU64 OldStartUS;                // same in sGetTimeUS(), for sPerfTraceTask()
+  sU64 OldEndUS;
+  sU64 TimeStartUS;
   sInt Enable;
 
   sRect *Rects;
@@ -282,6 +285,7 @@ class sStsPerfMon
   struct sVertexBasic *GeoPtr;
   void Box(sF32 x0,sF32 y0,sF32 x1,sF32 y1,sU32 col);
   void BoxEnd();
+  void ExportTrace();
 public:
   sStsPerfMon();
   ~sStsPerfMon();
@@ -23,6 +23,8 @@ wBuilder::wBuilder() : RecursionData(0)
   CallId = 1;
   CurrentCallId = 0;
   TypeCheckOnly = 0;
+  CutCached = 0;
+  Stats.Clear();
 }
 
 wBuilder::~wBuilder()
@@ -121,7 +123,6 @@ sBool wBuilder::Parse(wOp *root)
 
 wNode *wBuilder::ParseR(wOp *op,sInt recursion)
 {
-  wOpInputInfo *info;
   wOp *op2;
 
   // pre checks
@@ -143,6 +144,22 @@ wNode *wBuilder::ParseR(wOp *op,sInt recursion)
     sRelease(op->Cache);
   }
 
+  // allocate temp memory for inputs
+
+  if(RecursionData[recursion]==0)
+    RecursionData[recursion] = new RecursionData_;
+  RecursionData_ *rd = RecursionData[recursion];
+  sArray<wOp *> &inputs = rd->inputs;
+  sEndlessArray<sInt> &inputloop = rd->inputloop;
+
+  if(CutCached && op->Cache && op->Cache->CallId==CurrentCallId 
+    && !(op->Class->Flags & (wCF_CALL|wCF_INPUT|wCF_LOOP|wCF_ENDLOOP)))
+  {
+    wNode *node = CutCache(op,inputs);
+    if(node)
+      return node;
+  }
+
   if(op->CycleCheck!=0) 
   {
     Error(op,L"cyclic connection");
@@ -156,81 +173,10 @@ wNode *wBuilder::ParseR(wOp *op,sInt recursion)
   if(op->ConnectError)
     Error(op,L"connect error");
 
-  // allocate temp memory for inputs
+  // map inputs
 
-  if(RecursionData[recursion]==0)
-    RecursionData[recursion] = new RecursionData_;
-  RecursionData_ *rd = RecursionData[recursion];
-  sArray<wOp *> &inputs = rd->inputs;
-  inputs.Clear();
-  sEndlessArray<sInt> &inputloop = rd->inputloop;
   inputloop.Clear();
-  inputs.HintSize(op->Inputs.GetCount()+op->Links.GetCount());
-
-  // map inputs: inputs, links and defaults
-  
-  sInt index = 0;
-  sInt lastlink = -1;
-  sInt max = op->Inputs.GetCount();
-  sBool choose = 0;
-  sFORALL(op->Links,info)
-  {
-    if((op->Class->Inputs[_i].Flags & wCIF_METHODMASK)==wCIF_METHODCHOOSE)
-      choose = 1;
-    sBool optional = op->Class->Inputs[_i].Flags & wCIF_OPTIONAL;
-    wOp *in = 0;
-    switch(info->Select)
-    {
-    case 0:
-      if(index<max)
-        in = op->Inputs[index++];
-      break;
-    case 1:
-      in = info->Link;
-      lastlink = inputs.GetCount();
-      break;
-    case 2:
-      in = 0;
-      lastlink = inputs.GetCount();
-      break;
-    default:
-      if(info->Select>=3 && info->Select<3+max)
-        in = op->Inputs[info->Select-3];
-      lastlink = inputs.GetCount();
-      break;
-    }
-    info->DefaultUsed = 0;
-    if(info->Default && !in)
-    {
-      in = info->Default;
-      info->DefaultUsed = 1;
-    }
-
-    inputs.AddTail(in);
-
-    if(!optional && in==0)
-      Error(op,L"required input is missing");
-    if(op->Class->Inputs[_i].Flags & wCIF_WEAK && in)
-      in->WeakOutputs.AddTail(op);
-  }
-
-  // map inputs: append varargs
-
-  if(op->Class->Flags & wCF_VARARGS)
-  {
-    while(index<max)
-    {
-      wOp *in = op->Inputs[index++];
-      inputs.AddTail(in);
-    }
-  }
-  else if(!choose)
-  {
-    if(inputs.GetCount() != op->Class->Inputs.GetCount())
-      Error(op,L"too few inputs");
-    if(index!=max)
-      Error(op,L"too many inputs");
-  }
+  sInt lastlink = MapInputs(op,inputs,1);
 
   // perform loop op
 
@@ -375,6 +321,7 @@ wNode *wBuilder::ParseR(wOp *op,sInt recursion)
     op->BuilderNode = node;
     op->BuilderNodeCallId = CurrentCallId;
     AllNodes.AddTail(node);
+    Stats.Nodes++;
 
     for(sInt i=0;i<inputs.GetCount();i++)
     {
@@ -446,6 +393,164 @@ wNode *wBuilder::ParseR(wOp *op,sInt recursion)
 
 /****************************************************************************/
 
+// map inputs: inputs, links and defaults, then the varargs. returns the
+// last link, the loop ops after it are expanded by ParseR(). errors are only
+// reported when parsing, CutCache() uses this to count outputs.
+
+sInt wBuilder::MapInputs(wOp *op,sArray<wOp *> &inputs,sBool parse)
+{
+  wOpInputInfo *info;
+
+  inputs.Clear();
+  inputs.HintSize(op->Inputs.GetCount()+op->Links.GetCount());
+
+  sInt index = 0;
+  sInt lastlink = -1;
+  sInt max = op->Inputs.GetCount();
+  sBool choose = 0;
+  sFORALL(op->Links,info)
+  {
+    if((op->Class->Inputs[_i].Flags & wCIF_METHODMASK)==wCIF_METHODCHOOSE)
+      choose = 1;
+    sBool optional = op->Class->Inputs[_i].Flags & wCIF_OPTIONAL;
+    wOp *in = 0;
+    switch(info->Select)
+    {
+    case 0:
+      if(index<max)
+        in = op->Inputs[index++];
+      break;
+    case 1:
+      in = info->Link;
+      lastlink = inputs.GetCount();
+      break;
+    case 2:
+      in = 0;
+      lastlink = inputs.GetCount();
+      break;
+    default:
+      if(info->Select>=3 && info->Select<3+max)
+        in = op->Inputs[info->Select-3];
+      lastlink = inputs.GetCount();
+      break;
+    }
+    info->DefaultUsed = 0;
+    if(info->Default && !in)
+    {
+      in = info->Default;
+      info->DefaultUsed = 1;
+    }
+
+    inputs.AddTail(in);
+
+    if(parse)
+    {
+      if(!optional && in==0)
+        Error(op,L"required input is missing");
+      if(op->Class->Inputs[_i].Flags & wCIF_WEAK && in)
+        in->WeakOutputs.AddTail(op);
+    }
+  }
+
+  // append varargs
+
+  if(op->Class->Flags & wCF_VARARGS)
+  {
+    while(index<max)
+    {
+      wOp *in = op->Inputs[index++];
+      inputs.AddTail(in);
+    }
+  }
+  else if(!choose && parse)
+  {
+    if(inputs.GetCount() != op->Class->Inputs.GetCount())
+      Error(op,L"too few inputs");
+    if(index!=max)
+      Error(op,L"too many inputs");
+  }
+
+  return lastlink;
+}
+
+/****************************************************************************/
+
+// the cache of an op stands for the whole subgraph above it. instead of
+// walking that subgraph just to throw it away in OptimizeCacheR(), 
+// we load the cache right here. the inputs the op would have been parsed
+// with remember that they still have a (cached) output for this call id,
+// so the caching decision for PASSOUTPUT ops stays the same as with a full
+// parse.
+// a loop input would be parsed once per iteration with other call ids,
+// those ops are not cut. an input that needs a conversion is counted
+// directly, with a full parse a conversion shared by several outputs
+// would count only once.
+
+wNode *wBuilder::CutCache(wOp *op,sArray<wOp *> &inputs)
+{
+  sInt lastlink = MapInputs(op,inputs,0);
+  for(sInt i=lastlink+1;i<inputs.GetCount();i++)
+    if(inputs[i] && (inputs[i]->Class->Flags & wCF_LOOP))
+      return 0;
+
+  wNode *node = MakeNode(0);
+  node->Op = op;
+  node->LoadCache = 1;
+  node->OutType = op->Cache->Type;
+  node->CallId = CurrentCallId;
+  op->BuilderNode = node;
+  op->BuilderNodeCallId = CurrentCallId;
+  op->CacheLRU = Doc->CacheLRU++;
+  AllNodes.AddTail(node);
+
+  wOp *in;
+  sFORALL(inputs,in)
+    if(in)
+      AddCut(in);
+
+  Stats.Nodes++;
+  Stats.CacheCuts++;
+  return node;
+}
+
+void wBuilder::AddCut(wOp *op)
+{
+  for(sInt i=op->BuilderCut-1;i>=0;i=CutInputs[i].Next)
+  {
+    if(CutInputs[i].CallId==CurrentCallId)
+    {
+      CutInputs[i].Outputs++;
+      return;
+    }
+  }
+
+  wBuilderCut *cut = CutInputs.AddMany(1);
+  cut->Op = op;
+  cut->CallId = CurrentCallId;
+  cut->Outputs = 1;
+  cut->Next = op->BuilderCut-1;
+  op->BuilderCut = CutInputs.GetCount();
+}
+
+sInt wBuilder::CutOutputs(wNode *node)
+{
+  for(sInt i=node->Op->BuilderCut-1;i>=0;i=CutInputs[i].Next)
+    if(CutInputs[i].CallId==node->CallId)
+      return CutInputs[i].Outputs;
+  return 0;
+}
+
+void wBuilder::EndCut()
+{
+  wBuilderCut *cut;
+  sFORALL(CutInputs,cut)
+    cut->Op->BuilderCut = 0;
+  CutInputs.Clear();
+  CutCached = 0;
+}
+
+/****************************************************************************/
+
 sBool wBuilder::TypeCheck()
 {
   wNode *node;
@@ -481,7 +586,7 @@ void wBuilder::OptimizeCacheR(wNode **node)
   if((*node)->Visited!=1)
   {
     wOp *op = (*node)->Op;
-    if(op)
+    if(op && !(*node)->LoadCache)
     {
       if(op->Cache && op->Cache->CallId==(*node)->CallId)
       {
@@ -598,9 +703,13 @@ sBool wBuilder::Optimize(sBool cache)
   // count outputs
 
   sFORALL(AllNodes,node)
+  {
     for(sInt i=0;i<node->InputCount;i++)
       if(node->Inputs[i])
         node->Inputs[i]->OutputCount++;
+    if(node->Op && node->Op->BuilderCut)
+      node->OutputCount += CutOutputs(node);
+  }
 
   // add loadcache and storecache
 
@@ -688,6 +797,7 @@ wCommand *wBuilder::MakeCommand(wExecutive &exe,wOp *op,wCommand **inputs,sInt i
     cmd->Inputs[i] = inputs[i];
 
   exe.Commands.AddTail(cmd);
+  Stats.Commands++;
 
   return cmd;
 }
@@ -889,6 +999,9 @@ wObject *wBuilder::Execute(wExecutive &exe,wOp *root,sBool honorslow,sBool progr
   exe.MemPool->Reset();
   wObject *result = 0;
   TypeCheckOnly = 0;
+  CutCached = 1;
+  Stats.Clear();
+  sU64 time = sGetTimeUS();
 
   if(!Parse(root)) goto ende;
   if(!Optimize(1)) goto ende;
@@ -903,12 +1016,19 @@ wObject *wBuilder::Execute(wExecutive &exe,wOp *root,sBool honorslow,sBool progr
   else
   {
     if(!Output(exe)) goto ende;
+    Stats.PlanTime = sGetTimeUS()-time;
+    time = sGetTimeUS();
     if(exe.Commands.GetCount()>0)
       result = exe.Execute(progress);
+    Stats.ExecTime = sGetTimeUS()-time;
+    time = 0;
   }
 
 ende:
 
+  if(time)
+    Stats.PlanTime = sGetTimeUS()-time;
+  EndCut();
   exe.Commands.Clear();
   sFORALL(AllNodes,node)
   {
@@ -969,6 +1089,7 @@ wObject *wBuilder::FindCache(wOp *root)
 {
   wNode *node;
   wObject *result = 0;
+  CutCached = 1;
 
   if(!Parse(root)) goto ende;
   if(!Optimize(1)) goto ende;
@@ -982,6 +1103,7 @@ wObject *wBuilder::FindCache(wOp *root)
 
 ende:
 
+  EndCut();
   sFORALL(AllNodes,node)
   {
     if(node->Op)
@@ -43,6 +43,25 @@ struct wNode
   wCommand *StoreCacheDone;       // use the store cache!
 };
 
+struct wBuilderStats              // cost of the last build, for the fps display
+{
+  sInt Nodes;                     // nodes created by parsing
+  sInt CacheCuts;                 // cached ops that were not walked into
+  sInt Commands;                  // commands handed to the executive
+  sU64 PlanTime;                  // microseconds for parse, optimize and output
+  sU64 ExecTime;                  // microseconds for execution
+
+  void Clear() { sClear(*this); }
+};
+
+struct wBuilderCut                // outputs of an op that were not parsed because they are cached
+{
+  wOp *Op;
+  sInt CallId;                    // the outputs only count for the node with this call id
+  sInt Outputs;
+  sInt Next;                      // next entry of the same op, -1 for none
+};
+
 struct wBuilderPush
 {
   wNode *CallInputs;
@@ -71,6 +90,11 @@ class wBuilder
   void Error(wOp *op,sChar *text);
   sInt Errors;
   void rssall(wNode *node,sInt flag);
+  sInt MapInputs(wOp *op,sArray<wOp *> &inputs,sBool parse);
+  wNode *CutCache(wOp *op,sArray<wOp *> &inputs);
+  void AddCut(wOp *op);
+  sInt CutOutputs(wNode *node);
+  void EndCut();
 
   wNode *CallInputs;
   wOp *CallOp;
@@ -79,6 +103,8 @@ class wBuilder
   sInt CurrentCallId;
   sInt TypeCheckOnly;
   sInt LoopFlag;
+  sBool CutCached;                // stop parsing at ops with a valid cache
+  sArray<wBuilderCut> CutInputs;  // inputs of cut ops, their BuilderCut must be cleared
 
 
   struct RecursionData_
@@ -104,6 +130,7 @@ public:
   wObject *FindCache(wOp *root);
 
   sArray<wNode *> AllNodes;
+  wBuilderStats Stats;
 };
 
 /****************************************************************************/
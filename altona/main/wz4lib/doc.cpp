@@ -13,6 +13,7 @@
 #include "base/system.hpp"
 #include "util/image.hpp"
 #include "util/scanner.hpp"
+#include "util/scratch.hpp"
 #include "wz4lib/serials.hpp"
 #include "wz4lib/script.hpp"
 #include "wz4lib/basic_ops.hpp"
@@ -1084,6 +1085,133 @@ void wClass::Tag()
 /***                                                                      ***/
 /****************************************************************************/
 
+wStackIndex::wStackIndex()
+{
+  Query = 0;
+}
+
+void wStackIndex::Update(const sArray<wStackOp *> &ops)
+{
+  sInt max = ops.GetCount();
+  sBool same = CellStart.GetCount()>0 && Entries.GetCount()==max;
+  for(sInt i=0;i<max && same;i++)
+  {
+    const Entry *e = &Entries[i];
+    const wStackOp *op = ops[i];
+    same = e->Op==op && e->x0==op->PosX && e->y0==op->PosY
+        && e->x1==op->PosX+op->SizeX && e->y1==op->PosY+op->SizeY;
+  }
+  if(same)
+    return;
+
+  Entries.Resize(max);
+  for(sInt i=0;i<max;i++)
+  {
+    Entry *e = &Entries[i];
+    wStackOp *op = ops[i];
+    e->Op = op;
+    e->x0 = op->PosX;
+    e->y0 = op->PosY;
+    e->x1 = op->PosX+op->SizeX;
+    e->y1 = op->PosY+op->SizeY;
+    e->Mark = 0;
+  }
+  Query = 0;
+  Rebuild();
+}
+
+void wStackIndex::Rebuild()
+{
+  Entry *e;
+  sInt cells = GRIDX*GRIDY;
+
+  // count, then fill. ops outside the page go to the border cells
+
+  CellStart.Resize(cells+1);
+  for(sInt i=0;i<=cells;i++)
+    CellStart[i] = 0;
+
+  for(sInt pass=0;pass<2;pass++)
+  {
+    sFORALL(Entries,e)
+    {
+      sInt cx0 = sClamp(e->x0/CELLX,0,GRIDX-1);
+      sInt cy0 = sClamp(e->y0/CELLY,0,GRIDY-1);
+      sInt cx1 = sClamp((e->x1-1)/CELLX,0,GRIDX-1);
+      sInt cy1 = sClamp((e->y1-1)/CELLY,0,GRIDY-1);
+      for(sInt y=cy0;y<=cy1;y++)
+      {
+        for(sInt x=cx0;x<=cx1;x++)
+        {
+          if(pass==0)
+            CellStart[y*GRIDX+x+1]++;
+          else
+            CellList[Found[y*GRIDX+x]++] = _i;
+        }
+      }
+    }
+
+    if(pass==0)
+    {
+      for(sInt i=0;i<cells;i++)
+        CellStart[i+1] += CellStart[i];
+      CellList.Resize(CellStart[cells]);
+      Found.Resize(cells);
+      for(sInt i=0;i<cells;i++)
+        Found[i] = CellStart[i];
+    }
+  }
+}
+
+void wStackIndex::Find(sInt x0,sInt y0,sInt x1,sInt y1,sArray<wStackOp *> &found)
+{
+  found.Clear();
+  if(Entries.GetCount()==0)
+    return;
+
+  if(++Query==0)
+  {
+    Entry *e;
+    sFORALL(Entries,e)
+      e->Mark = 0;
+    Query = 1;
+  }
+
+  // same test as sRect::IsInside(), which is also true for an empty rect
+  // inside an op
+
+  sInt cx0 = sClamp(sMin(x0,x1-1)/CELLX,0,GRIDX-1);
+  sInt cy0 = sClamp(sMin(y0,y1-1)/CELLY,0,GRIDY-1);
+  sInt cx1 = sClamp(sMax(x0,x1-1)/CELLX,0,GRIDX-1);
+  sInt cy1 = sClamp(sMax(y0,y1-1)/CELLY,0,GRIDY-1);
+
+  Found.Clear();
+  for(sInt y=cy0;y<=cy1;y++)
+  {
+    for(sInt x=cx0;x<=cx1;x++)
+    {
+      sInt c = y*GRIDX+x;
+      for(sInt i=CellStart[c];i<CellStart[c+1];i++)
+      {
+        Entry *e = &Entries[CellList[i]];
+        if(e->Mark!=Query)
+        {
+          e->Mark = Query;
+          if(e->x0<x1 && e->x1>x0 && e->y0<y1 && e->y1>y0)
+            Found.AddTail(CellList[i]);
+        }
+      }
+    }
+  }
+
+  sHeapSortUp(Found);
+  found.HintSize(Found.GetCount());
+  for(sInt i=0;i<Found.GetCount();i++)
+    found.AddTail(Entries[Found[i]].Op);
+}
+
+/****************************************************************************/
+
 wPage::wPage()
 {
   IsTree = 0;
@@ -1135,9 +1263,14 @@ void wPage::DefaultName()
 }
 
 sBool wPage::CheckDest(wOp *op0,sInt x,sInt y,sInt w,sInt h,sBool move)
+{
+  Index.Update(Ops);
+  return TestDest(op0,x,y,w,h,move);
+}
+
+sBool wPage::TestDest(wOp *op0,sInt x,sInt y,sInt w,sInt h,sBool move)
 {
   wStackOp *op;
-  sRect r0,r1;
 
   if(x<0 || x+w>=wPAGEXS) return 0;
   if(y<0 || y+h>=wPAGEYS) return 0;
@@ -1145,17 +1278,13 @@ sBool wPage::CheckDest(wOp *op0,sInt x,sInt y,sInt w,sInt h,sBool move)
   if(op0 && op0->Class->Flags & wCF_COMMENT)
     return 1;
 
-  r0.Init(x,y,x+w,y+h);
-  sFORALL(Ops,op)
+  Index.Find(x,y,x+w,y+h,Found);
+  sFORALL(Found,op)
   {
     if(!(op->Class->Flags & wCF_COMMENT))
     {
       if(!move || !op->Select)
-      {
-        r1.Init(op->PosX,op->PosY,op->PosX+op->SizeX,op->PosY+op->SizeY);
-        if(r0.IsInside(r1))
-          return 0;
-      }
+        return 0;
     }
   }
   return 1;
@@ -1165,11 +1294,12 @@ sBool wPage::CheckMove(sInt dx,sInt dy,sInt dw,sInt dh,sBool move)
 {
   wStackOp *op0;
 
+  Index.Update(Ops);
   sFORALL(Ops,op0)
   {
     if(op0->Select)
     {
-      if(!CheckDest(op0,
+      if(!TestDest(op0,
          op0->PosX+dx,
          op0->PosY+dy,
          sClamp(op0->SizeX+dw,1,wPAGEXS-op0->SizeX-dw),
@@ -1232,6 +1362,7 @@ wOp::wOp() : SelectedHandles(0)
   Cache = 0;
   BuilderNodeCallId = 0;
   BuilderNodeCallerId = 0;
+  BuilderCut = 0;
   WeakCache = 0;
   CalcTemp = 0;
   BuilderNode = 0;
@@ -2560,6 +2691,7 @@ wDocument::wDocument()
   LowQuality = 0;
   IsCacheWarmup = 0;
   BlockedChanges = 0;
+  FlushCachesHook = new sHooks;
 
   ShellSwitches = 0;
   for(sInt i=0;i<wSWITCHES;i++)
@@ -2601,6 +2733,7 @@ wDocument::~wDocument()
 {
   delete Exe;
   delete Builder;
+  delete FlushCachesHook;
 }
 
 void wDocument::Finalize()
@@ -2982,25 +3115,20 @@ void wDocument::ConnectStack(wPage *page)
   }
   ops.Resize(max);
 
-  sSortUp(ops,&wStackOp::PosY);
+  sHeapSortUp(ops,&wStackOp::PosY);
 
-  // connection
+  // connection: ops that start right below op0 and overlap it
 
-  max = ops.GetCount();
+  wStackIndex *index = page->GetIndex();
+  sArray<wStackOp *> below;
   sFORALL(ops,op0)
   {
-    sInt j = _i+1;
-    while(j<max && ops[j]->PosY <  op0->PosY+op0->SizeY) j++;
-    while(j<max && ops[j]->PosY == op0->PosY+op0->SizeY)
+    sInt y = op0->PosY+op0->SizeY;
+    index->Find(op0->PosX,y,op0->PosX+op0->SizeX,y+1,below);
+    sFORALL(below,op1)
     {
-      op1 = ops[j];
-
-      if(op0->PosX < op1->PosX+op1->SizeX && op1->PosX < op0->PosX+op0->SizeX)
-      {
+      if(op1->PosY==y && op1!=op0 && !(op1->Class->Flags & wCF_COMMENT) && op1->CheckShellSwitch())
         op1->Inputs.AddTail(op0);
-      }
-
-      j++;
     }
   }
 
@@ -3146,6 +3274,7 @@ void wDocument::FlushCaches()
 
     op->BuilderNodeCallerId = 0;
   }
+  FlushCachesHook->Call();
 
   Connect();
 }
@@ -4113,6 +4242,7 @@ void ProgressPaint(sInt count,sInt max)
 }
 
 void (*ProgressPaintFunc)(sInt count, sInt max) = ProgressPaint;
+void (*CommandProfileFunc)(wCommand *cmd,const wCommandProfile &prof) = 0;
 
 wObject *wExecutive::Execute(sBool progress,sBool depend)
 {
@@ -4161,6 +4291,24 @@ wObject *wExecutive::Execute(sBool progress,sBool depend)
       ok = 1;
       if(allok)
       {
+        wCommandProfile prof;
+        if(CommandProfileFunc)
+        {
+          prof.TimeUS = sGetTimeUS();
+          prof.Allocs = sGetMemoryAllocId();
+          prof.Bytes = sMemoryUsed;
+        }
+
+        // objects may be kept in a compact form (like instanced meshes)
+        // until an op needs to look inside
+
+        if(!depend && cmd->Code && !(cmd->Op && (cmd->Op->Class->Flags & wCF_LAZYINPUT)))
+        {
+          for(sInt i=0;i<cmd->InputCount;i++)
+            if(cmd->Inputs[i] && cmd->Inputs[i]->Output)
+              cmd->Inputs[i]->Output->Expand();
+        }
+
         sVERIFY(cmd->Output==0);
         if(cmd->Op && cmd->Op->WeakCache)
         {
@@ -4321,6 +4469,20 @@ wObject *wExecutive::Execute(sBool progress,sBool depend)
           }
         }
 
+        // temporaries of the op (and its worker threads) are dead now
+
+        sPtr scratch = depend ? 0 : sResetScratch();
+
+        if(CommandProfileFunc && !depend)
+        {
+          prof.Scratch = scratch;
+          prof.TimeUS = sGetTimeUS()-prof.TimeUS;
+          prof.Allocs = sGetMemoryAllocId()-prof.Allocs;
+          prof.Bytes = sDInt(sMemoryUsed)-prof.Bytes;
+          prof.Ok = ok;
+          (*CommandProfileFunc)(cmd,prof);
+        }
+
         // gather globals (inputs + script)
 
         if(allok)
@@ -389,6 +389,7 @@ enum wClassFlags
   wCF_SHELLSWITCH     = 0x00400000, // modify build: depending on shell switch, use either input
   wCF_TYPEFROMINPUT   = 0x00800000, // op is tagged as AnyType, but actual type is same as input#0
   wCF_BLOCKCHANGE     = 0x01000000, // do not propagate changes to childs
+  wCF_LAZYINPUT       = 0x02000000, // inputs are passed without wObject::Expand()
 
   wCIF_METHODMASK     = 0x0007,   // method: link, input or optional=
   wCIF_METHODINPUT    = 0x0000,   // always input
@@ -587,6 +588,7 @@ public:
   struct wNode *BuilderNode;      // see build.hpp. must be 0 before calling wBuilder::parse()
   sInt BuilderNodeCallId;         // if this was created during a call, this was the caller id
   sInt BuilderNodeCallerId;       // if this is a call, when this was called this id was used
+  sInt BuilderCut;                // first entry in wBuilder::CutInputs +1, 0 for none
   wObject *Cache;                 // permanently cached copy of data
   sU32 CacheLRU;
   sArray<wScriptVar> CacheVars;   // script vars associated to Cached Object
@@ -695,8 +697,44 @@ public:
 
 /****************************************************************************/
 
+// grid over the ops of a stack page. each cell lists the ops that touch
+// it. Update() compares the ops with what was indexed last time and
+// rebuilds when anything was added, removed, moved or resized. that is a
+// pass over all ops, so do it once before a batch of queries.
+
+class wStackIndex
+{
+  enum
+  {
+    CELLX = 8,                    // in page units
+    CELLY = 4,
+    GRIDX = wPAGEXS/CELLX,
+    GRIDY = wPAGEYS/CELLY,
+  };
+  struct Entry
+  {
+    wStackOp *Op;
+    sInt x0,y0,x1,y1;
+    sU32 Mark;                    // last query that found this
+  };
+  sArray<Entry> Entries;          // same order as wPage::Ops
+  sArray<sInt> CellStart;         // CellList[CellStart[c]..CellStart[c+1]-1] touch cell c
+  sArray<sInt> CellList;
+  sArray<sInt> Found;             // scratch
+  sU32 Query;
+
+  void Rebuild();
+public:
+  wStackIndex();
+  void Update(const sArray<wStackOp *> &ops);
+  void Find(sInt x0,sInt y0,sInt x1,sInt y1,sArray<wStackOp *> &found); // ops overlapping the rect in page units, in order of wPage::Ops
+};
+
 class wPage : public sObject
 {
+  wStackIndex Index;
+  sArray<wStackOp *> Found;
+  sBool TestDest(wOp *op,sInt x,sInt y,sInt w,sInt h,sBool move);
 public:
   sCLASSNAME(wPage);
   wPage();
@@ -705,6 +743,7 @@ public:
   sBool CheckMove(sInt dx,sInt dy,sInt dw,sInt dh,sBool move);
   sBool IsProtected() { return this==0 || ManualWriteProtect || (Include && Include->Protected); }
   void Rem(wOp *);
+  wStackIndex *GetIndex() { Index.Update(Ops); return &Index; }  // valid until ops are changed
 
   // this serialization is not used during document serialisation, only for clipboard
   template <class streamer> void Serialize_(streamer &stream);
@@ -938,6 +977,7 @@ public:
   sBool IsPlayer;
   sInt LowQuality;
   sBool IsCacheWarmup;
+  sHooks *FlushCachesHook;        // called by FlushCaches(), for caches kept outside of ops
 
   wDocOptions DocOptions;
   wEditOptions EditOptions;
@@ -1004,6 +1044,7 @@ public:
   sBool IsType(wType *type) { return Type->IsType(type); }   // output->IsType(input). obj type is of type, or type is parent of obj type. 
   virtual void Reuse()  { sFatal(L"this class can not be used for weak linking."); }
   virtual wObject *Copy()  { return 0; }
+  virtual void Expand()  {}       // turn a lazy representation into the full object. see wCF_LAZYINPUT
 };
 
 struct wCommand
@@ -1074,6 +1115,19 @@ void NXNCheckout(const sChar* filename);
 
 extern void (*ProgressPaintFunc)(sInt count, sInt max);
 
+// called by wExecutive after every command when set. used for profiling.
+
+struct wCommandProfile
+{
+  sU64 TimeUS;                    // wall time including script
+  sInt Allocs;                    // number of allocations
+  sDInt Bytes;                    // change of heap usage, roughly the output size
+  sPtr Scratch;                   // peak scratch memory of all threads
+  sBool Ok;
+};
+
+extern void (*CommandProfileFunc)(wCommand *cmd,const wCommandProfile &prof);
+
 /****************************************************************************/
 
 #endif // FILE_WERKKZEUG4_DOC_HPP
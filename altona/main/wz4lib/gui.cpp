@@ -23,6 +23,7 @@
 #include "wz4lib/script.hpp"
 #include "wz4lib/wiki.hpp"
 #include "util/algorithms.hpp"
+#include "util/audioanalysis.hpp"
 
 
 MainWindow *App;
@@ -92,6 +93,7 @@ MainWindow::MainWindow()
   SampleOffset = 0;
   MusicData = 0;
   MusicSize = 0;
+  MusicTrack = 0;
   AutosaveTimer = 0;
   BackupIndex = 0;
   BlinkTimer = new sMessageTimer(sMessage(this,&MainWindow::CmdBlinkTimer),125,1);
@@ -348,6 +350,7 @@ MainWindow::~MainWindow()
   delete Painter;
   sDeleteAll(App->StoreTree);
   delete[] MusicData;
+  delete MusicTrack;
 }
 
 void MainWindow::Tag()
@@ -1821,6 +1824,7 @@ void MainWindow::CmdMusicDialog()
 void MainWindow::CmdReloadMusic()
 {
   sDeleteArray(MusicData);
+  sDelete(MusicTrack);
   MusicSize = 0;
 
   sDirEntry mfentry, cfentry;
@@ -1862,6 +1866,23 @@ void MainWindow::CmdReloadMusic()
     sDInt cfsize=0;
     MusicData = (sS16*)sLoadFile(cachefile,cfsize);
     MusicSize = cfsize/4;
+
+    // analysis track, cached like the raw samples. the player loads this
+    // file too, so scripts see the same values there.
+    if(MusicData)
+    {
+      sString<sMAXPATH> trackfile;
+      trackfile.PrintF(L"%s.atrk",Doc->DocOptions.MusicFile);
+
+      MusicTrack = new sAudioTrack;
+      if (!sGetFileInfo(trackfile,&cfentry) || mfentry.LastWriteTime!=cfentry.LastWriteTime || !MusicTrack->Load(trackfile))
+      {
+        MusicTrack->Analyze(MusicData,MusicSize);
+        if(MusicTrack->Save(trackfile))
+          sSetFileTime(trackfile,mfentry.LastWriteTime);
+      }
+      sCurrentAudioTrack = MusicTrack;
+    }
   }
 }
 
@@ -4189,7 +4210,11 @@ wStackOp *WinStack::GetHit(sInt mx,sInt my)
   cop = 0;
   if(Page)
   {
-    sFORALL(Page->Ops,op)
+    sArray<wStackOp *> found;
+    sInt x = (mx-Client.x0+1024*OpXS)/OpXS-1024;
+    sInt y = (my-Client.y0+1024*OpYS)/OpYS-1024;
+    Page->GetIndex()->Find(x,y,x+1,y+1,found);
+    sFORALL(found,op)
     {
       MakeRect(r,op);
       if(r.Hit(mx,my))
@@ -4451,6 +4476,12 @@ void WinStack::OnPaint2D()
 
   if(Page)
   {
+    // only what is visible. comments stick out a few pixels
+
+    sArray<wStackOp *> visible;
+    Page->GetIndex()->Find(
+      (Inner.x0-Client.x0)/OpXS-1,(Inner.y0-Client.y0)/OpYS-1,
+      (Inner.x1-Client.x0)/OpXS+2,(Inner.y1-Client.y0)/OpYS+2,visible);
 
     // tooltips
 
@@ -4507,7 +4538,7 @@ void WinStack::OnPaint2D()
 
     // die ops selber
 
-    sFORALL(Page->Ops,op)
+    sFORALL(visible,op)
     {
       if(!(op->Class->Flags & wCF_COMMENT))
       {
@@ -4718,7 +4749,7 @@ void WinStack::OnPaint2D()
 
     // comment ops darunter
 
-    sFORALL(Page->Ops,op)
+    sFORALL(visible,op)
     {
       if((op->Class->Flags & wCF_COMMENT))
       {
@@ -4990,10 +5021,15 @@ void WinStack::DragFrame(const sWindowDrag &dd,sDInt mode)
     DragRectMode = 0;
     if(Page)
     {
-      if(mode==0)
-        sFORALL(Page->Ops,op)
-          op->Select = 0;
       sFORALL(Page->Ops,op)
+        if(mode==0 || (op->Class->Flags & wCF_COMMENT))
+          op->Select = 0;
+
+      sArray<wStackOp *> found;
+      Page->GetIndex()->Find(
+        (DragRect.x0-Client.x0+1024*OpXS)/OpXS-1024,(DragRect.y0-Client.y0+1024*OpYS)/OpYS-1024,
+        (DragRect.x1-Client.x0+1024*OpXS)/OpXS-1023,(DragRect.y1-Client.y0+1024*OpYS)/OpYS-1023,found);
+      sFORALL(found,op)
       {
         if(!(op->Class->Flags & wCF_COMMENT))
         {
@@ -5007,10 +5043,6 @@ void WinStack::DragFrame(const sWindowDrag &dd,sDInt mode)
               op->Select = 1;
           }
         }
-        else
-        {
-          op->Select = 0;
-        }
       }
     }
     Update();
@@ -59,6 +59,7 @@ public:
   sF32 BPM;           // just for editing BPM
   sS16 *MusicData;
   sInt MusicSize;
+  class sAudioTrack *MusicTrack;  // analysis of MusicData, also sCurrentAudioTrack
 
 private:
   wDocName RenameTo;
@@ -9,6 +9,7 @@
 
 #include "wz4lib/script.hpp"
 #include "base/math.hpp"
+#include "util/audioanalysis.hpp"
 
 /****************************************************************************/
 /***                                                                      ***/
@@ -129,6 +130,7 @@ enum ScriptCodeEnum
   SC_FADEINOUT,                   // time,in,out,smooth
   SC_NOISE,                       // noise(time). random value between -1 and 1 (inclusive)
   SC_PERLINNOISE,                 // perlinnoise(time,variant). similar to noise, but bandlimited.
+  SC_AUDIO,                       // audio(channel,beat). precomputed soundtrack analysis, 0..1
 
   SC_CLAMP,                       // IF
   SC_LENGTH,
@@ -538,6 +540,7 @@ ScriptContext::ScriptContext()
   AddFunc(L"expease",L"f:ff")->Primitive=SC_EXPEASE;
   AddFunc(L"noise",L"f:f")->Primitive=SC_NOISE;
   AddFunc(L"perlinnoise",L"f:ff")->Primitive=SC_PERLINNOISE;
+  AddFunc(L"audio",L"f:ff")->Primitive=SC_AUDIO;
 
   AddFunc(L"clamp",L"f#1:f#1,f,f")->Primitive=SC_CLAMP;
   AddFunc(L"length",L"f:f#1")->Primitive=SC_LENGTH;
@@ -1761,6 +1764,15 @@ static  value Stack[0x10000];
         Stack[index++].f = v;
       }
       break;
+    case SC_AUDIO|SC_FLOAT:
+      index-=2;
+      {
+        // channel 0 is rms, 1 is onset, 2.. are bands from low to high
+        sInt channel = sInt(Stack[index+0].f);
+        sF32 v = sCurrentAudioTrack ? sCurrentAudioTrack->SampleBeat(channel,Stack[index+1].f) : 0.0f;
+        Stack[index++].f = v;
+      }
+      break;
 
     case SC_CLAMP|SC_FLOAT:
       {
@@ -3639,6 +3651,7 @@ void ScriptCompiler::PrintExpr(Expression *expr)
   case SC_FADEINOUT: PrintFunc2(L"fadeinout",expr); break;
   case SC_NOISE:  PrintFunc2(L"noise",expr); break;
   case SC_PERLINNOISE: PrintFunc2(L"perlinnoise",expr); break;
+  case SC_AUDIO:  PrintFunc2(L"audio",expr); break;
 
   case SC_CLAMP:  PrintFunc2(L"clamp",expr); break;
   case SC_LENGTH: PrintFunc2(L"length",expr); break;
@@ -3856,6 +3869,7 @@ void ScriptCompiler::OutputExpr(Expression *expr)
   case SC_FADEINOUT:
   case SC_NOISE:
   case SC_PERLINNOISE:
+  case SC_AUDIO:
 
   case SC_CLAMP:
   case SC_NORMALIZE:
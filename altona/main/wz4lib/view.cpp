@@ -415,6 +415,9 @@ void WinView::Paint(sViewport &view,const sTargetSpec &spec)
     Log.PrintF(L"'%f' ms %f fps\n",ms,1000/ms);
     Log.PrintF(L"'%d' batches '%k' verts %k ind %k prim %k splitters\n",
       stat.Batches,stat.Vertices,stat.Indices,stat.Primitives,stat.Splitter);
+    wBuilderStats &bs = Doc->Builder->Stats;
+    Log.PrintF(L"build '%d' nodes ('%d' cached) '%d' commands, plan %d us, exec %d us\n",
+      bs.Nodes,bs.CacheCuts,bs.Commands,sInt(bs.PlanTime),sInt(bs.ExecTime));
     if(GridUnit!=0)
       Log.PrintF(L"grid unit = %.0f\n",GridUnit);
   }
@@ -0,0 +1,213 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "base/types.hpp"
+#include "base/types2.hpp"
+#include "base/system.hpp"
+#include "network/sockets.hpp"
+#include "network/http.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Load test for sHTTPServer. Starts a server on loopback and hammers ***/
+/***   it with keep-alive clients.                                        ***/
+/***                                                                      ***/
+/***   httpbench [-c clients] [-n requests] [-w workers] [-port port]    ***/
+/***             [-url /page|/dynamic]                                    ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+static sU8 Page[4096];
+
+class DynamicHandler : public sHTTPServer::SimpleHandler
+{
+public:
+  sHTTPServer::HandlerResult WriteDocument(const sChar *URL)
+  {
+    WriteHTMLHeader(L"httpbench");
+    for (sInt i=0; i<32; i++)
+      PrintF(L"line %d of %s<br>\n",i,URL);
+    WriteHTMLFooter();
+    return sHTTPServer::HR_OK;
+  }
+
+  static sHTTPServer::Handler *Factory() { return new DynamicHandler; }
+};
+
+/****************************************************************************/
+
+static sHTTPServer *Server;
+static sInt Port;
+static sInt Requests;
+static const sChar *URL;
+
+struct Client
+{
+  sThread *Thread;
+  sU32 *Latency;      // us per request
+  sInt Done;
+  sInt Errors;
+};
+
+static void ServerFunc(sThread *t, void *user)
+{
+  if (!Server->Run(t))
+    sPrintF(L"server failed\n");
+}
+
+// reads one response, returns sFALSE on any error
+
+static sBool ReadResponse(sTCPSocket *s, sU8 *buf, sInt size)
+{
+  sInt fill=0;
+  sInt head=-1;
+  while (head<0)
+  {
+    sDInt read;
+    if (fill==size || !s->Read(buf+fill,size-fill,read) || !read) return sFALSE;
+    for (sInt i=sMax(fill-3,0); i+3<fill+read; i++)
+    {
+      if (buf[i]=='\r' && buf[i+1]=='\n' && buf[i+2]=='\r' && buf[i+3]=='\n')
+      {
+        head=i+4;
+        break;
+      }
+    }
+    fill+=sInt(read);
+  }
+
+  sInt length=-1;
+  for (sInt i=0; i<head; i++)
+  {
+    if (buf[i]=='\n' && !sCmpMem(buf+i+1,"Content-Length: ",16))
+    {
+      length=0;
+      for (sInt j=i+17; j<head && buf[j]>='0' && buf[j]<='9'; j++)
+        length=length*10+buf[j]-'0';
+      break;
+    }
+  }
+  if (length<0) return sFALSE;
+
+  sInt left=length-(fill-head);
+  while (left>0)
+  {
+    sDInt read;
+    if (!s->Read(buf,sMin(left,size),read) || !read) return sFALSE;
+    left-=sInt(read);
+  }
+  return left==0;
+}
+
+static void ClientFunc(sThread *t, void *user)
+{
+  Client *cl=(Client *)user;
+  sTCPClientSocket sock;
+  if (!sock.Connect(sIPAddress(127,0,0,1),Port))
+  {
+    cl->Errors++;
+    return;
+  }
+
+  sString<256> req;
+  sSPrintF(req,L"GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",URL);
+  sChar8 req8[256];
+  sCopyString(req8,req,256);
+  sInt reqlen=sGetStringLen(req);
+
+  static const sInt BUFSIZE=65536;
+  sU8 *buf=new sU8[BUFSIZE];
+
+  while (cl->Done<Requests && t->CheckTerminate())
+  {
+    sU64 start=sGetTimeUS();
+    if (!sock.WriteAll(req8,reqlen) || !ReadResponse(&sock,buf,BUFSIZE))
+    {
+      cl->Errors++;
+      break;
+    }
+    cl->Latency[cl->Done++]=sU32(sGetTimeUS()-start);
+  }
+
+  delete[] buf;
+}
+
+/****************************************************************************/
+
+void sMain()
+{
+  sGetMemHandler(sAMF_HEAP)->MakeThreadSafe();   // server, workers and clients all allocate
+
+  sInt clients=sGetShellParameterInt(L"c",0,8);
+  sInt workers=sGetShellParameterInt(L"w",0,2);
+  Requests=sGetShellParameterInt(L"n",0,5000);
+  Port=sGetShellParameterInt(L"port",0,8089);
+  URL=sGetShellString(L"url",L"-url",L"/page");
+
+  for (sInt i=0; i<sCOUNTOF(Page); i++)
+    Page[i]='a'+i%26;
+
+  Server=new sHTTPServer;
+  Server->SetWorkerCount(workers);
+  Server->AddStaticPage(L"/page",Page,sizeof(Page));
+  Server->AddHandler(L"/dynamic",DynamicHandler::Factory);
+  if (!Server->Init(Port,0))
+  {
+    sPrintF(L"can't listen on port %d\n",Port);
+    delete Server;
+    return;
+  }
+  sThread *server=new sThread(ServerFunc,0,0,0);
+
+  sPrintF(L"%d clients, %d requests each, %d workers, %s\n",clients,Requests,workers,URL);
+
+  Client *cl=new Client[clients];
+  sU64 start=sGetTimeUS();
+  for (sInt i=0; i<clients; i++)
+  {
+    cl[i].Latency=new sU32[Requests];
+    cl[i].Done=0;
+    cl[i].Errors=0;
+    cl[i].Thread=new sThread(ClientFunc,0,0,&cl[i]);
+  }
+
+  // threads are joined on delete, but they have to finish first
+  sInt done=0;
+  sInt errors=0;
+  for (sInt i=0; i<clients; i++)
+  {
+    while (cl[i].Done<Requests && !cl[i].Errors)
+      sSleep(10);
+    delete cl[i].Thread;
+    done+=cl[i].Done;
+    errors+=cl[i].Errors;
+  }
+  sU64 time=sGetTimeUS()-start;
+
+  delete server;
+  delete Server;
+
+  sArray<sU32> lat;
+  lat.HintSize(done);
+  for (sInt i=0; i<clients; i++)
+  {
+    for (sInt j=0; j<cl[i].Done; j++)
+      lat.AddTail(cl[i].Latency[j]);
+    delete[] cl[i].Latency;
+  }
+  delete[] cl;
+  sHeapSortUp(lat);
+
+  sPrintF(L"%d requests, %d errors, %d ms\n",done,errors,sInt(time/1000));
+  if (done)
+  {
+    sPrintF(L"%d req/s\n",sInt(sU64(done)*1000000/sMax<sU64>(time,1)));
+    sPrintF(L"latency p50 %d us, p99 %d us, max %d us\n",lat[done/2],lat[done*99/100],lat[done-1]);
+  }
+}
+
+/****************************************************************************/
@@ -379,7 +379,7 @@ void Document::_Operator()
       Scan.Match('=');
       op->Flags |= _Choice(L"||load|store|delete_import|delete_array_import|hide|conversion"
         L"|logging|slow|blockhandles|passinput|passoutput|curve|clip|obsolete|verticalresize|comment"
-        L"|call|input|loop|endloop|shellswitch|typefrominput|blockchange");
+        L"|call|input|loop|endloop|shellswitch|typefrominput|blockchange|lazyinput");
       Scan.Match(';');
     }
     else if(Scan.IfName(L"tab"))
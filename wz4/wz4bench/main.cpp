@@ -0,0 +1,409 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Headless benchmark: load a document, calculate stores and record   ***/
+/***   time, allocations and output size for every operator class.       ***/
+/***                                                                      ***/
+/***   wz4bench file.wz4 [-store name]* [-runs n] [-json out.json]        ***/
+/***            [-flame out.txt] [-compare base.json] [-threshold pct]    ***/
+/***            [-minms ms] [-player]                                     ***/
+/***                                                                      ***/
+/***   -player runs the document the way wz4player does (no editor        ***/
+/***   caches, optimized meshes), otherwise it is calculated as in the    ***/
+/***   editor.                                                            ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+#include "base/types.hpp"
+#include "base/system.hpp"
+#include "wz4lib/doc.hpp"
+#include "wz4lib/version.hpp"
+#include "wz4frlib/wz4_classes.hpp"
+#include "util/taskscheduler.hpp"
+#include "util/json.hpp"
+#include "extra/blobheap.hpp"
+
+/****************************************************************************/
+
+void RegisterWZ4Classes()
+{
+  Wz4RegisterPlayerClasses();
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Collecting                                                         ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+struct BenchClass
+{
+  wClass *Class;                  // 0 for commands without op
+  sInt Calls;
+  sInt Fails;
+  sU64 TimeUS;
+  sS64 Allocs;
+  sS64 Bytes;
+  sPtr Scratch;                   // max over all calls
+
+  const sChar *TypeName() const { return Class ? Class->OutputType->Symbol : L"none"; }
+  const sChar *ClassName() const { return Class ? (const sChar *)Class->Name : L"none"; }
+};
+
+struct BenchStore
+{
+  sPoolString Name;
+  sU64 TimeUS;
+  sBool Ok;
+  sArray<BenchClass> Classes;
+};
+
+static BenchStore *Current;
+
+static void ProfileCommand(wCommand *cmd,const wCommandProfile &prof)
+{
+  if(!Current) return;
+
+  wClass *cl = cmd->Op ? cmd->Op->Class : 0;
+  BenchClass *bc = sFind(Current->Classes,&BenchClass::Class,cl);
+  if(!bc)
+  {
+    bc = Current->Classes.AddMany(1);
+    sClear(*bc);
+    bc->Class = cl;
+  }
+  bc->Calls++;
+  if(!prof.Ok)
+    bc->Fails++;
+  bc->TimeUS += prof.TimeUS;
+  bc->Allocs += prof.Allocs;
+  bc->Bytes += prof.Bytes;
+  bc->Scratch = sMax(bc->Scratch,prof.Scratch);
+}
+
+static sBool CalcStore(BenchStore &store)
+{
+  wOp *op = Doc->FindStore(store.Name);
+  if(!op)
+  {
+    sPrintF(L"store %q not found\n",store.Name);
+    return 0;
+  }
+
+  Current = &store;
+  sU64 t0 = sGetTimeUS();
+  wObject *obj = Doc->CalcOp(op);
+  store.TimeUS = sGetTimeUS()-t0;
+  Current = 0;
+
+  store.Ok = obj!=0;
+  sRelease(obj);
+  sSortDown(store.Classes,&BenchClass::TimeUS);
+  return 1;
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Output                                                             ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+static void WriteJSON(const sChar *filename,const sChar *wz4name,sInt runs,sArray<BenchStore> &stores)
+{
+  sTextBuffer tb;
+  BenchStore *store;
+  BenchClass *bc;
+
+  tb.PrintF(L"{\n");
+  tb.PrintF(L"  \"file\" : %q,\n",wz4name);
+  tb.PrintF(L"  \"version\" : \"%d.%d\",\n",WZ4_VERSION,WZ4_REVISION);
+  tb.PrintF(L"  \"runs\" : %d,\n",runs);
+  tb.PrintF(L"  \"stores\" :\n  [\n");
+  sFORALL(stores,store)
+  {
+    tb.PrintF(L"    {\n");
+    tb.PrintF(L"      \"name\" : %q,\n",store->Name);
+    tb.PrintF(L"      \"ok\" : %d,\n",store->Ok);
+    tb.PrintF(L"      \"time_ms\" : %.3f,\n",store->TimeUS/1000.0);
+    tb.PrintF(L"      \"classes\" :\n      [\n");
+    sFORALL(store->Classes,bc)
+    {
+      // the json reader can't do negative numbers, and a class that frees
+      // more than it allocates has no meaningful output size anyway.
+      tb.PrintF(L"        { \"type\" : %q, \"class\" : %q, \"calls\" : %d, \"fails\" : %d, \"time_ms\" : %.3f, \"allocs\" : %.0f, \"bytes\" : %.0f, \"scratch\" : %.0f }%s\n",
+        bc->TypeName(),bc->ClassName(),bc->Calls,bc->Fails,bc->TimeUS/1000.0,
+        sF64(bc->Allocs),sF64(sMax<sS64>(bc->Bytes,0)),sF64(bc->Scratch),
+        _i<store->Classes.GetCount()-1 ? L"," : L"");
+    }
+    tb.PrintF(L"      ]\n");
+    tb.PrintF(L"    }%s\n",_i<stores.GetCount()-1 ? L"," : L"");
+  }
+  tb.PrintF(L"  ]\n");
+  tb.PrintF(L"}\n");
+
+  if(!sSaveTextAnsi(filename,tb.Get()))
+    sPrintF(L"could not write %q\n",filename);
+}
+
+// collapsed stack format, as used by flamegraph.pl: "a;b;c value"
+
+static void WriteFlame(const sChar *filename,sArray<BenchStore> &stores)
+{
+  sTextBuffer tb;
+  BenchStore *store;
+  BenchClass *bc;
+
+  sFORALL(stores,store)
+  {
+    sU64 ops = 0;
+    sFORALL(store->Classes,bc)
+    {
+      tb.PrintF(L"%s;%s;%s %d\n",store->Name,bc->TypeName(),bc->ClassName(),sInt(bc->TimeUS));
+      ops += bc->TimeUS;
+    }
+    if(store->TimeUS>ops)
+      tb.PrintF(L"%s;build %d\n",store->Name,sInt(store->TimeUS-ops));
+  }
+
+  if(!sSaveTextAnsi(filename,tb.Get()))
+    sPrintF(L"could not write %q\n",filename);
+}
+
+static void PrintSummary(sArray<BenchStore> &stores)
+{
+  BenchStore *store;
+  BenchClass *bc;
+
+  sFORALL(stores,store)
+  {
+    sPrintF(L"store %q: %.3f ms%s\n",store->Name,store->TimeUS/1000.0,store->Ok ? L"" : L" (FAILED)");
+    sFORALL(store->Classes,bc)
+      sPrintF(L"  %-16s %-24s %5d calls %10.3f ms %8d allocs %10K %10K scratch\n",
+        bc->TypeName(),bc->ClassName(),bc->Calls,bc->TimeUS/1000.0,sInt(bc->Allocs),sU64(sMax<sS64>(bc->Bytes,0)),sU64(bc->Scratch));
+  }
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Compare against a previous run                                     ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+static sF64 GetNumber(sJSON::Object *obj,const sChar *name)
+{
+  sJSON::Number *n = sJSON::As<sJSON::Number>(obj->Items.Get(name));
+  return n ? n->Value : 0;
+}
+
+static const sChar *GetString(sJSON::Object *obj,const sChar *name)
+{
+  sJSON::String *s = sJSON::As<sJSON::String>(obj->Items.Get(name));
+  return s ? (const sChar *)s->Value : L"";
+}
+
+// returns number of regressions, -1 if the baseline could not be read
+
+static sInt Compare(const sChar *filename,sArray<BenchStore> &stores,sF32 threshold,sF32 minms)
+{
+  const sChar *text = sLoadText(filename);
+  if(!text)
+  {
+    sPrintF(L"could not load baseline %q\n",filename);
+    return -1;
+  }
+  sJSON json;
+  sJSON::TypeBase *root = json.Parse(text);
+  delete[] text;
+
+  sJSON::Object *rootobj = sJSON::As<sJSON::Object>(root);
+  sJSON::Array *basestores = rootobj ? sJSON::As<sJSON::Array>(rootobj->Items.Get(L"stores")) : 0;
+  if(!basestores)
+  {
+    sPrintF(L"baseline %q is not a benchmark result\n",filename);
+    delete root;
+    return -1;
+  }
+
+  sInt regressions = 0;
+  sF64 factor = 1.0+threshold/100.0;
+  BenchStore *store;
+  BenchClass *bc;
+  sJSON::TypeBase *item;
+
+  sPrintF(L"comparing against %q (threshold %.1f%%, ignoring below %.2f ms)\n",filename,threshold,minms);
+  sFORALL(stores,store)
+  {
+    sJSON::Object *basestore = 0;
+    sFORALL(basestores->Items,item)
+    {
+      sJSON::Object *o = sJSON::As<sJSON::Object>(item);
+      if(o && sCmpString(GetString(o,L"name"),store->Name)==0)
+        basestore = o;
+    }
+    if(!basestore)
+    {
+      sPrintF(L"store %q: not in baseline\n",store->Name);
+      continue;
+    }
+
+    sF64 now = store->TimeUS/1000.0;
+    sF64 then = GetNumber(basestore,L"time_ms");
+    sBool bad = then>=minms && now>then*factor;
+    sPrintF(L"%s store %q: %.3f ms -> %.3f ms\n",bad ? L"REGRESSION" : L"ok        ",store->Name,then,now);
+    if(bad) regressions++;
+
+    sJSON::Array *baseclasses = sJSON::As<sJSON::Array>(basestore->Items.Get(L"classes"));
+    if(!baseclasses) continue;
+    sFORALL(store->Classes,bc)
+    {
+      sJSON::Object *baseclass = 0;
+      sFORALL(baseclasses->Items,item)
+      {
+        sJSON::Object *o = sJSON::As<sJSON::Object>(item);
+        if(o && sCmpString(GetString(o,L"type"),bc->TypeName())==0 && sCmpString(GetString(o,L"class"),bc->ClassName())==0)
+          baseclass = o;
+      }
+      if(!baseclass) continue;
+
+      now = bc->TimeUS/1000.0;
+      then = GetNumber(baseclass,L"time_ms");
+      if(then>=minms && now>then*factor)
+      {
+        sPrintF(L"REGRESSION   %s.%s: %.3f ms -> %.3f ms (+%.1f%%)\n",bc->TypeName(),bc->ClassName(),then,now,(now/then-1)*100);
+        regressions++;
+      }
+    }
+  }
+
+  delete root;
+  return regressions;
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Main                                                               ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+static void sExitSts()
+{
+  sDelete(sSched);
+  sDelete(sSchedMon);
+}
+
+void sMain()
+{
+  const sChar *wz4name = sGetShellParameter(0,0);
+  if(!wz4name)
+  {
+    sPrintF(L"wz4bench V%d.%d\n",WZ4_VERSION,WZ4_REVISION);
+    sPrintF(L"usage: wz4bench file.wz4 [-store name]* [-runs n] [-json out.json] [-flame out.txt]\n");
+    sPrintF(L"                [-compare base.json] [-threshold percent] [-minms ms] [-player]\n");
+    sSetErrorCode();
+    return;
+  }
+
+  sInt runs = sMax(1,sGetShellParameterInt(L"runs",0,1));
+  sF32 threshold = sGetShellParameterFloat(L"threshold",0,10.0f);
+  sF32 minms = sGetShellParameterFloat(L"minms",0,1.0f);
+
+  sAddSubsystem(L"StealingTaskScheduler (wz4bench)",0x80,0,sExitSts);
+  sAddGlobalBlobHeap();
+  sInit(sISF_3D,640,480);
+  sSched = new sStsManager(128*1024,512,0);
+  sSchedMon = new sStsPerfMon();
+
+  new wDocument;
+  sAddRoot(Doc);
+  Doc->IsPlayer = sGetShellSwitch(L"player");
+
+  sInt t0 = sGetTime();
+  if(!Doc->Load(wz4name))
+  {
+    sPrintF(L"could not load %q\n",wz4name);
+    sSetErrorCode();
+    sRemRoot(Doc);
+    return;
+  }
+  sPrintF(L"loaded %q in %d ms\n",wz4name,sGetTime()-t0);
+
+  // stores to calculate
+
+  sArray<sPoolString> names;
+  for(sInt i=0;sGetShellParameter(L"store",i);i++)
+    names.AddTail(sPoolString(sGetShellParameter(L"store",i)));
+  if(names.GetCount()==0)
+    names.AddTail(sPoolString(L"root"));
+
+  // run. every run starts with empty caches, the fastest run is reported.
+
+  sArray<BenchStore> best;
+  sU64 besttime = 0;
+  sBool ok = 1;
+  CommandProfileFunc = ProfileCommand;
+  for(sInt run=0;run<runs && ok;run++)
+  {
+    sArray<BenchStore> stores;
+    sU64 total = 0;
+    Doc->FlushCaches();
+
+    stores.AddMany(names.GetCount());
+    for(sInt i=0;i<names.GetCount() && ok;i++)
+    {
+      stores[i].Name = names[i];
+      ok = CalcStore(stores[i]);
+      total += stores[i].TimeUS;
+    }
+    sPrintF(L"run %d: %.3f ms\n",run,total/1000.0);
+
+    if(ok && (run==0 || total<besttime))
+    {
+      best = stores;
+      besttime = total;
+    }
+  }
+  CommandProfileFunc = 0;
+
+  if(ok)
+  {
+    PrintSummary(best);
+
+    const sChar *jsonname = sGetShellParameter(L"json",0);
+    if(jsonname)
+      WriteJSON(jsonname,wz4name,runs,best);
+    const sChar *flamename = sGetShellParameter(L"flame",0);
+    if(flamename)
+      WriteFlame(flamename,best);
+
+    BenchStore *store;
+    sFORALL(best,store)
+      if(!store->Ok)
+        ok = 0;
+
+    const sChar *basename = sGetShellParameter(L"compare",0);
+    if(basename)
+    {
+      sInt r = Compare(basename,best,threshold,minms);
+      if(r!=0)
+      {
+        if(r>0)
+          sPrintF(L"%d regressions\n",r);
+        ok = 0;
+      }
+    }
+  }
+
+  if(!ok)
+    sSetErrorCode();
+  Doc->FlushCaches();
+  sRemRoot(Doc);
+}
+
+/****************************************************************************/
+
@@ -7,6 +7,7 @@
 
 #include "chaos_font.hpp"
 #include "chaos_font_ops.hpp"
+#include "util/rasterizer.hpp"
 
 /****************************************************************************/
 
@@ -207,12 +208,30 @@ void ChaosFont::Symbol(sInt c,const sRect &r,const sImage *img,sInt yo)
   CursorX += r.SizeX() + Outline*2 + Safety;
 }
 
-void ChaosFont::Finish()
+void ChaosFont::Finish(sF32 distfield)
 {
+  sInt count = Image->SizeX*Image->SizeY;
   sRender2DGet(Image->Data);
-  for(sInt i=0;i<Image->SizeX*Image->SizeY;i++)
-    Image->Data[i] = (Image->Data[i]<<24)|(Image->Data[i]&0xffffff);
   sRender2DEnd();
+
+  if(distfield>0)
+  {
+    // os fonts give no outlines, so the distance field comes from the
+    // antialiased glyphs. Safety should be at least the spread.
+
+    sU8 *cover = new sU8[count];
+    for(sInt i=0;i<count;i++)
+      cover[i] = Image->Data[i]&0xff;
+    sCoverageToSDF(cover,Image->SizeX,Image->SizeY,Image->SizeX,distfield);
+    for(sInt i=0;i<count;i++)
+      Image->Data[i] = cover[i]*0x01010101;
+    delete[] cover;
+  }
+  else
+  {
+    for(sInt i=0;i<count;i++)
+      Image->Data[i] = (Image->Data[i]<<24)|(Image->Data[i]&0xffffff);
+  }
 }
 
 /****************************************************************************/
@@ -65,7 +65,7 @@ public:
   void InitFont(const sChar *name,sInt height,sInt width,sInt style,sInt safety,sInt outline);
   void Letter(sInt c);
   void Symbol(sInt c,const sRect &r,const sImage *img,sInt adjusty);
-  void Finish();
+  void Finish(sF32 distfield=0);   // >0: make a distance field, 128 on the outline
 
 
   // simple printing
@@ -274,6 +274,17 @@ void SphGenSource::Init()
 
 void SphGenSource::Reset()
 {
+  Rnd.Seed(1);
+}
+
+void SphGenSource::SaveState(Wz4CheckpointWriter &w)
+{
+  w.Value(Rnd);
+}
+
+void SphGenSource::LoadState(Wz4CheckpointReader &r)
+{
+  r.Value(Rnd);
 }
 
 void SphGenSource::SimPart(RPSPH *sph)
@@ -476,6 +487,7 @@ RPSPH::~RPSPH()
 
 void RPSPH::Init()
 {
+  Checkpoints.Init((Para.Flags & 1) ? 0 : Para.CheckpointInterval);
   Reset();
 
   for(sInt i=0;i<Para.StartSteps;i++)
@@ -501,6 +513,47 @@ void RPSPH::Reset()
   LastTimeF = 0;
 }
 
+void RPSPH::StoreCheckpoint()
+{
+  if(!Checkpoints.Want(LastTimeF))
+    return;
+
+  Wz4CheckpointWriter w(CheckpointData);
+  w.Value(SimStep);
+  w.Value(LastTimeF);
+  w.Array(*Parts[0]);
+  w.Array(Springs);
+  SphGenerator *gen;
+  sFORALL(Gens,gen)
+    gen->SaveState(w);
+
+  Checkpoints.Store(LastTimeF,CheckpointData);
+}
+
+sBool RPSPH::RestoreCheckpoint(sF32 time,sF32 after)
+{
+  sF32 found;
+  if(!Checkpoints.Find(time,found,CheckpointData,after))
+    return 0;
+
+  Wz4CheckpointReader r(CheckpointData);
+  r.Value(SimStep);
+  r.Value(LastTimeF);
+  r.Array(*Parts[0]);
+  r.Array(Springs);
+  SphGenerator *gen;
+  sFORALL(Gens,gen)
+    gen->LoadState(r);
+
+  if(!r.IsDone())                 // should not happen, but we know what to do
+  {
+    Checkpoints.Clear();
+    Reset();
+    return 0;
+  }
+  return 1;
+}
+
 void RPSPH::Hash()
 {
   sVector30 d;
@@ -952,8 +1005,15 @@ void RPSPH::Simulate(Wz4RenderContext *ctx)
     CurrentTime = t;
     if(LastTimeF-SimTimeStep > t+0.01f)
     {
-      LastTimeF = 0;
-      Reset();
+      if(!RestoreCheckpoint(t))
+      {
+        LastTimeF = 0;
+        Reset();
+      }
+    }
+    else if(LastTimeF+SimTimeStep*Para.MaxSteps < t)
+    {
+      RestoreCheckpoint(t,LastTimeF);   // jumping ahead: skip to a snapshot we already have
     }
     while(SimStep<Para.StartSteps && n<Para.MaxSteps)
     {
@@ -965,6 +1025,7 @@ void RPSPH::Simulate(Wz4RenderContext *ctx)
       SimPart();
       LastTimeF += SimTimeStep;
       n++;
+      StoreCheckpoint();
     }
   }
   ViewPrintF(L"SPH_Time: %5d, %d steps\n",SimStep,n);
@@ -11,6 +11,7 @@
 #include "wz4frlib/fr063_sph_ops.hpp"
 #include "wz4frlib/wz4_demo2.hpp"
 #include "wz4frlib/wz4_demo2_ops.hpp"
+#include "wz4frlib/wz4_checkpoint.hpp"
 
 enum Constants
 {
@@ -35,6 +36,8 @@ public:
 
   virtual void Reset()=0;
   virtual void SimPart(RPSPH *)=0;
+  virtual void SaveState(Wz4CheckpointWriter &) {}   // state that changes while simulating
+  virtual void LoadState(Wz4CheckpointReader &) {}
 };
 
 class SphGenObject : public SphGenerator
@@ -61,6 +64,8 @@ public:
   void Init();
   void Reset();
   void SimPart(RPSPH *);
+  void SaveState(Wz4CheckpointWriter &);
+  void LoadState(Wz4CheckpointReader &);
 };
 
 /****************************************************************************/
@@ -110,6 +115,8 @@ class RPSPH : public Wz4ParticleNode
   void Hash();
   void Inter(sInt n0,sInt n1);
   void Physics();
+  void StoreCheckpoint();
+  sBool RestoreCheckpoint(sF32 time,sF32 after=-1);
 
 public:
   RPSPH();
@@ -159,6 +166,9 @@ public:
   HashIndex HashTable[HASHSIZE];
   sArray<Particle> *Parts[2];
   sArray<Spring> Springs;
+
+  Wz4Checkpoints Checkpoints;     // for seeking on the timeline
+  sArray<sU8> CheckpointData;
 };
 
 /****************************************************************************/
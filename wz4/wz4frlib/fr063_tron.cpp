@@ -8,6 +8,7 @@
 #include "wz4_demo2_ops.hpp"
 #include "fr063_tron_shader.hpp"
 #include "fr063_tron.hpp"
+#include "util/simd_float.hpp"
 
 /****************************************************************************/
 
@@ -492,6 +493,350 @@ void RNFR063_Sprites::Render(Wz4RenderContext *ctx)
   } 
 }
 
+/***************************************************************************
+SCCloth
+***************************************************************************/
+
+struct SCClothStep
+{
+  SCCloth *Cloth;
+  sInt Phase;                     // 0: external force, 1: springs, 2: integrate
+  sVector30 Force;
+  sF32 Damping;
+  tSDF *DF;
+  sF32 Guard;
+  sF32 Slide;
+  sInt First;                     // springs of the current colour
+  sInt Count;
+  sInt Chunk;
+};
+
+SCCloth::SCCloth()
+{
+  Count = 0;
+}
+
+void SCCloth::Init(sInt count)
+{
+  Count = count;
+  sInt n = (count+3)&~3;
+  sArray<sF32> *hot[] = { &PX,&PY,&PZ,&VX,&VY,&VZ,&FX,&FY,&FZ,&M };
+  for(sInt i=0;i<sCOUNTOF(hot);i++)
+  {
+    hot[i]->Resize(n);
+    for(sInt j=0;j<n;j++)
+      (*hot[i])[j] = 0;
+  }
+  Cold.Resize(count);
+  Springs.Clear();
+  ColourStart.Clear();
+}
+
+void SCCloth::SetMass(sInt i,const sVector31 &p,sF32 m,sInt t)
+{
+  SetPos(i,p);
+  VX[i] = VY[i] = VZ[i] = 0;
+  M[i] = m;
+  Cold[i].Init(p,sVector30(0,0,0),t);
+}
+
+void SCCloth::AddSpring(sInt s,sInt e,sF32 c)
+{
+  Spring *sp = Springs.AddMany(1);
+  sp->S = s;
+  sp->E = e;
+  sp->L = (GetPos(e)-GetPos(s)).Length();
+  sp->C = c;
+}
+
+// greedy: every spring gets the first colour that none of its masses has.
+// a grid needs 12 colours. the order within a colour is kept, so the
+// forces on a mass are always summed in the same order.
+
+void SCCloth::Colour()
+{
+  sInt ns = Springs.GetCount();
+  sArray<sU32> used;
+  sArray<sInt> colour;
+  used.Resize(Count);
+  colour.Resize(ns);
+  for(sInt i=0;i<Count;i++)
+    used[i] = 0;
+
+  ColourStart.Resize(MAXCOLOUR+2);
+  for(sInt c=0;c<MAXCOLOUR+2;c++)
+    ColourStart[c] = 0;
+
+  for(sInt i=0;i<ns;i++)
+  {
+    const Spring *sp = &Springs[i];
+    sU32 u = used[sp->S] | used[sp->E];
+    sInt c = 0;
+    while(c<MAXCOLOUR && (u&(1U<<c)))
+      c++;
+    if(c<MAXCOLOUR)
+    {
+      used[sp->S] |= 1U<<c;
+      used[sp->E] |= 1U<<c;
+    }
+    colour[i] = c;
+    ColourStart[c+1]++;
+  }
+
+  for(sInt c=0;c<MAXCOLOUR+1;c++)
+    ColourStart[c+1] += ColourStart[c];
+
+  sArray<Spring> sorted;
+  sorted.Resize(ns);
+  sArray<sInt> pos;
+  pos.Copy(ColourStart);
+  for(sInt i=0;i<ns;i++)
+    sorted[pos[colour[i]]++] = Springs[i];
+  Springs.Swap(sorted);
+}
+
+void SCCloth::Freeze()
+{
+  for(sInt i=0;i<Count;i++)
+  {
+    Cold[i].RP = GetPos(i);
+    Cold[i].RV.Init(VX[i],VY[i],VZ[i]);
+  }
+}
+
+void SCCloth::Reset()
+{
+  for(sInt i=0;i<Count;i++)
+  {
+    SetPos(i,Cold[i].RP);
+    VX[i] = Cold[i].RV.x;
+    VY[i] = Cold[i].RV.y;
+    VZ[i] = Cold[i].RV.z;
+  }
+}
+
+void SCCloth::SpringRange(sInt s0,sInt s1)
+{
+  const Spring *sp = Springs.GetData();
+  const sF32 *px = PX.GetData();
+  const sF32 *py = PY.GetData();
+  const sF32 *pz = PZ.GetData();
+  sF32 *fx = FX.GetData();
+  sF32 *fy = FY.GetData();
+  sF32 *fz = FZ.GetData();
+  sInt i = s0;
+
+#if sSIMD_INTRINSICS
+  // four springs at once. the masses are all over the place, so they are
+  // gathered by hand
+
+  sALIGNED(sF32,fx4[4],16);
+  sALIGNED(sF32,fy4[4],16);
+  sALIGNED(sF32,fz4[4],16);
+  const sSSE qmin = sVecLoadScalar(0.0001f);
+  const sSSE qmax = sVecLoadScalar(100000.0f);
+
+  for(;i+4<=s1;i+=4)
+  {
+    const Spring *a=&sp[i+0],*b=&sp[i+1],*c=&sp[i+2],*d=&sp[i+3];
+    sSSE x = sVecSet(px[a->S]-px[a->E],px[b->S]-px[b->E],px[c->S]-px[c->E],px[d->S]-px[d->E]);
+    sSSE y = sVecSet(py[a->S]-py[a->E],py[b->S]-py[b->E],py[c->S]-py[c->E],py[d->S]-py[d->E]);
+    sSSE z = sVecSet(pz[a->S]-pz[a->E],pz[b->S]-pz[b->E],pz[c->S]-pz[c->E],pz[d->S]-pz[d->E]);
+    sSSE len = sVecSet(a->L,b->L,c->L,d->L);
+    sSSE con = sVecSet(a->C,b->C,c->C,d->C);
+    sSSE q = sVecAdd(sVecAdd(sVecMul(x,x),sVecMul(y,y)),sVecMul(z,z));
+    sSSE ok = sVecAnd(sVecCmpGE(q,qmin),sVecCmpLE(q,qmax));
+    sSSE dist = sVecSqrt(q);
+    sSSE cf = sVecDiv(sVecMul(sVecSub(dist,len),con),dist);
+    cf = sVecAnd(cf,ok);          // also gets rid of 0/0
+    sVecStore(sVecMul(x,cf),fx4);
+    sVecStore(sVecMul(y,cf),fy4);
+    sVecStore(sVecMul(z,cf),fz4);
+    for(sInt k=0;k<4;k++)
+    {
+      const Spring *s = &sp[i+k];
+      fx[s->S] -= fx4[k]; fy[s->S] -= fy4[k]; fz[s->S] -= fz4[k];
+      fx[s->E] += fx4[k]; fy[s->E] += fy4[k]; fz[s->E] += fz4[k];
+    }
+  }
+#endif
+
+  for(;i<s1;i++)
+  {
+    const Spring *s = &sp[i];
+    sF32 x = px[s->S]-px[s->E];
+    sF32 y = py[s->S]-py[s->E];
+    sF32 z = pz[s->S]-pz[s->E];
+    sF32 q = x*x+y*y+z*z;
+    if(q<0.0001f || q>100000.0f)
+      continue;
+    sF32 dist = sSqrt(q);
+    sF32 cf = ((dist-s->L)*s->C)/dist;
+    fx[s->S] -= x*cf; fy[s->S] -= y*cf; fz[s->S] -= z*cf;
+    fx[s->E] += x*cf; fy[s->E] += y*cf; fz[s->E] += z*cf;
+  }
+}
+
+void SCCloth::MassRange(sInt m0,sInt m1,const SCClothStep *step)
+{
+  sF32 *px = PX.GetData(); sF32 *py = PY.GetData(); sF32 *pz = PZ.GetData();
+  sF32 *vx = VX.GetData(); sF32 *vy = VY.GetData(); sF32 *vz = VZ.GetData();
+  sF32 *fx = FX.GetData(); sF32 *fy = FY.GetData(); sF32 *fz = FZ.GetData();
+  const sF32 *m = M.GetData();
+
+  if(step->Phase==0)              // external force and damping
+  {
+    sInt i = m0;
+#if sSIMD_INTRINSICS
+    const sSSE ex = sVecLoadScalar(step->Force.x);
+    const sSSE ey = sVecLoadScalar(step->Force.y);
+    const sSSE ez = sVecLoadScalar(step->Force.z);
+    const sSSE d = sVecLoadScalar(step->Damping);
+    for(;i<m1;i+=4)               // padded to 4
+    {
+      sVecStoreU(sVecNMSub(d,sVecLoadU(vx+i),ex),fx+i);
+      sVecStoreU(sVecNMSub(d,sVecLoadU(vy+i),ey),fy+i);
+      sVecStoreU(sVecNMSub(d,sVecLoadU(vz+i),ez),fz+i);
+    }
+#endif
+    for(;i<m1;i++)
+    {
+      fx[i] = step->Force.x-step->Damping*vx[i];
+      fy[i] = step->Force.y-step->Damping*vy[i];
+      fz[i] = step->Force.z-step->Damping*vz[i];
+    }
+  }
+  else                            // integrate and collide
+  {
+    sInt i = m0;
+#if sSIMD_INTRINSICS
+    const sSSE dt = sVecLoadScalar(SIMSTEP);
+    for(;i<m1;i+=4)
+    {
+      sSSE mt = sVecMul(sVecLoadU(m+i),dt);
+      sSSE x = sVecMAdd(sVecLoadU(fx+i),mt,sVecLoadU(vx+i));
+      sSSE y = sVecMAdd(sVecLoadU(fy+i),mt,sVecLoadU(vy+i));
+      sSSE z = sVecMAdd(sVecLoadU(fz+i),mt,sVecLoadU(vz+i));
+      sVecStoreU(x,vx+i); sVecStoreU(sVecAdd(sVecLoadU(px+i),x),px+i);
+      sVecStoreU(y,vy+i); sVecStoreU(sVecAdd(sVecLoadU(py+i),y),py+i);
+      sVecStoreU(z,vz+i); sVecStoreU(sVecAdd(sVecLoadU(pz+i),z),pz+i);
+    }
+#endif
+    for(;i<m1;i++)
+    {
+      sF32 mt = m[i]*SIMSTEP;
+      vx[i] += fx[i]*mt; px[i] += vx[i];
+      vy[i] += fy[i]*mt; py[i] += vy[i];
+      vz[i] += fz[i]*mt; pz[i] += vz[i];
+    }
+
+    tSDF *df = step->DF;
+    if(df)
+    {
+      for(i=m0;i<m1 && i<Count;i++)
+      {
+        sVector31 ep(px[i],py[i],pz[i]);
+        sF32 d = df->GetDistance(ep)-step->Guard;
+        if(d<0.0f)
+        {
+          sVector30 n;
+          df->GetNormal(ep,n);
+          if(n.LengthSq()<0.01f)
+            n = sVector30(-vx[i],-vy[i],-vz[i]);      // back to where it came from
+          ep = ep+d*n;
+          px[i] = ep.x; py[i] = ep.y; pz[i] = ep.z;
+          vx[i] = -n.x*step->Slide;
+          vy[i] = -n.y*step->Slide;
+          vz[i] = -n.z*step->Slide;
+        }
+      }
+    }
+  }
+}
+
+void SCCloth::SpringTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  SCClothStep *step = (SCClothStep *) data;
+  for(sInt t=start;t<start+count;t++)
+  {
+    sInt s0 = step->First+t*step->Chunk;
+    sInt s1 = sMin(s0+step->Chunk,step->First+step->Count);
+    step->Cloth->SpringRange(s0,s1);
+  }
+}
+
+void SCCloth::MassTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  SCClothStep *step = (SCClothStep *) data;
+  sInt n = step->Cloth->PX.GetCount();
+  for(sInt t=start;t<start+count;t++)
+    step->Cloth->MassRange(t*CHUNK,sMin<sInt>((t+1)*CHUNK,n),step);
+}
+
+void SCCloth::Run(sStsCode code,void *data,sInt tasks,sBool mt)
+{
+  if(!mt || tasks<2 || !sSched || sSched->GetThreadCount()<2)
+  {
+    (*code)(0,0,0,tasks,data);
+    return;
+  }
+
+  sStsWorkload *wl = sSched->BeginWorkload();
+  sStsTask *task = wl->NewTask(code,data,tasks,0);
+  wl->AddTask(task);
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
+
+void SCCloth::Step(const sVector30 &force,sF32 damping,tSDF *df,sF32 guard,sF32 slide,sBool mt)
+{
+  SCClothStep step;
+  step.Cloth = this;
+  step.Force = force;
+  step.Damping = damping;
+  step.DF = df;
+  step.Guard = guard;
+  step.Slide = slide;
+
+  sInt masstasks = (PX.GetCount()+CHUNK-1)/CHUNK;
+
+  step.Phase = 0;
+  Run(MassTask,&step,masstasks,mt);
+
+  step.Phase = 1;
+  for(sInt c=0;c<ColourStart.GetCount()-1;c++)
+  {
+    step.First = ColourStart[c];
+    step.Count = ColourStart[c+1]-ColourStart[c];
+    if(step.Count==0)
+      continue;
+    step.Chunk = (c<MAXCOLOUR) ? CHUNK : step.Count;
+    Run(SpringTask,&step,(step.Count+step.Chunk-1)/step.Chunk,mt);
+  }
+
+  step.Phase = 2;
+  Run(MassTask,&step,masstasks,mt);
+}
+
+void SCCloth::SaveState(Wz4CheckpointWriter &w) const
+{
+  w.Value(Count);
+  w.Array(PX); w.Array(PY); w.Array(PZ);
+  w.Array(VX); w.Array(VY); w.Array(VZ);
+}
+
+sBool SCCloth::LoadState(Wz4CheckpointReader &r)
+{
+  sInt n = 0;
+  r.Value(n);
+  if(!r.IsOk() || n!=Count)
+    return 0;
+  r.Array(PX); r.Array(PY); r.Array(PZ);
+  r.Array(VX); r.Array(VY); r.Array(VZ);
+  return r.IsOk();
+}
+
 /***************************************************************************
 RNFR063ClothGridSimRender
 ***************************************************************************/
@@ -532,7 +877,7 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
   if (yc<2) yc=2;
   
 	int maxParticle=xc*yc;
-  Particles.AddMany(maxParticle);
+  Cloth.Init(maxParticle);
 
   Moveable.Resize(Array.GetCount());
 
@@ -548,7 +893,7 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
 		for(i=0;i<xc;i++)
     {            
 			temp=pos+xn*i+yn*j;
-      Particles[k++].Init(pos+xn*i+yn*j, sVector30(0,0,0),m,0);            
+      Cloth.SetMass(k++,pos+xn*i+yn*j,m,0);            
 		}
 	}
   
@@ -558,24 +903,19 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
     int y=Array[i].Para.GridY%yc;
     int j=x+y*xc;
     sInt t=Array[i].Para.Type+1;
-    Moveable[i]=&Particles[j];
-    Particles[j].T=t;
+    Moveable[i]=j;
+    Cloth.Cold[j].T=t;
     sPoolString name(Array[i].Para.SplineName);
     Array[i].Symbol = Wz4RenderType->Script->AddSymbol(name);
     Array[i].Script = 0;
   }
 
-	int maxSprings= xc*(yc-1)+yc*(xc-1)+ xc*(yc-2)+yc*(xc-2)+(yc-1)*(xc-1)*2; // berechne anzahl noetiger federn
-  Springs.AddMany(maxSprings);
-	
-	k=0;
-
 	//Structure Springs
 	for(j=0;j<yc;j++)
   {
 		for(i=0;i<(xc-1);i++)
     {
-			Springs[k++].Init(&Particles[i+j*xc],&Particles[(i+1)+j*xc] ,c1);
+			Cloth.AddSpring(i+j*xc,(i+1)+j*xc,c1);
 		}
 	}
 	
@@ -583,7 +923,7 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
   {
 		for( i=0;i<xc;i++)
     {
-			Springs[k++].Init(&Particles[i+j*xc],&Particles[i+(j+1)*xc] ,c1);
+			Cloth.AddSpring(i+j*xc,i+(j+1)*xc,c1);
 		}
 	}
 
@@ -592,7 +932,7 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
   {
 		for(i=0;i<(xc-2);i++)
     {
-			Springs[k++].Init(&Particles[i+j*xc],&Particles[(i+2)+j*xc] ,c1);
+			Cloth.AddSpring(i+j*xc,(i+2)+j*xc,c1);
 		}
 	}
 	
@@ -600,7 +940,7 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
   {
 		for(i=0;i<xc;i++)
     {
-			Springs[k++].Init(&Particles[i+j*xc],&Particles[i+(j+2)*xc] ,c1);
+			Cloth.AddSpring(i+j*xc,i+(j+2)*xc,c1);
 		}
 	}
 
@@ -609,27 +949,29 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
   {
 		for(i=0;i<(xc-1);i++)
     {
-			Springs[k++].Init(&Particles[i+j*xc],&Particles[i+1+(j+1)*xc] ,c2);
-			Springs[k++].Init(&Particles[i+1+j*xc],&Particles[i+(j+1)*xc] ,c2);
+			Cloth.AddSpring(i+j*xc,i+1+(j+1)*xc,c2);
+			Cloth.AddSpring(i+1+j*xc,i+(j+1)*xc,c2);
 		}
 	}  
+  Cloth.Colour();
   
   sInt steps = ParaBase.TimeOffset/SIMSTEP;  
 
   for(i=0;i<n;i++)
   {
-    if (Moveable[i]->T==1 || Moveable[i]->T==3) //Fixing-Total, Release-AfterInit
+    sInt mi=Moveable[i];
+    if (Cloth.Cold[mi].T==1 || Cloth.Cold[mi].T==3) //Fixing-Total, Release-AfterInit
     {
-      Moveable[i]->M=0.0f;
-      if (Moveable[i]->T==1)
+      Cloth.M[mi]=0.0f;
+      if (Cloth.Cold[mi].T==1)
       {
-        sVector30 p=(sVector30)Moveable[i]->P;
+        sVector30 p=(sVector30)Cloth.GetPos(mi);
         for (int j=0;j<maxParticle;j++)
         {
-          sVector30 dv=((sVector30)Particles[j].P)-p;
+          sVector30 dv=((sVector30)Cloth.GetPos(j))-p;
           sF32 d=dv.Length()/(Array[i].Para.DragRadius+0.0001);
           d=sClamp(d,0.0f,1.0f);
-          Particles[j].M*=d;        
+          Cloth.M[j]*=d;        
         }
       }
     }      
@@ -640,19 +982,14 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
 
   CalcParticles(steps,true,0.0f);
 
-  sInt cnt=Particles.GetCount();
-
-  for (sInt i=0;i<cnt;i++)
-  {
-    Particles[i].Freeze();
-  }
+  Cloth.Freeze();
 
   for(i=0;i<n;i++)
   {
-    if (Moveable[i]->T==2)  //Fixing-AfterInit
-      Moveable[i]->M=0.0f;
-    else if (Moveable[i]->T==3) //Release-AfterInit
-      Moveable[i]->M=m;
+    if (Cloth.Cold[Moveable[i]].T==2)  //Fixing-AfterInit
+      Cloth.M[Moveable[i]]=0.0f;
+    else if (Cloth.Cold[Moveable[i]].T==3) //Release-AfterInit
+      Cloth.M[Moveable[i]]=m;
   }
 
   if (Para.DebugSubdivide)
@@ -662,6 +999,7 @@ void RNFR063ClothGridSimRender::Init(Wz4ADF *dfobj)
 
 
   LastTime=0.0f;
+  Checkpoints.Init(Para.CheckpointInterval);
 }
 
 
@@ -785,9 +1123,9 @@ void RNFR063ClothGridSimRender::Prepare(Wz4RenderContext *ctx)
         float v=y;
         u=u/(xc-1);
         v=v/(yc-1);
-        vp[j].px=Particles[i].P.x;
-        vp[j].py=Particles[i].P.y;
-        vp[j].pz=Particles[i].P.z;
+        vp[j].px=Cloth.PX[i];
+        vp[j].py=Cloth.PY[i];
+        vp[j].pz=Cloth.PZ[i];
         vp[j].u0=u;
         vp[j].v0=v;
         vp[j].nx=0.0f;
@@ -809,9 +1147,9 @@ void RNFR063ClothGridSimRender::Prepare(Wz4RenderContext *ctx)
         float v=y;
         u=u/(xc-1);
         v=v/(yc-1);
-        vp[j].px=Particles[i].P.x;
-        vp[j].py=Particles[i].P.y;
-        vp[j].pz=Particles[i].P.z;
+        vp[j].px=Cloth.PX[i];
+        vp[j].py=Cloth.PY[i];
+        vp[j].pz=Cloth.PZ[i];
         vp[j].u0=u;
         vp[j].v0=v;
         vp[j].nx=0.0f;
@@ -1344,37 +1682,55 @@ void RNFR063ClothGridSimRender::Simulate(sF32 time)
   }
   if (d<0.0f)
   {
-    Reset();        
-    steps=time/SIMSTEP;
-    LastTime=steps*SIMSTEP;
-    time=0.0f;
+    if (!RestoreCheckpoint(time))
+      Reset();        
   }
   else
   {
-    steps=d/SIMSTEP;    
-    time=LastTime;
-    LastTime+=steps*SIMSTEP;    
+    RestoreCheckpoint(time,LastTime);   // jumping ahead
   }    
-  
-  if (steps>0)
-    CalcParticles(steps,false,time/Para.TimeScale);
+  steps=sMax<sInt>((time-LastTime)/SIMSTEP,0);
+  time=LastTime;
+
+  // step by step, to leave snapshots on the way
+
+  for (sInt i=0;i<steps;i++)
+  {
+    CalcParticles(1,false,(time+i*SIMSTEP)/Para.TimeScale);
+    LastTime=time+(i+1)*SIMSTEP;
+    StoreCheckpoint();
+  }
 }
 
+void RNFR063ClothGridSimRender::StoreCheckpoint()
+{
+  if (Para.DebugDoSim==0 || !Checkpoints.Want(LastTime))
+    return;
+
+  Wz4CheckpointWriter w(CheckpointData);
+  w.Value(LastTime);
+  Cloth.SaveState(w);
+  Checkpoints.Store(LastTime,CheckpointData);
+}
 
-static void TaskCodeSimulate(sStsManager *m,sStsThread *th,sInt start,sInt count,void *data)
+sBool RNFR063ClothGridSimRender::RestoreCheckpoint(sF32 time,sF32 after)
 {
-  sArray <SCSpring> *springs = (sArray <SCSpring> *)data;
-  sInt ns=springs->GetCount();
-  sInt n=(ns+63)/64;
-  sInt s=n*start;
-  sInt e=s+n;
-  if (e>ns)
-    e=ns;
- 
-  for(sInt i=s;i<e;i++)
+  sF32 found;
+  if (!Checkpoints.Find(time,found,CheckpointData,after))
+    return 0;
+
+  Wz4CheckpointReader r(CheckpointData);
+  sF32 last=0;
+  r.Value(last);
+  if (Cloth.LoadState(r) && r.IsDone())
   {
-    (*springs)[i].CalcForces();
+    LastTime=last;
+    return 1;
   }
+  Checkpoints.Clear();
+  Cloth.Reset();
+  LastTime=0;
+  return 0;
 }
 
 void RNFR063ClothGridSimRender::CalcParticles(sInt steps, sBool init, sF32 time)
@@ -1386,13 +1742,7 @@ void RNFR063ClothGridSimRender::CalcParticles(sInt steps, sBool init, sF32 time)
 
   for (j=0;j<steps;j++)
   {
-    sInt i;  
-    sInt np=Particles.GetCount();
-    sInt ns=Springs.GetCount();
     sInt nm=Moveable.GetCount();
-    sVector30 G=Para.Gravity;
-    sVector30 M=Para.Force;
-    sF32 D=Para.Damping;   
     sInt count = Array.GetCount();  
 
     for(sInt i=0;i<count;i++)
@@ -1404,79 +1754,23 @@ void RNFR063ClothGridSimRender::CalcParticles(sInt steps, sBool init, sF32 time)
     }
     time+=SIMSTEP/Para.TimeScale;
 
-    for(i=0;i<np;i++)
-    {    
-      Particles[i].ClearForce();
-      Particles[i].AddForce(Para.Force);
-      Particles[i].AddForce(G);
-      Particles[i].AddForce(-D*Particles[i].V);		
-    }
-
     if (!init)
     {
-      for(i=0;i<nm;i++)
+      for(sInt i=0;i<nm;i++)
       {		
-        if (Moveable[i]->T==2||Moveable[i]->T==1)  //Fixing-AfterInit
-          Moveable[i]->P = Moveable[i]->ROP+sVector30(Array[i].Pos);
-      }
-    }
-    if (Para.DebugUseMulticore)
-    {
-      sStsWorkload *wl = sSched->BeginWorkload();
-      sStsTask *task = wl->NewTask(TaskCodeSimulate,&Springs,64,0);
-      wl->AddTask(task);
-      wl->Start();
-      wl->Sync();
-      wl->End();
-    }
-    else
-    {
-      for(i=0;i<ns;i++)
-      {
-        Springs[i].CalcForces();
+        sInt mi=Moveable[i];
+        if (Cloth.Cold[mi].T==2||Cloth.Cold[mi].T==1)  //Fixing-AfterInit
+          Cloth.SetPos(mi,Cloth.Cold[mi].ROP+sVector30(Array[i].Pos));
       }
     }
 
-    for(i=0;i<ns;i++)
-    {
-      Springs[i].S->AddForce(Springs[i].F);
-      Springs[i].E->SubForce(Springs[i].F);
-    }
-
-    for(i=0;i<np;i++)
-    {
-      tSDF *df=DF->GetObj();
-
-      sVector30  v=Particles[i].V+Particles[i].F*Particles[i].M*SIMSTEP;
-      sVector31 sp=Particles[i].P;
-      sVector31 ep=sp+v;      
-
-      sF32 d;
-      d=df->GetDistance(ep)-Para.CollisionGuard;        
-      if (d<0.0f)
-      {
-        sVector30 n;
-        df->GetNormal(ep,n);         
-        if (n.LengthSq()<0.01f)
-        {
-          n=sp-ep;
-        }
-        ep=ep+d*n;
-        v=-n*Para.SlideFactor;
-      }              
-      Particles[i].P=ep;
-      Particles[i].V=v;      
-    }
+    Cloth.Step(Para.Force+Para.Gravity,Para.Damping,DF->GetObj(),Para.CollisionGuard,Para.SlideFactor,Para.DebugUseMulticore);
   }
 }
 
 void RNFR063ClothGridSimRender::Reset()
 {  
-  sInt cnt=Particles.GetCount();
-  for (sInt i=0;i<cnt;i++)
-  {
-    Particles[i].Reset();
-  }
+  Cloth.Reset();
   LastTime=0;
 }
 
@@ -1487,7 +1781,7 @@ void RNFR063ClothGridSimRender::Handles(wPaintInfo &pi, Wz4RenderParaFR063_Cloth
 
   for (sInt i=0;i<o->Moveable.GetCount();i++)
   {
-    sVector30 tv=(sVector30)(o->Moveable[i]->ROP);
+    sVector30 tv=(sVector30)(o->Cloth.Cold[o->Moveable[i]].ROP);
     ScriptSpline *spline = o->Array[i].Script;
     if(spline && spline->Count==3)
     {      
@@ -1502,7 +1796,7 @@ void RNFR063ClothGridSimRender::Handles(wPaintInfo &pi, Wz4RenderParaFR063_Cloth
         v0 = v1;
       }
     }    
-    sVector31 p0=o->Moveable[i]->P;
+    sVector31 p0=o->Cloth.GetPos(o->Moveable[i]);
     sVector31 p1=p0-sVector30(0.1f,0.0f,0.0f);
     sVector31 p2=p0+sVector30(0.1f,0.0f,0.0f);
     pi.Line3D(p1,p2,0xff00ff00);
@@ -1892,42 +2186,90 @@ void SphCollPDF::Init()
 {
 }
 
+struct SphCollPDFJob
+{
+  SphCollPDF *Coll;
+  const Wz4PDFProgram *Prog;
+  RPSPH::Particle *Parts;
+  sInt Count;
+};
+
+static void SphCollPDFTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  SphCollPDFJob *job = (SphCollPDFJob *) data;
+  for(sInt i=start;i<start+count;i++)
+  {
+    sInt first = i*SphCollPDF::CHUNK;
+    job->Coll->CollChunk(job->Prog,job->Parts+first,sMin<sInt>(SphCollPDF::CHUNK,job->Count-first));
+  }
+}
+
 void SphCollPDF::CollPart(RPSPH *s)
 {
-  Wz4PDFObj *df=PDF->GetObj();
-  sInt max = s->Parts[0]->GetCount();
-  RPSPH::Particle *p = s->Parts[0]->GetData(); 
+  SphCollPDFJob job;
+  job.Coll = this;
+  job.Prog = PDF->GetProgram();
+  job.Count = s->Parts[0]->GetCount();
+  job.Parts = s->Parts[0]->GetData(); 
+
+  sInt tasks = (job.Count+CHUNK-1)/CHUNK;
+  if(tasks<2 || !sSched || sSched->GetThreadCount()<2)
+  {
+    SphCollPDFTask(0,0,0,tasks,&job);
+    return;
+  }
+
+  sStsWorkload *wl = sSched->BeginWorkload();
+  sStsTask *task = wl->NewTask(SphCollPDFTask,&job,tasks,0);
+  wl->AddTask(task);
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
+
+void SphCollPDF::CollChunk(const Wz4PDFProgram *prog,RPSPH::Particle *p,sInt max)
+{
+  sF32 dist[CHUNK];
+  prog->GetDistance(max,&p[0].NewPos,sizeof(RPSPH::Particle),dist);
 
   if(Para.Flags & 1)
   {
     for(sInt i=0;i<max;i++)
     {
-      sF32 d=df->GetDistance(p[i].NewPos);
+      sF32 d=dist[i];
       if (Para.Flags&16) d=-d;
       if (d<0.0f) p[i].Color = 0;      
     }
   }
   else
   {
+    // normals only for the particles inside
+
+    sInt index[CHUNK];
+    sVector31 pos[CHUNK];
+    sVector30 norm[CHUNK];
+    sInt in=0;
     for(sInt i=0;i<max;i++)
     {
-      sVector31 sp=p[i].OldPos;
-      sVector31 ep=p[i].NewPos;
-      sF32 d;
-      d=df->GetDistance(ep);
-      if (Para.Flags&16) d=-d;
-      if (d<0.0f)
+      if (Para.Flags&16) dist[i]=-dist[i];
+      if (dist[i]<0.0f)
       {
-        sVector30 n;
-        df->GetNormal(ep,n);
-        if (Para.Flags&16) n=-n;
-        if (n.LengthSq()<0.001f)
-        {
-          n=p[i].NewPos-p[i].OldPos;
-        }
-        ep=ep+d*n;
+        index[in] = i;
+        pos[in++] = p[i].NewPos;
+      }
+    }
+    prog->GetNormal(in,pos,sizeof(sVector31),norm);
+
+    for(sInt j=0;j<in;j++)
+    {
+      sInt i=index[j];
+      sVector30 n=norm[j];
+      if (Para.Flags&16) n=-n;
+      if (n.LengthSq()<0.001f)
+      {
+        n=p[i].NewPos-p[i].OldPos;
       }
-      p[i].NewPos=ep;
+      p[i].NewPos=p[i].NewPos+dist[i]*n;
     }
   }  
 }
@@ -17,110 +17,82 @@
 //#include "../wz4tronlib/adf.hpp"
 #include "wz4frlib/pdf.hpp"
 #include "fr063_sph.hpp"
+#include "wz4frlib/wz4_checkpoint.hpp"
 
 
 
 /****************************************************************************/
 
+// what a mass of the cloth is reset to. the solver does not touch this.
+
 struct SCMass
 {
-  inline void Init(const	sVector31 &p, const sVector30 &v, float m, sInt t)
+  inline void Init(const sVector31 &p, const sVector30 &v, sInt t)
   {
-		ROP=RP=OP=P=p;
-		ROV=RV=OV=V=v;
-		M=m;
+    ROP=RP=p;
+    RV=v;
     T=t;
-    F.Init(0,0,0);
-  }
-
-  inline void ClearForce()
-  {
-    F.Init(0,0,0);
-  }
-
-  inline void AddForce(const sVector30 &f)
-  {
-    F = F + f;
-  }
-
-  inline void SubForce(const sVector30 &f)
-  {
-    F = F - f;
-  }
-
-  inline void Save()
-  {
-    OP=P;
-    OV=V;
-  }
-
-  inline void Restore()
-  {
-    P=OP;
-    V=OV;
-  }
-  
-
-  inline void Freeze()
-  {
-    RP=P;
-    RV=V;
-    ROP=OP;
-    ROV=OV;
-  }
-
-  inline void Reset()
-  {
-    P=OP=RP;
-    V=OV=RV;
-    OP=ROP;
-    OV=ROV;
   }
 
   sVector31 RP;	  //Reset Position
 	sVector30 RV;	  //Reset Velocity
-  sVector31 ROP;	//Reset Old Position
-	sVector30 ROV;	//Reset Old Velocity  
-  sVector31 OP;	  //Old Position
-	sVector30 OV;	  //Old Velocity	
-  sVector31 P;    //Position
-  sVector30 V;    //Velocity
-	sVector30 F;	  //Force			
-	float     M;    //Mass
+  sVector31 ROP;	//Initial Position, moveables are animated relative to it
   sInt      T;    //Type, 0=normal, 1=Fixing-Total, 2=Fixing-AfterInit, 3=Release-AfterInit
 };
 
+// mass-spring solver. the masses are a structure of arrays, padded to
+// a multiple of 4 with massless dummies. the springs are sorted into
+// colours, no two springs of one colour share a mass: a colour is solved
+// in parallel without locks, and the result does not depend on the
+// number of threads.
 
-struct SCSpring
+class SCCloth
 {
-  inline void Init(SCMass *s, SCMass *e, float c)
+  struct Spring
   {
-		S=s;
-		E=e;
-    L=(e->P-s->P).Length();
-		C=c;
-  }
-
-  inline void CalcForces()
+    sInt S,E;
+    sF32 L,C;
+  };
+  sArray<Spring> Springs;         // sorted by colour
+  sArray<sInt> ColourStart;       // springs of colour c are ColourStart[c]..ColourStart[c+1]-1
+  sInt Count;
+
+  static void SpringTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data);
+  static void MassTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data);
+  void SpringRange(sInt s0,sInt s1);
+  void MassRange(sInt m0,sInt m1,const struct SCClothStep *step);
+  static void Run(sStsCode code,void *data,sInt tasks,sBool mt);
+public:
+  enum
   {
-	  sVector30 posdiff = (S->P - E->P);
-    sF32 distanceq = posdiff.LengthSq();    
+    CHUNK = 1024,                 // masses or springs per task, multiple of 4
+    MAXCOLOUR = 32,               // springs that do not fit are solved on one thread
+  };
 
-    if (distanceq<0.0001f || distanceq>100000.0f)
-    {
-      F=sVector30(0,0,0);      
-      return;
-    }    
-    sF32 distance = sSqrt(distanceq);
-	  sF32 cforce = ((distance-L) * C)/distance;
-    F = -cforce*posdiff;
-  }
+  SCCloth();
+  void Init(sInt count);
+  void SetMass(sInt i,const sVector31 &p,sF32 m,sInt t);
+  void AddSpring(sInt s,sInt e,sF32 c);
+  void Colour();                  // after the last spring was added
+
+  sInt GetCount() const { return Count; }
+  sVector31 GetPos(sInt i) const { return sVector31(PX[i],PY[i],PZ[i]); }
+  void SetPos(sInt i,const sVector31 &p) { PX[i]=p.x; PY[i]=p.y; PZ[i]=p.z; }
+  void Freeze();                  // current state becomes the reset state
+  void Reset();
+
+  // one step: external force and damping, springs, integration with
+  // collision against the distance field (may be 0)
+  void Step(const sVector30 &force,sF32 damping,class tSDF *df,sF32 guard,sF32 slide,sBool mt);
 
-	SCMass *S;
-  SCMass *E;
-	float   L;
-	float   C;	
-  sVector30 F;  
+  void SaveState(Wz4CheckpointWriter &w) const;
+  sBool LoadState(Wz4CheckpointReader &r);
+
+  sArray<sF32> PX,PY,PZ;          // position
+  sArray<sF32> VX,VY,VZ;          // velocity
+  sArray<sF32> FX,FY,FZ;          // force
+  sArray<sF32> M;                 // force to velocity, 0 = does not move
+  sArray<SCMass> Cold;
 };
 
 /****************************************************************************/
@@ -205,9 +177,8 @@ class RNFR063ClothGridSimRender : public Wz4RenderNode
 public:
   sGeometry *Geo;   // geometry holding the Grid    
   
-	sArray <SCMass>   Particles;	
-	sArray <SCSpring> Springs;
-  sArray <SCMass *>   Moveable;
+  SCCloth           Cloth;
+  sArray <sInt>     Moveable;     // index of mass
 
   sF32 LastTime;
   sF32 Time;
@@ -232,6 +203,8 @@ public:
   void CalcParticles(sInt steps, sBool init, sF32 time);
   void Simulate(sF32 time);
   void Reset();
+  void StoreCheckpoint();
+  sBool RestoreCheckpoint(sF32 time,sF32 after=-1);
   static void Handles(wPaintInfo &pi, Wz4RenderParaFR063_ClothGridSimRender *para, wOp *op);
   
   sArray<sVertexStandard>                 Vertices;
@@ -241,6 +214,9 @@ public:
 
   Wz4Mtrl *Mtrl;                  // material from inputs
   Wz4ADF *DF;    
+
+  Wz4Checkpoints Checkpoints;     // for seeking on the timeline
+  sArray<sU8> CheckpointData;
 };
 
 /****************************************************************************/
@@ -352,8 +328,10 @@ class SphCollPDF : public SphCollision
 public:
   SphCollisionParaSphPDFColl Para;
   Wz4PDF                    *PDF;  
+  enum { CHUNK = 256 };           // particles per task
   void Init();
   void CollPart(RPSPH *);
+  void CollChunk(const Wz4PDFProgram *prog,RPSPH::Particle *p,sInt max);
 };
 
 /****************************************************************************/
@@ -11,6 +11,7 @@
 #include "wz4frlib/wz4_bsp.hpp"
 #include "base/graphics.hpp"
 #include "util/algorithms.hpp"
+#include "util/scratch.hpp"
 
 /****************************************************************************/
 /****************************************************************************/
@@ -1251,7 +1252,8 @@ void RNChunks::Render(Wz4RenderContext *ctx)
   {
     sMatrix34 mat;
     sMatrix34CM *matp;
-    sMatrix34CM *imat = new sMatrix34CM[Parts.GetCount()];
+    InstMats.Resize(Parts.GetCount());
+    sMatrix34CM *imat = InstMats.GetData();
 
     sInt animdifferent = sMax(1,Parts.GetCount()/Para.AnimDifferent);
 
@@ -1259,39 +1261,57 @@ void RNChunks::Render(Wz4RenderContext *ctx)
     {
       if(Meshes[i]->Skeleton)
       {
-        sInt bc = Meshes[i]->Skeleton->Joints.GetCount();
-        sMatrix34 *bonemat = new sMatrix34[bc];
-        sMatrix34CM *basemat = new sMatrix34CM[bc];
-        
-        sFORALL(Matrices,matp)
+        // parts come in groups of animdifferent that share the pose of the
+        // first part. find the groups that show this mesh and evaluate
+        // their poses all at once
+
+        GroupFirst.Clear();
+        GroupTimes.Clear();
+        sInt group = -1;
+        sFORALL(Parts,p)
         {
-          sInt n = 0;
-          sFORALL(Parts,p)
+          if(_i%animdifferent==0)
+            group = _i;
+          if(group>=0 && p->Time>=0 && p->Index==i)
           {
-            if(_i%animdifferent==0)
-            {
-              if(n>0)
-                Meshes[i]->RenderBoneInst(ctx->RenderMode,Para.EnvNum,bc,basemat,n,imat);
-              n = 0;
-#ifdef sCOMPIL_ASSIMP
-              if(!Meshes[i]->WaiIsAssimpAnimated)
-#endif
-                Meshes[i]->Skeleton->EvaluateCM(p->Anim,bonemat,basemat);
+            GroupFirst.AddTail(group);
+            GroupTimes.AddTail(Parts[group].Anim);
+            group = -1;
+          }
+        }
+        sInt groups = GroupFirst.GetCount();
+        if(groups==0)
+          continue;
+
+        sInt bc = Meshes[i]->Skeleton->Joints.GetCount();
+        BaseMats.Resize(groups*bc);
 #ifdef sCOMPIL_ASSIMP
-              else
-                Meshes[i]->Skeleton->WaiEvaluateAssimpCM(p->Anim,bonemat,basemat,Meshes[i]->WaiAnimSequence);
+        if(Meshes[i]->WaiIsAssimpAnimated)
+        {
+          sScratchScope scratch;
+          sMatrix34 *bonemat = scratch.Alloc<sMatrix34>(bc);
+          for(sInt g=0;g<groups;g++)
+            Meshes[i]->Skeleton->WaiEvaluateAssimpCM(GroupTimes[g],bonemat,&BaseMats[g*bc],Meshes[i]->WaiAnimSequence);
+        }
+        else
 #endif
-            }
-            if(p->Time>=0 && p->Index==i)
+          Meshes[i]->Skeleton->GetBatch()->EvaluateCMMT(groups,GroupTimes.GetData(),BaseMats.GetData());
+
+        sFORALL(Matrices,matp)
+        {
+          for(sInt g=0;g<groups;g++)
+          {
+            sInt n = 0;
+            sInt end = sMin(GroupFirst[g]+animdifferent,Parts.GetCount());
+            for(sInt k=GroupFirst[g];k<end;k++)
             {
-              imat[n++] = p->Mat*sMatrix34(*matp);
+              p = &Parts[k];
+              if(p->Time>=0 && p->Index==i)
+                imat[n++] = p->Mat*sMatrix34(*matp);
             }
+            Meshes[i]->RenderBoneInst(ctx->RenderMode,Para.EnvNum,bc,&BaseMats[g*bc],n,imat);
           }
-          if(n>0)
-            Meshes[i]->RenderBoneInst(ctx->RenderMode,Para.EnvNum,bc,basemat,n,imat);
         }
-        delete[] bonemat;
-        delete[] basemat;
       }
       else
       {
@@ -1308,8 +1328,6 @@ void RNChunks::Render(Wz4RenderContext *ctx)
         }
       }
     }
-
-    delete[] imat;
   }
   else if(BoneCount)
   {
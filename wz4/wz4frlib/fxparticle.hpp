@@ -211,6 +211,11 @@ class RNChunks : public Wz4RenderNode
   sInt BoneCount;         // when in bone-mode (that is, one mesh with bones)
   Wz4PartInfo PInfo[3];
 
+  sArray<sMatrix34CM> InstMats;   // skeleton mode, kept between frames
+  sArray<sMatrix34CM> BaseMats;
+  sArray<sInt> GroupFirst;
+  sArray<sF32> GroupTimes;
+
 public:
   RNChunks();
   ~RNChunks();
@@ -39,6 +39,12 @@ public:
   sBool SetOffset(sS64 offset);       // seek to offset
   sS64 GetOffset();                   // get offset
   sS64 GetSize();                     // get size
+
+  sBool CanReadAsync();
+  sFileReadHandle BeginRead(sS64 offset,sDInt size,void *destbuffer,sFilePriorityFlags prio);
+  sBool DataAvailable(sFileReadHandle handle);
+  void *GetData(sFileReadHandle handle);
+  void EndRead(sFileReadHandle handle);
 };
 
 
@@ -273,6 +279,34 @@ sS64 DPFUnpacked::GetSize()
   return Size;
 }
 
+// async reads go straight to the pack file
+
+sBool DPFUnpacked::CanReadAsync()
+{
+  return BaseFile->CanReadAsync();
+}
+
+sFileReadHandle DPFUnpacked::BeginRead(sS64 offset,sDInt size,void *destbuffer,sFilePriorityFlags prio)
+{
+  sVERIFY(offset>=0 && offset+size<=Size);
+  return BaseFile->BeginRead(offset+BaseOffset,size,destbuffer,prio);
+}
+
+sBool DPFUnpacked::DataAvailable(sFileReadHandle handle)
+{
+  return BaseFile->DataAvailable(handle);
+}
+
+void *DPFUnpacked::GetData(sFileReadHandle handle)
+{
+  return BaseFile->GetData(handle);
+}
+
+void DPFUnpacked::EndRead(sFileReadHandle handle)
+{
+  BaseFile->EndRead(handle);
+}
+
 /****************************************************************************/
 /****************************************************************************/
 
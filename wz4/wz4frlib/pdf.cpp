@@ -7,6 +7,8 @@
 
 #include "pdf.hpp"
 #include "pdf_ops.hpp"
+#include "util/scratch.hpp"
+#include "util/simd_float.hpp"
 
 /****************************************************************************/
 
@@ -22,39 +24,108 @@ Wz4PDF::Wz4PDF()
 {
   Type = Wz4PDFType;  
   Obj  = 0;
+  Program = 0;
 }
 
 Wz4PDF::~Wz4PDF()
 {
   if (Obj)
     Obj->Release();
+  delete Program;
+}
+
+const Wz4PDFProgram *Wz4PDF::GetProgram()
+{
+  if (!Program)
+  {
+    Program = new Wz4PDFProgram;
+    Program->Compile(Obj);
+  }
+  return Program;
 }
 
 sBool Wz4PDF::TraceRay(sVector31 &p, sVector30 &n, const sRay &ray, const sF32 md, const sF32 mx, const sInt mi)
 {   
-  sInt i=0;
-  sF32 d=10000;  
-  sF32 id=0;
-  sVector31 np;
-  sVector31 tp = ray.Start;  
+  Wz4PDFHit hit;
+  TraceRays(1,&ray,&hit,md,mx,mi);
+  p = hit.Pos;
+  if (hit.Hit)
+    n = hit.Normal;
+  return hit.Hit;
+}
+
+// all rays step at once, the ones that are done drop out of the packet.
+
+void Wz4PDF::TraceRays(sInt count, const sRay *rays, Wz4PDFHit *hits, const sF32 md, const sF32 mx, const sInt mi)
+{
+  struct RayState
+  {
+    sVector31 Near;               // where d was smallest
+    sF32 D;
+    sF32 Dist;
+    sInt Steps;
+  };
+
+  const Wz4PDFProgram *prog = GetProgram();
+  sScratchScope scratch;
+  RayState *state = scratch.Alloc<RayState>(count);
+  sInt *active = scratch.Alloc<sInt>(count);
+  sVector31 *pos = scratch.Alloc<sVector31>(count);
+  sF32 *dist = scratch.Alloc<sF32>(count);
+  sInt ac = count;
+
+  for (sInt i=0;i<count;i++)
+  {
+    state[i].D = 10000;
+    state[i].Dist = 0;
+    state[i].Steps = 0;
+    hits[i].Pos = rays[i].Start;
+    active[i] = i;
+  }
 
-  do
+  while (ac>0)
   {
-    p = tp;
-    sF32 td = Obj->GetDistance(p);          
-    if (td<=d)
+    for (sInt i=0;i<ac;i++)
+      pos[i] = hits[active[i]].Pos;
+    prog->GetDistance(ac,pos,sizeof(sVector31),dist);
+
+    sInt left = 0;
+    for (sInt i=0;i<ac;i++)
     {
-      d=td;  
-      np=p;
+      sInt r = active[i];
+      RayState *st = &state[r];
+      sF32 td = dist[i];
+      if (td<=st->D)
+      {
+        st->D = td;
+        st->Near = pos[i];
+      }
+      if (st->D>md && st->Steps++!=mi && st->Dist+sAbs(td)<mx)
+      {
+        hits[r].Pos = pos[i] + rays[r].Dir * sAbs(td);
+        active[left++] = r;
+      }
+      st->Dist += sAbs(td);
     }
-    tp = tp + ray.Dir * sAbs(td);
-    id+= sAbs(td);
-  }while (d>md && i++!=mi && id<mx);
-   
-  if (d<=md)
-    Obj->GetNormal(np,n);
+    ac = left;
+  }
+
+  // normals of all hits in one go
 
-  return d<=md;
+  sInt hc = 0;
+  for (sInt i=0;i<count;i++)
+  {
+    hits[i].Hit = state[i].D<=md;
+    if (hits[i].Hit)
+    {
+      pos[hc] = state[i].Near;
+      active[hc++] = i;
+    }
+  }
+  sVector30 *norm = scratch.Alloc<sVector30>(hc+1);
+  prog->GetNormal(hc,pos,sizeof(sVector31),norm);
+  for (sInt i=0;i<hc;i++)
+    hits[active[i]].Normal = norm[i];
 }
 
 
@@ -106,6 +177,299 @@ void Wz4PDFObj::GetNormal(const sVector31 &p, sVector30 &n)
   n.Unit();            
 }
 
+void Wz4PDFObj::Compile(Wz4PDFProgram *prog)
+{
+  prog->EmitVirtual(this);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Compiled Evaluation                                                ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+Wz4PDFProgram::Wz4PDFProgram()
+{
+  PosDepth = MaxPos = 1;
+  DistDepth = MaxDist = 0;
+}
+
+void Wz4PDFProgram::Compile(Wz4PDFObj *root)
+{
+  Ops.Clear();
+  PosDepth = MaxPos = 1;
+  DistDepth = MaxDist = 0;
+  if (root)
+    root->Compile(this);
+  else
+    EmitConst(0);
+  sVERIFY(PosDepth==1 && DistDepth==1);
+}
+
+Wz4PDFProgram::Op *Wz4PDFProgram::Add(sInt code,sInt pos,sInt dist)
+{
+  Op *op = Ops.AddMany(1);
+  sClear(*op);
+  op->Code = code;
+  PosDepth += pos;
+  DistDepth += dist;
+  sVERIFY(PosDepth>=1 && DistDepth>=0);
+  MaxPos = sMax(MaxPos,PosDepth);
+  MaxDist = sMax(MaxDist,DistDepth);
+  return op;
+}
+
+void Wz4PDFProgram::EmitConst(sF32 d)                   { Add(OP_CONST,0,1)->Value = d; }
+void Wz4PDFProgram::EmitSphere()                        { Add(OP_SPHERE,0,1); }
+void Wz4PDFProgram::EmitCube()                          { Add(OP_CUBE,0,1); }
+void Wz4PDFProgram::EmitADF(tSDF *adf)                  { Add(OP_ADF,0,1)->ADF = adf; }
+void Wz4PDFProgram::EmitVirtual(Wz4PDFObj *obj)         { Add(OP_VIRTUAL,0,1)->Obj = obj; }
+void Wz4PDFProgram::EmitTransform(const sMatrix34 &mat) { Add(OP_TRANSFORM,1,0)->Mat = mat; }
+void Wz4PDFProgram::EmitPopPos()                        { Add(OP_POPPOS,-1,0); }
+void Wz4PDFProgram::EmitMin()                           { Add(OP_MIN,0,-1); }
+
+void Wz4PDFProgram::EmitTwirl(const sVector30 &scale,const sVector30 &bias)
+{
+  Op *op = Add(OP_TWIRL,1,0);
+  op->Scale = scale;
+  op->Bias = bias;
+}
+
+void Wz4PDFProgram::EmitMerge(sInt type,sF32 factor)
+{
+  Op *op = Add(OP_MERGE,0,-1);
+  op->Type = type;
+  op->Value = factor;
+}
+
+// count is a multiple of 4. pos holds MaxPos levels of x[BATCH],y[BATCH],
+// z[BATCH], the first is the input. dist holds MaxDist rows of BATCH.
+
+void Wz4PDFProgram::Run(sInt count,sF32 *pos,sF32 *dist) const
+{
+  sF32 *px = pos;                 // current position level
+  sF32 *d = dist-BATCH;           // top of distance stack
+  const Op *op;
+
+  sFORALL(Ops,op)
+  {
+    switch (op->Code)
+    {
+    case OP_CONST:
+      d += BATCH;
+      for (sInt i=0;i<count;i++)
+        d[i] = op->Value;
+      break;
+
+    case OP_SPHERE:
+      d += BATCH;
+#if sSIMD_INTRINSICS
+      for (sInt i=0;i<count;i+=4)
+      {
+        sSSE x = sVecLoad(px+i);
+        sSSE y = sVecLoad(px+i+BATCH);
+        sSSE z = sVecLoad(px+i+2*BATCH);
+        sSSE r = _mm_sqrt_ps(sVecAdd(sVecAdd(sVecMul(x,x),sVecMul(y,y)),sVecMul(z,z)));
+        sVecStore(sVecSub(r,sVecLoadScalar(1.0f)),d+i);
+      }
+#else
+      for (sInt i=0;i<count;i++)
+        d[i] = sqrtf(px[i]*px[i] + px[i+BATCH]*px[i+BATCH] + px[i+2*BATCH]*px[i+2*BATCH]) - 1.0f;
+#endif
+      break;
+
+    case OP_CUBE:
+      d += BATCH;
+#if sSIMD_INTRINSICS
+      {
+        const sSSE absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const sSSE half = sVecLoadScalar(0.5f);
+        for (sInt i=0;i<count;i+=4)
+        {
+          sSSE x = sVecAnd(sVecLoad(px+i),absmask);
+          sSSE y = sVecAnd(sVecLoad(px+i+BATCH),absmask);
+          sSSE z = sVecAnd(sVecLoad(px+i+2*BATCH),absmask);
+          sSSE t = sVecSub(sVecMax(sVecMax(x,y),z),half);
+          sSSE corner = sVecAnd(sVecAnd(sVecCmpGT(x,half),sVecCmpGT(y,half)),sVecCmpGT(z,half));
+          x = sVecSub(x,half);
+          y = sVecSub(y,half);
+          z = sVecSub(z,half);
+          sSSE c = _mm_sqrt_ps(sVecAdd(sVecAdd(sVecMul(x,x),sVecMul(y,y)),sVecMul(z,z)));
+          sVecStore(sVecSel(t,c,corner),d+i);
+        }
+      }
+#else
+      for (sInt i=0;i<count;i++)
+      {
+        sF32 x = sAbs(px[i]);
+        sF32 y = sAbs(px[i+BATCH]);
+        sF32 z = sAbs(px[i+2*BATCH]);
+        if (x>0.5f && y>0.5f && z>0.5f)
+          d[i] = sSqrt((x-0.5f)*(x-0.5f)+(y-0.5f)*(y-0.5f)+(z-0.5f)*(z-0.5f));
+        else
+          d[i] = sMax(sMax(x,y),z)-0.5f;
+      }
+#endif
+      break;
+
+    case OP_ADF:
+      d += BATCH;
+      for (sInt i=0;i<count;i++)
+        d[i] = op->ADF->GetDistance(sVector31(px[i],px[i+BATCH],px[i+2*BATCH]));
+      break;
+
+    case OP_VIRTUAL:
+      d += BATCH;
+      for (sInt i=0;i<count;i++)
+        d[i] = op->Obj->GetDistance(sVector31(px[i],px[i+BATCH],px[i+2*BATCH]));
+      break;
+
+    case OP_TRANSFORM:
+      {
+        const sMatrix34 &m = op->Mat;
+        sF32 *np = px+3*BATCH;
+#if sSIMD_INTRINSICS
+        for (sInt i=0;i<count;i+=4)
+        {
+          sSSE x = sVecLoad(px+i);
+          sSSE y = sVecLoad(px+i+BATCH);
+          sSSE z = sVecLoad(px+i+2*BATCH);
+          sVecStore(sVecAdd(sVecAdd(sVecAdd(sVecMul(x,sVecLoadScalar(m.i.x)),sVecMul(y,sVecLoadScalar(m.j.x))),sVecMul(z,sVecLoadScalar(m.k.x))),sVecLoadScalar(m.l.x)),np+i);
+          sVecStore(sVecAdd(sVecAdd(sVecAdd(sVecMul(x,sVecLoadScalar(m.i.y)),sVecMul(y,sVecLoadScalar(m.j.y))),sVecMul(z,sVecLoadScalar(m.k.y))),sVecLoadScalar(m.l.y)),np+i+BATCH);
+          sVecStore(sVecAdd(sVecAdd(sVecAdd(sVecMul(x,sVecLoadScalar(m.i.z)),sVecMul(y,sVecLoadScalar(m.j.z))),sVecMul(z,sVecLoadScalar(m.k.z))),sVecLoadScalar(m.l.z)),np+i+2*BATCH);
+        }
+#else
+        for (sInt i=0;i<count;i++)
+        {
+          sVector31 v = sVector31(px[i],px[i+BATCH],px[i+2*BATCH])*m;
+          np[i] = v.x;
+          np[i+BATCH] = v.y;
+          np[i+2*BATCH] = v.z;
+        }
+#endif
+        px = np;
+      }
+      break;
+
+    case OP_TWIRL:
+      {
+        sF32 *np = px+3*BATCH;
+        for (sInt i=0;i<count;i++)
+        {
+          sVector31 p(px[i],px[i+BATCH],px[i+2*BATCH]);
+          sMatrix34 m;
+          m.EulerXYZ(p.x*op->Scale.x+op->Bias.x,p.y*op->Scale.y+op->Bias.y,p.z*op->Scale.z+op->Bias.z);
+          p = p*m;
+          np[i] = p.x;
+          np[i+BATCH] = p.y;
+          np[i+2*BATCH] = p.z;
+        }
+        px = np;
+      }
+      break;
+
+    case OP_POPPOS:
+      px -= 3*BATCH;
+      break;
+
+    case OP_MIN:
+      d -= BATCH;
+#if sSIMD_INTRINSICS
+      for (sInt i=0;i<count;i+=4)
+        sVecStore(sVecMin(sVecLoad(d+i+BATCH),sVecLoad(d+i)),d+i);
+#else
+      for (sInt i=0;i<count;i++)
+        d[i] = sMin(d[i+BATCH],d[i]);
+#endif
+      break;
+
+    case OP_MERGE:
+      d -= BATCH;
+      {
+        sF32 f1 = 1.0f-op->Value;
+        sF32 f2 = op->Value;
+        for (sInt i=0;i<count;i++)
+        {
+          sF32 d1 = d[i];
+          sF32 d2 = d[i+BATCH];
+          switch (op->Type)
+          {
+            case 5 : d[i] = sMax(d1,0.0f)*f1+sMax(d2,0.0f)*f2; break;
+            case 4 : d[i] = sMin(d1,d2)*f1+sMax(d1,d2)*f2; break;
+            case 3 : d[i] = d1*f1+d2*f2; break;
+            case 2 : d[i] = sMax(-d1,d2); break;
+            case 1 : d[i] = sMax(d1,d2); break;
+            default : d[i] = sMin(d1,d2); break;
+          }
+        }
+      }
+      break;
+    }
+  }
+}
+
+void Wz4PDFProgram::GetDistance(sInt count,const sVector31 *pos,sInt stride,sF32 *dist) const
+{
+  sScratchScope scratch;
+  sF32 *p = scratch.Alloc<sF32>(MaxPos*3*BATCH);
+  sF32 *d = scratch.Alloc<sF32>(MaxDist*BATCH);
+  const sU8 *src = (const sU8 *) pos;
+
+  for (sInt start=0;start<count;start+=BATCH)
+  {
+    sInt n = sMin<sInt>(BATCH,count-start);
+    sInt n4 = (n+3)&~3;
+    for (sInt i=0;i<n4;i++)
+    {
+      const sVector31 *v = (const sVector31 *) (src + sMin(i,n-1)*stride);
+      p[i] = v->x;
+      p[i+BATCH] = v->y;
+      p[i+2*BATCH] = v->z;
+    }
+    Run(n4,p,d);
+    sCopyMem(dist+start,d,n*sizeof(sF32));
+    src += n*stride;
+  }
+}
+
+void Wz4PDFProgram::GetNormal(sInt count,const sVector31 *pos,sInt stride,sVector30 *normal) const
+{
+  sScratchScope scratch;
+  sF32 *p = scratch.Alloc<sF32>(MaxPos*3*BATCH);
+  sF32 *d = scratch.Alloc<sF32>(MaxDist*BATCH);
+  sF32 *nd = scratch.Alloc<sF32>(2*BATCH);
+  const sU8 *src = (const sU8 *) pos;
+  sF32 nds = Wz4PDFObj::GetND();
+
+  for (sInt start=0;start<count;start+=BATCH)
+  {
+    sInt n = sMin<sInt>(BATCH,count-start);
+    sInt n4 = (n+3)&~3;
+
+    for (sInt axis=0;axis<3;axis++)
+    {
+      for (sInt side=0;side<2;side++)
+      {
+        for (sInt i=0;i<n4;i++)
+        {
+          const sVector31 *v = (const sVector31 *) (src + sMin(i,n-1)*stride);
+          p[i] = v->x;
+          p[i+BATCH] = v->y;
+          p[i+2*BATCH] = v->z;
+          p[i+axis*BATCH] += side ? nds : -nds;
+        }
+        Run(n4,p,d);
+        sCopyMem(nd+side*BATCH,d,n*sizeof(sF32));
+      }
+      for (sInt i=0;i<n;i++)
+        (&normal[start+i].x)[axis] = nd[i]-nd[i+BATCH];
+    }
+    for (sInt i=0;i<n;i++)
+      normal[start+i].Unit();
+    src += n*stride;
+  }
+}
+
 /****************************************************************************/
 
 Wz4PDFCube::Wz4PDFCube()
@@ -148,6 +512,11 @@ sF32 Wz4PDFCube::GetDistance(const sVector31 &p)
   return t;
 }
 
+void Wz4PDFCube::Compile(Wz4PDFProgram *prog)
+{
+  prog->EmitCube();
+}
+
 /****************************************************************************/
 
 Wz4PDFAdd::Wz4PDFAdd()
@@ -204,6 +573,23 @@ void Wz4PDFAdd::GetNormal(const sVector31 &p, sVector30 &n)
   }  
 }
 
+void Wz4PDFAdd::Compile(Wz4PDFProgram *prog)
+{
+  if (Array.GetCount())
+  {
+    Array[0]->Compile(prog);
+    for (sInt i=1;i<Array.GetCount();i++)
+    {
+      Array[i]->Compile(prog);
+      prog->EmitMin();
+    }
+  }
+  else
+  {
+    prog->EmitConst(0);
+  }
+}
+
 void Wz4PDFAdd::AddObj(Wz4PDFObj *obj)
 {
   Array.AddTail(obj);
@@ -234,6 +620,13 @@ void Wz4PDFTransform::GetNormal(const sVector31 &p, sVector30 &n)
   Obj->GetNormal(np,n);
 }
 
+void Wz4PDFTransform::Compile(Wz4PDFProgram *prog)
+{
+  prog->EmitTransform(Mat);
+  Obj->Compile(prog);
+  prog->EmitPopPos();
+}
+
 void Wz4PDFTransform::Init(Wz4PDFObj *obj, sVector31 &scale, sVector30 &rot, sVector31 &trans)
 {
   Obj=obj;
@@ -263,6 +656,11 @@ sF32 Wz4PDFSphere::GetDistance(const sVector31 &p)
   return sqrtf(p.x*p.x + p.y*p.y + p.z*p.z) - 1.0f;  
 }
 
+void Wz4PDFSphere::Compile(Wz4PDFProgram *prog)
+{
+  prog->EmitSphere();
+}
+
 /****************************************************************************/
 
 Wz4PDFTwirl::Wz4PDFTwirl()
@@ -281,6 +679,13 @@ sF32 Wz4PDFTwirl::GetDistance(const sVector31 &p)
   return Obj->GetDistance(np);
 }
 
+void Wz4PDFTwirl::Compile(Wz4PDFProgram *prog)
+{
+  prog->EmitTwirl(Scale,Bias);
+  Obj->Compile(prog);
+  prog->EmitPopPos();
+}
+
 void Wz4PDFTwirl::Init(Wz4PDFObj *obj, sVector30 &scale, sVector30 &bias)
 {
   Obj=obj;
@@ -309,6 +714,11 @@ void Wz4PDFFromADF::GetNormal(const sVector31 &p, sVector30 &n)
   ADF->GetObj()->GetNormal(p,n);
 }
 
+void Wz4PDFFromADF::Compile(Wz4PDFProgram *prog)
+{
+  prog->EmitADF(ADF->GetObj());
+}
+
 /****************************************************************************/
 
 Wz4PDFMerge::Wz4PDFMerge()
@@ -329,6 +739,13 @@ void Wz4PDFMerge::Init(Wz4PDFObj *obj1, Wz4PDFObj *obj2, sInt type, sF32 factor)
   Factor=factor;
 }
 
+void Wz4PDFMerge::Compile(Wz4PDFProgram *prog)
+{
+  Obj1->Compile(prog);
+  Obj2->Compile(prog);
+  prog->EmitMerge(Type,Factor);
+}
+
 sF32 Wz4PDFMerge::GetDistance(const sVector31 &p)
 {
   sF32 d1=Obj1->GetDistance(p);
@@ -391,24 +808,27 @@ void TaskCodePDF(sStsManager *m,sStsThread *th,sInt start,sInt count,void *data)
 {
   sVERIFY(count==1);
   tPDF_Render *mi = (tPDF_Render *)data;
-  sRay ray;
+  sInt sx = mi->img->SizeX;
   sU32 *ptr = mi->img->Data;
+  sScratchScope scratch;
+  sRay *rays = scratch.Alloc<sRay>(sx);
+  Wz4PDFHit *hits = scratch.Alloc<Wz4PDFHit>(sx);
 
-  ptr+=start*mi->img->SizeX;
+  ptr+=start*sx;
 
-  for(sInt x=0;x<mi->img->SizeX;x++)
+  for(sInt x=0;x<sx;x++)
   {
-    sVector30 norm;
-    sVector31 pos;
-
-    ray.Start = mi->px + mi->dnx*x + mi->dny*start;
-    ray.Dir = ray.Start-mi->cp; 
-    ray.Dir.Unit();
-
+    rays[x].Start = mi->px + mi->dnx*x + mi->dny*start;
+    rays[x].Dir = rays[x].Start-mi->cp; 
+    rays[x].Dir.Unit();
+  }
+  mi->pdf->TraceRays(sx,rays,hits);
 
-    if (mi->pdf->TraceRay(pos,norm,ray))
+  for(sInt x=0;x<sx;x++)
+  {
+    if (hits[x].Hit)
     {
-      norm = (norm + sVector30(1.0f, 1.0f, 1.0f)) * 0.5f;
+      sVector30 norm = (hits[x].Normal + sVector30(1.0f, 1.0f, 1.0f)) * 0.5f;
       unsigned int r = norm.x * 255;
       unsigned int g = norm.y * 255;
       unsigned int b = norm.z * 255;
@@ -452,6 +872,7 @@ void Wz4PDFObj_Render(sImage *img, Wz4PDF *pdf, wPaintInfo &pi)
   mi.img=img;
   mi.pdf=pdf;
   mi.pi=&pi;
+  pdf->GetProgram();
   
   sStsWorkload *wl = sSched->BeginWorkload();
   sStsTask *task = wl->NewTask(TaskCodePDF,&mi,img->SizeY,0);  //sSched->NewTask(TaskCodePDF,&mi,img->SizeY,0);
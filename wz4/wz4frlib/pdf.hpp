@@ -14,6 +14,8 @@
 
 /****************************************************************************/
 
+class Wz4PDFProgram;
+
 class Wz4PDFObj : public wObject
 {         
   protected:
@@ -30,14 +32,91 @@ class Wz4PDFObj : public wObject
 
     // Returns normal 
     virtual void GetNormal(const sVector31 &p, sVector30 &n);
+
+    // Emit instructions that push the distance, default calls GetDistance()
+    virtual void Compile(Wz4PDFProgram *prog);
+
+    static sF32 GetND() { return ND; }
+};
+
+/****************************************************************************/
+
+// the tree of Wz4PDFObj flattened into a list of instructions for a stack
+// machine, evaluated for BATCH points at once (SoA, SSE) instead of one
+// virtual call per node and point. transforms push a position, leafs push
+// a distance, combiners pop two distances and push one.
+
+class Wz4PDFProgram
+{
+  enum OpCode
+  {
+    OP_CONST = 0,
+    OP_SPHERE,
+    OP_CUBE,
+    OP_ADF,
+    OP_VIRTUAL,                   // Wz4PDFObj::GetDistance()
+    OP_TRANSFORM,                 // push position * Mat
+    OP_TWIRL,
+    OP_POPPOS,
+    OP_MIN,
+    OP_MERGE,                     // Wz4PDFMerge::Type
+  };
+  struct Op
+  {
+    sInt Code;
+    sInt Type;
+    sF32 Value;                   // const, merge factor
+    sMatrix34 Mat;
+    sVector30 Scale;              // twirl
+    sVector30 Bias;
+    tSDF *ADF;
+    Wz4PDFObj *Obj;
+  };
+  sArray<Op> Ops;
+  sInt PosDepth,MaxPos;
+  sInt DistDepth,MaxDist;
+
+  Op *Add(sInt code,sInt pos,sInt dist);
+  void Run(sInt count,sF32 *pos,sF32 *dist) const;
+public:
+  enum { BATCH = 64 };
+
+  Wz4PDFProgram();
+  void Compile(Wz4PDFObj *root);
+
+  // for Wz4PDFObj::Compile()
+  void EmitConst(sF32 d);
+  void EmitSphere();
+  void EmitCube();
+  void EmitADF(tSDF *adf);
+  void EmitVirtual(Wz4PDFObj *obj);
+  void EmitTransform(const sMatrix34 &mat);
+  void EmitTwirl(const sVector30 &scale,const sVector30 &bias);
+  void EmitPopPos();
+  void EmitMin();
+  void EmitMerge(sInt type,sF32 factor);
+
+  // count points, stride in bytes between the positions.
+  // safe to call from several threads
+  void GetDistance(sInt count,const sVector31 *pos,sInt stride,sF32 *dist) const;
+  // central differences of the whole tree, normalized
+  void GetNormal(sInt count,const sVector31 *pos,sInt stride,sVector30 *normal) const;
 };
 
 /****************************************************************************/
 
+struct Wz4PDFHit
+{
+  sVector31 Pos;
+  sVector30 Normal;
+  sBool Hit;
+};
+
 class Wz4PDF : public wObject
 {       
   protected:
     Wz4PDFObj *Obj;
+    Wz4PDFProgram *Program;
     
   public:
 
@@ -52,11 +131,19 @@ class Wz4PDF : public wObject
     inline void SetObj(Wz4PDFObj *obj)
     {
       Obj=obj;
+      sDelete(Program);
     }
+
+    // compiled on first use. call once from the main thread before
+    // handing the object to tasks.
+    const Wz4PDFProgram *GetProgram();
     
     //  
     sBool TraceRay(sVector31 &p, sVector30 &n, const sRay &ray, const sF32 md=0.005f, const sF32 mx=100.0f, const sInt mi=512);
 
+    // packet of rays, stepped together. same results as TraceRay()
+    void TraceRays(sInt count, const sRay *rays, Wz4PDFHit *hits, const sF32 md=0.005f, const sF32 mx=100.0f, const sInt mi=512);
+
     static sMatrix34 Camera;
 };
 
@@ -71,6 +158,7 @@ class Wz4PDFAdd : public Wz4PDFObj
     virtual ~Wz4PDFAdd();    
     virtual sF32 GetDistance(const sVector31 &p);
     virtual void GetNormal(const sVector31 &p, sVector30 &n);
+    virtual void Compile(Wz4PDFProgram *prog);
     void AddObj(Wz4PDFObj *obj);    
 };
 
@@ -90,6 +178,7 @@ class Wz4PDFTransform : public Wz4PDFObj
     void Init(Wz4PDFObj *obj, sVector31 &scale, sVector30 &rot, sVector31 &trans);
     virtual sF32 GetDistance(const sVector31 &p);
     virtual void GetNormal(const sVector31 &p, sVector30 &n);
+    virtual void Compile(Wz4PDFProgram *prog);
 
     inline void Modify(const sVector31 &p, sVector31 &np)
     {
@@ -105,6 +194,7 @@ class Wz4PDFCube : public Wz4PDFObj
     Wz4PDFCube();
     virtual ~Wz4PDFCube();
     virtual sF32 GetDistance(const sVector31 &p);    
+    virtual void Compile(Wz4PDFProgram *prog);
 };
 
 /****************************************************************************/
@@ -115,6 +205,7 @@ class Wz4PDFSphere : public Wz4PDFObj
   Wz4PDFSphere();
   virtual ~Wz4PDFSphere();  
   virtual sF32 GetDistance(const sVector31 &p);
+  virtual void Compile(Wz4PDFProgram *prog);
 };
 
 
@@ -131,6 +222,7 @@ class Wz4PDFTwirl : public Wz4PDFObj
     virtual ~Wz4PDFTwirl();
     void Init(Wz4PDFObj *obj, sVector30 &scale, sVector30 &bias);
     virtual sF32 GetDistance(const sVector31 &p);
+    virtual void Compile(Wz4PDFProgram *prog);
     inline void Modify(const sVector31 &p, sVector31 &np)
     {
       sMatrix34 m;
@@ -153,6 +245,7 @@ class Wz4PDFFromADF: public Wz4PDFObj
   virtual ~Wz4PDFFromADF();  
   virtual sF32 GetDistance(const sVector31 &p);
   virtual void GetNormal(const sVector31 &p, sVector30 &n);
+  virtual void Compile(Wz4PDFProgram *prog);
 };
 
 
@@ -170,6 +263,7 @@ class Wz4PDFMerge: public Wz4PDFObj
   virtual ~Wz4PDFMerge();  
   void Init(Wz4PDFObj *obj1, Wz4PDFObj *obj2, sInt type, sF32 factor);
   virtual sF32 GetDistance(const sVector31 &p);
+  virtual void Compile(Wz4PDFProgram *prog);
 };
 
 void Wz4PDFObj_Render(sImage *img, Wz4PDF *pdf, wPaintInfo &pi);
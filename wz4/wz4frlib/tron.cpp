@@ -67,27 +67,31 @@ void TronPOM::Func(Wz4PartInfo &pinfo,sF32 time,sF32 dt)
     sVector30 d(0.0,-1.0f,0.0f);
     d=d*mat;  
 
+    Rays.Clear();
     for(i=0;i<pinfo.Alloc;i++)
     {
-      if(part->Time>=0)
+      if(part[i].Time>=0)
       { 
-        sRay ray;
-        sF32 tMin=0.0f;
-        sF32 tMax=Para.Length;
-        sF32 tHit;
-        sVector30 hitNormal;
-        sVector31 pos;
-        part->Get(pos);
-
-        ray.Dir=d;
-        ray.Start=pos;
-        if (bsp.TraceRay(ray,tMin,tMax,tHit,hitNormal))
-        {
-          pos+=d*tHit;
-        }
-        part->Pos = pos;
+        sRay *ray = Rays.AddMany(1);
+        part[i].Get(ray->Start);
+        ray->Dir=d;
+      }
+    }
+
+    Hits.Resize(Rays.GetCount());
+    bsp.TraceRays(Rays.GetCount(),Rays.GetData(),0.0f,Para.Length,Hits.GetData());
+
+    sInt n=0;
+    for(i=0;i<pinfo.Alloc;i++)
+    {
+      if(part[i].Time>=0)
+      {
+        sVector31 pos = Rays[n].Start;
+        if(Hits[n].Hit)
+          pos+=d*Hits[n].Time;
+        part[i].Pos = pos;
+        n++;
       }
-      part++;
     }
     first=false;
   }
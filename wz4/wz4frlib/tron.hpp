@@ -97,6 +97,8 @@ class TronPOM : public Wz4ParticleNode
 private:
   Wz4BSP bsp;
   sBool first;
+  sArray<sRay> Rays;
+  sArray<Wz4BSPRayHit> Hits;
 public:
   TronPOM();
   ~TronPOM();
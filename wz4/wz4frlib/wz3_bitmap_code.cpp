@@ -7,7 +7,8 @@
 
 #include "wz4frlib/wz3_bitmap_code.hpp"
 #include "wz4frlib/wz3_bitmap_ops.hpp"
-#include "genvector.hpp"
+#include "util/rasterizer.hpp"
+#include "util/scratch.hpp"
 #include <emmintrin.h>
 
 /****************************************************************************/
@@ -1635,8 +1636,9 @@ void GenBitmap::Blur(sInt flags,sF32 sx,sF32 sy,sF32 _amp)
   order = flags & 15;
   if(order==0) return;
 
+  sScratchScope scratch;
   pp = (sU16 *)Data;
-  qq = (sU16 *) new sU64[Size];
+  qq = (sU16 *) scratch.Alloc<sU64>(Size);
 
 // blur x
 
@@ -1780,7 +1782,6 @@ void GenBitmap::Blur(sInt flags,sF32 sx,sF32 sy,sF32 _amp)
   while(repeat--);
   
   sVERIFY(qq!=(sU16 *)Data);
-  delete[] qq;
 }
 
 /****************************************************************************/
@@ -3197,9 +3198,28 @@ void CalcGenBitmapVectorLoop(struct GenBitmapArrayVector *e,sInt count,sArray<Ge
 }
 
 
+struct GenBitmapVectorRows
+{
+  GenBitmap *Bitmap;
+  sU64 Color;
+  sInt Fade;                      // 0..256 from the alpha of the color
+};
+
+static void GenBitmapVectorRow(void *user,sInt y,const sF32 *cover,sInt sizex)
+{
+  GenBitmapVectorRows *rows = (GenBitmapVectorRows *) user;
+  sU64 *ip = rows->Bitmap->Data + y*sizex;
+  for(sInt x=0;x<sizex;x++)
+  {
+    sInt fade = sInt(cover[x]*65536.0f)*rows->Fade/256;
+    if(fade)
+      GenBitmap::Fade64(ip[x],ip[x],rows->Color,fade);
+  }
+}
+
 void GenBitmap::Vector(sU32 color,GenBitmapArrayVector *arr,sInt count)
 {
-  Vectorizer::VectorRasterizer vec(this);
+  sVectorRasterizer vec(XSize,YSize);
 
   sInt xs = XSize;
   sInt ys = YSize;
@@ -3228,7 +3248,7 @@ void GenBitmap::Vector(sU32 color,GenBitmapArrayVector *arr,sInt count)
       for(sInt i=start;i<end;i++)
       {
         sVector2 p0(arr[i].x*xs,arr[i].y*ys);
-        vec.line(p1,p0);
+        vec.Edge(p1,p0);
         p1 = p0;
       }
     }
@@ -3245,13 +3265,17 @@ void GenBitmap::Vector(sU32 color,GenBitmapArrayVector *arr,sInt count)
         sVector2 c(arr[i+2].x*xs,arr[i+2].y*ys);
         sVector2 d(arr[ie ].x*xs,arr[ie ].y*ys);
 
-        vec.cubic(a,b,c,d);
+        vec.BezierEdge(a,b,c,d);
       }
     }
     start = end;
     if(raster>=0 && (start==count || (arr[start].restart&8)==0))
     {
-      vec.rasterizeAll(arr[raster].col,(arr[raster].restart & 16)?1:0);
+      GenBitmapVectorRows rows;
+      rows.Bitmap = this;
+      rows.Color = GetColor64(arr[raster].col);
+      rows.Fade = sInt(rows.Color>>48)*256/0x7fff;
+      vec.Rasterize((arr[raster].restart & 16) ? sVRFC_EVENODD : sVRFC_NONZERO_WINDING,GenBitmapVectorRow,&rows);
       raster = -1;
     }
   }
@@ -8,6 +8,9 @@
 #include "wz4_anim.hpp"
 #include "wz4_anim_ops.hpp"
 #include "wz4lib/serials.hpp"
+#include "util/taskscheduler.hpp"
+#include "util/scratch.hpp"
+#include "util/simd_float.hpp"
 
 /****************************************************************************/
 /***                                                                      ***/
@@ -391,6 +394,7 @@ Wz4Skeleton::Wz4Skeleton()
 {
   Type = Wz4SkeletonType;
   TotalTime = 1;
+  Batch = 0;
 }
 
 Wz4Skeleton::~Wz4Skeleton()
@@ -398,6 +402,7 @@ Wz4Skeleton::~Wz4Skeleton()
   Wz4AnimJoint *j;
   sFORALL(Joints,j)
     j->Channel->Release();
+  delete Batch;
 }
 
 template <class streamer> void Wz4Skeleton::Serialize_(streamer &stream)
@@ -432,6 +437,7 @@ void Wz4Skeleton::CopyFrom(Wz4Skeleton *src)
   Wz4AnimJoint *joint;
   Joints = src->Joints;
   TotalTime = src->TotalTime;
+  sDelete(Batch);
   sFORALL(Joints,joint)
     if(joint->Channel)
       joint->Channel = joint->Channel->CopyTo();
@@ -534,27 +540,7 @@ void Wz4Skeleton::Evaluate(sF32 time,sMatrix34 *mata,sMatrix34 *basemat)
 
 void Wz4Skeleton::EvaluateCM(sF32 time,sMatrix34 *mata,sMatrix34CM *basemat)
 {
-  Wz4AnimJoint *j;
-  Wz4AnimKey key;
-  sMatrix34 mat;
-
-  sFORALL(Joints,j)
-  {
-    if(j->Channel)
-    {
-      j->Channel->Evaluate(time,key);
-      key.ToMatrix(mat);
-    }
-    else
-    {
-      mat.Init();
-    }
-    if(j->Parent==-1)
-      mata[_i] = mat;
-    else
-      mata[_i] = mat * mata[j->Parent];
-    basemat[_i] = j->BasePose * mata[_i];
-  }
+  GetBatch()->EvaluateCM(1,&time,basemat,mata);
 }
 
 void Wz4Skeleton::EvaluateBlendCM(sF32 time1,sF32 time2,sF32 reftime,sMatrix34 *mata,sMatrix34CM *basemat)
@@ -629,6 +615,412 @@ void Wz4Skeleton::EvaluateFadeCM(sF32 time1,sF32 time2,sF32 fade,sMatrix34 *mata
   }
 }
 
+const Wz4SkeletonBatch *Wz4Skeleton::GetBatch()
+{
+  if(!Batch)
+    Batch = new Wz4SkeletonBatch;
+  if(!Batch->IsValid(this))
+    Batch->Init(this);
+  return Batch;
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Batched Evaluation                                                 ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void Wz4SkeletonBatch::Init(Wz4Skeleton *skel)
+{
+  Wz4AnimJoint *sj;
+
+  Joints.Clear();
+  Keys.Clear();
+  Floats.Clear();
+  Joints.AddMany(skel->Joints.GetCount());
+
+  sFORALL(skel->Joints,sj)
+  {
+    Joint *j = &Joints[_i];
+    sClear(*j);
+    j->Kind = BJ_STATIC;
+    j->Parent = sj->Parent;
+    j->MaxTime = 1;
+    j->Start.Init();
+    j->Local.Init();
+    j->BasePose = sj->BasePose;
+    j->Channel = sj->Channel;
+
+    Wz4Channel *ch = sj->Channel;
+    if(!ch)
+      continue;
+    j->MaxTime = ch->MaxTime;
+
+    switch(ch->Kind)
+    {
+    case Wz4ChannelKindConstant:
+      ((Wz4ChannelConstant *)ch)->Start.ToMatrix(j->Local);
+      break;
+
+    case Wz4ChannelKindPerFrame:
+      {
+        Wz4ChannelPerFrame *pf = (Wz4ChannelPerFrame *) ch;
+        j->Start = pf->Start;
+        j->Has = (pf->Scale ? 1 : 0) | (pf->Rot ? 2 : 0) | (pf->Trans ? 4 : 0);
+        if(pf->Keys>1 && j->Has)
+        {
+          j->Kind = BJ_PERFRAME;
+          j->Keys = pf->Keys;
+          j->FirstKey = Keys.GetCount();
+          Key *k = Keys.AddMany(pf->Keys);
+          for(sInt i=0;i<pf->Keys;i++)
+          {
+            k[i].Scale = pf->Scale ? pf->Scale[i] : pf->Start.Scale;
+            k[i].Rot   = pf->Rot   ? pf->Rot[i]   : pf->Start.Rot;
+            k[i].Trans = pf->Trans ? pf->Trans[i] : pf->Start.Trans;
+          }
+        }
+        else
+        {
+          pf->Start.ToMatrix(j->Local);
+        }
+      }
+      break;
+
+    case Wz4ChannelKindSpline:
+      {
+        Wz4ChannelSpline *sp = (Wz4ChannelSpline *) ch;
+        j->Start = sp->Start;
+        AddCurve(j->Scale,sp->Scale.GetNumKnots(),sp->Scale.GetKnots(),(const sF32 *)sp->Scale.GetControlPoints(),3);
+        AddCurve(j->Rot  ,sp->Rot  .GetNumKnots(),sp->Rot  .GetKnots(),(const sF32 *)sp->Rot  .GetControlPoints(),4);
+        AddCurve(j->Trans,sp->Trans.GetNumKnots(),sp->Trans.GetKnots(),(const sF32 *)sp->Trans.GetControlPoints(),3);
+        if(j->Scale.Knots || j->Rot.Knots || j->Trans.Knots)
+          j->Kind = BJ_SPLINE;
+        else
+          sp->Start.ToMatrix(j->Local);
+      }
+      break;
+
+    default:
+      j->Kind = BJ_VIRTUAL;
+      break;
+    }
+  }
+}
+
+sBool Wz4SkeletonBatch::IsValid(Wz4Skeleton *skel) const
+{
+  if(skel->Joints.GetCount()!=Joints.GetCount())
+    return 0;
+  for(sInt i=0;i<Joints.GetCount();i++)
+    if(skel->Joints[i].Channel!=Joints[i].Channel || skel->Joints[i].Parent!=Joints[i].Parent)
+      return 0;
+  return 1;
+}
+
+void Wz4SkeletonBatch::AddCurve(Curve &c,sInt n,const sF32 *knots,const sF32 *points,sInt dim)
+{
+  c.Knots = n;
+  c.KnotOfs = Floats.GetCount();
+  c.PointOfs = c.KnotOfs + n;
+  if(n==0)
+    return;
+  sInt np = (n-sBSPLINE_ORDER)*dim;
+  sF32 *d = Floats.AddMany(n+np);
+  sCopyMem(d,knots,n*sizeof(sF32));
+  sCopyMem(d+n,points,np*sizeof(sF32));
+}
+
+// same as sBSpline::Evaluate(), adding up in the same order
+
+void Wz4SkeletonBatch::EvalCurve(const Curve &c,sF32 time,sF32 *dest,sInt dim) const
+{
+  sF32 w[4];
+  const sF32 *knots = Floats.GetData()+c.KnotOfs;
+  sInt first = sBSplineTool::CalcBasis(knots,c.Knots,time,w);
+  const sF32 *s = Floats.GetData()+c.PointOfs+first*dim;
+  for(sInt i=0;i<dim;i++)
+    dest[i] = w[0]*s[i] + w[1]*s[dim+i] + w[2]*s[2*dim+i] + w[3]*s[3*dim+i];
+}
+
+// same as the Evaluate() of the channels. returns 0 for static joints,
+// use Joint::Local for them
+
+sBool Wz4SkeletonBatch::EvalKey(const Joint *j,sF32 time,Wz4AnimKey &key) const
+{
+  switch(j->Kind)
+  {
+  case BJ_PERFRAME:
+    {
+      key = j->Start;
+      time = (time / j->MaxTime) * (j->Keys-1);
+      sInt n = sClamp<sInt>(sInt(sRoundDown(time*1024)),0,j->Keys*1024-1025);
+      sF32 f = (n&1023)/1024.0f;
+      const Key *k = Keys.GetData()+j->FirstKey+n/1024;
+      if(j->Has & 1) key.Scale.Fade(f,k[0].Scale,k[1].Scale);
+      if(j->Has & 2) key.Rot.Fade(f,k[0].Rot,k[1].Rot);
+      if(j->Has & 4) key.Trans.Fade(f,k[0].Trans,k[1].Trans);
+    }
+    return 1;
+
+  case BJ_SPLINE:
+    key = j->Start;
+    time /= j->MaxTime;
+    if(j->Scale.Knots) EvalCurve(j->Scale,time,&key.Scale.x,3);
+    if(j->Rot.Knots)   { EvalCurve(j->Rot,time,&key.Rot.r,4); key.Rot.Unit(); }
+    if(j->Trans.Knots) EvalCurve(j->Trans,time,&key.Trans.x,3);
+    return 1;
+
+  case BJ_VIRTUAL:
+    j->Channel->Evaluate(time,key);
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+void Wz4SkeletonBatch::EvalLocal(const Joint *j,sF32 time,sMatrix34 &mat) const
+{
+  Wz4AnimKey key;
+  if(EvalKey(j,time,key))
+    key.ToMatrix(mat);
+  else
+    mat = j->Local;
+}
+
+void Wz4SkeletonBatch::EvaluateCM(sInt count,const sF32 *times,sMatrix34CM *basemat,sMatrix34 *bonemat) const
+{
+#if sSIMD_INTRINSICS
+  if(count>=4 && !bonemat)
+  {
+    EvaluateSSE(count,times,basemat);
+    return;
+  }
+#endif
+
+  sInt jc = Joints.GetCount();
+  sScratchScope scratch;
+  sMatrix34 *temp = bonemat ? 0 : scratch.Alloc<sMatrix34>(CHUNK*jc);
+  sMatrix34 mat;
+
+  // CHUNK instances at a time, joint by joint, so the keys of a joint
+  // and the bones of the parents stay in the cache
+
+  for(sInt first=0;first<count;first+=CHUNK)
+  {
+    sInt nc = sMin<sInt>(CHUNK,count-first);
+    sMatrix34 *bones = bonemat ? bonemat+first*jc : temp;
+    sMatrix34CM *base = basemat+first*jc;
+    for(sInt ji=0;ji<jc;ji++)
+    {
+      const Joint *j = &Joints[ji];
+      for(sInt n=0;n<nc;n++)
+      {
+        sMatrix34 *b = bones+n*jc;
+        EvalLocal(j,times[first+n],mat);
+        if(j->Parent==-1)
+          b[ji] = mat;
+        else
+          b[ji] = mat * b[j->Parent];
+        base[n*jc+ji] = j->BasePose * b[ji];
+      }
+    }
+  }
+}
+
+/****************************************************************************/
+
+#if sSIMD_INTRINSICS
+
+// four instances side by side, one per lane: i.x i.y i.z j.x .. l.z
+
+struct Wz4SSEMatrix
+{
+  sSSE v[12];
+};
+
+static void SplatSSE(Wz4SSEMatrix &r,const sMatrix34 &m)
+{
+  const sF32 *f = &m.i.x;
+  for(sInt n=0;n<12;n++)
+    r.v[n] = sVecLoadScalar(f[n]);
+}
+
+// same as sMatrix34 operator*
+
+static sINLINE void MulSSE(Wz4SSEMatrix &r,const Wz4SSEMatrix &a,const Wz4SSEMatrix &b)
+{
+  for(sInt row=0;row<4;row++)
+  {
+    const sSSE *ar = a.v+row*3;
+    for(sInt c=0;c<3;c++)
+    {
+      sSSE s = sVecAdd(sVecAdd(sVecMul(ar[0],b.v[c]),sVecMul(ar[1],b.v[3+c])),sVecMul(ar[2],b.v[6+c]));
+      r.v[row*3+c] = row==3 ? sVecAdd(s,b.v[9+c]) : s;
+    }
+  }
+}
+
+// same as Wz4AnimKey::ToMatrix(). k is scale xyz, rot rijk, trans xyz
+
+static void KeyToSSE(Wz4SSEMatrix &m,const sSSE *k)
+{
+  sSSE two = sVecLoadScalar(2.0f);
+  sSSE one = sVecLoadScalar(1.0f);
+  sSSE qr = k[3], qi = k[4], qj = k[5], qk = k[6];
+
+  sSSE xx = sVecMul(sVecMul(two,qi),qi);
+  sSSE xy = sVecMul(sVecMul(two,qi),qj);
+  sSSE xz = sVecMul(sVecMul(two,qi),qk);
+  sSSE yy = sVecMul(sVecMul(two,qj),qj);
+  sSSE yz = sVecMul(sVecMul(two,qj),qk);
+  sSSE zz = sVecMul(sVecMul(two,qk),qk);
+  sSSE xw = sVecMul(sVecMul(two,qi),qr);
+  sSSE yw = sVecMul(sVecMul(two,qj),qr);
+  sSSE zw = sVecMul(sVecMul(two,qk),qr);
+
+  m.v[ 0] = sVecMul(sVecSub(one,sVecAdd(yy,zz)),k[0]);
+  m.v[ 1] = sVecMul(sVecSub(xy,zw),k[0]);
+  m.v[ 2] = sVecMul(sVecAdd(xz,yw),k[0]);
+  m.v[ 3] = sVecMul(sVecAdd(xy,zw),k[1]);
+  m.v[ 4] = sVecMul(sVecSub(one,sVecAdd(xx,zz)),k[1]);
+  m.v[ 5] = sVecMul(sVecSub(yz,xw),k[1]);
+  m.v[ 6] = sVecMul(sVecSub(xz,yw),k[2]);
+  m.v[ 7] = sVecMul(sVecAdd(yz,xw),k[2]);
+  m.v[ 8] = sVecMul(sVecSub(one,sVecAdd(xx,yy)),k[2]);
+  m.v[ 9] = k[7];
+  m.v[10] = k[8];
+  m.v[11] = k[9];
+}
+
+// transpose into sMatrix34CM of the first lanes instances
+
+static void StoreSSE(sMatrix34CM *dest,sInt stride,const Wz4SSEMatrix &m,sInt lanes)
+{
+  sSSE x[4] = { m.v[0],m.v[3],m.v[6],m.v[ 9] };
+  sSSE y[4] = { m.v[1],m.v[4],m.v[7],m.v[10] };
+  sSSE z[4] = { m.v[2],m.v[5],m.v[8],m.v[11] };
+  _MM_TRANSPOSE4_PS(x[0],x[1],x[2],x[3]);
+  _MM_TRANSPOSE4_PS(y[0],y[1],y[2],y[3]);
+  _MM_TRANSPOSE4_PS(z[0],z[1],z[2],z[3]);
+  for(sInt n=0;n<lanes;n++)
+  {
+    sVecStoreU(x[n],&dest[n*stride].x);
+    sVecStoreU(y[n],&dest[n*stride].y);
+    sVecStoreU(z[n],&dest[n*stride].z);
+  }
+}
+
+// the keys are evaluated one by one, matrices four at a time
+
+void Wz4SkeletonBatch::EvaluateSSE(sInt count,const sF32 *times,sMatrix34CM *basemat) const
+{
+  const sInt QUADS = CHUNK/4;
+  sInt jc = Joints.GetCount();
+  sScratchScope scratch;
+  Wz4SSEMatrix *bones = scratch.Alloc<Wz4SSEMatrix>(jc*QUADS);
+  Wz4SSEMatrix local,pose,base;
+  Wz4AnimKey key;
+  sSSE kv[10];
+  sF32 *kf = (sF32 *) kv;
+
+  for(sInt first=0;first<count;first+=CHUNK)
+  {
+    sInt quads = (sMin<sInt>(CHUNK,count-first)+3)/4;
+    for(sInt ji=0;ji<jc;ji++)
+    {
+      const Joint *j = &Joints[ji];
+      SplatSSE(pose,j->BasePose);
+      if(j->Kind==BJ_STATIC)
+        SplatSSE(local,j->Local);
+
+      for(sInt q=0;q<quads;q++)
+      {
+        sInt n0 = first+q*4;
+        if(j->Kind!=BJ_STATIC)
+        {
+          for(sInt l=0;l<4;l++)
+          {
+            EvalKey(j,times[sMin(n0+l,count-1)],key);
+            kf[0*4+l] = key.Scale.x;
+            kf[1*4+l] = key.Scale.y;
+            kf[2*4+l] = key.Scale.z;
+            kf[3*4+l] = key.Rot.r;
+            kf[4*4+l] = key.Rot.i;
+            kf[5*4+l] = key.Rot.j;
+            kf[6*4+l] = key.Rot.k;
+            kf[7*4+l] = key.Trans.x;
+            kf[8*4+l] = key.Trans.y;
+            kf[9*4+l] = key.Trans.z;
+          }
+          KeyToSSE(local,kv);
+        }
+
+        Wz4SSEMatrix &b = bones[ji*QUADS+q];
+        if(j->Parent==-1)
+          b = local;
+        else
+          MulSSE(b,local,bones[j->Parent*QUADS+q]);
+        MulSSE(base,pose,b);
+        StoreSSE(basemat+n0*jc+ji,jc,base,sMin(4,count-n0));
+      }
+    }
+  }
+}
+
+#else
+
+void Wz4SkeletonBatch::EvaluateSSE(sInt count,const sF32 *times,sMatrix34CM *basemat) const
+{
+  EvaluateCM(count,times,basemat);
+}
+
+#endif
+
+struct Wz4SkeletonBatchJob
+{
+  const Wz4SkeletonBatch *Batch;
+  sInt Count;
+  const sF32 *Times;
+  sMatrix34CM *BaseMat;
+};
+
+void Wz4SkeletonBatch::EvaluateTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Wz4SkeletonBatchJob *job = (Wz4SkeletonBatchJob *) data;
+  sInt jc = job->Batch->Joints.GetCount();
+  for(sInt i=start;i<start+count;i++)
+  {
+    sInt first = i*CHUNK;
+    sInt n = sMin<sInt>(CHUNK,job->Count-first);
+    job->Batch->EvaluateCM(n,job->Times+first,job->BaseMat+first*jc);
+  }
+}
+
+void Wz4SkeletonBatch::EvaluateCMMT(sInt count,const sF32 *times,sMatrix34CM *basemat) const
+{
+  sInt tasks = (count+CHUNK-1)/CHUNK;
+  if(tasks<2 || !sSched || sSched->GetThreadCount()<2)
+  {
+    EvaluateCM(count,times,basemat);
+    return;
+  }
+
+  Wz4SkeletonBatchJob job;
+  job.Batch = this;
+  job.Count = count;
+  job.Times = times;
+  job.BaseMat = basemat;
+
+  sStsWorkload *wl = sSched->BeginWorkload();
+  sStsTask *task = wl->NewTask(EvaluateTask,&job,tasks,0);
+  wl->AddTask(task);
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
+
 /****************************************************************************/
 // ASSIMP
 /****************************************************************************/
@@ -63,6 +63,9 @@
 /****************************************************************************/
 
 class Wz4Channel;
+class Wz4Skeleton;
+class sStsManager;
+class sStsThread;
 
 /****************************************************************************/
 
@@ -248,8 +251,77 @@ struct sAiAnimation
 
 /****************************************************************************/
 
+// the channels of a skeleton, laid out for evaluating many instances at
+// once (crowds). perframe keys of all joints are in one array, scale, rot
+// and trans of a key next to each other. spline knots and control points
+// are copied into one pool and evaluated without virtual calls. joints
+// that do not move are turned into a constant matrix. other channels
+// fall back to Wz4Channel::Evaluate().
+
+class Wz4SkeletonBatch
+{
+  enum JointKind
+  {
+    BJ_STATIC = 0,                // Local is the matrix
+    BJ_PERFRAME,
+    BJ_SPLINE,
+    BJ_VIRTUAL,
+  };
+  struct Key
+  {
+    sVector31 Scale;
+    sQuaternion Rot;
+    sVector31 Trans;
+  };
+  struct Curve
+  {
+    sInt Knots;                   // 0: use Start
+    sInt KnotOfs;                 // into Floats
+    sInt PointOfs;
+  };
+  struct Joint
+  {
+    sInt Kind;
+    sInt Parent;
+    sF32 MaxTime;
+    sInt Keys;                    // perframe
+    sInt FirstKey;
+    sInt Has;                     // perframe: 1=scale 2=rot 4=trans
+    Curve Scale,Rot,Trans;        // spline
+    Wz4AnimKey Start;
+    sMatrix34 Local;              // static
+    sMatrix34 BasePose;
+    Wz4Channel *Channel;          // virtual, and to see if the skeleton changed
+  };
+  sArray<Joint> Joints;
+  sArray<Key> Keys;
+  sArray<sF32> Floats;
+
+  void AddCurve(Curve &c,sInt n,const sF32 *knots,const sF32 *points,sInt dim);
+  void EvalCurve(const Curve &c,sF32 time,sF32 *dest,sInt dim) const;
+  sBool EvalKey(const Joint *j,sF32 time,Wz4AnimKey &key) const;
+  void EvalLocal(const Joint *j,sF32 time,sMatrix34 &mat) const;
+  void EvaluateSSE(sInt count,const sF32 *times,sMatrix34CM *basemat) const;
+  static void EvaluateTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data);
+public:
+  enum { CHUNK = 16 };            // instances per task
+
+  void Init(Wz4Skeleton *skel);
+  sBool IsValid(Wz4Skeleton *skel) const;
+  sInt GetJointCount() const { return Joints.GetCount(); }
+
+  // evaluate count instances at times[]. basemat (and bonemat) get
+  // GetJointCount() matrices per instance, one instance after the other.
+  void EvaluateCM(sInt count,const sF32 *times,sMatrix34CM *basemat,sMatrix34 *bonemat=0) const;
+  // same, split into tasks of CHUNK instances on sSched
+  void EvaluateCMMT(sInt count,const sF32 *times,sMatrix34CM *basemat) const;
+};
+
+/****************************************************************************/
+
 class Wz4Skeleton : public wObject
 {
+  Wz4SkeletonBatch *Batch;
 public:
   Wz4Skeleton();
   ~Wz4Skeleton();
@@ -264,6 +336,7 @@ public:
   void EvaluateCM(sF32 time,sMatrix34 *mat,sMatrix34CM *basemat);
   void EvaluateBlendCM(sF32 time1,sF32 time2,sF32 reftime,sMatrix34 *mat,sMatrix34CM *basemat);
   void EvaluateFadeCM(sF32 time1,sF32 time2,sF32 fade,sMatrix34 *mat,sMatrix34CM *basemat);
+  const Wz4SkeletonBatch *GetBatch();   // rebuilt when the joints changed
 
   sArray<Wz4AnimJoint> Joints;
   sF32 TotalTime;                     // total time in seconds
@@ -7,71 +7,9 @@
 
 #include "wz4_audio.hpp"
 #include "util/image.hpp"
+#include "util/audioanalysis.hpp"
 #include "wz4lib/gui.hpp"
 
-/****************************************************************************/
-
-// from numerical recipes in C
-// you need to scale the IFFT by 1/N yourself
-static void sFFT(sComplex *dataComplex,sInt count,sBool inverse)
-{
-  sVERIFY(count && (count & (count-1)) == 0);
-  sF32 *data = &dataComplex->r - 1;
-
-  // bit reversal
-  sInt n = count*2;
-  sInt j = 1;
-  for(sInt i=1;i<n;i+=2)
-  {
-    if(j>i)
-    {
-      sSwap(data[j],data[i]);
-      sSwap(data[j+1],data[i+1]);
-    }
-    sInt m = n >> 1;
-    while(m>=2 && j>m)
-    {
-      j -= m;
-      m >>= 1;
-    }
-    j += m;
-  }
-
-  // actual fft
-  sInt mmax = 2;
-  while(n > mmax)
-  {
-    sInt istep = mmax << 1;
-    sF32 theta = (inverse ? -1.0f : 1.0f) * sPI2F / mmax;
-    sF32 wtemp = sFSin(0.5f * theta);
-    sF32 wpr = -2.0f * wtemp * wtemp;
-    sF32 wpi = sFSin(theta);
-    sF32 wr = 1.0f, wi = 0.0f;
-
-    for(sInt m=1;m<mmax;m+=2)
-    {
-      for(sInt i=m;i<=n;i+=istep)
-      {
-        j = i+mmax;
-        sF32 tempr = wr*data[j] - wi*data[j+1];
-        sF32 tempi = wr*data[j+1] + wi*data[j];
-        data[j] = data[i] - tempr;
-        data[j+1] =data[i+1] - tempi;
-        data[i] += tempr;
-        data[i+1] += tempi;
-      }
-      wtemp = wr;
-      wr = wtemp*wpr - wi*wpi + wr;
-      wi = wi*wpr + wtemp*wpi + wi;
-    }
-    
-    mmax = istep;
-  }
-}
-
-/****************************************************************************/
-
-
 /****************************************************************************/
 
 // Polyphase 2-decimator; expanded symmetrically
@@ -152,7 +90,11 @@ namespace Wz4Audiolyzer
       windowFunction[i] = 0.5f * (1.0f + sFCos((i - fftHalf) * sPIF / fftHalf));
 
     out->Init(width,fftHalf);
-    sComplex *fftVec = new sComplex[fftSize];
+    sRealFFT fft;
+    fft.Init(fftSize);
+    sF32 *fftIn = new sF32[fftSize];
+    sComplex *fftOut = new sComplex[fftHalf+1];
+    sComplex *fftScratch = new sComplex[fftHalf];
 
     sU32 *ptr = out->Data;
     for(sInt i=0;i<width;i++)
@@ -163,22 +105,24 @@ namespace Wz4Audiolyzer
       {
         sInt smp = sMin(startSmp+j,App->MusicSize-1);
         sF32 sample = 0.5f * (App->MusicData[smp*2+0] + App->MusicData[smp*2+1]) / 32768.0f;
-        fftVec[j] = sample * windowFunction[j];
+        fftIn[j] = sample * windowFunction[j];
       }
 
       // calc fft
-      sFFT(fftVec,fftSize,sFALSE);
+      fft.Transform(fftIn,fftOut,fftScratch);
 
       // gen output
       for(sInt j=0;j<fftHalf;j++)
       {
-        sF32 magn = sFSqrt(fftVec[j].r*fftVec[j].r + fftVec[j].i*fftVec[j].i);
+        sF32 magn = sFSqrt(fftOut[j].r*fftOut[j].r + fftOut[j].i*fftOut[j].i);
         sU32 col = 0xff000000 + sClamp<sInt>(magn*255,0,255)*0x010101;
         ptr[(fftHalf-1-j)*width+i] = col;
       }
     }
 
-    delete[] fftVec;
+    delete[] fftScratch;
+    delete[] fftOut;
+    delete[] fftIn;
     delete[] windowFunction;
   }
 }
@@ -1118,46 +1118,83 @@ sVector4 Wz4BSP::PickSplittingPlane(const sArray<Wz4BSPFace*> &faces,sRandomMT &
   return bestPlane;
 }
 
-Wz4BSPNode *Wz4BSP::BuildTreeR(sArray<Wz4BSPFace*> &splitFaces,sRandomMT &rand)
+// parallel build only: subtrees with at least this many faces on both
+// sides are built as separate tasks. each task gets its own random
+// generator, seeded from the parent, so the tree does not depend on the
+// number of threads. it does differ from the sequential build, which
+// draws all planes from one generator.
+
+static const sInt Wz4BSPParallelFaces = 256;
+
+struct Wz4BSPBuildJob
 {
-  if(ErrorCode != WZ4BSP_OK)
+  Wz4BSP *BSP;
+  sStsWorkload *Workload;
+  sArray<Wz4BSPFace*> Faces;
+  sU32 Seed;
+  sInt Leaf;
+  Wz4BSPNode **Out;
+};
+
+void Wz4BSP::BuildTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Wz4BSPBuildJob *job = (Wz4BSPBuildJob *) data;
+  sRandomMT rand(job->Seed);
+  *job->Out = job->BSP->BuildTreeR(job->Faces,rand,job->Leaf,job->Workload);
+  delete job;
+}
+
+// consumes the references in splitFaces. leaf is the node type to create
+// when there are no faces left.
+
+Wz4BSPNode *Wz4BSP::BuildTreeR(sArray<Wz4BSPFace*> &splitFaces,sRandomMT &rand,sInt leaf,sStsWorkload *wl)
+{
+  if(BuildError != WZ4BSP_OK)
+  {
+    for(sInt i=0;i<splitFaces.GetCount();i++)
+      sRelease(splitFaces[i]);
     return 0;
+  }
 
   if(!splitFaces.GetCount())
-    return new Wz4BSPNode(Wz4BSPNode::Empty);
+    return new Wz4BSPNode(leaf);
 
   sVector4 splitPlane = PickSplittingPlane(splitFaces,rand);
   sArray<Wz4BSPFace*> frontSplit,backSplit;
   Wz4BSPFace *frontFace,*backFace;
+  Wz4BSPError error;
 
   for(sInt i=0;i<splitFaces.GetCount();i++)
   {
     switch(splitFaces[i]->Classify(splitPlane,PlaneThickness))
     {
     case WZ4BSP_BACK:
-      splitFaces[i]->AddRef();
       backSplit.AddTail(splitFaces[i]);
       break;
 
     case WZ4BSP_FRONT:
-      splitFaces[i]->AddRef();
       frontSplit.AddTail(splitFaces[i]);
       break;
 
     case WZ4BSP_STRADDLING:
-      if(ErrorCode == WZ4BSP_OK)
+      if(BuildError == WZ4BSP_OK)
       {
-        ErrorCode = splitFaces[i]->Split(splitPlane,frontFace,backFace,PlaneThickness);
+        error = splitFaces[i]->Split(splitPlane,frontFace,backFace,PlaneThickness);
+        if(error != WZ4BSP_OK)
+          sAtomicCmpSwap(&BuildError,error,WZ4BSP_OK);
         if(frontFace) frontSplit.AddTail(frontFace);
         if(backFace) backSplit.AddTail(backFace);
       }
+      sRelease(splitFaces[i]);
       break;
     case WZ4BSP_ON:
+      sRelease(splitFaces[i]);
       break;
     }
   }
+  splitFaces.Clear();
 
-  if(ErrorCode != WZ4BSP_OK)
+  if(BuildError != WZ4BSP_OK)
   {
     for(sInt i=0;i<backSplit.GetCount();i++)
       sRelease(backSplit[i]);
@@ -1168,28 +1205,28 @@ Wz4BSPNode *Wz4BSP::BuildTreeR(sArray<Wz4BSPFace*> &splitFaces,sRandomMT &rand)
     return 0;
   }
 
+  // on error, the partial tree is deleted by FromMesh() after all tasks finished
+
   Wz4BSPNode *node = new Wz4BSPNode;
   node->Plane = splitPlane;
-  node->Child[0] = BuildTreeR(backSplit,rand);
-  for(sInt i=0;i<backSplit.GetCount();i++)
-    sRelease(backSplit[i]);
-
-  node->Child[1] = BuildTreeR(frontSplit,rand);
-  for(sInt i=0;i<frontSplit.GetCount();i++)
-    sRelease(frontSplit[i]);
-
-  if(ErrorCode == WZ4BSP_OK)
+  if(wl && backSplit.GetCount()>=Wz4BSPParallelFaces && frontSplit.GetCount()>=Wz4BSPParallelFaces)
   {
-    if(node->Child[0]->Type == Wz4BSPNode::Empty)
-      node->Child[0]->Type = Wz4BSPNode::Solid;
-
-    return node;
+    Wz4BSPBuildJob *job = new Wz4BSPBuildJob;
+    job->BSP = this;
+    job->Workload = wl;
+    job->Faces.Swap(backSplit);
+    job->Seed = rand.Int32();
+    job->Leaf = Wz4BSPNode::Solid;
+    job->Out = &node->Child[0];
+    wl->AddTask(wl->NewTask(BuildTask,job,1,0));
   }
   else
   {
-    delete node;
-    return 0;
+    node->Child[0] = BuildTreeR(backSplit,rand,Wz4BSPNode::Solid,wl);
   }
+  node->Child[1] = BuildTreeR(frontSplit,rand,Wz4BSPNode::Empty,wl);
+
+  return node;
 }
 
 Wz4BSPNode *Wz4BSP::CopyTreeR(Wz4BSPNode *node)
@@ -1353,11 +1390,33 @@ Wz4BSPNode *Wz4BSP::MakeRandomSplitsR(Wz4BSPNode *node,sRandomMT &rand,const Wz4
   return node;
 }
 
+sInt Wz4BSP::FlattenR(const Wz4BSPNode *node)
+{
+  if(node->Type != Wz4BSPNode::Inner)
+    return node->Type==Wz4BSPNode::Solid ? Wz4BSPFlatNode::SolidLeaf : Wz4BSPFlatNode::EmptyLeaf;
+
+  sInt index = Nodes.GetCount();
+  Nodes.AddMany(1)->Plane = node->Plane;
+  sInt back = FlattenR(node->Child[0]);
+  sInt front = FlattenR(node->Child[1]);
+  Nodes[index].Child[0] = back;
+  Nodes[index].Child[1] = front;
+  return index;
+}
+
+void Wz4BSP::Flatten()
+{
+  Nodes.Clear();
+  FlatRoot = Root ? FlattenR(Root) : Wz4BSPFlatNode::EmptyLeaf;
+}
+
 Wz4BSP::Wz4BSP()
 {
   Type = Wz4BSPType;
   Root = 0;
+  FlatRoot = Wz4BSPFlatNode::EmptyLeaf;
   PlaneThickness = 1e-5f;
+  BuildError = WZ4BSP_OK;
 }
 
 Wz4BSP::~Wz4BSP()
@@ -1373,6 +1432,8 @@ void Wz4BSP::CopyFrom(Wz4BSP *bsp)
   Bounds = bsp->Bounds;
   CenterPos = bsp->CenterPos;
   PlaneThickness = bsp->PlaneThickness;
+  Nodes = bsp->Nodes;
+  FlatRoot = bsp->FlatRoot;
 }
 
 void Wz4BSP::MakePolyhedron(sInt nFaces,sInt nIter,sF32 power,sBool dualize,sInt seed)
@@ -1474,16 +1535,18 @@ void Wz4BSP::MakePolyhedron(sInt nFaces,sInt nIter,sF32 power,sBool dualize,sInt
   *Last = new Wz4BSPNode(Wz4BSPNode::Solid);
   Bounds = box;
   CalcBoundsR(Root,Bounds);
+  Flatten();
 
   delete[] facePoints;
 }
 
-Wz4BSPError Wz4BSP::FromMesh(const Wz4Mesh *mesh,sF32 planeThickness)
+Wz4BSPError Wz4BSP::FromMesh(const Wz4Mesh *mesh,sF32 planeThickness,sBool parallel)
 {
   sArray<Wz4BSPFace*> faces;
   sRandomMT rand;
 
   sDelete(Root);
+  Flatten();
 
   PlaneThickness = planeThickness;
   rand.Init();
@@ -1531,13 +1594,33 @@ Wz4BSPError Wz4BSP::FromMesh(const Wz4Mesh *mesh,sF32 planeThickness)
       faces.AddTail(face);
   }
 
-  ErrorCode = WZ4BSP_OK;
-  Root = BuildTreeR(faces,rand);
+  BuildError = WZ4BSP_OK;
+  if(parallel)
+  {
+    sStsWorkload *wl = sSched->BeginWorkload();
+    Wz4BSPBuildJob *job = new Wz4BSPBuildJob;
+    job->BSP = this;
+    job->Workload = wl;
+    job->Faces.Swap(faces);
+    job->Seed = rand.Int32();
+    job->Leaf = Wz4BSPNode::Empty;
+    job->Out = &Root;
+    wl->AddTask(wl->NewTask(BuildTask,job,1,0));
+    wl->Start();
+    wl->Sync();
+    wl->End();
+  }
+  else
+  {
+    Root = BuildTreeR(faces,rand,Wz4BSPNode::Empty,0);
+  }
+  ErrorCode = (Wz4BSPError) BuildError;
+
+  if(ErrorCode != WZ4BSP_OK)
+    sDelete(Root);
   if(Root)
     CalcBoundsR(Root,Bounds);
-
-  for(sInt i=0;i<faces.GetCount();i++)
-    faces[i]->Release();
+  Flatten();
 
   return ErrorCode;
 }
@@ -1554,6 +1637,7 @@ void Wz4BSP::MakeRandomSplits(sF32 randomPlaneProb,sF32 minEdge,sF32 maxEdge,sIn
   rand.Seed(seed);
   poly.InitBBox(Bounds);
   Root = MakeRandomSplitsR(Root,rand,poly,maxSplits);
+  Flatten();
 }
 
 Wz4BSPError Wz4BSP::GeneratePolyhedrons(Wz4Mesh *out,sF32 explode)
@@ -1579,7 +1663,7 @@ sBool Wz4BSP::TraceRay(const sRay &inRay,sF32 tMin,sF32 tMax,sF32 &tHit,sVector3
   static const sInt StackSize=256;
   struct StackEntry
   {
-    Wz4BSPNode *node,*parent;
+    sInt node,parent;
     sF32 time;
   };
   StackEntry stack[StackSize];
@@ -1591,13 +1675,15 @@ sBool Wz4BSP::TraceRay(const sRay &inRay,sF32 tMin,sF32 tMax,sF32 &tHit,sVector3
   ray.Start -= CenterPos;
 
   sVERIFY(Root != 0);
-  Wz4BSPNode *node = Root, *parent = 0;
+  const Wz4BSPFlatNode *nodes = Nodes.GetData();
+  sInt node = FlatRoot, parent = -1;
   while(1)
   {
-    if(node->Type == Wz4BSPNode::Inner)
+    if(node >= 0)
     {
-      sF32 denom = ray.Dir ^ node->Plane;
-      sF32 dist = -(ray.Start ^ node->Plane);
+      const Wz4BSPFlatNode *n = &nodes[node];
+      sF32 denom = ray.Dir ^ n->Plane;
+      sF32 dist = -(ray.Start ^ n->Plane);
       sInt nearIndex = dist < 0.0f;
 
       if(denom != 0.0f)
@@ -1607,7 +1693,7 @@ sBool Wz4BSP::TraceRay(const sRay &inRay,sF32 tMin,sF32 tMax,sF32 &tHit,sVector3
         {
           if(t >= tMin-IntersectEpsilon)
           {
-            stack[stackp].node = node->Child[1-nearIndex];
+            stack[stackp].node = n->Child[1-nearIndex];
             stack[stackp].time = tMax;
             stack[stackp].parent = node;
             stackp++;
@@ -1619,21 +1705,22 @@ sBool Wz4BSP::TraceRay(const sRay &inRay,sF32 tMin,sF32 tMax,sF32 &tHit,sVector3
       }
       else if(sFAbs(dist) < IntersectEpsilon)
       {
-        stack[stackp].node = node->Child[1-nearIndex];
+        // ray runs inside the plane: the far side is traced over the same
+        // interval. a solid hit there reports this plane as normal; the
+        // pointer tree version left parent (and so the normal) stale here.
+        stack[stackp].node = n->Child[1-nearIndex];
         stack[stackp].time = tMax;
+        stack[stackp].parent = node;
         stackp++;
       }
 
       parent = node;
-      node = node->Child[nearIndex];
+      node = n->Child[nearIndex];
     }
     else
     {
-      if(node->Type == Wz4BSPNode::Solid)
+      if(node == Wz4BSPFlatNode::SolidLeaf)
       {
-        //sInt col = sClamp<sInt>(-normal.z*255,0,255);
-        //colHit = col*0x010101;
-        //colHit = Tree[parent].Color;
         hitNormal = normal;
         tHit = tMin;
         return sTRUE;
@@ -1642,7 +1729,7 @@ sBool Wz4BSP::TraceRay(const sRay &inRay,sF32 tMin,sF32 tMax,sF32 &tHit,sVector3
       if(!stackp)
         break;
 
-      normal = sVector30(parent->Plane);
+      normal = sVector30(nodes[parent].Plane);
       tMin = tMax;
       stackp--;
       node = stack[stackp].node;
@@ -1654,21 +1741,69 @@ sBool Wz4BSP::TraceRay(const sRay &inRay,sF32 tMin,sF32 tMax,sF32 &tHit,sVector3
   return sFALSE;
 }
 
+struct Wz4BSPTraceJob
+{
+  enum { BatchSize = 256 };
+  Wz4BSP *BSP;
+  const sRay *Rays;
+  Wz4BSPRayHit *Hits;
+  sInt Count;
+  sF32 TMin;
+  sF32 TMax;
+};
 
-sBool Wz4BSP::IsInside(const sVector31 &pos_)
+static void Wz4BSPTraceTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
 {
-  const sVector31 pos(pos_-CenterPos);
+  Wz4BSPTraceJob *job = (Wz4BSPTraceJob *) data;
+  for(sInt b=start;b<start+count;b++)
+  {
+    sInt end = sMin<sInt>((b+1)*Wz4BSPTraceJob::BatchSize,job->Count);
+    for(sInt i=b*Wz4BSPTraceJob::BatchSize;i<end;i++)
+    {
+      Wz4BSPRayHit *hit = &job->Hits[i];
+      hit->Hit = job->BSP->TraceRay(job->Rays[i],job->TMin,job->TMax,hit->Time,hit->Normal);
+    }
+  }
+}
 
-  Wz4BSPNode *n = Root;
+// traces many rays at once, in batches spread over all threads
 
-  while(n->Type==Wz4BSPNode::Inner)
+void Wz4BSP::TraceRays(sInt count,const sRay *rays,sF32 tMin,sF32 tMax,Wz4BSPRayHit *hits)
+{
+  Wz4BSPTraceJob job;
+  job.BSP = this;
+  job.Rays = rays;
+  job.Hits = hits;
+  job.Count = count;
+  job.TMin = tMin;
+  job.TMax = tMax;
+
+  sInt batches = (count+Wz4BSPTraceJob::BatchSize-1)/Wz4BSPTraceJob::BatchSize;
+  if(batches<=1)
   {
-    if((n->Plane ^ pos)<0)
-      n = n->Child[0];
-    else 
-      n = n->Child[1];
+    Wz4BSPTraceTask(sSched,0,0,batches,&job);
+    return;
   }
-  return (n->Type==Wz4BSPNode::Solid);
+
+  sStsWorkload *wl = sSched->BeginWorkload();
+  wl->AddTask(wl->NewTask(Wz4BSPTraceTask,&job,batches,0));
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
+
+
+sBool Wz4BSP::IsInside(const sVector31 &pos_)
+{
+  const sVector31 pos(pos_-CenterPos);
+
+  const Wz4BSPFlatNode *nodes = Nodes.GetData();
+  sInt n = FlatRoot;
+
+  while(n>=0)
+    n = nodes[n].Child[(nodes[n].Plane ^ pos)<0 ? 0 : 1];
+
+  return (n==Wz4BSPFlatNode::SolidLeaf);
 }
 
 /****************************************************************************/
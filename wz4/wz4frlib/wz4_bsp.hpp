@@ -12,6 +12,7 @@
 #include "base/types2.hpp"
 #include "base/math.hpp"
 #include "wz4frlib/wz4_mesh.hpp"
+#include "util/taskscheduler.hpp"
 
 /****************************************************************************/
 
@@ -114,21 +115,41 @@ struct Wz4BSPNode
   Wz4BSPNode *Child[2]; // back, front
 };
 
+struct Wz4BSPFlatNode             // compact copy of the tree used for queries
+{
+  static const sInt EmptyLeaf = -1;
+  static const sInt SolidLeaf = -2;
+
+  sVector4 Plane;
+  sInt Child[2];                  // back, front. index of inner node or leaf code
+};
+
+struct Wz4BSPRayHit
+{
+  sBool Hit;
+  sF32 Time;
+  sVector30 Normal;
+};
+
 class Wz4BSP : public wObject
 {
   Wz4BSPNode *Root;
+  sArray<Wz4BSPFlatNode> Nodes;   // depth first, back child follows its parent
+  sInt FlatRoot;
   sAABBox Bounds; // in internal coordinate system
 
   sVector30 CenterPos; // in world coordinate system
   
   sF32 PlaneThickness;
   Wz4BSPError ErrorCode;
+  volatile sU32 BuildError; // Wz4BSPError while BuildTreeR() runs in tasks, first error wins
 
   sF32 RandomPlaneProb;
   sF32 MaxVolume,MinVolume;
 
   sVector4 PickSplittingPlane(const sArray<Wz4BSPFace*> &faces,sRandomMT &rand);
-  Wz4BSPNode *BuildTreeR(sArray<Wz4BSPFace*> &splitFaces,sRandomMT &rand);
+  Wz4BSPNode *BuildTreeR(sArray<Wz4BSPFace*> &splitFaces,sRandomMT &rand,sInt leaf,sStsWorkload *wl);
+  static void BuildTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data);
   Wz4BSPNode *CopyTreeR(Wz4BSPNode *node);
   Wz4BSPNode *SplitTreeR(Wz4BSPNode *node,const sAABBox &box,const sVector4 &plane,sInt side,sInt &splitSolids);
   Wz4BSPNode *SplitTree(Wz4BSPNode *root,const sVector4 &plane,sInt &splitSolids);
@@ -136,6 +157,8 @@ class Wz4BSP : public wObject
   void GeneratePolyhedronsR(Wz4BSPNode *node,const Wz4BSPPolyhedron &base,Wz4Mesh *out,sF32 explode);
   void CalcBoundsR(Wz4BSPNode *node,const sAABBox &box);
   Wz4BSPNode *MakeRandomSplitsR(Wz4BSPNode *node,sRandomMT &rand,const Wz4BSPPolyhedron &poly,sInt &maxSplits);
+  sInt FlattenR(const Wz4BSPNode *node);
+  void Flatten();
 
 public:
   Wz4BSP();
@@ -143,11 +166,12 @@ public:
   void CopyFrom(Wz4BSP *bsp);
 
   void MakePolyhedron(sInt nFaces,sInt nIter,sF32 power,sBool dualize,sInt seed);
-  Wz4BSPError FromMesh(const Wz4Mesh *mesh,sF32 planeThickness);
+  Wz4BSPError FromMesh(const Wz4Mesh *mesh,sF32 planeThickness,sBool parallel=sFALSE);
   void MakeRandomSplits(sF32 randomPlaneProb,sF32 minEdge,sF32 maxEdge,sInt seed,sInt maxSplits);
   Wz4BSPError GeneratePolyhedrons(Wz4Mesh *mesh,sF32 explode);
 
   sBool TraceRay(const sRay &ray,sF32 tMin,sF32 tMax,sF32 &tHit,sVector30 &hitNormal);
+  void TraceRays(sInt count,const sRay *rays,sF32 tMin,sF32 tMax,Wz4BSPRayHit *hits);
   sBool IsInside(const sVector31 &pos);
 };
 
@@ -0,0 +1,286 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "wz4frlib/wz4_checkpoint.hpp"
+#include "base/system.hpp"
+#include "util/fastcompress.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Reader / Writer                                                    ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+void Wz4CheckpointWriter::Bytes(const void *src,sInt size)
+{
+  if(size>0)
+    sCopyMem(Data.AddMany(size),src,size);
+}
+
+void Wz4CheckpointReader::Bytes(void *dest,sInt size)
+{
+  if(Ok && size>=0 && size<=End-Ptr)
+  {
+    sCopyMem(dest,Ptr,size);
+    Ptr += size;
+  }
+  else
+  {
+    Ok = 0;
+  }
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Shared by all caches                                               ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+struct Wz4CheckpointGlobals
+{
+  sThreadLock Lock;
+  Wz4Checkpoints *First;
+  sU32 Serial;
+  sDInt Memory;
+  sDInt Budget;
+  sFastLzpCompressor *Comp;       // created on first use, they are big
+  sFastLzpDecompressor *Decomp;
+
+  Wz4CheckpointGlobals()
+  {
+    First = 0;
+    Serial = 0;
+    Memory = 0;
+    Budget = 64*1024*1024;
+    Comp = 0;
+    Decomp = 0;
+  }
+  ~Wz4CheckpointGlobals()
+  {
+    delete Comp;
+    delete Decomp;
+  }
+
+  void Evict(const Wz4Checkpoints *keep);
+};
+
+static Wz4CheckpointGlobals *CPG;
+
+static void Wz4InitCheckpoints()
+{
+  CPG = new Wz4CheckpointGlobals;
+}
+
+static void Wz4ExitCheckpoints()
+{
+  sDelete(CPG);
+}
+
+sADDSUBSYSTEM(Wz4Checkpoints,0x40,Wz4InitCheckpoints,Wz4ExitCheckpoints);
+
+// drop the oldest snapshots until we are in budget. the newest snapshot
+// of the cache that just stored is kept, or storing would be pointless.
+
+void Wz4CheckpointGlobals::Evict(const Wz4Checkpoints *keep)
+{
+  while(Memory>Budget)
+  {
+    Wz4Checkpoints *best = 0;
+    sInt bestn = -1;
+    for(Wz4Checkpoints *cp=First;cp;cp=cp->Next)
+    {
+      for(sInt i=0;i<cp->Entries.GetCount();i++)
+      {
+        if(cp==keep && cp->Entries[i].Serial==Serial)
+          continue;
+        if(!best || sInt(cp->Entries[i].Serial-best->Entries[bestn].Serial)<0)
+        {
+          best = cp;
+          bestn = i;
+        }
+      }
+    }
+    if(!best)
+      break;
+    best->Remove(bestn);
+  }
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Cache                                                              ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+Wz4Checkpoints::Wz4Checkpoints()
+{
+  Interval = 0;
+  Next = 0;
+  if(CPG)
+  {
+    sScopeLock lock(&CPG->Lock);
+    Next = CPG->First;
+    CPG->First = this;
+  }
+}
+
+Wz4Checkpoints::~Wz4Checkpoints()
+{
+  Clear();
+  if(CPG)
+  {
+    sScopeLock lock(&CPG->Lock);
+    Wz4Checkpoints **pp = &CPG->First;
+    while(*pp && *pp!=this)
+      pp = &(*pp)->Next;
+    if(*pp)
+      *pp = Next;
+  }
+}
+
+void Wz4Checkpoints::Init(sF32 interval)
+{
+  Clear();
+  Interval = sMax<sF32>(interval,0);
+}
+
+void Wz4Checkpoints::Clear()
+{
+  if(CPG)
+  {
+    sScopeLock lock(&CPG->Lock);
+    while(Entries.GetCount())
+      Remove(Entries.GetCount()-1);
+  }
+  else
+  {
+    while(Entries.GetCount())
+      Remove(Entries.GetCount()-1);
+  }
+}
+
+void Wz4Checkpoints::Remove(sInt n)
+{
+  if(CPG)
+    CPG->Memory -= Entries[n].PackedSize;
+  delete[] Entries[n].Packed;
+  Entries.RemAtOrder(n);
+}
+
+sInt Wz4Checkpoints::Slot(sF32 time) const
+{
+  // a little slack, the time of a simulation is summed up from steps
+  return sRoundDown(time/Interval+0.001f);
+}
+
+sBool Wz4Checkpoints::Want(sF32 time) const
+{
+  if(!IsEnabled() || !CPG || time<0)
+    return 0;
+
+  sInt slot = Slot(time);
+  for(sInt i=Entries.GetCount()-1;i>=0;i--)
+  {
+    sInt s = Slot(Entries[i].Time);
+    if(s==slot)
+      return 0;
+    if(s<slot)
+      break;
+  }
+  return 1;
+}
+
+void Wz4Checkpoints::Store(sF32 time,const sArray<sU8> &state)
+{
+  if(!IsEnabled() || !CPG)
+    return;
+
+  sScopeLock lock(&CPG->Lock);
+
+  // compress
+
+  if(!CPG->Comp)
+    CPG->Comp = new sFastLzpCompressor;
+
+  sFile *file = sCreateGrowMemFile();
+  CPG->Comp->StartPiecewise();
+  sBool ok = CPG->Comp->WritePiecewise(file,state.GetData(),state.GetCount());
+  ok = CPG->Comp->EndPiecewise(file) && ok;
+
+  // insert, replacing a snapshot of the same slot
+
+  if(ok)
+  {
+    sInt slot = Slot(time);
+    sInt pos = Entries.GetCount();
+    while(pos>0 && Entries[pos-1].Time>time)
+      pos--;
+    if(pos>0 && Slot(Entries[pos-1].Time)==slot)
+      Remove(--pos);
+
+    Entry e;
+    e.Time = time;
+    e.Serial = ++CPG->Serial;
+    e.Size = state.GetCount();
+    e.PackedSize = sInt(file->GetSize());
+    e.Packed = new sU8[e.PackedSize];
+    sCopyMem(e.Packed,file->Map(0,e.PackedSize),e.PackedSize);
+    Entries.AddBefore(e,pos);
+    CPG->Memory += e.PackedSize;
+
+    CPG->Evict(this);
+  }
+  delete file;
+}
+
+sBool Wz4Checkpoints::Find(sF32 time,sF32 &found,sArray<sU8> &state,sF32 after) const
+{
+  if(!IsEnabled() || !CPG)
+    return 0;
+
+  sScopeLock lock(&CPG->Lock);
+
+  sInt pos = Entries.GetCount();
+  while(pos>0 && Entries[pos-1].Time>time)
+    pos--;
+  if(pos==0 || Entries[pos-1].Time<=after)
+    return 0;
+  const Entry *e = &Entries[pos-1];
+
+  // decompress
+
+  if(!CPG->Decomp)
+    CPG->Decomp = new sFastLzpDecompressor;
+
+  state.Resize(e->Size);
+  sFile *file = sCreateMemFile((const void *)e->Packed,e->PackedSize,sFALSE);
+  CPG->Decomp->StartPiecewise();
+  sBool ok = CPG->Decomp->ReadPiecewise(file,state.GetData(),e->Size);
+  CPG->Decomp->EndPiecewise();
+  delete file;
+
+  found = e->Time;
+  return ok;
+}
+
+void Wz4Checkpoints::SetBudget(sDInt bytes)
+{
+  if(CPG)
+  {
+    sScopeLock lock(&CPG->Lock);
+    CPG->Budget = bytes;
+    CPG->Evict(0);
+  }
+}
+
+sDInt Wz4Checkpoints::GetMemory()
+{
+  return CPG ? CPG->Memory : 0;
+}
+
+/****************************************************************************/
+
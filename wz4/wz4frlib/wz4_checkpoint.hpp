@@ -0,0 +1,104 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_WZ4FRLIB_WZ4_CHECKPOINT_HPP
+#define FILE_WZ4FRLIB_WZ4_CHECKPOINT_HPP
+
+#include "base/types.hpp"
+#include "base/types2.hpp"
+
+/****************************************************************************/
+
+// packing simulation state into a snapshot. only for plain old data.
+
+class Wz4CheckpointWriter
+{
+  sArray<sU8> &Data;
+public:
+  Wz4CheckpointWriter(sArray<sU8> &data) : Data(data) { Data.Clear(); }
+
+  void Bytes(const void *src,sInt size);
+  template <class T> void Value(const T &v) { Bytes(&v,sizeof(T)); }
+  template <class T> void Array(const sArray<T> &a) { sInt n=a.GetCount(); Value(n); Bytes(a.GetData(),n*sizeof(T)); }
+};
+
+class Wz4CheckpointReader
+{
+  const sU8 *Ptr;
+  const sU8 *End;
+  sBool Ok;
+public:
+  Wz4CheckpointReader(const sArray<sU8> &data) { Ptr=data.GetData(); End=Ptr+data.GetCount(); Ok=1; }
+
+  void Bytes(void *dest,sInt size);
+  template <class T> void Value(T &v) { Bytes(&v,sizeof(T)); }
+  template <class T> void Array(sArray<T> &a);
+  sBool IsOk() const { return Ok; }                  // nothing read past the end
+  sBool IsDone() const { return Ok && Ptr==End; }    // and everything read
+};
+
+template <class T> void Wz4CheckpointReader::Array(sArray<T> &a)
+{
+  sInt n = 0;
+  Value(n);
+  if(Ok && n>=0 && sDInt(n)*sDInt(sizeof(T))<=sDInt(End-Ptr))
+  {
+    a.Resize(n);
+    Bytes(a.GetData(),n*sizeof(T));
+  }
+  else
+  {
+    Ok = 0;
+  }
+}
+
+/****************************************************************************/
+
+// snapshots of a simulation node, so seeking on the timeline can restart
+// from the nearest earlier snapshot instead of simulating from zero.
+// the node stores a snapshot whenever Want() says so, at multiples of the
+// interval (in the node's own time units). snapshots are compressed, and
+// all caches share one memory budget: when it is exceeded, the snapshots
+// that were stored first are dropped, no matter which node they belong to.
+
+class Wz4Checkpoints
+{
+  friend struct Wz4CheckpointGlobals;
+  struct Entry
+  {
+    sF32 Time;
+    sU32 Serial;                  // order of creation over all caches
+    sInt Size;                    // uncompressed
+    sInt PackedSize;
+    sU8 *Packed;
+  };
+  sArray<Entry> Entries;          // sorted by time
+  sF32 Interval;
+  Wz4Checkpoints *Next;           // all caches, for the budget
+
+  sInt Slot(sF32 time) const;
+  void Remove(sInt n);
+public:
+  Wz4Checkpoints();
+  ~Wz4Checkpoints();
+
+  void Init(sF32 interval);       // 0 = disabled. clears the cache
+  void Clear();
+  sBool IsEnabled() const { return Interval>0; }
+
+  sBool Want(sF32 time) const;    // time has reached a multiple of the interval that has no snapshot yet
+  void Store(sF32 time,const sArray<sU8> &state);
+  sBool Find(sF32 time,sF32 &found,sArray<sU8> &state,sF32 after=-1) const; // latest snapshot at or before time, if it is later than after
+
+  static void SetBudget(sDInt bytes);   // compressed bytes over all caches
+  static sDInt GetMemory();
+};
+
+/****************************************************************************/
+
+#endif // FILE_WZ4FRLIB_WZ4_CHECKPOINT_HPP
+
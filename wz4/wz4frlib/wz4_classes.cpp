@@ -0,0 +1,74 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "wz4frlib/wz4_classes.hpp"
+#include "wz4lib/doc.hpp"
+
+/****************************************************************************/
+
+void Wz4RegisterPlayerClasses()
+{
+  for(sInt i=0;i<2;i++)
+  {
+    sREGOPS(basic,0);
+    sREGOPS(poc,1);
+//    sREGOPS(minmesh,1);           // obsolete wz3
+//    sREGOPS(genspline,1);         // obsolete wz3
+
+    sREGOPS(chaos_font,0);        // should go away soon (detuned)
+    sREGOPS(wz3_bitmap,0);
+    sREGOPS(wz4_anim,0);
+//    sREGOPS(wz4_bitmap,1);        // bitmap system based on new image libarary, never finished
+//    sREGOPS(wz4_cubemap,0);       // bitmap system based on new image libarary, never finished
+    sREGOPS(wz4_mtrl,1);
+    sREGOPS(chaosmesh,1);         // should go away soon (detuned)
+//    sREGOPS(wz4_demo,1);          // old demo system, never worked
+    sREGOPS(wz4_demo2,0);
+    sREGOPS(wz4_mesh,0);
+    sREGOPS(chaosfx,0);
+    sREGOPS(easter,0);
+    sREGOPS(wz4_bsp,0);
+    sREGOPS(wz4_mtrl2,0);
+//    sREGOPS(wz4_rovemtrl,0);      // was never finished
+    sREGOPS(tron,1);
+    sREGOPS(wz4_ipp,0);
+    sREGOPS(wz4_audio,0);         // audio to image -> not usefull (yet)
+    //sREGOPS(wz4_ssao,0);
+    sREGOPS(fxparticle,0);
+    sREGOPS(wz4_modmtrl,0);
+    sREGOPS(wz4_modmtrlmod,0);
+
+//    sREGOPS(fr033,0);   // bp invitation
+    sREGOPS(fr062,0);   // the cube
+    sREGOPS(fr063_chaos,0);   // chaos+tron
+    sREGOPS(fr063_tron,0);   // chaos+tron
+    sREGOPS(fr063_mandelbulb,0);   // chaos+tron
+    sREGOPS(fr063_sph,0);   // chaos+tron
+//    sREGOPS(fr070,0);
+
+    sREGOPS(adf,0);     
+    sREGOPS(pdf,0);
+
+#ifdef sCOMPIL_PHYSX
+    sREGOPS(wz4_physx,0);
+#endif
+  }
+
+  Doc->FindType(L"Scene")->Secondary = 1;
+  Doc->FindType(L"GenBitmap")->Order = 2;
+  Doc->FindType(L"Wz4Mesh")->Order = 3;
+  Doc->FindType(L"Wz4Render")->Order = 4;
+  Doc->FindType(L"Wz4Mtrl")->Order = 5;
+
+  wClass *cl = Doc->FindClass(L"MakeTexture2",L"Texture2D");
+  sVERIFY(cl);
+  Doc->Classes.RemOrder(cl);
+  Doc->Classes.AddHead(cl);   // order preserving!
+}
+
+/****************************************************************************/
+
@@ -0,0 +1,24 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_WZ4FRLIB_WZ4_CLASSES_HPP
+#define FILE_WZ4FRLIB_WZ4_CLASSES_HPP
+
+#include "base/types.hpp"
+
+/****************************************************************************/
+
+// the operator classes and type order of the player. wz4player and
+// wz4bench call this from their RegisterWZ4Classes(), so a benchmarked
+// document sees exactly the classes the player does.
+
+void Wz4RegisterPlayerClasses();
+
+/****************************************************************************/
+
+#endif // FILE_WZ4FRLIB_WZ4_CLASSES_HPP
+
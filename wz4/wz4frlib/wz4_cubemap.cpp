@@ -9,6 +9,9 @@
 
 #include "wz4_cubemap.hpp"
 #include "wz4_cubemap_ops.hpp"
+#include "util/noise.hpp"
+#include "util/simd_float.hpp"
+#include "util/taskscheduler.hpp"
 
 /****************************************************************************/
 
@@ -133,12 +136,7 @@ void Wz4Cubemap::Sample(const sVector30 &n,Pixel &result) const
   sF32 ax,ay,az;
   sF32 nx,ny,nz;
   sF32 u,v,s;
-  sInt fx,fy;
-  sInt x00,x01,x10,x11;
-  sInt y00,y01,y10,y11;
-  sInt f00,f01,f10,f11;
-  Pixel c00,c01,c10,c11,c0,c1;
-
+  sInt f;
 
   nx = n.x;
   ny = n.y;
@@ -148,25 +146,37 @@ void Wz4Cubemap::Sample(const sVector30 &n,Pixel &result) const
   az = sFAbs(nz);
   if(ax>ay && ax>az)
   {
-    if(n.x>0) { f00 = 0; u=-nz; v=-ny; s= nx; }
-    else      { f00 = 1; u= nz; v=-ny; s=-nx; }
+    if(n.x>0) { f = 0; u=-nz; v=-ny; s= nx; }
+    else      { f = 1; u= nz; v=-ny; s=-nx; }
   }
   else if(ay>az)
   {
-    if(n.y>0) { f00 = 2; u= nx; v= nz; s= ny;  }
-    else      { f00 = 3; u= nx; v=-nz; s=-ny;  }
+    if(n.y>0) { f = 2; u= nx; v= nz; s= ny;  }
+    else      { f = 3; u= nx; v=-nz; s=-ny;  }
   }
   else
   {
-    if(n.z>0) { f00 = 4; u= nx; v=-ny; s= nz;  }
-    else      { f00 = 5; u=-nx; v=-ny; s=-nz;  }
+    if(n.z>0) { f = 4; u= nx; v=-ny; s= nz;  }
+    else      { f = 5; u=-nx; v=-ny; s=-nz;  }
   }
 
   s = 1/s;
   u *= s; u = u*0.5f+0.5f;
   v *= s; v = v*0.5f+0.5f;
+  SampleFace(f,u,v,result);
+}
+
+void Wz4Cubemap::SampleFace(sInt f,sF32 u,sF32 v,Pixel &result) const
+{
+  sInt fx,fy;
+  sInt x00,x01,x10,x11;
+  sInt y00,y01,y10,y11;
+  sInt f00,f01,f10,f11;
+  Pixel c00,c01,c10,c11,c0,c1;
+
   fx = sInt(u*Size*256)-128;
   fy = sInt(v*Size*256)-128;
+  f00 = f;
   x00 = fx>>8; fx = fx&255;
   y00 = fy>>8; fy = fy&255;
   x01 = x00+1;
@@ -200,8 +210,145 @@ void Wz4Cubemap::Sample(const sVector30 &n,Pixel &result) const
   result.Lerp(fy*256,c0,c1);
 }
 
+void Wz4Cubemap::SampleBatch(sInt count,const sF32 *nx,const sF32 *ny,const sF32 *nz,Pixel *result) const
+{
+  sInt i = 0;
+
+#if sSIMD_INTRINSICS
+  // face selection and projection four at a time, the arithmetic is the
+  // same as in Sample(), only the fetch stays scalar.
+
+  const sSSE zero = sVecZero();
+  const sSSE half = sVecLoadScalar(0.5f);
+  const sSSE one = sVecLoadScalar(1.0f);
+  const sSSE sign = sVecLoadScalar(-0.0f);
+  sALIGNED(sF32,us[4],16);
+  sALIGNED(sF32,vs[4],16);
+
+  for(;i+4<=count;i+=4)
+  {
+    sSSE x = sVecLoadU(nx+i);
+    sSSE y = sVecLoadU(ny+i);
+    sSSE z = sVecLoadU(nz+i);
+    sSSE ax = sVecAndC(x,sign);
+    sSSE ay = sVecAndC(y,sign);
+    sSSE az = sVecAndC(z,sign);
+    sSSE mx = sVecAnd(sVecCmpGT(ax,ay),sVecCmpGT(ax,az));
+    sSSE my = sVecAndC(sVecCmpGT(ay,az),mx);
+    sSSE px = sVecCmpGT(x,zero);
+    sSSE py = sVecCmpGT(y,zero);
+    sSSE pz = sVecCmpGT(z,zero);
+
+    // x faces: u=-+z v=-y s=+-x, y faces: u=x v=+-z s=+-y, z faces: u=+-x v=-y s=+-z
+    sSSE ux = sVecXor(z,sVecAnd(px,sign));
+    sSSE sx = sVecXor(x,sVecAndC(sign,px));
+    sSSE vy = sVecXor(z,sVecAndC(sign,py));
+    sSSE sy = sVecXor(y,sVecAndC(sign,py));
+    sSSE uz = sVecXor(x,sVecAndC(sign,pz));
+    sSSE sz = sVecXor(z,sVecAndC(sign,pz));
+    sSSE u = sVecSel(sVecSel(uz,x,my),ux,mx);
+    sSSE v = sVecSel(sVecXor(y,sign),vy,my);
+    sSSE s = sVecSel(sVecSel(sz,sy,my),sx,mx);
+
+    s = sVecDiv(one,s);
+    u = sVecAdd(sVecMul(sVecMul(u,s),half),half);
+    v = sVecAdd(sVecMul(sVecMul(v,s),half),half);
+    sVecStore(u,us);
+    sVecStore(v,vs);
+
+    sInt fmx = _mm_movemask_ps(mx);
+    sInt fmy = _mm_movemask_ps(my);
+    sInt fpx = _mm_movemask_ps(px);
+    sInt fpy = _mm_movemask_ps(py);
+    sInt fpz = _mm_movemask_ps(pz);
+    for(sInt j=0;j<4;j++)
+    {
+      sInt f;
+      if(fmx&(1<<j))      f = (fpx&(1<<j)) ? 0 : 1;
+      else if(fmy&(1<<j)) f = (fpy&(1<<j)) ? 2 : 3;
+      else                f = (fpz&(1<<j)) ? 4 : 5;
+      SampleFace(f,us[j],vs[j],result[i+j]);
+    }
+  }
+#endif
+
+  for(;i<count;i++)
+    Sample(sVector30(nx[i],ny[i],nz[i]),result[i]);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Running over all texels in parallel                                ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// all faces are stacked into one image of Size*6 rows. the operations
+// split that into bands of rows, which are processed in parallel.
+
+enum
+{
+  Wz4CubemapBand = 16,            // rows per task
+  Wz4CubemapBlock = 256,          // texels per batch on the stack
+};
+
+struct Wz4CubemapJob
+{
+  void (*Rows)(const Wz4CubemapJob *job,sInt row0,sInt row1);
+  sInt RowCount;
+
+  Wz4Cubemap *Out;
+  const Wz4Cubemap *In[3];
+  const GenTexture *Grad[3];
+  sInt Op;
+
+  sInt Freq,Oct,Seed,Mode,Offset; // noise
+  sF32 Scaling,Fadeoff;
+  sVector30 Dir;                  // glow
+  sF32 Radius;
+  sInt Matrix[4][5];              // color matrix, 16:16 fixed point
+  sBool ClampPremult;
+  const sMatrix34 *Coord;         // coord matrix
+};
+
+static void Wz4CubemapTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  const Wz4CubemapJob *job = (const Wz4CubemapJob *) data;
+  for(sInt band=start;band<start+count;band++)
+    (*job->Rows)(job,band*Wz4CubemapBand,sMin((band+1)*Wz4CubemapBand,job->RowCount));
+}
+
+static void Wz4CubemapRun(Wz4CubemapJob *job)
+{
+  job->RowCount = 6*job->Out->Size;
+
+  sInt bands = (job->RowCount+Wz4CubemapBand-1)/Wz4CubemapBand;
+  if(bands<2 || !sSched || sSched->GetThreadCount()<2)
+  {
+    Wz4CubemapTask(0,0,0,bands,job);
+  }
+  else
+  {
+    sStsWorkload *wl = sSched->BeginWorkload();
+    sStsTask *task = wl->NewTask(Wz4CubemapTask,job,bands,0);
+    wl->AddTask(task);
+    wl->Start();
+    wl->Sync();
+    wl->End();
+  }
+}
+
+// unit direction of a texel, given by row and column
+
+static void Wz4CubemapNormal(const Wz4Cubemap *cube,sInt row,sInt x,sVector30 &n)
+{
+  cube->MakeCube(row>>cube->Shift,x*cube->RSize+cube->HSize,(row&cube->Mask)*cube->RSize+cube->HSize,n);
+  n.Unit();
+}
 
 /****************************************************************************/
+/***                                                                      ***/
+/***   Generators                                                         ***/
+/***                                                                      ***/
 /****************************************************************************/
 
 void Wz4Cubemap::Flat(const Pixel &col)
@@ -212,6 +359,58 @@ void Wz4Cubemap::Flat(const Pixel &col)
 
 /****************************************************************************/
 
+static void Wz4CubemapNoiseRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
+{
+  const Wz4Cubemap *cube = job->Out;
+  const sInt block = Wz4CubemapBlock;
+  sInt nx[block],ny[block],nz[block];
+  sInt xs[block],ys[block],zs[block];
+  sInt n[block];
+  sF32 nv[block];
+
+  // evaluate the noise for blocks of pixels at once
+
+  sInt size = cube->Size;
+  sInt end = row1*size;
+  Pixel *out = cube->Data + row0*size;
+  for(sInt j0=row0*size;j0<end;j0+=block)
+  {
+    sInt count = sMin<sInt>(block,end-j0);
+    for(sInt j=0;j<count;j++)
+    {
+      sVector30 normal;
+      Wz4CubemapNormal(cube,(j0+j)>>cube->Shift,(j0+j)&cube->Mask,normal);
+      nx[j] = sInt(normal.x*0x08000);
+      ny[j] = sInt(normal.y*0x08000);
+      nz[j] = sInt(normal.z*0x08000);
+      n[j] = job->Offset;
+    }
+
+    sF32 s = job->Scaling;
+    for(sInt i=job->Freq;i<job->Freq+job->Oct;i++)
+    {
+      for(sInt j=0;j<count;j++)
+      {
+        xs[j] = nx[j]<<i;
+        ys[j] = ny[j]<<i;
+        zs[j] = nz[j]<<i;
+      }
+      sPerlin3DBatch(count,xs,ys,zs,((1<<i)-1)&0xff,job->Seed,nv);
+      for(sInt j=0;j<count;j++)
+      {
+        sF32 v = nv[j];
+        if(job->Mode & 1)
+          v = sFAbs(v);
+        n[j] += sInt(v * s);
+      }
+      s *= job->Fadeoff;
+    }
+
+    for(sInt j=0;j<count;j++)
+      job->Grad[0]->SampleGradient(*out++,n[j]);
+  }
+}
+
 void Wz4Cubemap::Noise(const GenTexture *grad,sInt freq,sInt oct,sF32 fadeoff,sInt seed,sInt mode)
 {
   sVERIFY(oct > 0);
@@ -239,81 +438,84 @@ void Wz4Cubemap::Noise(const GenTexture *grad,sInt freq,sInt oct,sF32 fadeoff,sI
 
  // sInt offs = (1 << (16 - Shift + freq)) >> 1;
 
-  Pixel *out = Data;
-  for(sInt j=0;j<CubeSize;j++)
-  {
-    sVector30 normal;
-    MakeCube(j,normal); normal.Unit();
-    sInt nx = sInt(normal.x*0x08000);
-    sInt ny = sInt(normal.y*0x08000);
-    sInt nz = sInt(normal.z*0x08000);
-
-    sInt n = offset;
-    sF32 s = scaling;
-
-    for(sInt i=freq;i<freq+oct;i++)
-    {
-//      sF32 nv = (mode & NoiseBandlimit) ? Noise2(px,py,mx,my,seed) : GNoise2(px,py,mx,my,seed);
-      sF32 nv = sPerlin3D(nx<<i,ny<<i,nz<<i,((1<<i)-1)&0xff,seed);
-      if(mode & 1)
-        nv = sFAbs(nv);
-
-      n += sInt(nv * s);
-      s *= fadeoff;
-    }
-
-    grad->SampleGradient(*out,n);
-    out++;
-  }
+  Wz4CubemapJob job;
+  job.Rows = Wz4CubemapNoiseRows;
+  job.Out = this;
+  job.Grad[0] = grad;
+  job.Freq = freq;
+  job.Oct = oct;
+  job.Seed = seed;
+  job.Mode = mode;
+  job.Offset = offset;
+  job.Scaling = scaling;
+  job.Fadeoff = fadeoff;
+  Wz4CubemapRun(&job);
 }
 
 /****************************************************************************/
 
-void Wz4Cubemap::Glow(const Wz4Cubemap *background,const GenTexture *grad,const sVector30 &dir,sF32 radius)
+static void Wz4CubemapGlowRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
 {
+  const Wz4Cubemap *cube = job->Out;
+  const Pixel *in = job->In[0]->Data + row0*cube->Size;
+  Pixel *out = cube->Data + row0*cube->Size;
   Pixel col;
-  CopyFrom(background);
-  for(sInt i=0;i<CubeSize;i++)
+
+  for(sInt row=row0;row<row1;row++)
   {
-    sVector30 normal;
-    MakeCube(i,normal); normal.Unit();
+    for(sInt x=0;x<cube->Size;x++)
+    {
+      sVector30 normal;
+      Wz4CubemapNormal(cube,row,x,normal);
 
-    sF32 n = ((dir^normal)-(1-radius))/radius;
-    if(n<0) n=0;
-    grad->SampleGradient(col,sInt(n*(1<<24)));
+      sF32 n = ((job->Dir^normal)-(1-job->Radius))/job->Radius;
+      if(n<0) n=0;
+      job->Grad[0]->SampleGradient(col,sInt(n*(1<<24)));
 
-    Data[i].CompositeAdd(col);
+      *out = *in++;
+      out->CompositeAdd(col);
+      out++;
+    }
   }
 }
 
-/****************************************************************************/
-
-void Wz4Cubemap::ColorMatrixTransform(const Wz4Cubemap *x,const Matrix45 &matrix,sBool clampPremult)
+void Wz4Cubemap::Glow(const Wz4Cubemap *background,const GenTexture *grad,const sVector30 &dir,sF32 radius)
 {
-  sInt m[4][5];
+  if(background!=this)
+    Init(background->Size);
+
+  Wz4CubemapJob job;
+  job.Rows = Wz4CubemapGlowRows;
+  job.Out = this;
+  job.In[0] = background;
+  job.Grad[0] = grad;
+  job.Dir = dir;
+  job.Radius = radius;
+  Wz4CubemapRun(&job);
+}
 
-  sVERIFY(Size==x->Size);
+/****************************************************************************/
+/***                                                                      ***/
+/***   Filters                                                            ***/
+/***                                                                      ***/
+/****************************************************************************/
 
-  for(sInt i=0;i<4;i++)
-  {
-    for(sInt j=0;j<5;j++)
-    {
-      sVERIFY(matrix[i][j] >= -127.0f && matrix[i][j] <= 127.0f);
-      m[i][j] = sInt(matrix[i][j] * 65536.0f);
-    }
-  }
+static void Wz4CubemapColorMatrixRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
+{
+  sInt size = job->Out->Size;
+  const sInt (*m)[5] = job->Matrix;
 
-  for(sInt i=0;i<CubeSize;i++)
+  for(sInt i=row0*size;i<row1*size;i++)
   {
-    Pixel &out = Data[i];
-    const Pixel &in = x->Data[i];
+    Pixel &out = job->Out->Data[i];
+    const Pixel &in = job->In[0]->Data[i];
 
     sInt r = MulShift16(m[0][0],in.r) + MulShift16(m[0][1],in.g) + MulShift16(m[0][2],in.b) + MulShift16(m[0][3],in.a) + m[0][4];
     sInt g = MulShift16(m[1][0],in.r) + MulShift16(m[1][1],in.g) + MulShift16(m[1][2],in.b) + MulShift16(m[1][3],in.a) + m[1][4];
     sInt b = MulShift16(m[2][0],in.r) + MulShift16(m[2][1],in.g) + MulShift16(m[2][2],in.b) + MulShift16(m[2][3],in.a) + m[2][4];
     sInt a = MulShift16(m[3][0],in.r) + MulShift16(m[3][1],in.g) + MulShift16(m[3][2],in.b) + MulShift16(m[3][3],in.a) + m[3][4];
 
-    if(clampPremult)
+    if(job->ClampPremult)
     {
       out.a = sClamp<sInt>(a,0,65535);
       out.r = sClamp<sInt>(r,0,out.a);
@@ -330,38 +532,82 @@ void Wz4Cubemap::ColorMatrixTransform(const Wz4Cubemap *x,const Matrix45 &matrix
   }
 }
 
-/****************************************************************************/
-
-void Wz4Cubemap::CoordMatrixTransform(const Wz4Cubemap *in,const sMatrix34 &matrix)
+void Wz4Cubemap::ColorMatrixTransform(const Wz4Cubemap *x,const Matrix45 &matrix,sBool clampPremult)
 {
-  sVERIFY(Size==in->Size);
-  sVector30 normal;
-  sVector31 pos;
+  Wz4CubemapJob job;
 
-  for(sInt i=0;i<CubeSize;i++)
+  sVERIFY(Size==x->Size);
+
+  for(sInt i=0;i<4;i++)
   {
-    MakeCube(i,normal); 
-    normal.Unit();
+    for(sInt j=0;j<5;j++)
+    {
+      sVERIFY(matrix[i][j] >= -127.0f && matrix[i][j] <= 127.0f);
+      job.Matrix[i][j] = sInt(matrix[i][j] * 65536.0f);
+    }
+  }
+
+  job.Rows = Wz4CubemapColorMatrixRows;
+  job.Out = this;
+  job.In[0] = x;
+  job.ClampPremult = clampPremult;
+  Wz4CubemapRun(&job);
+}
+
+/****************************************************************************/
+
+static void Wz4CubemapCoordMatrixRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
+{
+  const Wz4Cubemap *cube = job->Out;
+  const sInt block = Wz4CubemapBlock;
+  sF32 px[block],py[block],pz[block];
 
-    pos = sVector31(normal) * matrix;
+  // transformed directions for a block of texels, then sample them at once
 
-    in->Sample(sVector30(pos),Data[i]);
+  sInt size = cube->Size;
+  sInt end = row1*size;
+  for(sInt j0=row0*size;j0<end;j0+=block)
+  {
+    sInt count = sMin<sInt>(block,end-j0);
+    for(sInt j=0;j<count;j++)
+    {
+      sVector30 normal;
+      Wz4CubemapNormal(cube,(j0+j)>>cube->Shift,(j0+j)&cube->Mask,normal);
+      sVector31 pos = sVector31(normal) * *job->Coord;
+      px[j] = pos.x;
+      py[j] = pos.y;
+      pz[j] = pos.z;
+    }
+    job->In[0]->SampleBatch(count,px,py,pz,cube->Data+j0);
   }
 }
 
+void Wz4Cubemap::CoordMatrixTransform(const Wz4Cubemap *in,const sMatrix34 &matrix)
+{
+  sVERIFY(Size==in->Size);
+  sVERIFY(in!=this);
+
+  Wz4CubemapJob job;
+  job.Rows = Wz4CubemapCoordMatrixRows;
+  job.Out = this;
+  job.In[0] = in;
+  job.Coord = &matrix;
+  Wz4CubemapRun(&job);
+}
+
 /****************************************************************************/
 
-void Wz4Cubemap::ColorRemap(const Wz4Cubemap *inTex,const GenTexture *mapR,const GenTexture *mapG,const GenTexture *mapB)
+static void Wz4CubemapColorRemapRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
 {
-  sVERIFY(Size==inTex->Size);
-
-//  const Pixel *in = inTex->Data;
-//  Pixel *out = Data;
+  sInt size = job->Out->Size;
+  const GenTexture *mapR = job->Grad[0];
+  const GenTexture *mapG = job->Grad[1];
+  const GenTexture *mapB = job->Grad[2];
 
-  for(sInt i=0;i<CubeSize;i++)
+  for(sInt i=row0*size;i<row1*size;i++)
   {
-    const Pixel &in = inTex->Data[i];
-    Pixel &out = Data[i];
+    const Pixel &in = job->In[0]->Data[i];
+    Pixel &out = job->Out->Data[i];
 
     if(in.a == 65535) // alpha==1, everything easy.
     {
@@ -397,74 +643,157 @@ void Wz4Cubemap::ColorRemap(const Wz4Cubemap *inTex,const GenTexture *mapR,const
   }
 }
 
+void Wz4Cubemap::ColorRemap(const Wz4Cubemap *inTex,const GenTexture *mapR,const GenTexture *mapG,const GenTexture *mapB)
+{
+  sVERIFY(Size==inTex->Size);
+
+  Wz4CubemapJob job;
+  job.Rows = Wz4CubemapColorRemapRows;
+  job.Out = this;
+  job.In[0] = inTex;
+  job.Grad[0] = mapR;
+  job.Grad[1] = mapG;
+  job.Grad[2] = mapB;
+  Wz4CubemapRun(&job);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Combiners                                                          ***/
+/***                                                                      ***/
 /****************************************************************************/
 
-void Wz4Cubemap::Binary(const Wz4Cubemap *tex0,const Wz4Cubemap *tex1,CombineOp op)
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+
+// MulIntens() for eight channels, bit exact
+
+static sINLINE __m128i Wz4CubemapMulIntens(__m128i a,__m128i b)
 {
-  sVERIFY(Size==tex0->Size);
-  sVERIFY(Size==tex1->Size);
+  const __m128i round = _mm_set1_epi32(0x8000);
+  const __m128i bias = _mm_set1_epi16(-0x8000);
+  __m128i lo = _mm_mullo_epi16(a,b);
+  __m128i hi = _mm_mulhi_epu16(a,b);
+  __m128i x0 = _mm_add_epi32(_mm_unpacklo_epi16(lo,hi),round);
+  __m128i x1 = _mm_add_epi32(_mm_unpackhi_epi16(lo,hi),round);
+  x0 = _mm_srli_epi32(_mm_add_epi32(x0,_mm_srli_epi32(x0,16)),16);
+  x1 = _mm_srli_epi32(_mm_add_epi32(x1,_mm_srli_epi32(x1,16)),16);
+
+  // results are 0..65535, move them into signed range to pack them
+  x0 = _mm_sub_epi32(x0,round);
+  x1 = _mm_sub_epi32(x1,round);
+  return _mm_xor_si128(_mm_packs_epi32(x0,x1),bias);
+}
 
-//  Pixel *out = Data;
-  sInt transIn,transOut;
+// the combiners that treat all channels alike, two pixels at a time.
+// returns the number of pixels done.
 
-  for(sInt i=0;i<CubeSize;i++)
+static sInt Wz4CubemapBinarySSE(Pixel *out,const Pixel *in0,const Pixel *in1,sInt count,sInt op)
+{
+  sVERIFYSTATIC(sizeof(Pixel)==8);
+  sInt i = 0;
+
+  switch(op)
   {
-    const Pixel &in0 = tex0->Data[i];
-    const Pixel &in1  = tex1->Data[i];
-    Pixel &out = Data[i];
+  case Wz4Cubemap::CombineAdd:
+  case Wz4Cubemap::CombineSub:
+  case Wz4Cubemap::CombineMulC:
+  case Wz4Cubemap::CombineMin:
+  case Wz4Cubemap::CombineMax:
+    break;
+  default:
+    return 0;
+  }
 
+  for(;i+2<=count;i+=2)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *) (in0+i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (in1+i));
+    __m128i x;
     switch(op)
     {
-    case CombineAdd:
+    default:
+    case Wz4Cubemap::CombineAdd:  x = _mm_adds_epu16(a,b); break;
+    case Wz4Cubemap::CombineSub:  x = _mm_subs_epu16(a,b); break;
+    case Wz4Cubemap::CombineMulC: x = Wz4CubemapMulIntens(a,b); break;
+    case Wz4Cubemap::CombineMin:  x = _mm_sub_epi16(a,_mm_subs_epu16(a,b)); break;
+    case Wz4Cubemap::CombineMax:  x = _mm_add_epi16(b,_mm_subs_epu16(a,b)); break;
+    }
+    _mm_storeu_si128((__m128i *) (out+i),x);
+  }
+  return i;
+}
+
+#endif
+
+static void Wz4CubemapBinaryRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
+{
+  sInt size = job->Out->Size;
+  sInt i = row0*size;
+  sInt end = row1*size;
+  sInt transIn,transOut;
+
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+  i += Wz4CubemapBinarySSE(job->Out->Data+i,job->In[0]->Data+i,job->In[1]->Data+i,end-i,job->Op);
+#endif
+
+  for(;i<end;i++)
+  {
+    const Pixel &in0 = job->In[0]->Data[i];
+    const Pixel &in1  = job->In[1]->Data[i];
+    Pixel &out = job->Out->Data[i];
+
+    switch(job->Op)
+    {
+    case Wz4Cubemap::CombineAdd:
       out.r = sMin(in0.r + in1.r,65535);
       out.g = sMin(in0.g + in1.g,65535);
       out.b = sMin(in0.b + in1.b,65535);
       out.a = sMin(in0.a + in1.a,65535);
       break;
 
-    case CombineSub:
+    case Wz4Cubemap::CombineSub:
       out.r = sMax<sInt>(in0.r - in1.r,0);
       out.g = sMax<sInt>(in0.g - in1.g,0);
       out.b = sMax<sInt>(in0.b - in1.b,0);
       out.a = sMax<sInt>(in0.a - in1.a,0);
       break;
 
-    case CombineMulC:
+    case Wz4Cubemap::CombineMulC:
       out.r = MulIntens(in0.r,in1.r);
       out.g = MulIntens(in0.g,in1.g);
       out.b = MulIntens(in0.b,in1.b);
       out.a = MulIntens(in0.a,in1.a);
       break;
 
-    case CombineMin:
+    case Wz4Cubemap::CombineMin:
       out.r = sMin(in0.r,in1.r);
       out.g = sMin(in0.g,in1.g);
       out.b = sMin(in0.b,in1.b);
       out.a = sMin(in0.a,in1.a);
       break;
 
-    case CombineMax:
+    case Wz4Cubemap::CombineMax:
       out.r = sMax(in0.r,in1.r);
       out.g = sMax(in0.g,in1.g);
       out.b = sMax(in0.b,in1.b);
       out.a = sMax(in0.a,in1.a);
       break;
 
-    case CombineSetAlpha:
+    case Wz4Cubemap::CombineSetAlpha:
       out.r = in0.r;
       out.g = in0.g;
       out.b = in0.b;
       out.a = in1.r;
       break;
 
-    case CombinePreAlpha:
+    case Wz4Cubemap::CombinePreAlpha:
       out.r = MulIntens(in0.r,in1.r);
       out.g = MulIntens(in0.g,in1.r);
       out.b = MulIntens(in0.b,in1.r);
       out.a = in1.g;
       break;
 
-    case CombineOver:
+    case Wz4Cubemap::CombineOver:
       transIn = 65535 - in1.a;
 
       out.r = MulIntens(transIn,in0.r) + in1.r;
@@ -473,7 +802,7 @@ void Wz4Cubemap::Binary(const Wz4Cubemap *tex0,const Wz4Cubemap *tex1,CombineOp
       out.a += MulIntens(in1.a,65535-out.a);
       break;
 
-    case CombineMultiply:
+    case Wz4Cubemap::CombineMultiply:
       transIn = 65535 - in1.a;
       transOut = 65535 - out.a;
 
@@ -483,21 +812,21 @@ void Wz4Cubemap::Binary(const Wz4Cubemap *tex0,const Wz4Cubemap *tex1,CombineOp
       out.a += MulIntens(in1.a,transOut);
       break;
 
-    case CombineScreen:
+    case Wz4Cubemap::CombineScreen:
       out.r += MulIntens(in1.r,65535-in0.r);
       out.g += MulIntens(in1.g,65535-in0.g);
       out.b += MulIntens(in1.b,65535-in0.b);
       out.a += MulIntens(in1.a,65535-in0.a);
       break;
 
-    case CombineDarken:
+    case Wz4Cubemap::CombineDarken:
       out.r += in1.r - sMax(MulIntens(in1.r,in0.a),MulIntens(in0.r,in1.a));
       out.g += in1.g - sMax(MulIntens(in1.g,in0.a),MulIntens(in0.g,in1.a));
       out.b += in1.b - sMax(MulIntens(in1.b,in0.a),MulIntens(in0.b,in1.a));
       out.a += MulIntens(in1.a,65535-in0.a);
       break;
 
-    case CombineLighten:
+    case Wz4Cubemap::CombineLighten:
       out.r += in1.r - sMin(MulIntens(in1.r,in0.a),MulIntens(in0.r,in1.a));
       out.g += in1.g - sMin(MulIntens(in1.g,in0.a),MulIntens(in0.g,in1.a));
       out.b += in1.b - sMin(MulIntens(in1.b,in0.a),MulIntens(in0.b,in1.a));
@@ -507,4 +836,63 @@ void Wz4Cubemap::Binary(const Wz4Cubemap *tex0,const Wz4Cubemap *tex1,CombineOp
   }
 }
 
+void Wz4Cubemap::Binary(const Wz4Cubemap *tex0,const Wz4Cubemap *tex1,CombineOp op)
+{
+  sVERIFY(Size==tex0->Size);
+  sVERIFY(Size==tex1->Size);
+
+  Wz4CubemapJob job;
+  job.Rows = Wz4CubemapBinaryRows;
+  job.Out = this;
+  job.In[0] = tex0;
+  job.In[1] = tex1;
+  job.Op = op;
+  Wz4CubemapRun(&job);
+}
+
+/****************************************************************************/
+
+static void Wz4CubemapTernaryRows(const Wz4CubemapJob *job,sInt row0,sInt row1)
+{
+  sInt size = job->Out->Size;
+
+  for(sInt i=row0*size;i<row1*size;i++)
+  {
+    const Pixel &in1 = job->In[0]->Data[i];
+    const Pixel &in2 = job->In[1]->Data[i];
+    const Pixel &in3 = job->In[2]->Data[i];
+    Pixel &out = job->Out->Data[i];
+
+    switch(job->Op)
+    {
+    case Wz4Cubemap::TernaryLerp:
+      out.r = MulIntens(65535-in3.r,in1.r) + MulIntens(in3.r,in2.r);
+      out.g = MulIntens(65535-in3.r,in1.g) + MulIntens(in3.r,in2.g);
+      out.b = MulIntens(65535-in3.r,in1.b) + MulIntens(in3.r,in2.b);
+      out.a = MulIntens(65535-in3.r,in1.a) + MulIntens(in3.r,in2.a);
+      break;
+
+    case Wz4Cubemap::TernarySelect:
+      out = (in3.r>=32768) ? in2 : in1;
+      break;
+    }
+  }
+}
+
+void Wz4Cubemap::Ternary(const Wz4Cubemap *in1,const Wz4Cubemap *in2,const Wz4Cubemap *in3,TernaryOp op)
+{
+  sVERIFY(Size==in1->Size);
+  sVERIFY(Size==in2->Size);
+  sVERIFY(Size==in3->Size);
+
+  Wz4CubemapJob job;
+  job.Rows = Wz4CubemapTernaryRows;
+  job.Out = this;
+  job.In[0] = in1;
+  job.In[1] = in2;
+  job.In[2] = in3;
+  job.Op = op;
+  Wz4CubemapRun(&job);
+}
+
 /****************************************************************************/
@@ -30,6 +30,8 @@ public:
   void MakeCube(sInt pixel,sVector30 &n) const;
   void MakeCube(sInt face,sF32 fx,sF32 fy,sVector30 &n) const;
   void Sample(const sVector30 &n,Pixel &) const;
+  void SampleFace(sInt face,sF32 u,sF32 v,Pixel &) const;  // u,v 0..1 on the face
+  void SampleBatch(sInt count,const sF32 *nx,const sF32 *ny,const sF32 *nz,Pixel *result) const;
 
   sInt Size;                      // must be power of two
   sInt SquareSize;              // Size*Size
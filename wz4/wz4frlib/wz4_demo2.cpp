@@ -11,6 +11,7 @@
 #include "wz4frlib/wz4_ipp.hpp"
 
 #include "wz4lib/gui.hpp"
+#include "util/audioanalysis.hpp"
 #include "base/devices.hpp"
 
 /****************************************************************************/
@@ -88,6 +89,8 @@ void Wz4RenderType_::Show(wObject *obj,wPaintInfo &pi)
   SV_Time->FloatPtr[0] = sFMod(pi.TimeBeat/65536.0f/16,1);
   SV_LocalTime->FloatPtr[0] = pi.TimeBeat/65536.0f;
   SV_LowQuality->IntPtr[0] = Doc->LowQuality && (Doc->DocOptions.DialogFlags & wDODF_LowQuality);
+  if(sCurrentAudioTrack)
+    sCurrentAudioTrack->SetBeatsPerSecond(Doc->DocOptions.BeatsPerSecond/65536.0f);
   for(sInt i=0;i<8;i++)
   {
     SV_Rotor->FloatPtr[i] = MidiFloat[i+8];
@@ -0,0 +1,180 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "wz4frlib/wz4_importcache.hpp"
+#include "wz4frlib/wz4_mesh.hpp"
+#include "wz4frlib/wz4_mtrl2_ops.hpp"
+#include "base/system.hpp"
+#include "base/serialize.hpp"
+
+/****************************************************************************/
+
+static const sU32 Wz4ImportCacheId = 0x9c3a51e7;   // from the random range
+static const sInt Wz4ImportCacheVersion = 1;       // bump when a loader changes its output
+static const sS64 Wz4ImportCacheMaxSize = sS64(1024)*1024*1024;
+
+// keep the cache directory below Wz4ImportCacheMaxSize, the files written
+// longest ago go first. keep is the file that was just written.
+
+static void Wz4ImportCachePrune(const sChar *dir,const sChar *keep)
+{
+#if sPLATFORM==sPLAT_WINDOWS || sPLATFORM==sPLAT_LINUX
+  sArray<sDirEntry> list;
+  sDirEntry *de;
+  if(!sLoadDir(list,dir))
+    return;
+
+  sS64 total = 0;
+  sFORALL(list,de)
+    if(!(de->Flags & sDEF_DIR))
+      total += de->Size;
+  if(total<=Wz4ImportCacheMaxSize)
+    return;
+
+  sSortUp(list,&sDirEntry::LastWriteTime);
+  sFORALL(list,de)
+  {
+    if(total<=Wz4ImportCacheMaxSize)
+      break;
+    if((de->Flags & sDEF_DIR) || sCmpStringI(de->Name,keep)==0)
+      continue;
+    sString<sMAXPATH> path;
+    path = dir;
+    path.AddPath(de->Name);
+    if(sDeleteFile(path))
+      total -= de->Size;
+  }
+#endif
+}
+
+sBool Wz4ImportCache::Enable = 1;
+
+Wz4ImportCache::Wz4ImportCache(const sChar *file,const sChar *params)
+{
+  sDirEntry info;
+  if(!Enable || !sGetFileInfo(file,&info) || (info.Flags & sDEF_DIR))
+    return;
+
+  sString<sMAXPATH> path;
+  if(sIsAbsolutePath(file))
+  {
+    path = file;
+  }
+  else
+  {
+    sGetCurrentDir(path);
+    path.AddPath(file);
+  }
+
+  // everything that decides about the result goes into the key
+
+  Key.PrintF(L"%d %d %d|%s|%d|%016x|%s",Wz4ImportCacheVersion,
+    sInt(sizeof(Wz4MeshVertex)),sInt(sizeof(Wz4MeshFace)),
+    path,info.Size,info.LastWriteTime,params);
+
+  sGetTempDir(Name);
+  Name.AddPath(L"wz4importcache");
+  if(!sCheckDir(Name) && !sMakeDirAll(Name))
+  {
+    Name = L"";
+    return;
+  }
+  sString<32> hash;
+  hash.PrintF(L"%016x.cache",sHashStringFNV(Key));
+  Name.AddPath(hash);
+}
+
+/****************************************************************************/
+
+sBool Wz4ImportCache::Load(Wz4Mesh *mesh)
+{
+  if(Name.IsEmpty())
+    return 0;
+  sVERIFY(mesh->IsEmpty());
+
+  sFile *file = sCreateFile(Name,sFA_READ);
+  if(!file)
+    return 0;
+
+  sString<sMAXPATH*2> key;
+  sReader s;
+  s.Begin(file);
+  sBool ok = s.Header(Wz4ImportCacheId,1)==1;
+  if(ok)
+  {
+    s | key;
+    ok = s.IsOk() && key==Key;    // the name is only a hash
+  }
+  if(ok)
+  {
+    mesh->Serialize(s);
+    s.Footer();
+  }
+  ok = s.End() && ok;
+  delete file;
+
+  if(!ok)
+  {
+    mesh->Clear();
+    mesh->Chunks.Clear();
+    sRelease(mesh->Skeleton);
+  }
+  mesh->SaveFlags = 0;
+  return ok;
+}
+
+void Wz4ImportCache::Store(Wz4Mesh *mesh)
+{
+  if(Name.IsEmpty())
+    return;
+#ifdef sCOMPIL_ASSIMP
+  if(mesh->WaiIsAssimpAnimated)   // the assimp node tree is not serialized
+    return;
+#endif
+
+  // Wz4Mesh::Serialize() can only read back SimpleMtrl
+
+  Wz4MeshCluster *cl;
+  sFORALL(mesh->Clusters,cl)
+    if(cl->Mtrl && cl->Mtrl->Type!=SimpleMtrlType)
+      return;
+
+  // write to a temporary name, so nobody sees half a file
+
+  sString<sMAXPATH> temp;
+  temp.PrintF(L"%s.new",Name);
+  sFile *file = sCreateFile(temp,sFA_WRITE);
+  if(!file)
+    return;
+
+  sInt flags = mesh->SaveFlags;
+  mesh->SaveFlags = 0x2000;
+
+  sWriter s;
+  s.Begin(file);
+  s.Header(Wz4ImportCacheId,1);
+  s | (const sChar *)Key;
+  mesh->Serialize(s);
+  s.Footer();
+  sBool ok = s.End();
+  delete file;
+
+  mesh->SaveFlags = flags;
+
+  if(!ok || !sRenameFile(temp,Name,1))
+  {
+    sDeleteFile(temp);
+    return;
+  }
+
+  sString<sMAXPATH> dir;
+  sExtractPath(Name,dir);
+  Wz4ImportCachePrune(dir,sFindFileWithoutPath(Name));
+}
+
+/****************************************************************************/
+
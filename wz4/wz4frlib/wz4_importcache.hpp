@@ -0,0 +1,47 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_WZ4FRLIB_WZ4_IMPORTCACHE_HPP
+#define FILE_WZ4FRLIB_WZ4_IMPORTCACHE_HPP
+
+#include "base/types.hpp"
+#include "base/types2.hpp"
+
+class Wz4Mesh;
+
+/****************************************************************************/
+
+// meshes imported from foreign formats, stored in the temp directory as
+// they are in memory, so that the next import of the same file is little
+// more than mapping the cache file. the key is the full path, size and
+// modification time of the source file plus the loader parameters, which
+// the caller passes as a string. textures that are loaded from other files
+// are cached with the mesh, touch the mesh file to reload them. meshes
+// with materials other than SimpleMtrl are not cached. the directory is
+// kept below 1 GB, the oldest files are deleted first.
+//
+//   Wz4ImportCache cache(name,params);
+//   if(!cache.Load(mesh) && mesh->LoadXSI(name))
+//     cache.Store(mesh);
+
+class Wz4ImportCache
+{
+  sString<sMAXPATH> Name;         // cache file, empty if the source can't be cached
+  sString<sMAXPATH*2> Key;
+public:
+  Wz4ImportCache(const sChar *file,const sChar *params);
+
+  sBool Load(Wz4Mesh *mesh);      // mesh must be empty, stays empty on failure
+  void Store(Wz4Mesh *mesh);
+
+  static sBool Enable;            // default on
+};
+
+/****************************************************************************/
+
+#endif // FILE_WZ4FRLIB_WZ4_IMPORTCACHE_HPP
+
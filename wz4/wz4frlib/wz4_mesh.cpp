@@ -8,7 +8,11 @@
 #include "wz4frlib/wz4_mesh.hpp"
 #include "wz4frlib/wz4_mesh_ops.hpp"
 #include "util/algorithms.hpp"
+#include "util/taskscheduler.hpp"
+#include "util/scratch.hpp"
+#include "util/simd_float.hpp"
 #include "wz4frlib/wz4_mtrl2.hpp"
+#include "wz4frlib/wz4_vertexpack.hpp"
 //#include "wz4frlib/chaosmesh_code.hpp"
 
 struct SolidVertex
@@ -196,6 +200,55 @@ void Wz4MeshVertex::Skin(sMatrix34 *basemat,sInt max,sVector31 &pos)
   }
 }
 
+void Wz4SkinPositions(const sMatrix34 *basemat,sInt max,const Wz4MeshVertex *vp,sInt count,sVector31 *out)
+{
+#if sSIMD_INTRINSICS
+  // the matrices as four rows of sse registers (i,j,k,l)
+
+  sScratchScope scratch;
+  sF32 *rows = scratch.Alloc<sF32>(max*16);
+  for(sInt b=0;b<max;b++)
+  {
+    const sMatrix34 &m = basemat[b];
+    sF32 *r = rows+b*16;
+    r[ 0] = m.i.x; r[ 1] = m.i.y; r[ 2] = m.i.z; r[ 3] = 0;
+    r[ 4] = m.j.x; r[ 5] = m.j.y; r[ 6] = m.j.z; r[ 7] = 0;
+    r[ 8] = m.k.x; r[ 9] = m.k.y; r[10] = m.k.z; r[11] = 0;
+    r[12] = m.l.x; r[13] = m.l.y; r[14] = m.l.z; r[15] = 0;
+  }
+
+  sF32 res[4];
+  for(sInt n=0;n<count;n++)
+  {
+    const Wz4MeshVertex *v = vp+n;
+    if(v->Index[0]<0 || v->Index[0]>=max)
+    {
+      out[n] = v->Pos;
+      continue;
+    }
+
+    sSSE x = sVecLoadScalar(v->Pos.x);
+    sSSE y = sVecLoadScalar(v->Pos.y);
+    sSSE z = sVecLoadScalar(v->Pos.z);
+    sSSE accu = sVecZero();
+    for(sInt i=0;i<4;i++)
+    {
+      sInt b = v->Index[i];
+      if(b<0 || b>=max)
+        break;
+      const sF32 *r = rows+b*16;
+      sSSE p = sVecMAdd(x,sVecLoad(r),sVecMAdd(y,sVecLoad(r+4),sVecMAdd(z,sVecLoad(r+8),sVecLoad(r+12))));
+      accu = sVecMAdd(p,sVecLoadScalar(v->Weight[i]),accu);
+    }
+    sVecStoreU(accu,res);
+    out[n].Init(res[0],res[1],res[2]);
+  }
+#else
+  for(sInt n=0;n<count;n++)
+    ((Wz4MeshVertex *)vp+n)->Skin((sMatrix34 *)basemat,max,out[n]);
+#endif
+}
+
 sBool Wz4MeshVertex::operator==(const Wz4MeshVertex &v) const
 {
   if(Pos.x!=v.Pos.x) return 0;
@@ -395,6 +448,7 @@ Wz4Mesh::Wz4Mesh()
   InstancePlusGeo = 0;
   WireGeoInst = 0;
   Skeleton = 0;
+  InstanceBase = 0;
   BBoxValid = 0;
   SaveFlags = 0;
   ChargeCount = 0;
@@ -426,6 +480,7 @@ Wz4Mesh::~Wz4Mesh()
 #endif
 
   Skeleton->Release();
+  InstanceBase->Release();
 }
 
 #ifdef sCOMPIL_ASSIMP
@@ -455,6 +510,14 @@ void Wz4Mesh::WaiReleaseAnimation()
 
 /****************************************************************************/
 
+// arrays as they are in memory. only for files that never leave this machine
+
+template <class streamer,class Type> static void Wz4RawArray(streamer &s,sArray<Type> &a)
+{
+  for(sInt i=0;i<a.GetCount();i+=0x10000)
+    s.ArrayU8((sU8 *)&a[i],sMin(a.GetCount()-i,0x10000)*sizeof(Type));
+}
+
 template <class streamer> void Wz4Mesh::Serialize_(streamer &s)
 {
   sInt version=s.Header(sSerId::Wz4Mesh, 2); version;
@@ -464,7 +527,19 @@ template <class streamer> void Wz4Mesh::Serialize_(streamer &s)
     s | SaveFlags;
 
   s.Array(Vertices);
-  for (sInt i=0; i<Vertices.GetCount(); i++)
+  if(SaveFlags & 0x2000)          // raw memory image, see Wz4ImportCache
+  {
+    sInt vs = sizeof(Wz4MeshVertex);
+    sInt fs = sizeof(Wz4MeshFace);
+    s | vs | fs;
+    if(vs!=sizeof(Wz4MeshVertex) || fs!=sizeof(Wz4MeshFace))
+    {
+      s.Fail();
+      return;
+    }
+    Wz4RawArray(s,Vertices);
+  }
+  else for (sInt i=0; i<Vertices.GetCount(); i++)
   {
     Wz4MeshVertex &v=Vertices[i];
     s | v.Pos | v.Normal; 
@@ -494,7 +569,9 @@ template <class streamer> void Wz4Mesh::Serialize_(streamer &s)
   }
 
   s.Array(Faces);
-  for (sInt i=0; i<Faces.GetCount(); i++)
+  if(SaveFlags & 0x2000)
+    Wz4RawArray(s,Faces);
+  else for (sInt i=0; i<Faces.GetCount(); i++)
   {
     Wz4MeshFace &f=Faces[i];
     sU32 count = f.Count;
@@ -533,9 +610,11 @@ template <class streamer> void Wz4Mesh::Serialize_(streamer &s)
         else
         {
           s.Ptr(c.Mtrl);
-          c.Mtrl->AddRef();
+          if(c.Mtrl)
+            c.Mtrl->AddRef();
         }
-        c.Mtrl->Prepare();
+        if(c.Mtrl)
+          c.Mtrl->Prepare();
       }
       else
       {
@@ -567,7 +646,7 @@ template <class streamer> void Wz4Mesh::Serialize_(streamer &s)
   s.Footer();
 }
 
-void Wz4Mesh::Serialize(sWriter &stream) { Serialize_(stream); }
+void Wz4Mesh::Serialize(sWriter &stream) { Expand(); Serialize_(stream); }
 void Wz4Mesh::Serialize(sReader &stream) { Serialize_(stream); }
 
 /****************************************************************************/
@@ -684,7 +763,7 @@ void Wz4Mesh::CopyClustersFrom(Wz4Mesh *src)
 
 sBool Wz4Mesh::IsEmpty()
 {
-  return Clusters.GetCount()==0 && Vertices.GetCount()==0 && Faces.GetCount()==0 && Skeleton==0;
+  return Clusters.GetCount()==0 && Vertices.GetCount()==0 && Faces.GetCount()==0 && Skeleton==0 && InstanceBase==0;
 }
 
 /****************************************************************************/
@@ -712,6 +791,8 @@ void Wz4Mesh::Clear()
   sDeleteAll(Clusters);
   Vertices.Clear();
   Faces.Clear();
+  sRelease(InstanceBase);
+  InstanceMats.Clear();
 }
 
 void Wz4Mesh::ClearClusters()
@@ -763,6 +844,114 @@ void Wz4Mesh::Add(Wz4Mesh *add)
 
 /****************************************************************************/
 
+// instancing needs a mesh without bones and materials that can draw
+// with sRF_MATRIX_INSTANCE
+
+sBool Wz4Mesh::CanInstance()
+{
+  Wz4Mesh *base = InstanceBase ? InstanceBase : this;
+  Wz4MeshCluster *cl;
+
+  if(base->Skeleton || base->Chunks.GetCount()>0)
+    return 0;
+  sFORALL(base->Clusters,cl)
+  {
+    Wz4Mtrl *mtrl = cl->Mtrl ? cl->Mtrl : Wz4MeshType->DefaultMtrl;
+    if(!mtrl->CanMatrix(sRF_MATRIX_INSTANCE))
+      return 0;
+  }
+  return 1;
+}
+
+void Wz4Mesh::SetInstances(Wz4Mesh *base,sInt count,const sMatrix34 *mats)
+{
+  sVERIFY(IsEmpty());
+  sVERIFY(base->Skeleton==0 && base->Chunks.GetCount()==0);
+
+  // instancing an instanced mesh just multiplies the transforms
+
+  if(base->InstanceBase)
+  {
+    sInt bc = base->InstanceMats.GetCount();
+    InstanceMats.Resize(count*bc);
+    for(sInt i=0;i<count;i++)
+      for(sInt j=0;j<bc;j++)
+        InstanceMats[i*bc+j] = base->InstanceMats[j] * mats[i];
+    base = base->InstanceBase;
+  }
+  else
+  {
+    InstanceMats.Resize(count);
+    sCopyMem(InstanceMats.GetData(),mats,sizeof(sMatrix34)*count);
+  }
+
+  InstanceBase = base;
+  InstanceBase->AddRef();
+}
+
+void Wz4Mesh::Expand()
+{
+  if(!InstanceBase)
+    return;
+
+  Wz4Mesh *base = InstanceBase;
+  InstanceBase = 0;
+
+  sInt ic = InstanceMats.GetCount();
+  sInt vc = base->Vertices.GetCount();
+  Vertices.HintSize(vc*ic);
+  Faces.HintSize(base->Faces.GetCount()*ic);
+  for(sInt i=0;i<ic;i++)
+    Add(base);
+
+  sMatrix34 ident;
+  Wz4MeshVertex *mv = Vertices.GetData();
+  for(sInt i=0;i<ic;i++)
+  {
+    const sMatrix34 &mat = InstanceMats[i];
+    if(sCmpMem(&mat,&ident,sizeof(sMatrix34))!=0)
+    {
+      sMatrix34 mati = mat;
+      mati.Invert3();
+      mati.Trans3();
+      for(sInt j=0;j<vc;j++)
+        mv[j].Transform(mat,mati);
+    }
+    mv += vc;
+  }
+
+  InstanceMats.Reset();
+  InstanceScratch.Reset();
+  InstanceColorScratch.Reset();
+  base->Release();
+  Flush();
+}
+
+// instance matrices for mc placements of the instanced mesh, placement major
+
+const sMatrix34CM *Wz4Mesh::CombineInstances(sInt mc,const sMatrix34CM *mats)
+{
+  sInt ic = InstanceMats.GetCount();
+  InstanceScratch.Resize(mc*ic);
+  sMatrix34CM *dest = InstanceScratch.GetData();
+  for(sInt j=0;j<ic;j++)
+  {
+    sMatrix34CM inst(InstanceMats[j]);
+    if(mats)
+    {
+      for(sInt i=0;i<mc;i++)
+        dest[i*ic+j] = inst * mats[i];
+    }
+    else
+    {
+      dest[j] = inst;
+    }
+  }
+  return dest;
+}
+
+/****************************************************************************/
+
 void Wz4Mesh::MergeClusters()
 {
   Wz4MeshCluster *cl;
@@ -823,12 +1012,13 @@ void Wz4Mesh::MergeClusters()
 
 /****************************************************************************/
 
-void Wz4Mesh::MergeVertices()
+void Wz4Mesh::MergeVertices(sArray<sInt> *kept)
 {
   sInt max = Vertices.GetCount();
   sHashTable<Wz4MeshVertex,Wz4MeshVertex> hash(1<<sFindLowerPower(max+0x1000),0x1000);
-  sInt *map = new sInt[max];    // new = map[old]
-  sInt *remap = new sInt[max];  // old = map[new]
+  sScratchScope scratch;
+  sInt *map = scratch.Alloc<sInt>(max);    // new = map[old]
+  sInt *remap = scratch.Alloc<sInt>(max);  // old = map[new]
  
   // mark used vertices
 
@@ -868,12 +1058,13 @@ void Wz4Mesh::MergeVertices()
   }
 
   if(0) sDPrintF(L"optimize mesh: %k -> %k vertices\n",max,vc);
-  if(vc==max)
+  if(kept)
   {
-    delete[] map;
-    delete[] remap;
-    return;      // nothing to do
+    kept->Resize(vc);
+    sCopyMem(kept->GetData(),remap,vc*sizeof(sInt));
   }
+  if(vc==max)
+    return;      // nothing to do
 
   // remap vertices
 
@@ -889,11 +1080,6 @@ void Wz4Mesh::MergeVertices()
     for(sInt i=0;i<face->Count;i++)
       face->Vertex[i] = map[face->Vertex[i]];
   }
-
-  // done
-
-  delete[] map;
-  delete[] remap;
 }
 
 /****************************************************************************/
@@ -1336,7 +1522,8 @@ sInt *Wz4Mesh::BasePos(sInt toitself)
   sInt *map = new sInt[Vertices.GetCount()];
 
   const sInt HashSize = sMax(4096,1<<sFindLowerPower(Vertices.GetCount()/2));
-  sInt *HashMap = new sInt[HashSize];
+  sScratchScope scratch;
+  sInt *HashMap = scratch.Alloc<sInt>(HashSize);
   for(sInt i=0;i<HashSize;i++)
     HashMap[i] = -1;
 
@@ -1360,7 +1547,6 @@ sInt *Wz4Mesh::BasePos(sInt toitself)
 done:;
   }
 
-  delete[] HashMap;
   return map;
 }
 
@@ -1407,7 +1593,8 @@ Wz4MeshFaceConnect *Wz4Mesh::Adjacency()
     numEdges += face->Count;
 
   // make edge list
-  sFixedArray<Wz4MeshTempEdge> edges(numEdges);
+  sScratchScope scratch;
+  Wz4MeshTempEdge *edges = scratch.Alloc<Wz4MeshTempEdge>(numEdges);
   sInt edgeCtr = 0;
 
   sFORALL(Faces,face)
@@ -1424,13 +1611,13 @@ Wz4MeshFaceConnect *Wz4Mesh::Adjacency()
     }
   }
 
-  sIntroSort(sAll(edges));
+  sIntroSort(sArrayRange<Wz4MeshTempEdge>(edges,edges+numEdges));
 
   // generate adjacency
   sInt last0 = -1, last1 = -1, count = 0, temp[2];
-  Wz4MeshTempEdge *edge;
-  sFORALL(edges,edge)
+  for(sInt i=0;i<numEdges;i++)
   {
+    Wz4MeshTempEdge *edge = &edges[i];
     if(last0 == edge->v0 && last1 == edge->v1)
     {
       temp[count++] = edge->Tag;
@@ -1466,7 +1653,8 @@ sInt *Wz4Mesh::BaseNormal()
   sInt *map = new sInt[Vertices.GetCount()];
 
   const sInt HashSize = sMax(4096,1<<sFindLowerPower(Vertices.GetCount()/2));
-  sInt *HashMap = new sInt[HashSize];
+  sScratchScope scratch;
+  sInt *HashMap = scratch.Alloc<sInt>(HashSize);
   for(sInt i=0;i<HashSize;i++)
     HashMap[i] = -1;
 
@@ -1493,7 +1681,6 @@ sInt *Wz4Mesh::BaseNormal()
     map[_i] = -1;
 done:;
   }
-  delete[] HashMap;
 
   return map;
 }
@@ -1526,12 +1713,13 @@ void Wz4Mesh::CalcNormalAndTangents(sBool forceSmooth, sBool onlyselected)
 
 void Wz4Mesh::CalcNormals(sInt *map, sBool onlyselected)
 {
-  sVector30 *facenormal = new sVector30[Faces.GetCount()];
+  sScratchScope scratch;
+  sVector30 *facenormal = scratch.Alloc<sVector30>(Faces.GetCount());
   Wz4MeshFace *fp;
   Wz4MeshVertex *vp;
 
   sVector30 *oldnormals=0;
-  if (onlyselected) oldnormals = new sVector30[Vertices.GetCount()];
+  if (onlyselected) oldnormals = scratch.Alloc<sVector30>(Vertices.GetCount());
 
   sFORALL(Vertices,vp)
   {
@@ -1591,9 +1779,6 @@ void Wz4Mesh::CalcNormals(sInt *map, sBool onlyselected)
     }
 
   }
-
-  delete[] oldnormals;
-  delete[] facenormal;
 }
 
 /****************************************************************************/
@@ -1606,8 +1791,9 @@ void Wz4Mesh::CalcTangents(sInt *map, sBool onlyselected)
   Wz4MeshVertex *mv;
 
   // calc tangent space
+  sScratchScope scratch;
   sVector30 *oldtangents=0;
-  if (onlyselected) oldtangents = new sVector30[Vertices.GetCount()];
+  if (onlyselected) oldtangents = scratch.Alloc<sVector30>(Vertices.GetCount());
 
   sFORALL(Vertices,mv)
   {
@@ -1649,8 +1835,6 @@ void Wz4Mesh::CalcTangents(sInt *map, sBool onlyselected)
     else
       mv->Tangent = Vertices[map[_i]].Tangent;
   }
-
-  delete[] oldtangents;
 }
 
 /****************************************************************************/
@@ -1850,10 +2034,14 @@ void Wz4Mesh::BakeAnim(sF32 time)
   bonemat = new sMatrix34[max];
   basemat = new sMatrix34[max];
   Skeleton->Evaluate(time,bonemat,basemat);
+
+  sScratchScope scratch;
+  sVector31 *pos = scratch.Alloc<sVector31>(Vertices.GetCount());
+  Wz4SkinPositions(basemat,max,Vertices.GetData(),Vertices.GetCount(),pos);
   
   sFORALL(Vertices,v)
   {
-    v->Skin(basemat,max,v->Pos);
+    v->Pos = pos[_i];
     for(sInt i=0;i<4;i++)
     {
       v->Index[i] = -1;
@@ -2333,6 +2521,17 @@ void Wz4Mesh::Uncrease(sInt select)
 }
 
 /****************************************************************************/
+/***                                                                      ***/
+/***   subdivision                                                        ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// every level of Subdivide() is turned into stencils: which vertices of the
+// input, with what weights, make up each vertex of the output. the
+// stencils are built once per topology and applied to the vertex data in
+// parallel. the weights for the positions are kept as polynomials of the
+// smooth parameter, so the tables for the last few topologies are reused
+// when only the positions or the smoothing change.
 
 struct EdgeInfo
 {
@@ -2352,51 +2551,199 @@ struct EdgeInfo
   sInt Hash;                    // hash value
   sInt HashNext;                // next in hashtable, -1 = end
 };
-struct VertInfo
+
+struct Wz4SubdivTerm            // weight = W[0] + W[1]*smooth + W[2]*smooth^2
 {
-  sVector30 Face;
-  sVector30 Edge;
-  sInt FaceCount;
-  sInt EdgeCount;
-  sInt Subdivide;
+  sInt Vert;
+  sF32 W[3];
+
+  bool operator < (const Wz4SubdivTerm &b) const { return Vert < b.Vert; }
+};
+
+struct Wz4SubdivLevel
+{
+  sArray<sInt> Merge;             // merged vertex -> vertex of the previous level, empty if nothing merges
+  sInt CopyCount;                 // the first output vertices are copies of the (merged) input
+  sInt VertCount;                 // output
+  sArray<sInt> AttrStart;         // the others are blended from AttrVert/AttrWeight[AttrStart[i-CopyCount]..]
+  sArray<sInt> AttrVert;
+  sArray<sF32> AttrWeight;
+  sArray<sInt> PosStart;          // position of each output vertex from PosTerm[PosStart[i]..]
+  sArray<Wz4SubdivTerm> PosTerm;
+  sArray<Wz4MeshFace> Faces;      // output
 };
 
-void Wz4Mesh::Subdivide(sF32 smooth)
+struct Wz4SubdivTable
 {
-  Facette(1);
+  sU32 Hash;
+  sInt Levels;                    // as requested, Level may have less when nothing was left to split
+  sArray<Wz4MeshFace> Faces;      // input, after merging
+  sArray<sInt> Base;              // input, vertex with the same position
+  sAutoArray<Wz4SubdivLevel *> Level;
+  sU32 LastUse;
+};
 
+enum Wz4SubdivConfig
+{
+  W4S_TABLES = 4,                 // topologies to remember
+  W4S_VERTEXJOB = 0x1000,         // vertices per job
+};
 
+/****************************************************************************/
 
-  Wz4MeshFace *f;
-  Wz4MeshVertex *v;
-  EdgeInfo *e;
-  sInt max = 0;
+struct Wz4SubdivBuilder
+{
+  const Wz4Mesh *Mesh;
+  const sInt *Map;                // same position
+  sArray<EdgeInfo> Edges;
+  sArray<sInt> EdgeLink;          // face*4+vert -> edge
+  sArray<sU8> Movable;            // all faces around this vertex are subdivided
+  sArray<sU8> VertSub;            // all edges around this vertex are subdivided
+  sArray<sInt> FaceStart;         // faces around each vertex
+  sArray<sInt> FaceList;
+  sArray<sInt> EdgeStart;         // split edges around each vertex
+  sArray<sInt> EdgeList;
+  sArray<Wz4SubdivTerm> Emit;
+
+  void EmitPos(sInt v,sF32 w,sInt d);
+  void EmitCenter(sInt f,sF32 w,sInt d);
+  void EmitEdge(const EdgeInfo *e,sF32 w,sInt d);
+  void EmitVert(sInt v,sF32 w);
+  void EmitSplit(const EdgeInfo *e);
+  void Flush(Wz4SubdivLevel *lv);
+  sBool Build(const Wz4Mesh *mesh,const sInt *map,Wz4SubdivLevel *lv);
+};
 
-  sInt maxface = Faces.GetCount();
-  sInt maxvert = Vertices.GetCount();
-  sArray<EdgeInfo> edges;
-  edges.HintSize(maxface*4);
-  EdgeInfo **edgelink = new EdgeInfo*[maxface*4];
-  sInt *centervert = new sInt[maxface];
-  VertInfo *vertinfo = new VertInfo[maxvert];
-  sVector30 *centerpos = new sVector30[maxface];
+void Wz4SubdivBuilder::EmitPos(sInt v,sF32 w,sInt d)
+{
+  sVERIFY(d<3);
+  Wz4SubdivTerm *t = Emit.AddMany(1);
+  t->Vert = Map[v];
+  t->W[0] = t->W[1] = t->W[2] = 0;
+  t->W[d] = w;
+}
 
-  // get same position map
+// face center
 
-  sInt *map = BasePos();
-  for(sInt i=0;i<maxvert;i++)
-    if(map[i]==-1)
-      map[i] = i;
+void Wz4SubdivBuilder::EmitCenter(sInt f,sF32 w,sInt d)
+{
+  const Wz4MeshFace *face = &Mesh->Faces[f];
+  sF32 rc = 1.0f/face->Count;
+  for(sInt j=0;j<face->Count;j++)
+    EmitPos(face->Vertex[j],w*rc,d);
+}
+
+// split point, before the holes are fixed:
+// mid + smooth*((centerA+centerB)/2-mid)/2
+
+void Wz4SubdivBuilder::EmitEdge(const EdgeInfo *e,sF32 w,sInt d)
+{
+  EmitPos(e->Vert0,w*0.5f,d);
+  EmitPos(e->Vert1,w*0.5f,d);
+  if(e->Subdivide)
+  {
+    EmitCenter(e->FaceA,w*0.25f,d+1);
+    EmitCenter(e->FaceB,w*0.25f,d+1);
+    EmitPos(e->Vert0,-w*0.25f,d+1);
+    EmitPos(e->Vert1,-w*0.25f,d+1);
+  }
+}
+
+// original point after moving:
+// p + smooth*((p*(faces-3) + edges*2 + centers)/faces - p) inside,
+// p + smooth*(edges - p) at borders, with the averages of edges and centers.
+
+void Wz4SubdivBuilder::EmitVert(sInt v,sF32 w)
+{
+  v = Map[v];
+  EmitPos(v,w,0);
+  sInt fc = FaceStart[v+1]-FaceStart[v];
+  sInt ec = EdgeStart[v+1]-EdgeStart[v];
+  if(!Movable[v] || fc==0 || ec==0)
+    return;
+
+  if(VertSub[v])
+  {
+    EmitPos(v,-3*w/fc,1);
+    for(sInt i=EdgeStart[v];i<EdgeStart[v+1];i++)
+      EmitEdge(&Edges[EdgeList[i]],2*w/(fc*ec),1);
+    for(sInt i=FaceStart[v];i<FaceStart[v+1];i++)
+      EmitCenter(FaceList[i],w/(fc*fc),1);
+  }
+  else
+  {
+    EmitPos(v,-w,1);
+    for(sInt i=EdgeStart[v];i<EdgeStart[v+1];i++)
+      EmitEdge(&Edges[EdgeList[i]],w/ec,1);
+  }
+}
+
+// split point, edges that border a hole are between the moved points
+
+void Wz4SubdivBuilder::EmitSplit(const EdgeInfo *e)
+{
+  if(e->Subdivide)
+  {
+    EmitEdge(e,1,0);
+  }
+  else
+  {
+    EmitVert(e->Vert0,0.5f);
+    EmitVert(e->Vert1,0.5f);
+  }
+}
+
+// one output position done
+
+void Wz4SubdivBuilder::Flush(Wz4SubdivLevel *lv)
+{
+  sIntroSort(sArrayRange<Wz4SubdivTerm>(Emit.GetData(),Emit.GetData()+Emit.GetCount()));
+  Wz4SubdivTerm *t;
+  Wz4SubdivTerm *last = 0;
+  sFORALL(Emit,t)
+  {
+    if(last && last->Vert==t->Vert)
+    {
+      last->W[0] += t->W[0];
+      last->W[1] += t->W[1];
+      last->W[2] += t->W[2];
+    }
+    else
+    {
+      if(last && (last->W[0]!=0 || last->W[1]!=0 || last->W[2]!=0))
+        lv->PosTerm.AddTail(*last);
+      last = t;
+    }
+  }
+  if(last && (last->W[0]!=0 || last->W[1]!=0 || last->W[2]!=0))
+    lv->PosTerm.AddTail(*last);
+  lv->PosStart.AddTail(lv->PosTerm.GetCount());
+  Emit.Clear();
+}
+
+sBool Wz4SubdivBuilder::Build(const Wz4Mesh *mesh,const sInt *map,Wz4SubdivLevel *lv)
+{
+  const Wz4MeshFace *f;
+  EdgeInfo *e;
+
+  Mesh = mesh;
+  Map = map;
+  sInt maxface = mesh->Faces.GetCount();
+  sInt maxvert = mesh->Vertices.GetCount();
+  Edges.Clear();
+  Edges.HintSize(maxface*4);
+  EdgeLink.Resize(maxface*4);
 
   // build edge information.
 
-  sInt hashmax = 1<<(sFindLowerPower(maxface)/2);
+  sInt hashbits = sFindLowerPower(maxface)+1;
+  sInt hashmax = 1<<hashbits;
     
   sInt *hashtable = new sInt[hashmax];
   for(sInt i=0;i<hashmax;i++)
     hashtable[i] = -1;
 
-  sFORALL(Faces,f)
+  sFORALL(mesh->Faces,f)
   {
     sInt i = _i;
     for(sInt j=0;j<f->Count;j++)
@@ -2406,19 +2753,19 @@ void Wz4Mesh::Subdivide(sF32 smooth)
       sInt v0 = map[o0];
       sInt v1 = map[o1];
 
-      sInt hash = (v0^v1)&(hashmax-1);
+      sInt hash = sInt((sU32(sMin(v0,v1))*0x9e3779b1U + sU32(sMax(v0,v1))*0x85ebca6bU)>>(32-hashbits));
       sInt ei = hashtable[hash];
 
       if(v0<v1)
       {
         while(ei>=0)
         {
-          e = &edges[ei];
+          e = &Edges[ei];
           if(e->Vert0==v0 && e->Vert1==v1 && e->FaceA==-1)
             goto found1a;
           ei = e->HashNext;
         }
-        e = edges.AddMany(1);
+        e = Edges.AddMany(1);
         e->Vert0 = v0;
         e->Vert1 = v1;
         e->FaceB = -1;
@@ -2430,24 +2777,24 @@ void Wz4Mesh::Subdivide(sF32 smooth)
         e->Subdivide = 1;
         e->Hash = hash;
         e->HashNext = hashtable[hash];
-        hashtable[hash] = e-edges.GetData();
+        hashtable[hash] = e-Edges.GetData();
 found1a:
         e->FaceA = i;
         e->FaceAI = j;
         e->VertA0 = o0;
         e->VertA1 = o1;
-        edgelink[i*4+j] = e;
+        EdgeLink[i*4+j] = e-Edges.GetData();
       }
       else
       {
         while(ei>=0)
         {
-          e = &edges[ei];
+          e = &Edges[ei];
           if(e->Vert0==v1 && e->Vert1==v0 && e->FaceB==-1)
             goto found1b;
           ei = e->HashNext;
         }
-        e = edges.AddMany(1);
+        e = Edges.AddMany(1);
         e->Vert0 = v1;
         e->Vert1 = v0;
         e->FaceA = -1;
@@ -2456,7 +2803,7 @@ found1a:
         e->VertA1 = -1;
         e->Hash = hash;
         e->HashNext = hashtable[hash];
-        hashtable[hash] = e-edges.GetData();
+        hashtable[hash] = e-Edges.GetData();
 found1b:
         e->FaceB = i;
         e->FaceBI = j;
@@ -2465,7 +2812,7 @@ found1b:
         e->SplitVertA = -1;
         e->SplitVertB = -1;
         e->Subdivide = 1;
-        edgelink[i*4+j] = e;
+        EdgeLink[i*4+j] = e-Edges.GetData();
       }
     }
   }
@@ -2474,25 +2821,24 @@ found1b:
 
   // count splits and mark vertices that need moving
 
-  sInt splitedge = 0;
   sInt splitface = 0;
 
-  sFORALL(Vertices,v)
-    v->Temp = 1;
+  Movable.Resize(maxvert);
+  for(sInt i=0;i<maxvert;i++)
+    Movable[i] = 1;
 
-  sFORALL(Faces,f)
+  sFORALL(mesh->Faces,f)
   {
     if(f->Select>=0.5f)
     {
       splitface++;
       for(sInt j=0;j<f->Count;j++)
       {
-        e = edgelink[_i*4+j];
+        e = &Edges[EdgeLink[_i*4+j]];
         if(e->SplitVertA==-1)
         {
           e->SplitVertA = 0;
           e->SplitVertB = 0;
-          splitedge++;
         }
       }
     }
@@ -2500,202 +2846,172 @@ found1b:
     {
       for(sInt j=0;j<f->Count;j++)
       {
-        Vertices[map[f->Vertex[j]]].Temp = 0;
-        e = edgelink[_i*4+j];
-        e->Subdivide = 0;
+        Movable[map[f->Vertex[j]]] = 0;
+        Edges[EdgeLink[_i*4+j]].Subdivide = 0;
       }
     }
   }
 
   if(splitface==0)
-    goto ende;
- 
-  // create face centerpoints
-
-  sFORALL(Faces,f)
-  {
-    centervert[_i] = -1;
-    sF32 rc = 1.0f/f->Count;
-    centerpos[_i].Init(0,0,0);
-    for(sInt j=0;j<f->Count;j++)
-      centerpos[_i] += sVector30(Vertices[f->Vertex[j]].Pos)*rc;
-    if(f->Select>=0.5f)
-    {
-      centervert[_i] = Vertices.GetCount();
-      Wz4MeshVertex *v = Vertices.AddMany(1);
+    return 0;
 
-      v->Zero();
-      for(sInt j=0;j<f->Count;j++)
-        v->AddScale(&Vertices[f->Vertex[j]],rc);
-    }
-  }
+  // number the new vertices: face centerpoints, then edge split points
 
-  // create edge split points
+  sInt vc = maxvert;
+  sInt *centervert = new sInt[maxface];
+  sFORALL(mesh->Faces,f)
+    centervert[_i] = (f->Select>=0.5f) ? vc++ : -1;
 
-  Vertices.HintSize(Vertices.GetCount()+splitedge+splitface);
-  sFORALL(edges,e)
+  sFORALL(Edges,e)
   {
     if(e->FaceA==-1 || e->FaceB==-1)
       e->Subdivide = 0;
     if(e->SplitVertA==0)
     {
-      sVector31 fp;
-      sVector31 fpp;
-      Wz4MeshVertex *v0,*v1;
-      v0=v1=0;
-      if(e->FaceA>=0 && e->FaceB>=0)
-        fp = sVector31((centerpos[e->FaceA]+centerpos[e->FaceB])*0.5f);
-      else if(e->FaceA>=0)
-        fp = sVector31(centerpos[e->FaceA]);
-      else if(e->FaceB>=0)
-        fp = sVector31(centerpos[e->FaceB]);
-
-      e->SplitVertA = Vertices.GetCount();
-      e->SplitVertB = e->SplitVertA;
+      e->SplitVertA = vc;
+      e->SplitVertB = vc;
       if(e->VertA0==e->VertB0 && e->VertA1==e->VertB1)
       {
-        Wz4MeshVertex *v = Vertices.AddMany(1);
-
-        v0 = &Vertices[e->VertA0];
-        v1 = &Vertices[e->VertA1];
-
-        v->Zero();
-        v->AddScale(v0,0.5f);
-        v->AddScale(v1,0.5f);
-        if(e->Subdivide)
-        {
-          v->Pos.Average(v0->Pos,v1->Pos);
-          fpp.Average(v[0].Pos,fp);
-          v[0].Pos.Fade(smooth,v[0].Pos,fpp);
-        }
+        vc++;
       }
-      else if(e->FaceA>=0 || e->FaceB>=0)
+      else
       {
-        sVector31 pos;
-        v0 = &Vertices[e->Vert0];
-        v1 = &Vertices[e->Vert1];
-        pos.Average(v0->Pos,v1->Pos);
-        if(e->Subdivide)
-        {
-          fpp.Average(pos,fp);
-          pos.Fade(smooth,pos,fpp);
-        }
         if(e->FaceA>=0)
-        {
-          Wz4MeshVertex *v = Vertices.AddMany(1);
-
-          v0 = &Vertices[e->VertA0];
-          v1 = &Vertices[e->VertA1];
-          v->Zero();
-          v->AddScale(v0,0.5f);
-          v->AddScale(v1,0.5f);
-          v->Pos = pos;
-        }
-
+          vc++;
         if(e->FaceB>=0)
-        {
-          e->SplitVertB = Vertices.GetCount();
-          Wz4MeshVertex *v = Vertices.AddMany(1);
-
-          v0 = &Vertices[e->VertB0];
-          v1 = &Vertices[e->VertB1];
-          v->Zero();
-          v->AddScale(v0,0.5f);
-          v->AddScale(v1,0.5f);
-          v->Pos = pos;
-        }
+          e->SplitVertB = vc++;
       }
     }
   }
 
-  // move original points
+  // faces and split edges around the points
 
+  VertSub.Resize(maxvert);
+  FaceStart.Resize(maxvert+1);
+  EdgeStart.Resize(maxvert+1);
+  for(sInt i=0;i<=maxvert;i++)
+    FaceStart[i] = EdgeStart[i] = 0;
   for(sInt i=0;i<maxvert;i++)
+    VertSub[i] = 1;
+
+  sFORALL(mesh->Faces,f)
+    for(sInt j=0;j<f->Count;j++)
+      FaceStart[map[f->Vertex[j]]+1]++;
+  sFORALL(Edges,e)
   {
-    sClear(vertinfo[i]);
-    vertinfo[i].Subdivide = 1;
+    if(e->SplitVertA>=0)
+    {
+      EdgeStart[e->Vert0+1]++;
+      EdgeStart[e->Vert1+1]++;
+      VertSub[e->Vert0] &= e->Subdivide;
+      VertSub[e->Vert1] &= e->Subdivide;
+    }
   }
-  sFORALL(Faces,f)
+  for(sInt i=0;i<maxvert;i++)
   {
-    sInt i=_i;
+    FaceStart[i+1] += FaceStart[i];
+    EdgeStart[i+1] += EdgeStart[i];
+  }
+  FaceList.Resize(FaceStart[maxvert]);
+  EdgeList.Resize(EdgeStart[maxvert]);
+  sFORALL(mesh->Faces,f)
     for(sInt j=0;j<f->Count;j++)
+      FaceList[FaceStart[map[f->Vertex[j]]]++] = _i;
+  sFORALL(Edges,e)
+  {
+    if(e->SplitVertA>=0)
     {
-      sInt n = map[f->Vertex[j]];
-      vertinfo[n].Face += centerpos[i];
-      vertinfo[n].FaceCount++;
+      EdgeList[EdgeStart[e->Vert0]++] = _i;
+      EdgeList[EdgeStart[e->Vert1]++] = _i;
     }
   }
-  sFORALL(edges,e)
+  for(sInt i=maxvert;i>0;i--)
   {
-    if(e->SplitVertA>=0)
+    FaceStart[i] = FaceStart[i-1];
+    EdgeStart[i] = EdgeStart[i-1];
+  }
+  FaceStart[0] = EdgeStart[0] = 0;
+
+  // stencils for the attributes of the new points
+
+  lv->CopyCount = maxvert;
+  lv->VertCount = vc;
+  lv->AttrStart.HintSize(vc-maxvert+1);
+  sFORALL(mesh->Faces,f)
+  {
+    if(centervert[_i]>=0)
+    {
+      lv->AttrStart.AddTail(lv->AttrVert.GetCount());
+      sF32 rc = 1.0f/f->Count;
+      for(sInt j=0;j<f->Count;j++)
+      {
+        lv->AttrVert.AddTail(f->Vertex[j]);
+        lv->AttrWeight.AddTail(rc);
+      }
+    }
+  }
+  sFORALL(Edges,e)
+  {
+    if(e->SplitVertA<maxvert)
+      continue;
+    if(e->FaceA>=0)
     {
-      vertinfo[e->Vert0].Edge += sVector30(Vertices[e->SplitVertA].Pos);
-      vertinfo[e->Vert0].EdgeCount++;
-      vertinfo[e->Vert0].Subdivide &= e->Subdivide;
-      vertinfo[e->Vert1].Edge += sVector30(Vertices[e->SplitVertA].Pos);
-      vertinfo[e->Vert1].EdgeCount++;
-      vertinfo[e->Vert1].Subdivide &= e->Subdivide;
+      lv->AttrStart.AddTail(lv->AttrVert.GetCount());
+      lv->AttrVert.AddTail(e->VertA0); lv->AttrWeight.AddTail(0.5f);
+      lv->AttrVert.AddTail(e->VertA1); lv->AttrWeight.AddTail(0.5f);
     }
-    else if(e->SplitVertB>=0)
+    if(e->SplitVertB!=e->SplitVertA || e->FaceA<0)
     {
-      vertinfo[e->Vert0].Edge += sVector30(Vertices[e->SplitVertB].Pos);
-      vertinfo[e->Vert0].EdgeCount++;
-      vertinfo[e->Vert0].Subdivide &= e->Subdivide;
-      vertinfo[e->Vert1].Edge += sVector30(Vertices[e->SplitVertB].Pos);
-      vertinfo[e->Vert1].EdgeCount++;
-      vertinfo[e->Vert1].Subdivide &= e->Subdivide;
+      lv->AttrStart.AddTail(lv->AttrVert.GetCount());
+      lv->AttrVert.AddTail(e->VertB0); lv->AttrWeight.AddTail(0.5f);
+      lv->AttrVert.AddTail(e->VertB1); lv->AttrWeight.AddTail(0.5f);
     }
   }
+  lv->AttrStart.AddTail(lv->AttrVert.GetCount());
+  sVERIFY(lv->AttrStart.GetCount()==vc-maxvert+1);
+
+  // stencils for all positions
+
+  lv->PosStart.HintSize(vc+1);
+  lv->PosStart.AddTail(0);
   for(sInt i=0;i<maxvert;i++)
   {
-    v = &Vertices[i];
-    if(v->Temp && vertinfo[i].FaceCount>0)
+    EmitVert(i,1);
+    Flush(lv);
+  }
+  sFORALL(mesh->Faces,f)
+  {
+    if(centervert[_i]>=0)
     {
-      sF32 f = vertinfo[i].FaceCount;
-      sF32 e = vertinfo[i].EdgeCount;
-      sVector30 ff = vertinfo[i].Face/f;
-      sVector30 ee = vertinfo[i].Edge/e;
-      sVector30 pp = sVector30(v->Pos);
-      if(vertinfo[i].Subdivide)
-      {
-        sVERIFY(vertinfo[i].FaceCount==vertinfo[i].EdgeCount);
-        v->Pos.Fade(smooth,v->Pos,sVector31((pp*(f-3)+ee*2+ff)/f));
-      }
-      else
-      {
-        v->Pos.Fade(smooth,v->Pos,sVector31(ee));  // case with borders
-      }
+      EmitCenter(_i,1,0);
+      Flush(lv);
     }
   }
-
-  // update edges that border a hole. this does not make round holes.
-    
-  sFORALL(edges,e)
+  sFORALL(Edges,e)
   {
-    if(!e->Subdivide)
+    if(e->SplitVertA<maxvert)
+      continue;
+    sInt n = (e->SplitVertA==e->SplitVertB) ? 1 : 2;
+    for(sInt i=0;i<n;i++)
     {
-      Wz4MeshVertex *v0 = &Vertices[e->Vert0];
-      Wz4MeshVertex *v1 = &Vertices[e->Vert1];
-
-      if(e->SplitVertA>=0)
-        Vertices[e->SplitVertA].Pos.Average(v0->Pos,v1->Pos);
-      if(e->SplitVertB>=0)
-        Vertices[e->SplitVertB].Pos.Average(v0->Pos,v1->Pos);
-
+      EmitSplit(e);
+      Flush(lv);
     }
   }
+  sVERIFY(lv->PosStart.GetCount()==vc+1);
 
   // update faces
 
-  max = Faces.GetCount();
+  lv->Faces = mesh->Faces;
+  sInt max = lv->Faces.GetCount();
   for(sInt i=0;i<max;i++)
   {
-    f = &Faces[i];
+    Wz4MeshFace *f = &lv->Faces[i];
     sInt count = f->Count;
     if(f->Select>=0.5f)
     {
-      Wz4MeshFace *nf = Faces.AddMany(count);
-      f = &Faces[i];
+      Wz4MeshFace *nf = lv->Faces.AddMany(count);
+      f = &lv->Faces[i];
       for(sInt j=0;j<count;j++)
       {
         nf->Cluster = f->Cluster;
@@ -2705,13 +3021,13 @@ found1b:
         nf->Vertex[0] = centervert[i];
         nf->Vertex[2] = f->Vertex[(j+1)%count];
 
-        e = edgelink[i*4+j];
+        e = &Edges[EdgeLink[i*4+j]];
         if(e->FaceA==i)
           nf->Vertex[1] = e->SplitVertA;
         else
           nf->Vertex[1] = e->SplitVertB;
         
-        e = edgelink[i*4+(j+1)%count];
+        e = &Edges[EdgeLink[i*4+(j+1)%count]];
         if(e->FaceA==i)
           nf->Vertex[3] = e->SplitVertA;
         else
@@ -2725,7 +3041,7 @@ found1b:
     {
       sInt split = 0;
       for(sInt j=0;j<count && !split;j++)
-        if(edgelink[i*4+j]->SplitVertA>=0)
+        if(Edges[EdgeLink[i*4+j]].SplitVertA>=0)
           split = 1;
 
       if(split)
@@ -2736,7 +3052,7 @@ found1b:
         for(sInt j=0;j<count;j++)
         {
           sv[sc++] = f->Vertex[j];
-          e = edgelink[i*4+j];
+          e = &Edges[EdgeLink[i*4+j]];
           
           if(e->SplitVertA>=0)
           {
@@ -2747,8 +3063,8 @@ found1b:
               sv[sc++] = e->SplitVertB;
           }
         }
-        Wz4MeshFace *nf = Faces.AddMany(sc-2);
-        f = &Faces[i];
+        Wz4MeshFace *nf = lv->Faces.AddMany(sc-2);
+        f = &lv->Faces[i];
         for(sInt j=0;j<sc-2;j++)
         {
           nf->Count = 3;
@@ -2767,51 +3083,339 @@ found1b:
 
   // weed out unused faces
 
-  sRemFalse(Faces,&Wz4MeshFace::Count);
-
-  // copy position to split vertices
-
-  for(sInt i=0;i<maxvert;i++)
-    Vertices[i].Pos = Vertices[map[i]].Pos;
-
-  for(sInt i=0;i<Vertices.GetCount();i++)
-    Vertices[i].NormWeight();
+  sRemFalse(lv->Faces,&Wz4MeshFace::Count);
 
-  // done
-ende:
-  delete[] vertinfo;
   delete[] centervert;
-  delete[] edgelink;
-  delete[] map;
-  delete[] centerpos;
+  return 1;
 }
 
 /****************************************************************************/
 
-void Wz4Mesh::SelStoreLoad(sInt mode, sInt type, sInt slot)
+struct Wz4SubdivJob
 {
-  Wz4MeshFace *f;
-  Wz4MeshVertex *v;
-  Wz4MeshSel s;
+  const Wz4SubdivLevel *Level;
+  const Wz4MeshVertex *In;
+  Wz4MeshVertex *Out;
+  sF32 Smooth;
+};
 
-  switch(mode)
-  {
-  case wMSM_LOAD:
-    switch(type)
-    {
-    case wMST_VERTEX:
-      // clear vertices selection
-      sFORALL(Vertices,v)
-        v->Select = 0.0f;
+static void Wz4SubdivTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  const Wz4SubdivJob *job = (const Wz4SubdivJob *) data;
+  const Wz4SubdivLevel *lv = job->Level;
+  const sF32 s1 = job->Smooth;
+  const sF32 s2 = job->Smooth*job->Smooth;
 
-      // read all vertices stored and set selection
-      for(int i=0; i<SelVertices[slot].GetCount(); i++)
-        Vertices[SelVertices[slot][i].Id].Select = SelVertices[slot][i].Selected;
+  sInt end = sMin((start+count)*W4S_VERTEXJOB,lv->VertCount);
+  for(sInt i=start*W4S_VERTEXJOB;i<end;i++)
+  {
+    Wz4MeshVertex *v = job->Out+i;
 
-      // clear faces selection
-      sFORALL(Faces,f)
-        f->Select = 0;
-      break;
+    // attributes
+
+    if(i<lv->CopyCount)
+    {
+      *v = job->In[i];
+    }
+    else
+    {
+      sInt n = i-lv->CopyCount;
+      v->Zero();
+      for(sInt t=lv->AttrStart[n];t<lv->AttrStart[n+1];t++)
+        v->AddScale((Wz4MeshVertex *) &job->In[lv->AttrVert[t]],lv->AttrWeight[t]);
+    }
+
+    // position
+
+    const Wz4SubdivTerm *t = lv->PosTerm.GetData()+lv->PosStart[i];
+    const Wz4SubdivTerm *te = lv->PosTerm.GetData()+lv->PosStart[i+1];
+#if sSIMD_INTRINSICS
+    sSSE accu = sVecZero();
+    for(;t<te;t++)
+    {
+      sF32 w = t->W[0] + t->W[1]*s1 + t->W[2]*s2;
+      accu = sVecMAdd(sVecLoadU(&job->In[t->Vert].Pos.x),sVecLoadScalar(w),accu);
+    }
+    sF32 res[4];
+    sVecStoreU(accu,res);
+    v->Pos.Init(res[0],res[1],res[2]);
+#else
+    sVector30 accu(0,0,0);
+    for(;t<te;t++)
+      accu += sVector30(job->In[t->Vert].Pos) * (t->W[0] + t->W[1]*s1 + t->W[2]*s2);
+    v->Pos = sVector31(accu);
+#endif
+
+    v->NormWeight();
+  }
+}
+
+// vertices of one level, from the merged input
+
+static void Wz4SubdivApply(const Wz4SubdivLevel *lv,sArray<Wz4MeshVertex> &verts,sF32 smooth)
+{
+  sVERIFY(verts.GetCount()==lv->CopyCount);
+
+  Wz4MeshVertex *in = new Wz4MeshVertex[lv->CopyCount];
+  sCopyMem(in,verts.GetData(),sizeof(Wz4MeshVertex)*lv->CopyCount);
+  verts.Resize(lv->VertCount);
+
+  Wz4SubdivJob job;
+  job.Level = lv;
+  job.In = in;
+  job.Out = verts.GetData();
+  job.Smooth = smooth;
+
+  sInt jobs = (lv->VertCount+W4S_VERTEXJOB-1)/W4S_VERTEXJOB;
+  if(jobs<2 || !sSched || sSched->GetThreadCount()<2)
+  {
+    Wz4SubdivTask(0,0,0,jobs,&job);
+  }
+  else
+  {
+    sStsWorkload *wl = sSched->BeginWorkload();
+    sStsTask *task = wl->NewTask(Wz4SubdivTask,&job,jobs,0);
+    wl->AddTask(task);
+    wl->Start();
+    wl->Sync();
+    wl->End();
+  }
+
+  delete[] in;
+}
+
+/****************************************************************************/
+
+// the tables are kept until the next subdivision evicts them, or until the
+// document flushes its caches
+
+struct Wz4SubdivCache
+{
+  sAutoArray<Wz4SubdivTable *> Tables;
+  sU32 Time;
+
+  Wz4SubdivCache() { Time = 0; }
+};
+
+static Wz4SubdivCache *Wz4Subdiv;  // operators run on the main thread only
+
+static void Wz4InitSubdiv()
+{
+  Wz4Subdiv = new Wz4SubdivCache;
+}
+
+static void Wz4ExitSubdiv()
+{
+  sDelete(Wz4Subdiv);
+}
+
+static void Wz4FlushSubdiv(void *)
+{
+  if(Wz4Subdiv)
+    sDeleteAll(Wz4Subdiv->Tables);
+}
+
+sADDSUBSYSTEM(Wz4Subdivision,0x40,Wz4InitSubdiv,Wz4ExitSubdiv);
+
+// topology keys, for the subdivision tables and for ChargeSolid()
+
+static sU32 Wz4FaceHash(const sArray<Wz4MeshFace> &faces,sInt verts,sInt extra)
+{
+  sU32 hash = 2166136261U;
+  hash = (hash ^ verts) * 16777619U;
+  hash = (hash ^ extra) * 16777619U;
+  const Wz4MeshFace *f;
+  sFORALL(faces,f)
+  {
+    hash = (hash ^ f->Cluster) * 16777619U;
+    hash = (hash ^ (f->Count | (f->Select<<8) | (f->Selected<<16))) * 16777619U;
+    for(sInt j=0;j<f->Count;j++)
+      hash = (hash ^ f->Vertex[j]) * 16777619U;
+  }
+  return hash;
+}
+
+static sBool Wz4SameFaces(const sArray<Wz4MeshFace> &a,const sArray<Wz4MeshFace> &b)
+{
+  if(a.GetCount()!=b.GetCount())
+    return 0;
+  for(sInt i=0;i<a.GetCount();i++)
+  {
+    const Wz4MeshFace &fa = a[i];
+    const Wz4MeshFace &fb = b[i];
+    if(fa.Cluster!=fb.Cluster || fa.Count!=fb.Count || fa.Select!=fb.Select || fa.Selected!=fb.Selected)
+      return 0;
+    for(sInt j=0;j<fa.Count;j++)
+      if(fa.Vertex[j]!=fb.Vertex[j])
+        return 0;
+  }
+  return 1;
+}
+
+/****************************************************************************/
+
+void Wz4Mesh::Subdivide(sF32 smooth,sInt levels)
+{
+  if(levels<1)
+    return;
+
+  // like Facette(1), without the normals
+
+  Wz4MeshVertex *v;
+  sFORALL(Vertices,v)
+  {
+    v->Normal.Init(0,0,0);
+    v->Tangent.Init(0,0,0);
+  }
+  MergeVertices();
+
+  // get same position map
+
+  sInt maxvert = Vertices.GetCount();
+  sInt *map = BasePos();
+  for(sInt i=0;i<maxvert;i++)
+    if(map[i]==-1)
+      map[i] = i;
+
+  // find the tables for this topology
+
+  Wz4SubdivCache *cache = Wz4Subdiv;
+  sU32 hash = Wz4FaceHash(Faces,maxvert,levels);
+  Wz4SubdivTable *table = 0;
+  Wz4SubdivTable *t;
+  sFORALL(cache->Tables,t)
+  {
+    if(t->Hash==hash && t->Levels==levels && t->Base.GetCount()==maxvert &&
+       Wz4SameFaces(t->Faces,Faces) &&
+       sCmpMem(t->Base.GetData(),map,maxvert*sizeof(sInt))==0)
+    {
+      table = t;
+      break;
+    }
+  }
+
+  if(table)
+  {
+    // only the vertex data changed. the merges between levels depend on the
+    // attributes too, so they are done again and must match the table.
+    // if not, start over with the input.
+
+    sArray<Wz4MeshVertex> input;
+    if(table->Level.GetCount()>1)
+      input = Vertices;
+
+    sArray<sInt> merge;
+    for(sInt l=0;l<table->Level.GetCount();l++)
+    {
+      const Wz4SubdivLevel *lv = table->Level[l];
+      if(l>0)
+      {
+        sInt count = Vertices.GetCount();
+        MergeVertices(&merge);
+        if(merge.GetCount()==count)
+          merge.Clear();
+        if(merge.GetCount()!=lv->Merge.GetCount() ||
+           sCmpMem(merge.GetData(),lv->Merge.GetData(),merge.GetCount()*sizeof(sInt))!=0)
+        {
+          Vertices.Swap(input);
+          Faces = table->Faces;
+          cache->Tables.Rem(table);
+          delete table;
+          table = 0;
+          break;
+        }
+      }
+      Wz4SubdivApply(lv,Vertices,smooth);
+      Faces = lv->Faces;
+    }
+  }
+
+  if(!table)
+  {
+    // build new tables, evict the one that was not used for the longest time
+
+    if(cache->Tables.GetCount()>=W4S_TABLES)
+    {
+      sInt oldest = 0;
+      for(sInt i=1;i<cache->Tables.GetCount();i++)
+        if(sInt(cache->Tables[i]->LastUse-cache->Tables[oldest]->LastUse)<0)
+          oldest = i;
+      delete cache->Tables[oldest];
+      cache->Tables.RemAt(oldest);
+    }
+    if(Doc)                       // once per document
+    {
+      Doc->FlushCachesHook->Rem(Wz4FlushSubdiv);
+      Doc->FlushCachesHook->Add(Wz4FlushSubdiv);
+    }
+
+    table = new Wz4SubdivTable;
+    table->Hash = hash;
+    table->Levels = levels;
+    table->Faces = Faces;
+    table->Base.Resize(maxvert);
+    sCopyMem(table->Base.GetData(),map,maxvert*sizeof(sInt));
+
+    Wz4SubdivBuilder builder;
+    for(sInt l=0;l<levels;l++)
+    {
+      Wz4SubdivLevel *lv = new Wz4SubdivLevel;
+      if(l>0)
+      {
+        sInt count = Vertices.GetCount();
+        MergeVertices(&lv->Merge);
+        if(lv->Merge.GetCount()==count)
+          lv->Merge.Clear();
+
+        delete[] map;
+        map = BasePos();
+        for(sInt i=0;i<Vertices.GetCount();i++)
+          if(map[i]==-1)
+            map[i] = i;
+      }
+
+      if(!builder.Build(this,map,lv))
+      {
+        delete lv;
+        break;
+      }
+      table->Level.AddTail(lv);
+      Wz4SubdivApply(lv,Vertices,smooth);
+      Faces = lv->Faces;
+    }
+    cache->Tables.AddTail(table);
+  }
+  table->LastUse = ++cache->Time;
+
+  delete[] map;
+}
+
+/****************************************************************************/
+
+void Wz4Mesh::SelStoreLoad(sInt mode, sInt type, sInt slot)
+{
+  Wz4MeshFace *f;
+  Wz4MeshVertex *v;
+  Wz4MeshSel s;
+
+  switch(mode)
+  {
+  case wMSM_LOAD:
+    switch(type)
+    {
+    case wMST_VERTEX:
+      // clear vertices selection
+      sFORALL(Vertices,v)
+        v->Select = 0.0f;
+
+      // read all vertices stored and set selection
+      for(int i=0; i<SelVertices[slot].GetCount(); i++)
+        Vertices[SelVertices[slot][i].Id].Select = SelVertices[slot][i].Selected;
+
+      // clear faces selection
+      sFORALL(Faces,f)
+        f->Select = 0;
+      break;
 
     case wMST_FACE:
       sFORALL(Faces,f)
@@ -4685,319 +5289,846 @@ void Wz4Mesh::ChargeWire(sVertexFormatHandle *fmt)
 
 /****************************************************************************/
 
-void Wz4Mesh::ChargeSolid(sInt flags)
+// ChargeSolid() works in three passes:
+// 1. in parallel, per cluster: triangulate, remap to cluster vertices and
+//    collect bone matrices
+// 2. create the geometries and lock the buffers
+// 3. in parallel, per range of vertices or indices: fill the buffers
+// the triangulated and remapped indices depend on the faces only, they are
+// kept for a few topologies. when only the vertices changed (animation,
+// Transform, the other geometry of the same mesh), pass 1 only collects the
+// bone matrices and pass 3 copies the indices.
+
+struct Wz4ChargeScratch           // per thread, reused between charges
+{
+  sArray<sInt> Seen;              // serial of the last cluster that used a vertex
+  sArray<sInt> Map;               // mesh vertex -> cluster vertex
+  sArray<sInt> Joints;            // joint -> bone matrix slot
+  sInt Serial;
+};
+
+enum Wz4ChargeTopologyFlags
 {
-  Wz4MeshCluster *cl;
-  Wz4MeshVertex *mv;
-  Wz4MeshFace *mf;
-  Wz4ChunkPhysics *chunk;
-  sU32 *ip32;
-  sU16 *ip16;
-  sInt *jointtemp=0;
-  sInt *firstindex=0;
+  W4CT_OPTIMIZE = 1,              // index order is optimized
+  W4CT_CHUNKS = 2,                // FirstIndex is needed
+};
 
-#if WZ4ONLYONEGEO
-  sInt geoindex = 0;
-#else
-  sInt geoindex = ((flags & sRF_TARGET_MASK) == sRF_TARGET_MAIN) ? 0 : 1;
-#endif
-  if(Clusters.GetCount()==0) return;
-  if(Clusters[0]->Geo[geoindex]) return;
+struct Wz4ChargeTopoCluster
+{
+  sInt FirstIndex;                // range in Wz4ChargeTopology::Indices
+  sInt IndexCount;
+  sArray<sInt> VertexMap;         // cluster vertex -> mesh vertex
+};
 
-  // check if geo is null in all Clusters
-  sFORALL(Clusters,cl)
-  {
-    if(cl->Geo[geoindex] != 0)
-      return;
-  }
+struct Wz4ChargeTopology
+{
+  sU32 Hash;
+  sInt VertexCount;
+  sInt Flags;                     // Wz4ChargeTopologyFlags
+  sArray<Wz4MeshFace> Faces;
+  sArray<Wz4ChargeTopoCluster> Clusters;
+  sArray<sInt> Indices;           // cluster vertices, all clusters
+  sArray<sInt> FirstIndex;        // per face, only with W4CT_CHUNKS
+  sU32 LastUse;
+};
 
-  ChargeBBox();
+struct Wz4ChargeCluster
+{
+  sVertexFormatHandle *Format;
+  sInt FirstFace;                 // range in Wz4ChargeContext::FaceList
+  sInt FaceCount;
+  sU32 *VB;
+  void *IB;
+};
 
-  sInt ccount = Clusters.GetCount();
-  sInt fcount = Faces.GetCount();
-  sInt vcount = Vertices.GetCount();
+struct Wz4ChargeJob
+{
+  sInt Cluster;
+  sInt Start;
+  sInt Count;
+  sBool Indices;                  // index range instead of vertex range
+};
 
-  sInt njoints = Skeleton ? Skeleton->Joints.GetCount() : Chunks.GetCount();
-  jointtemp = new sInt[njoints];
+struct Wz4ChargeContext
+{
+  Wz4Mesh *Mesh;
+  sInt GeoIndex;
+  sInt JointCount;
+  Wz4ChargeTopology *Topo;
+  sBool Build;                    // Topo is new, pass 1 fills it
+  sArray<Wz4ChargeCluster> Clusters;
+  sArray<Wz4ChargeJob> Jobs;
+  sArray<sInt> FaceList;          // faces sorted by cluster
+  sArray<Wz4ChargeScratch> Scratch;
+  sAutoArray<Wz4ChargeTopology *> Topologies;
+  sU32 Time;
+
+  Wz4ChargeContext() { Mesh = 0; Topo = 0; Time = 0; }
+  void Begin(Wz4Mesh *mesh,sInt geoindex,sInt joints);
+  void FindTopology(sInt flags);
+  Wz4ChargeScratch *GetScratch(sStsThread *thread);
+  void PrepareCluster(sInt cli,Wz4ChargeScratch *scratch);
+  void AssignMatrices(sInt cli,Wz4ChargeScratch *scratch);
+  void ConvertVertices(const Wz4ChargeJob *job,Wz4ChargeScratch *scratch);
+  void Run(sStsCode code,sInt count);
+  void End();
+};
 
-  if(Chunks.GetCount()>0)
+static sBool Wz4ChargeHasBones(sVertexFormatHandle *fmt)
+{
+  for(const sU32 *desc=fmt->GetDesc();*desc;desc++)
+    if(*desc==(sVF_BONEINDEX|sVF_I4))
+      return 1;
+  return 0;
+}
+
+static Wz4ChargeContext Wz4Charge;  // charging happens on the main thread only
+
+static void Wz4FlushCharge(void *)
+{
+  sDeleteAll(Wz4Charge.Topologies);
+}
+
+static void Wz4ExitCharge()
+{
+  Wz4FlushCharge(0);
+}
+
+sADDSUBSYSTEM(Wz4Charge,0x40,0,Wz4ExitCharge);
+
+enum Wz4ChargeConfig
+{
+  W4C_VERTEXJOB = 0x4000,         // vertices per job
+  W4C_INDEXJOB = 0x10000,         // indices per job
+  W4C_MAXMATRICES = 74,           // bone matrices per cluster
+  W4C_KEEPSCRATCH = 0x40000,      // vertices, larger scratch tables are freed after charging
+  W4C_TOPOLOGIES = 4,             // topologies to remember
+};
+
+void Wz4ChargeContext::Begin(Wz4Mesh *mesh,sInt geoindex,sInt joints)
+{
+  Mesh = mesh;
+  GeoIndex = geoindex;
+  JointCount = joints;
+  Topo = 0;
+  Build = 0;
+  Clusters.Clear();
+  Jobs.Clear();
+
+  // scratch memory for each thread, grown to the largest mesh seen so far
+
+  sInt threads = sSched->GetThreadCount();
+  sInt vcount = mesh->Vertices.GetCount();
+  if(Scratch.GetCount()<threads)
   {
-    firstindex = new sInt[fcount];
-    for(sInt i=0;i<fcount;i++)
-      firstindex[i] = 0;
+    sInt n = Scratch.GetCount();
+    Scratch.AddMany(threads-n);
+    for(sInt i=n;i<threads;i++)
+      Scratch[i].Serial = 0;
+  }
+  for(sInt t=0;t<threads;t++)
+  {
+    Wz4ChargeScratch *s = &Scratch[t];
+    if(s->Seen.GetCount()<vcount)
+    {
+      s->Seen.Resize(vcount);
+      s->Map.Resize(vcount);
+      for(sInt i=0;i<vcount;i++)
+        s->Seen[i] = -1;
+      s->Serial = 0;
+    }
+    if(s->Joints.GetCount()<joints)
+      s->Joints.Resize(joints);
   }
+}
 
-  // build linked list of all faces in cluster
-  sInt *firstFaceInCluster = new sInt[ccount];
-  sInt *nextFaceInCluster = new sInt[fcount];
-  for(sInt i=0;i<ccount;i++)
-    firstFaceInCluster[i] = -1;
+// find the indices for the faces of the mesh, or make room for new ones.
+// sets Build if they have to be made.
 
-  for(sInt i=fcount-1;i>=0;i--)
+void Wz4ChargeContext::FindTopology(sInt flags)
+{
+  sInt vcount = Mesh->Vertices.GetCount();
+  sInt ccount = Mesh->Clusters.GetCount();
+  sU32 hash = Wz4FaceHash(Mesh->Faces,vcount,flags|(ccount<<2));
+  Wz4ChargeTopology *t;
+  sFORALL(Topologies,t)
   {
-    sInt cl = Faces[i].Cluster;
-    sVERIFY(cl >= 0 && cl < ccount);
-    nextFaceInCluster[i] = firstFaceInCluster[cl];
-    firstFaceInCluster[cl] = i;
+    if(t->Hash==hash && t->VertexCount==vcount && t->Flags==flags &&
+       t->Clusters.GetCount()==ccount && Wz4SameFaces(t->Faces,Mesh->Faces))
+    {
+      Topo = t;
+      Build = 0;
+      Topo->LastUse = ++Time;
+      return;
+    }
   }
 
-  // set up per-vertex info
-  sInt *vertseen = new sInt[vcount];
-  sInt *map = new sInt[vcount];
-  sInt *revmap = new sInt[vcount];
-  sSetMem(vertseen,0xff,vcount*sizeof(sInt)); // clear "last seen in cluster" index for all vertices
+  // evict the one that was not used for the longest time
 
-  sFORALL(Clusters,cl)
+  if(Topologies.GetCount()>=W4C_TOPOLOGIES)
   {
-    sInt cli = _i;
-    
-    sVERIFY(!cl->Geo[geoindex]);
+    sInt oldest = 0;
+    for(sInt i=1;i<Topologies.GetCount();i++)
+      if(sInt(Topologies[i]->LastUse-Topologies[oldest]->LastUse)<0)
+        oldest = i;
+    delete Topologies[oldest];
+    Topologies.RemAt(oldest);
+  }
+  if(Doc)                         // once per document
+  {
+    Doc->FlushCachesHook->Rem(Wz4FlushCharge);
+    Doc->FlushCachesHook->Add(Wz4FlushCharge);
+  }
 
-    cl->ChunkStart = 0;
-    cl->ChunkEnd = 0;
-    cl->Matrices.Clear();
-    for(sInt i=0;i<njoints;i++)
-      jointtemp[i] = -1;
+  Topo = new Wz4ChargeTopology;
+  Topo->Hash = hash;
+  Topo->VertexCount = vcount;
+  Topo->Flags = flags;
+  Topo->Faces = Mesh->Faces;
+  Topo->Clusters.AddMany(ccount);
+  Topo->LastUse = ++Time;
+  Topologies.AddTail(Topo);
+  Build = 1;
+}
 
-    // count indices
+Wz4ChargeScratch *Wz4ChargeContext::GetScratch(sStsThread *thread)
+{
+  return &Scratch[thread->GetIndex()];
+}
+
+void Wz4ChargeContext::Run(sStsCode code,sInt count)
+{
+  if(count==0)
+    return;
+  sStsWorkload *wl = sSched->BeginWorkload();
+  sStsTask *task = wl->NewTask(code,this,count,0);
+  wl->AddTask(task);
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
 
-    sInt ic=0;
+// the tables have grown to the largest mesh charged so far. keep them for
+// the next charge only while they are small.
 
-    for(sInt _i=firstFaceInCluster[cli];_i>=0;_i=nextFaceInCluster[_i])
+void Wz4ChargeContext::End()
+{
+  Wz4ChargeScratch *s;
+  sFORALL(Scratch,s)
+  {
+    if(s->Seen.GetSize()>W4C_KEEPSCRATCH)
     {
-      mf = &Faces[_i];
-      if(firstindex)
-        firstindex[_i] = ic;
-      ic += (mf->Count-2)*3;
+      s->Seen.Reset();
+      s->Map.Reset();
     }
+  }
+  if(FaceList.GetSize()>W4C_KEEPSCRATCH)
+    FaceList.Reset();
+  Clusters.Reset();
+  Jobs.Reset();
+  Mesh = 0;
+  Topo = 0;
+}
 
-    if(ic>0)
+void Wz4ChargeContext::PrepareCluster(sInt cli,Wz4ChargeScratch *scratch)
+{
+  Wz4ChargeCluster *cc = &Clusters[cli];
+  Wz4ChargeTopoCluster *tc = &Topo->Clusters[cli];
+  const Wz4MeshFace *faces = Mesh->Faces.GetData();
+  sArray<sInt> &vmap = tc->VertexMap;
+
+  vmap.Clear();
+  if(tc->IndexCount==0)
+    return;
+
+  // build index list
+
+  sInt *il = Topo->Indices.GetData()+tc->FirstIndex;
+  sInt ili = 0;
+  for(sInt n=0;n<cc->FaceCount;n++)
+  {
+    sInt fi = FaceList[cc->FirstFace+n];
+    const Wz4MeshFace *mf = &faces[fi];
+    if(Topo->FirstIndex.GetCount())
+      Topo->FirstIndex[fi] = ili;
+    for(sInt i=2;i<mf->Count;i++)
+    {
+      il[ili++] = mf->Vertex[0];
+      il[ili++] = mf->Vertex[i-1];
+      il[ili++] = mf->Vertex[i];
+    }
+  }
+  sVERIFY(ili==tc->IndexCount);
+
+  if(Topo->Flags & W4CT_OPTIMIZE)
+    OptimizeIndexOrder(il,ili,Mesh->Vertices.GetCount());
+
+  // remap to cluster vertices, in order of first use
+
+  sInt serial = ++scratch->Serial;
+  sInt *seen = scratch->Seen.GetData();
+  sInt *map = scratch->Map.GetData();
+  for(sInt i=0;i<ili;i++)
+  {
+    sInt vi = il[i];
+    if(seen[vi]!=serial)
     {
-      // build index list
+      seen[vi] = serial;
+      map[vi] = vmap.GetCount();
+      vmap.AddTail(vi);
+    }
+    il[i] = map[vi];
+  }
+}
 
-      sInt *il = new sInt[ic];
-      sInt ili = 0;
-      sFORALL(Faces,mf)
+// bone matrix slots, in order of first use. the bones are vertex data, so
+// this is done for every charge.
+
+void Wz4ChargeContext::AssignMatrices(sInt cli,Wz4ChargeScratch *scratch)
+{
+  Wz4MeshCluster *cl = Mesh->Clusters[cli];
+  Wz4ChargeCluster *cc = &Clusters[cli];
+  const sArray<sInt> &vmap = Topo->Clusters[cli].VertexMap;
+
+  cl->ChunkStart = 0;
+  cl->ChunkEnd = 0;
+  cl->Matrices.Clear();
+
+  if(JointCount && vmap.GetCount() && Wz4ChargeHasBones(cc->Format))
+  {
+    sInt *joints = scratch->Joints.GetData();
+    for(sInt i=0;i<JointCount;i++)
+      joints[i] = -1;
+    for(sInt n=0;n<vmap.GetCount();n++)
+    {
+      const Wz4MeshVertex *mv = &Mesh->Vertices[vmap[n]];
+      for(sInt i=0;i<4;i++)
       {
-        if(mf->Cluster==cli)
+        sInt mi = mv->Index[i];
+        if(mi>=0 && joints[mi]==-1)
         {
-          for(sInt i=2;i<mf->Count;i++)
-          {
-            il[ili++] = mf->Vertex[0]; 
-            il[ili++] = mf->Vertex[i-1]; 
-            il[ili++] = mf->Vertex[i]; 
-          }
+          joints[mi] = cl->Matrices.GetCount();
+          cl->Matrices.AddTail(mi);
+          if(joints[mi] == W4C_MAXMATRICES) // == so we only get one warning per cluster
+            sDPrintF(L"ChaosMesh warning: too many matrices referenced in cluster %d\n",cli);
         }
       }
-      sVERIFY(ili==ic);
+    }
+  }
+}
 
-      // optimize index order here. do not optimize in the presence of chunks
-      // seems not to be important for performance. strangely. although it works.
-      // switch it on in player, but don't make the wz4 slower!
+#if sSIMD_INTRINSICS && sSIMD_SSE2
 
-      if(!firstindex && Doc->IsPlayer)
-      {
-//        DumpCacheEfficiency(il,ic);
-        OptimizeIndexOrder(il,ic,Vertices.GetCount());
-//        DumpCacheEfficiency(il,ic);
-      }
+// the packed elements go four vertices at a time. the loads take the same
+// four floats from four vertices and transpose them, so x, y, z and w each
+// hold one component of all four. reading four floats from any of the
+// vector fields or the uv's stays inside the vertex.
 
-      // build vertex list
+static sINLINE void Wz4ChargeLoad4(const sF32 *field,const sInt *vmap,sSSE &x,sSSE &y,sSSE &z,sSSE &w)
+{
+  const sInt floats = sizeof(Wz4MeshVertex)/sizeof(sF32);
+  x = sVecLoadU(field+sDInt(vmap[0])*floats);
+  y = sVecLoadU(field+sDInt(vmap[1])*floats);
+  z = sVecLoadU(field+sDInt(vmap[2])*floats);
+  w = sVecLoadU(field+sDInt(vmap[3])*floats);
+  _MM_TRANSPOSE4_PS(x,y,z,w);
+}
 
-      sInt vc=0;
-      for(sInt i=0;i<ic;i++)
-      {
-        sInt vi = il[i];
-        if(vertseen[vi] != cli) // vertex not seen in this cluster yet?
-        {
-          vertseen[vi] = cli;
-          map[vi] = vc; // assign next free index to this vertex
-          revmap[vc++] = vi;
-        }
-      }
-      
-      // build vertex buffers
+static sINLINE void Wz4ChargeStore4(sU32 *d,sInt stride,__m128i v)
+{
+  sU32 r[4];
+  _mm_storeu_si128((__m128i *) r,v);
+  d[0] = r[0];
+  d[stride] = r[1];
+  d[stride*2] = r[2];
+  d[stride*3] = r[3];
+}
 
-      sGeometry *geo = new sGeometry;
-      cl->Geo[geoindex] = geo;
-      sInt renderflags = (njoints ? sRF_MATRIX_BONE : sRF_MATRIX_ONE) | (geoindex ? sRF_TARGET_ZNORMAL : sRF_TARGET_MAIN);
-      sVertexFormatHandle *hnd = (cl->Mtrl ? cl->Mtrl : Wz4MeshType->DefaultMtrl)->GetFormatHandle(renderflags);
-      const sU32 *descdata = hnd->GetDesc();
+static sINLINE void Wz4ChargeCopy3(sU32 *d,const sF32 *s)
+{
+  sSSE v = sVecLoadU(s);
+  _mm_storel_pi((__m64 *) d,v);
+  sVecStoreElem(v,d+2,2);
+}
 
-      sU32 *vp;
-      sF32 *fp;
+#endif
 
-      if(ic>65534)
-        cl->IndexSize = sGF_INDEX32;
-      else
-        cl->IndexSize = sGF_INDEX16;
+// the vertex format is applied one element at a time over all vertices of
+// the job, which keeps the inner loops simple enough for the compiler.
 
-      geo->Init(sGF_TRILIST|cl->IndexSize,hnd);
+void Wz4ChargeContext::ConvertVertices(const Wz4ChargeJob *job,Wz4ChargeScratch *scratch)
+{
+  Wz4MeshCluster *cl = Mesh->Clusters[job->Cluster];
+  Wz4ChargeCluster *cc = &Clusters[job->Cluster];
+  const Wz4MeshVertex *verts = Mesh->Vertices.GetData();
+  const sInt *vmap = Topo->Clusters[job->Cluster].VertexMap.GetData()+job->Start;
+  const sInt count = job->Count;
+  const sInt stride = cc->Format->GetSize(0)/sizeof(sU32);
+  sU32 *vp = cc->VB + job->Start*stride;
+  sInt *joints = 0;
 
-      geo->BeginLoadVB(vc,sGD_STATIC,&vp);
-      for(sInt i=0;i<vc;i++)
-      {
-        const sU32 *desc = descdata;
-        mv = &Vertices[revmap[i]];
+  if(JointCount)
+  {
+    joints = scratch->Joints.GetData();
+    for(sInt i=0;i<JointCount;i++)
+      joints[i] = -1;
+    for(sInt i=0;i<cl->Matrices.GetCount();i++)
+      joints[cl->Matrices[i]] = i;
+  }
 
-        while(*desc)
+  for(const sU32 *desc=cc->Format->GetDesc();*desc;desc++)
+  {
+    sU32 *d = vp;
+    switch(*desc)
+    {
+    case sVF_POSITION|sVF_F3:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        Wz4ChargeCopy3(d,&mv->Pos.x);
+#else
+        sF32 *fp = (sF32 *) d;
+        fp[0] = mv->Pos.x;
+        fp[1] = mv->Pos.y;
+        fp[2] = mv->Pos.z;
+#endif
+      }
+      vp+=3;
+      break;
+    case sVF_POSITION|sVF_S4:
+      {
+        const sAABBoxC &box = cl->PackBox[GeoIndex];
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        Wz4PackPosSSE pack(box);
+        for(sInt n=0;n<count;n++,d+=stride)
+          pack.Pack(d,verts[vmap[n]].Pos);
+#else
+        for(sInt n=0;n<count;n++,d+=stride)
+          Wz4PackPos(d,verts[vmap[n]].Pos,box);
+#endif
+      }
+      vp+=2;
+      break;
+    case sVF_NORMAL|sVF_F3:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        Wz4ChargeCopy3(d,&mv->Normal.x);
+#else
+        sF32 *fp = (sF32 *) d;
+        fp[0] = mv->Normal.x;
+        fp[1] = mv->Normal.y;
+        fp[2] = mv->Normal.z;
+#endif
+      }
+      vp+=3;
+      break;
+    case sVF_NORMAL|sVF_I4:
+      {
+        sInt n = 0;
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        for(;n+4<=count;n+=4,d+=stride*4)
         {
-          switch(*desc)
-          {
-          case sVF_POSITION|sVF_F3:
-            fp = (sF32 *) vp;
-            fp[0] = mv->Pos.x;
-            fp[1] = mv->Pos.y;
-            fp[2] = mv->Pos.z;
-            vp+=3;
-            break;
-          case sVF_NORMAL|sVF_F3:
-            fp = (sF32 *) vp;
-            fp[0] = mv->Normal.x;
-            fp[1] = mv->Normal.y;
-            fp[2] = mv->Normal.z;
-            vp+=3;
-            break;
-          case sVF_NORMAL|sVF_I4:
-            {
-              sU8 nx = sClamp(sInt(mv->Normal.x*127+128),0,254);
-              sU8 ny = sClamp(sInt(mv->Normal.y*127+128),0,254);
-              sU8 nz = sClamp(sInt(mv->Normal.z*127+128),0,254);
-            
-              *vp++ = (nx)|(ny<<8)|(nz<<16);
-            }
-            break;
-          case sVF_TANGENT|sVF_F3:
-            fp = (sF32 *) vp;
-            fp[0] = mv->Tangent.x;
-            fp[1] = mv->Tangent.y;
-            fp[2] = mv->Tangent.z;
-            vp+=3;
-            break;
-          case sVF_TANGENT|sVF_F4:
-            fp = (sF32 *) vp;
-            fp[0] = mv->Tangent.x;
-            fp[1] = mv->Tangent.y;
-            fp[2] = mv->Tangent.z;
-            fp[3] = mv->BiSign;
-            vp+=4;
-            break;
-          case sVF_BONEINDEX|sVF_I4:
-            {
-              sInt ind[4];
-              for(sInt i=0;i<4;i++)
-              {
-                sInt mi = mv->Index[i];
-                if(njoints && mi >= 0)
-                {
-                  if(jointtemp[mi]==-1)
-                  {
-                    jointtemp[mi] = cl->Matrices.GetCount();
-                    *cl->Matrices.AddMany(1) = mi;
-                    if(jointtemp[mi] == 74) // == so we only get one warning per cluster
-                      sDPrintF(L"ChaosMesh warning: too many matrices referenced in cluster %d\n",cli);
-                  }
-                  mi = jointtemp[mi];
-                }
-                ind[i] = mi;
-              }
-
-              sU32 i0 = sMax<sInt>(ind[0],0)*3;
-              sU32 i1 = sMax<sInt>(ind[1],0)*3;
-              sU32 i2 = sMax<sInt>(ind[2],0)*3;
-              sU32 i3 = sMax<sInt>(ind[3],0)*3;
-              *vp++ = i0 | (i1<<8) | (i2<<16) | (i3<<24);
-            }
-            break;
-          case sVF_BONEWEIGHT|sVF_I4:
-            {
-              sU32 w1 = (mv->Weight[1]*0.5f+0.5f)*254;
-              sU32 w2 = (mv->Weight[2]*0.5f+0.5f)*254;
-              sU32 w3 = (mv->Weight[3]*0.5f+0.5f)*254;
-              sU32 w0 = 254-(w1-127)-(w2-127)-(w3-127);
-              *vp++ = w0 | (w1<<8) | (w2<<16) | (w3<<24);
-            }
-            break;
-          case sVF_COLOR0|sVF_C4:
+          sSSE x,y,z,w;
+          Wz4ChargeLoad4(&verts->Normal.x,vmap+n,x,y,z,w);
+          sSSE scale = sVecLoadScalar(127.0f);
+          sSSE bias = sVecLoadScalar(128.0f);
+          __m128i ix = _mm_cvttps_epi32(sVecAdd(sVecMul(x,scale),bias));
+          __m128i iy = _mm_cvttps_epi32(sVecAdd(sVecMul(y,scale),bias));
+          __m128i iz = _mm_cvttps_epi32(sVecAdd(sVecMul(z,scale),bias));
+
+          // clamp in 16 bit, sse2 has no 32 bit min and max
+
+          __m128i xy = _mm_packs_epi32(ix,iy);
+          __m128i zz = _mm_packs_epi32(iz,iz);
+          xy = _mm_min_epi16(_mm_max_epi16(xy,_mm_setzero_si128()),_mm_set1_epi16(254));
+          zz = _mm_min_epi16(_mm_max_epi16(zz,_mm_setzero_si128()),_mm_set1_epi16(254));
+          __m128i r = _mm_unpacklo_epi16(xy,_mm_setzero_si128());
+          r = _mm_or_si128(r,_mm_slli_epi32(_mm_unpackhi_epi16(xy,_mm_setzero_si128()),8));
+          r = _mm_or_si128(r,_mm_slli_epi32(_mm_unpacklo_epi16(zz,_mm_setzero_si128()),16));
+          Wz4ChargeStore4(d,stride,r);
+        }
+#endif
+        for(;n<count;n++,d+=stride)
+        {
+          const Wz4MeshVertex *mv = &verts[vmap[n]];
+          sU8 nx = sClamp(sInt(mv->Normal.x*127+128),0,254);
+          sU8 ny = sClamp(sInt(mv->Normal.y*127+128),0,254);
+          sU8 nz = sClamp(sInt(mv->Normal.z*127+128),0,254);
+          *d = (nx)|(ny<<8)|(nz<<16);
+        }
+      }
+      vp+=1;
+      break;
+    case sVF_NORMAL|sVF_S2:
+      {
+        sInt n = 0;
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        for(;n+4<=count;n+=4,d+=stride*4)
+        {
+          sSSE x,y,z,w;
+          Wz4ChargeLoad4(&verts->Normal.x,vmap+n,x,y,z,w);
+          Wz4ChargeStore4(d,stride,Wz4PackOct4(x,y,z));
+        }
+#endif
+        for(;n<count;n++,d+=stride)
+          *d = Wz4PackOct(verts[vmap[n]].Normal);
+      }
+      vp+=1;
+      break;
+    case sVF_TANGENT|sVF_F3:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        Wz4ChargeCopy3(d,&mv->Tangent.x);
+#else
+        sF32 *fp = (sF32 *) d;
+        fp[0] = mv->Tangent.x;
+        fp[1] = mv->Tangent.y;
+        fp[2] = mv->Tangent.z;
+#endif
+      }
+      vp+=3;
+      break;
+    case sVF_TANGENT|sVF_F4:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        sVecStoreU(sVecLoadU(&mv->Tangent.x),d);     // BiSign follows Tangent
+#else
+        sF32 *fp = (sF32 *) d;
+        fp[0] = mv->Tangent.x;
+        fp[1] = mv->Tangent.y;
+        fp[2] = mv->Tangent.z;
+        fp[3] = mv->BiSign;
+#endif
+      }
+      vp+=4;
+      break;
+    case sVF_TANGENT|sVF_S2:
+      {
+        sInt n = 0;
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        for(;n+4<=count;n+=4,d+=stride*4)
+        {
+          sSSE x,y,z,w;
+          Wz4ChargeLoad4(&verts->Tangent.x,vmap+n,x,y,z,w);
+          Wz4ChargeStore4(d,stride,Wz4PackOct4(x,y,z));
+        }
+#endif
+        for(;n<count;n++,d+=stride)
+          *d = Wz4PackOct(verts[vmap[n]].Tangent);
+      }
+      vp+=1;
+      break;
+    case sVF_BONEINDEX|sVF_I4:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+        sU32 ind[4];
+        for(sInt i=0;i<4;i++)
+        {
+          sInt mi = mv->Index[i];
+          if(joints && mi>=0)
+            mi = joints[mi];
+          ind[i] = sMax<sInt>(mi,0)*3;
+        }
+        *d = ind[0] | (ind[1]<<8) | (ind[2]<<16) | (ind[3]<<24);
+      }
+      vp+=1;
+      break;
+    case sVF_BONEWEIGHT|sVF_I4:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+        sU32 w1 = (mv->Weight[1]*0.5f+0.5f)*254;
+        sU32 w2 = (mv->Weight[2]*0.5f+0.5f)*254;
+        sU32 w3 = (mv->Weight[3]*0.5f+0.5f)*254;
+        sU32 w0 = 254-(w1-127)-(w2-127)-(w3-127);
+        *d = w0 | (w1<<8) | (w2<<16) | (w3<<24);
+      }
+      vp+=1;
+      break;
+    case sVF_COLOR0|sVF_C4:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
 #if !WZ4MESH_LOWMEM
-            *vp++ = mv->Color0;
+        *d = verts[vmap[n]].Color0;
 #else
-            *vp++ = 0xffffffff;
+        *d = 0xffffffff;
 #endif
-            break;
-          case sVF_COLOR1|sVF_C4:
+      }
+      vp+=1;
+      break;
+    case sVF_COLOR1|sVF_C4:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
 #if !WZ4MESH_LOWMEM
-            *vp++ = mv->Color1;
+        *d = verts[vmap[n]].Color1;
 #else
-            *vp++ = 0x00000000;
+        *d = 0x00000000;
 #endif
-            break;
-          case sVF_UV0|sVF_F2:
-            fp = (sF32 *) vp;
-            fp[0] = mv->U0;
-            fp[1] = mv->V0;
-            vp+=2;
-            break;
-          case sVF_UV1|sVF_F2:
-            fp = (sF32 *) vp;
-            fp[0] = mv->U1;
-            fp[1] = mv->V1;
-            vp+=2;
-            break;
-          default:
-            sFatal(L"unknown vertex format");
+      }
+      vp+=1;
+      break;
+    case sVF_UV0|sVF_F2:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+        sF32 *fp = (sF32 *) d;
+        fp[0] = mv->U0;
+        fp[1] = mv->V0;
+      }
+      vp+=2;
+      break;
+    case sVF_UV1|sVF_F2:
+      for(sInt n=0;n<count;n++,d+=stride)
+      {
+        const Wz4MeshVertex *mv = &verts[vmap[n]];
+        sF32 *fp = (sF32 *) d;
+        fp[0] = mv->U1;
+        fp[1] = mv->V1;
+      }
+      vp+=2;
+      break;
+    case sVF_UV0|sVF_H2:
+    case sVF_UV1|sVF_H2:
+      {
+        sBool uv1 = (*desc & sVF_USEMASK)==sVF_UV1;
+        sInt n = 0;
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+        for(;n+4<=count;n+=4,d+=stride*4)
+        {
+          sSSE u0,v0,u1,v1;
+          Wz4ChargeLoad4(&verts->U0,vmap+n,u0,v0,u1,v1);
+          if(uv1)
+          {
+            u0 = u1;
+            v0 = v1;
           }
-          desc++;
+          Wz4ChargeStore4(d,stride,_mm_or_si128(Wz4PackHalf4(u0),_mm_slli_epi32(Wz4PackHalf4(v0),16)));
+        }
+#endif
+        for(;n<count;n++,d+=stride)
+        {
+          const Wz4MeshVertex *mv = &verts[vmap[n]];
+          if(uv1)
+            *d = Wz4PackHalf(mv->U1) | (Wz4PackHalf(mv->V1)<<16);
+          else
+            *d = Wz4PackHalf(mv->U0) | (Wz4PackHalf(mv->V0)<<16);
         }
       }
-      geo->EndLoadVB();
+      vp+=1;
+      break;
+    default:
+      sFatal(L"unknown vertex format");
+    }
+  }
+}
 
-      // build index buffers
+static void Wz4ChargeClusterTask(sStsManager *,sStsThread *thread,sInt start,sInt count,void *data)
+{
+  Wz4ChargeContext *ctx = (Wz4ChargeContext *) data;
+  Wz4ChargeScratch *scratch = ctx->GetScratch(thread);
+  for(sInt i=start;i<start+count;i++)
+  {
+    if(ctx->Build)
+      ctx->PrepareCluster(i,scratch);
+    ctx->AssignMatrices(i,scratch);
+  }
+}
 
-      if(cl->IndexSize==sGF_INDEX32)
+static void Wz4ChargeFillTask(sStsManager *,sStsThread *thread,sInt start,sInt count,void *data)
+{
+  Wz4ChargeContext *ctx = (Wz4ChargeContext *) data;
+  Wz4ChargeScratch *scratch = ctx->GetScratch(thread);
+  for(sInt i=start;i<start+count;i++)
+  {
+    const Wz4ChargeJob *job = &ctx->Jobs[i];
+    const Wz4ChargeCluster *cc = &ctx->Clusters[job->Cluster];
+    if(job->Indices)
+    {
+      const sInt *il = ctx->Topo->Indices.GetData() + ctx->Topo->Clusters[job->Cluster].FirstIndex + job->Start;
+      if(ctx->Mesh->Clusters[job->Cluster]->IndexSize==sGF_INDEX32)
       {
-        geo->BeginLoadIB(ic,sGD_STATIC,&ip32);
-        for(sInt i=0;i<ic;i++)
-          ip32[i] = map[il[i]];
-        geo->EndLoadIB();
+        sU32 *ip = ((sU32 *) cc->IB) + job->Start;
+        for(sInt n=0;n<job->Count;n++)
+          ip[n] = il[n];
       }
       else
       {
-        geo->BeginLoadIB(ic,sGD_STATIC,&ip16);
-        for(sInt i=0;i<ic;i++)
-          ip16[i] = map[il[i]];
-        geo->EndLoadIB();
+        sU16 *ip = ((sU16 *) cc->IB) + job->Start;
+        for(sInt n=0;n<job->Count;n++)
+          ip[n] = il[n];
       }
+    }
+    else
+    {
+      ctx->ConvertVertices(job,scratch);
+    }
+  }
+}
+
+static void Wz4ChargeAddJobs(sArray<Wz4ChargeJob> &jobs,sInt cluster,sInt count,sBool indices)
+{
+  sInt size = indices ? W4C_INDEXJOB : W4C_VERTEXJOB;
+  for(sInt start=0;start<count;start+=size)
+  {
+    Wz4ChargeJob *job = jobs.AddMany(1);
+    job->Cluster = cluster;
+    job->Start = start;
+    job->Count = sMin(size,count-start);
+    job->Indices = indices;
+  }
+}
 
-      // clean up
+/****************************************************************************/
+
+void Wz4Mesh::ChargeSolid(sInt flags)
+{
+  Wz4MeshCluster *cl;
+  Wz4ChunkPhysics *chunk;
+
+#if WZ4ONLYONEGEO
+  sInt geoindex = 0;
+#else
+  sInt geoindex = ((flags & sRF_TARGET_MASK) == sRF_TARGET_MAIN) ? 0 : 1;
+#endif
+  if(Clusters.GetCount()==0) return;
+  if(Clusters[0]->Geo[geoindex]) return;
+
+  // check if geo is null in all Clusters
+  sFORALL(Clusters,cl)
+  {
+    if(cl->Geo[geoindex] != 0)
+      return;
+  }
+
+  ChargeBBox();
+
+  sInt ccount = Clusters.GetCount();
+  sInt fcount = Faces.GetCount();
+  sInt njoints = Skeleton ? Skeleton->Joints.GetCount() : Chunks.GetCount();
+  Wz4ChargeContext *ctx = &Wz4Charge;
+  ctx->Begin(this,geoindex,njoints);
+
+  Wz4ChargeCluster *cc = ctx->Clusters.AddMany(ccount);
+  sInt renderflags = (njoints ? sRF_MATRIX_BONE : sRF_MATRIX_ONE) | (geoindex ? sRF_TARGET_ZNORMAL : sRF_TARGET_MAIN);
+  sFORALL(Clusters,cl)
+  {
+    cc[_i].Format = (cl->Mtrl ? cl->Mtrl : Wz4MeshType->DefaultMtrl)->GetFormatHandle(renderflags);
+    cc[_i].FaceCount = 0;
+    cc[_i].VB = 0;
+    cc[_i].IB = 0;
+  }
 
-      delete[] il;
+  // optimize index order here. do not optimize in the presence of chunks
+  // seems not to be important for performance. strangely. although it works.
+  // switch it on in player, but don't make the wz4 slower!
+
+  sInt topoflags = 0;
+  if(Chunks.GetCount()>0)
+    topoflags |= W4CT_CHUNKS;
+  else if(Doc->IsPlayer)
+    topoflags |= W4CT_OPTIMIZE;
+  ctx->FindTopology(topoflags);
+  Wz4ChargeTopology *topo = ctx->Topo;
+  Wz4ChargeTopoCluster *tc = topo->Clusters.GetData();
+
+  // sort faces by cluster and count indices
+
+  if(ctx->Build)
+  {
+    for(sInt i=0;i<ccount;i++)
+      tc[i].IndexCount = 0;
+    for(sInt i=0;i<fcount;i++)
+    {
+      const Wz4MeshFace *mf = &Faces[i];
+      sVERIFY(mf->Cluster >= 0 && mf->Cluster < ccount);
+      cc[mf->Cluster].FaceCount++;
+      tc[mf->Cluster].IndexCount += (mf->Count-2)*3;
     }
-    if(cl->Matrices.GetCount() > 74)
+    sInt fo = 0;
+    sInt io = 0;
+    for(sInt i=0;i<ccount;i++)
+    {
+      cc[i].FirstFace = fo;
+      tc[i].FirstIndex = io;
+      fo += cc[i].FaceCount;
+      io += tc[i].IndexCount;
+      cc[i].FaceCount = 0;
+    }
+    ctx->FaceList.Resize(fcount);
+    for(sInt i=0;i<fcount;i++)
     {
-      sDPrintF(L"final matrix count for cluster %d: %d\n",cli,cl->Matrices.GetCount());
-      cl->Matrices.Resize(74);
+      Wz4ChargeCluster *c = &cc[Faces[i].Cluster];
+      ctx->FaceList[c->FirstFace + c->FaceCount++] = i;
     }
+    topo->Indices.Resize(io);
+    topo->FirstIndex.Resize((topoflags & W4CT_CHUNKS) ? fcount : 0);
+    for(sInt i=0;i<topo->FirstIndex.GetCount();i++)
+      topo->FirstIndex[i] = 0;
   }
+
+  // triangulate and remap all clusters, if needed. collect bone matrices
+
+  ctx->Run(Wz4ChargeClusterTask,ccount);
+
+  // create geometries and lock buffers
+
+  sFORALL(Clusters,cl)
+  {
+    sInt ic = tc[_i].IndexCount;
+    sInt vc = tc[_i].VertexMap.GetCount();
+    if(ic==0)
+      continue;
+
+    sGeometry *geo = new sGeometry;
+    cl->Geo[geoindex] = geo;
+    cl->PackBox[geoindex] = cl->Bounds;
+    cl->IndexSize = (ic>65534) ? sGF_INDEX32 : sGF_INDEX16;
+    geo->Init(sGF_TRILIST|cl->IndexSize,cc[_i].Format);
+    geo->BeginLoadVB(vc,sGD_STATIC,&cc[_i].VB);
+    geo->BeginLoadIB(ic,sGD_STATIC,&cc[_i].IB);
+
+    Wz4ChargeAddJobs(ctx->Jobs,_i,vc,0);
+    Wz4ChargeAddJobs(ctx->Jobs,_i,ic,1);
+  }
+
+  // fill buffers
+
+  ctx->Run(Wz4ChargeFillTask,ctx->Jobs.GetCount());
+
+  sFORALL(Clusters,cl)
+  {
+    if(cl->Geo[geoindex])
+    {
+      cl->Geo[geoindex]->EndLoadVB();
+      cl->Geo[geoindex]->EndLoadIB();
+    }
+    if(cl->Matrices.GetCount() > W4C_MAXMATRICES)
+    {
+      sDPrintF(L"final matrix count for cluster %d: %d\n",_i,cl->Matrices.GetCount());
+      cl->Matrices.Resize(W4C_MAXMATRICES);
+    }
+  }
+
   sFORALL(Chunks,chunk)
   {
     if (chunk->FirstFace<Faces.GetCount())
     {
-      chunk->FirstIndex = firstindex[chunk->FirstFace];
+      chunk->FirstIndex = topo->FirstIndex[chunk->FirstFace];
       sInt n = Faces[chunk->FirstFace].Cluster; 
       if(Clusters[n]->ChunkEnd==0)
         Clusters[n]->ChunkStart = _i;
       Clusters[n]->ChunkEnd = _i+1;
     }
   }
-
-  delete[] firstFaceInCluster;
-  delete[] nextFaceInCluster;
-  delete[] firstindex;
-  delete[] vertseen;
-  delete[] map;
-  delete[] revmap;
-  delete[] jointtemp;
+  ctx->End();
 
 //  sDPrintF(L"charge: %5f - %9d / %9d\n",100.0f*Vertices.GetCount()/Vertices.GetSize(),Vertices.GetCount(),Vertices.GetSize());
 }
@@ -5077,6 +6208,13 @@ void Wz4Mesh::BeforeFrame(sInt EnvNum,sInt matcount,const sMatrix34CM *mat)
 {
   Wz4MeshCluster *cl;
 
+  if(InstanceBase)
+  {
+    sInt mc = mat ? matcount : 1;
+    InstanceBase->BeforeFrame(EnvNum,mc*InstanceMats.GetCount(),CombineInstances(mc,mat));
+    return;
+  }
+
   if(!BBoxValid)
     ChargeBBox();
   sFORALL(Clusters,cl)
@@ -5095,6 +6233,36 @@ void Wz4Mesh::Render(sInt flags,sInt index,const sMatrix34CM *mat,sF32 time,cons
   sVERIFY((flags & sRF_MATRIX_MASK)==0); // do not set matrix mask
   sInt geoindex = 0;
 
+  if(InstanceBase)
+  {
+    // drop instances that are outside the frustum, like clusters below
+
+    sInt ic = InstanceMats.GetCount();
+    CombineInstances(1,mat);
+    sMatrix34CM *mats = InstanceScratch.GetData();
+    if(!Doc->IsCacheWarmup)
+    {
+      InstanceBase->ChargeBBox();
+      sInt n = 0;
+      for(sInt i=0;i<ic;i++)
+      {
+        sFrustum fri;
+        fri.Transform(fr,mats[i]);
+        sFORALL(InstanceBase->Clusters,cl)
+        {
+          if(fri.IsInside(cl->Bounds))
+          {
+            mats[n++] = mats[i];
+            break;
+          }
+        }
+      }
+      ic = n;
+    }
+    if(ic>0)
+      InstanceBase->RenderInst(flags,index,ic,mats);
+    return;
+  }
 
   switch(flags & sRF_TARGET_MASK)
   {
@@ -5155,6 +6323,7 @@ void Wz4Mesh::Render(sInt flags,sInt index,const sMatrix34CM *mat,sF32 time,cons
         Wz4Mtrl *mtrl = cl->Mtrl ? cl->Mtrl : Wz4MeshType->DefaultMtrl;
         if(mtrl->SkipPhase(flags,index)) continue;
 
+        mtrl->PackBox = cl->PackBox[geoindex];
         if(Skeleton)
           mtrl->Set(flags,index,mat,cl->Matrices.GetCount(),basemat,cl->Matrices.GetData());
         else
@@ -5178,6 +6347,22 @@ void Wz4Mesh::RenderInst(sInt flags,sInt index,sInt mc,const sMatrix34CM *mats,s
   if(Skeleton)      // can't do this. please use bakeanim!
     return;
 
+  if(InstanceBase)
+  {
+    sInt ic = InstanceMats.GetCount();
+    sU32 *icolors = 0;
+    if(colors)
+    {
+      InstanceColorScratch.Resize(mc*ic);
+      icolors = InstanceColorScratch.GetData();
+      for(sInt i=0;i<mc;i++)
+        for(sInt j=0;j<ic;j++)
+          icolors[i*ic+j] = colors[i];
+    }
+    InstanceBase->RenderInst(flags,index,mc*ic,CombineInstances(mc,mats),icolors);
+    return;
+  }
+
   sGeometry *ig = 0;
   if(colors)
   {
@@ -5241,6 +6426,7 @@ void Wz4Mesh::RenderInst(sInt flags,sInt index,sInt mc,const sMatrix34CM *mats,s
         }
         cl->InstanceGeo[geoindex]->Merge(cl->Geo[geoindex&1],ig);
 
+        mtrl->PackBox = cl->PackBox[geoindex&1];
         mtrl->Set(flags,index,0,0,0,0);
 
         cl->InstanceGeo[geoindex]->Draw(0,0,mc,0);
@@ -5313,6 +6499,7 @@ void Wz4Mesh::RenderBone(sInt flags,sInt index,sInt mc,const sMatrix34CM *mats,s
         if(mtrl->SkipPhase(flags,index)) continue;
 //        if (mtrl!=lastmtrl)
         {
+          mtrl->PackBox = cl->PackBox[geoindex];
           mtrl->Set(flags,index,mat,cl->Matrices.GetCount(),mats,cl->Matrices.GetData());
           lastmtrl=mtrl;
         }
@@ -5403,6 +6590,7 @@ void Wz4Mesh::RenderBoneInst(sInt flags,sInt index,sInt mc,const sMatrix34CM *ma
         cl->InstanceGeo[geoindex]->Merge(cl->Geo[geoindex],InstanceGeo);
      //   if (mtrl!=lastmtrl)
         {
+          mtrl->PackBox = cl->PackBox[geoindex];
           mtrl->Set(flags,index,0,cl->Matrices.GetCount(),mats,cl->Matrices.GetData());
           lastmtrl=mtrl;
         }
@@ -33,6 +33,7 @@ public:
   sInt ChunkEnd;                  // last chunk id +1 in this cluster
   sInt IndexSize;                 // sGF_INDEX16 or sGF_INDEX32
   sAABBoxC Bounds;                // bounding box of the whole cluster
+  sAABBoxC PackBox[2];            // Bounds when Geo[] was filled, for packed positions
   sInt LocalRenderPass;           // used as sort key
 
   Wz4MeshCluster();
@@ -74,6 +75,10 @@ struct Wz4MeshVertex
   void CopyFrom(Wz4MeshVertex *v);
 };
 
+// Wz4MeshVertex::Skin() for many vertices at once, with sse where available.
+// out may not overlap the vertices.
+void Wz4SkinPositions(const sMatrix34 *basemat,sInt max,const Wz4MeshVertex *vp,sInt count,sVector31 *out);
+
 struct Wz4MeshFace
 {
   sInt Cluster;
@@ -139,6 +144,9 @@ class Wz4Mesh : public wObject
   sGeometry *InstanceGeo;
   sGeometry *InstancePlusGeo;
   sGeometry *WireGeoInst;
+  sArray<sMatrix34CM> InstanceScratch;
+  sArray<sU32> InstanceColorScratch;
+  const sMatrix34CM *CombineInstances(sInt mc,const sMatrix34CM *mats);
 public:
   sArray<Wz4MeshVertex> Vertices;
   sArray<Wz4MeshFace> Faces;
@@ -151,6 +159,18 @@ public:
 
   sString<64> Name;
 
+  // instancing: while InstanceBase is set, this mesh has no vertices or
+  // faces of its own and stands for InstanceBase transformed by each of
+  // InstanceMats, like after InstanceMats.GetCount() calls to Add().
+  // rendering uses RenderInst() on the base, Expand() builds the real mesh.
+
+  Wz4Mesh *InstanceBase;
+  sArray<sMatrix34> InstanceMats;
+
+  sBool CanInstance();
+  void SetInstances(Wz4Mesh *base,sInt count,const sMatrix34 *mats);
+  void Expand();
+
   Wz4Mesh();
   ~Wz4Mesh();
 
@@ -167,7 +187,7 @@ public:
   void AddDefaultCluster();
   void Add(Wz4Mesh *mesh);
   void MergeClusters();
-  void MergeVertices();           // merge identical vertices and kill unused vertices
+  void MergeVertices(sArray<sInt> *kept=0); // merge identical vertices and kill unused vertices. kept: old index of each new vertex
   sBool IsDegenerateFace(sInt face) const; // degenerate face: one in which a vertex position occurs twice
   void RemoveDegenerateFaces();
   void ConvertFrom(class ChaosMesh *);
@@ -257,7 +277,7 @@ public:
   void Facette(sF32 smooth=0);
   void Crease();                  // create a crease between selected and unselected faces
   void Uncrease(sInt select);     // remove all creases at the selected vertices
-  void Subdivide(sF32 smooth); // subdivide all selected faces
+  void Subdivide(sF32 smooth,sInt levels=1); // subdivide all selected faces. normals and tangents have to be recalculated
   void Extrude(sInt steps,sF32 amount,sInt flags,const sVector31 &center,sF32 localScale,sInt SelectUpdateFlag,const sVector2 &uvOffset);
   void Splitter(Wz4Mesh *in,sF32 depth,sF32 scale);
   void Dual(Wz4Mesh *in,sF32 random);
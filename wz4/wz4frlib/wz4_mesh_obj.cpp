@@ -7,164 +7,584 @@
 
 #include "wz4_mesh.hpp"
 #include "wz4_mtrl2_ops.hpp"
-#include "util/scanner.hpp"
+#include "util/taskscheduler.hpp"
 #include "wz4lib/basic_ops.hpp"
 
+/****************************************************************************/
+/***                                                                      ***/
+/***   OBJ import                                                         ***/
+/***                                                                      ***/
 /****************************************************************************/
 
-// TODO: support polygons with more than 4 vertices as soon as somebody writes
-// a proper triangulator for non-convex polys
+// the file is mapped in windows of at most Wz4ObjWindowSize bytes. each
+// window is split at line boundaries into chunks, which are parsed in
+// parallel. the chunks are merged in file order: a short sequential pass
+// assigns base indices and clusters, then vertices and faces are filled
+// in parallel again.
 
-sBool Wz4Mesh::LoadOBJ(const sChar *filename)
+static const sDInt Wz4ObjWindowSize = 256*1024*1024;
+static const sDInt Wz4ObjChunkSize = 4*1024*1024;
+
+struct Wz4ObjCorner
 {
-  sArray<sVector31> positions;
-  sArray<sVector30> normals;
-  sArray<sVector30> uvs;
+  sInt Pos,UV,Normal;             // indices as written in the file. 0 = not specified
+};
+
+struct Wz4ObjFace
+{
+  sInt FirstCorner;
+  sInt Count;
+  sInt Line;                      // local line, for error messages
+  sInt Pos,UV,Normal;             // local element counts when the face was read
+};
+
+struct Wz4ObjSegment
+{
+  sInt Face;                      // first local face
+  sInt Cluster;
+};
+
+struct Wz4ObjChunk
+{
+  const sU8 *Start;
+  const sU8 *End;
+
+  sArray<sVector31> Positions;
+  sArray<sVector30> UVs;
+  sArray<sVector30> Normals;
+  sArray<Wz4ObjFace> Faces;
+  sArray<Wz4ObjCorner> Corners;
+  sArray<sInt> Groups;            // local face index for each 'g'
+  sArray<Wz4ObjSegment> Segments;
+  sInt Lines;
+  const sChar *Error;
+  sInt ErrorLine;
+
+  // filled when merging
+
+  sInt FirstPos,FirstUV,FirstNormal;
+  sInt FirstFace,FirstVertex;
+
+  Wz4ObjChunk(const sU8 *start,const sU8 *end);
+  void SetError(const sChar *error,sInt line) { if(!Error) { Error = error; ErrorLine = line; } }
+  void Parse();
+  void ParseLine(const sU8 *s,const sU8 *e);
+  void ParseFace(const sU8 *s,const sU8 *e);
+};
+
+struct Wz4ObjLoader
+{
+  Wz4Mesh *Mesh;
+  Wz4ObjChunk **Chunks;
+  const sVector31 *Positions;
+  const sVector30 *UVs;
+  const sVector30 *Normals;
+};
+
+/****************************************************************************/
+
+static sINLINE sBool Wz4ObjIsSpace(sU8 c)
+{
+  return c==' ' || c=='\t' || c=='\r';
+}
+
+static sINLINE const sU8 *Wz4ObjSkipSpace(const sU8 *s,const sU8 *e)
+{
+  while(s<e && Wz4ObjIsSpace(*s)) s++;
+  return s;
+}
 
-  sScanner scan;
-  scan.Init();
-  scan.Flags = sSF_NUMBERCOMMENT|sSF_NEWLINE;
-  scan.AddTokens(L"/-.\\_");
-  scan.StartFile(filename);
+static sBool Wz4ObjInt(const sU8 *&s,const sU8 *e,sInt &val)
+{
+  const sU8 *p = s;
+  sBool neg = 0;
+  if(p<e && (*p=='-' || *p=='+'))
+    neg = (*p++=='-');
+  if(p==e || *p<'0' || *p>'9')
+    return 0;
+  sInt v = 0;
+  while(p<e && *p>='0' && *p<='9')
+    v = v*10 + (*p++-'0');
+  val = neg ? -v : v;
+  s = p;
+  return 1;
+}
 
-  sInt basecluster = Clusters.GetCount();
-  sInt curcluster = basecluster-1;
+// locale independent and much faster than going through sScanner.
+// more than 18 significant digits are ignored, which is well below float
+// precision anyway.
 
-  while (!scan.Errors && scan.Token!=sTOK_END)
+static sBool Wz4ObjFloat(const sU8 *&s,const sU8 *e,sF32 &val)
+{
+  static const sF64 pow10[] =
   {
-    if (scan.IfName(L"mtllib")) // material lib
-    {
-      scan.Scan(); // skip next token (material name)
-    }
-    else if (scan.IfName(L"o")) // object
-    {
-      scan.Scan(); // skip next token (object name)
-    }
-    else if (scan.IfName(L"g")) // group
+    1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+    1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22,
+  };
+
+  const sU8 *p = Wz4ObjSkipSpace(s,e);
+  sBool neg = 0;
+  if(p<e && (*p=='-' || *p=='+'))
+    neg = (*p++=='-');
+
+  sU64 mant = 0;
+  sInt digits = 0;
+  sInt sig = 0;
+  sInt exp = 0;
+  while(p<e && *p>='0' && *p<='9')
+  {
+    if(sig<18) { mant = mant*10 + (*p-'0'); if(mant) sig++; }
+    else exp++;
+    p++; digits++;
+  }
+  if(p<e && *p=='.')
+  {
+    p++;
+    while(p<e && *p>='0' && *p<='9')
     {
-      scan.Scan(); // skip name
-      curcluster++;
-      AddDefaultCluster();
-      Clusters.GetTail()->LocalRenderPass=curcluster-basecluster;
+      if(sig<18) { mant = mant*10 + (*p-'0'); if(mant) sig++; exp--; }
+      p++; digits++;
     }
-    else if (scan.IfName(L"usemtl")) // material ref
+  }
+  if(digits==0)
+    return 0;
+  if(p<e && (*p=='e' || *p=='E'))
+  {
+    sInt ev;
+    const sU8 *q = p+1;
+    if(Wz4ObjInt(q,e,ev))
     {
-      scan.Scan(); // skip next token (material name)
+      exp += sClamp(ev,-1000,1000);
+      p = q;
     }
-    else if (scan.IfName(L"s")) // smooth
+  }
+
+  sF64 v = sF64(mant);
+  if(mant!=0)
+  {
+    while(exp>22)  { v *= 1e22; exp -= 22; }
+    while(exp<-22) { v /= 1e22; exp += 22; }
+    if(exp>=0)
+      v *= pow10[exp];
+    else
+      v /= pow10[-exp];
+  }
+  val = sF32(neg ? -v : v);
+  s = p;
+  return 1;
+}
+
+/****************************************************************************/
+
+Wz4ObjChunk::Wz4ObjChunk(const sU8 *start,const sU8 *end)
+{
+  Start = start;
+  End = end;
+  Lines = 0;
+  Error = 0;
+  ErrorLine = 0;
+  FirstPos = FirstUV = FirstNormal = 0;
+  FirstFace = FirstVertex = 0;
+}
+
+void Wz4ObjChunk::Parse()
+{
+  const sU8 *s = Start;
+  const sU8 *e = End;
+
+  while(s<e && !Error)
+  {
+    const sU8 *eol = s;
+    while(eol<e && *eol!='\n') eol++;
+    Lines++;
+    ParseLine(s,eol);
+    s = eol+1;
+  }
+
+  // end pointers are only valid while the window is mapped
+
+  Start = End = 0;
+}
+
+void Wz4ObjChunk::ParseLine(const sU8 *s,const sU8 *e)
+{
+  s = Wz4ObjSkipSpace(s,e);
+  if(s==e || *s=='#')
+    return;
+
+  const sU8 *key = s;
+  while(s<e && !Wz4ObjIsSpace(*s)) s++;
+  sDInt len = s-key;
+
+  if(len==1 && key[0]=='v') // vertex pos
+  {
+    sVector31 pos;
+    if(!Wz4ObjFloat(s,e,pos.x) || !Wz4ObjFloat(s,e,pos.y) || !Wz4ObjFloat(s,e,pos.z))
+      SetError(L"number expected",Lines);
+    else
+      Positions.AddTail(pos);
+  }
+  else if(len==2 && key[0]=='v' && key[1]=='t') // vertex uv
+  {
+    sVector30 uv;
+    if(!Wz4ObjFloat(s,e,uv.x) || !Wz4ObjFloat(s,e,uv.y))
+      SetError(L"number expected",Lines);
+    else
     {
-      scan.Scan(); // skip next token (smooth on/off)
+      if(!Wz4ObjFloat(s,e,uv.z))
+        uv.z = 0;
+      UVs.AddTail(uv);
     }
-    else if (scan.IfName(L"v")) // vertex pos
+  }
+  else if(len==2 && key[0]=='v' && key[1]=='n') // vertex normal
+  {
+    sVector30 n;
+    if(!Wz4ObjFloat(s,e,n.x) || !Wz4ObjFloat(s,e,n.y) || !Wz4ObjFloat(s,e,n.z))
+      SetError(L"number expected",Lines);
+    else
+      Normals.AddTail(n);
+  }
+  else if(len==1 && key[0]=='f') // face
+  {
+    ParseFace(s,e);
+  }
+  else if(len==1 && key[0]=='g') // group
+  {
+    Groups.AddTail(Faces.GetCount());
+  }
+
+  // everything else (mtllib, o, usemtl, s, ...) is skipped
+}
+
+void Wz4ObjChunk::ParseFace(const sU8 *s,const sU8 *e)
+{
+  sInt first = Corners.GetCount();
+  sInt count = 0;
+
+  for(;;)
+  {
+    s = Wz4ObjSkipSpace(s,e);
+    if(s==e || !((*s>='0' && *s<='9') || *s=='-' || *s=='+'))
+      break;
+    if(count==4)
     {
-      sVector31 pos;
-      pos.x=scan.ScanFloat();
-      pos.y=scan.ScanFloat();
-      pos.z=scan.ScanFloat();
-      positions.AddTail(pos);
+      SetError(L"too many vertices per face (max 4)",Lines);
+      break;
     }
-    else if (scan.IfName(L"vt")) // vertex uv
+
+    Wz4ObjCorner c;
+    c.UV = 0;
+    c.Normal = 0;
+    if(!Wz4ObjInt(s,e,c.Pos) || c.Pos==0)
     {
-      sVector30 uv;
-      uv.x=scan.ScanFloat();
-      uv.y=scan.ScanFloat();
-      if (scan.Token==sTOK_INT || scan.Token==sTOK_FLOAT || scan.Token=='-')
-        uv.z=scan.ScanFloat();
-      else
-        uv.z=0;
-      uvs.AddTail(uv);
+      SetError(L"invalid vtx index",Lines);
+      break;
     }
-    else if (scan.IfName(L"vn")) // vertex normal
+    if(s<e && *s=='/')
     {
-      sVector30 n;
-      n.x=scan.ScanFloat();
-      n.y=scan.ScanFloat();
-      n.z=scan.ScanFloat();
-      normals.AddTail(n);
+      s++;
+      if(Wz4ObjInt(s,e,c.UV) && c.UV==0)
+      {
+        SetError(L"invalid texcoord index",Lines);
+        break;
+      }
+      if(s<e && *s=='/')
+      {
+        s++;
+        if(!Wz4ObjInt(s,e,c.Normal) || c.Normal==0)
+        {
+          SetError(L"invalid normal index",Lines);
+          break;
+        }
+      }
     }
-    else if (scan.IfName(L"f")) // face
+    Corners.AddTail(c);
+    count++;
+  }
+
+  if(!Error && count>2)
+  {
+    Wz4ObjFace f;
+    f.FirstCorner = first;
+    f.Count = count;
+    f.Line = Lines;
+    f.Pos = Positions.GetCount();
+    f.UV = UVs.GetCount();
+    f.Normal = Normals.GetCount();
+    Faces.AddTail(f);
+  }
+  else
+  {
+    Corners.Resize(first);
+  }
+}
+
+/****************************************************************************/
+
+static void Wz4ObjParseTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Wz4ObjChunk **chunks = (Wz4ObjChunk **) data;
+  for(sInt i=start;i<start+count;i++)
+    chunks[i]->Parse();
+}
+
+static void Wz4ObjGatherTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Wz4ObjLoader *ld = (Wz4ObjLoader *) data;
+  for(sInt i=start;i<start+count;i++)
+  {
+    Wz4ObjChunk *c = ld->Chunks[i];
+    sCopyMem((void *)(ld->Positions+c->FirstPos),c->Positions.GetData(),c->Positions.GetCount()*sizeof(sVector31));
+    sCopyMem((void *)(ld->UVs+c->FirstUV),c->UVs.GetData(),c->UVs.GetCount()*sizeof(sVector30));
+    sCopyMem((void *)(ld->Normals+c->FirstNormal),c->Normals.GetData(),c->Normals.GetCount()*sizeof(sVector30));
+    c->Positions.Reset();
+    c->UVs.Reset();
+    c->Normals.Reset();
+  }
+}
+
+// obj indices are 1-based, negative indices are relative to the current end
+
+static sINLINE sInt Wz4ObjResolve(sInt index,sInt count)
+{
+  sInt i = index>0 ? index-1 : count+index;
+  return (i>=0 && i<count) ? i : -1;
+}
+
+static void Wz4ObjFillTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Wz4ObjLoader *ld = (Wz4ObjLoader *) data;
+  for(sInt i=start;i<start+count;i++)
+  {
+    Wz4ObjChunk *c = ld->Chunks[i];
+    Wz4MeshVertex *vp = ld->Mesh->Vertices.GetData() + c->FirstVertex;
+    Wz4MeshFace *fp = ld->Mesh->Faces.GetData() + c->FirstFace;
+    sInt seg = 0;
+
+    for(sInt fi=0;fi<c->Faces.GetCount() && !c->Error;fi++)
     {
-      sInt verts[4];
-      sInt vcount=0;
-      while (scan.Token==sTOK_INT && vcount<4)
+      const Wz4ObjFace &of = c->Faces[fi];
+      while(seg+1<c->Segments.GetCount() && c->Segments[seg+1].Face<=fi)
+        seg++;
+
+      Wz4MeshFace &mf = fp[fi];
+      mf.Init(of.Count);
+      mf.Cluster = c->Segments[seg].Cluster;
+
+      for(sInt j=0;j<of.Count;j++)
       {
-        sInt pindex=scan.ScanInt()-1;
-        sInt tindex=-1;
-        sInt nindex=-1;
-        if (pindex<0 || pindex>=positions.GetCount())
+        const Wz4ObjCorner &oc = c->Corners[of.FirstCorner+j];
+        Wz4MeshVertex &v = vp[of.FirstCorner+j];
+        v.Zero();
+
+        sInt pi = Wz4ObjResolve(oc.Pos,c->FirstPos+of.Pos);
+        if(pi<0)
         {
-          scan.Error(L"invalid vtx index");
+          c->SetError(L"invalid vtx index",of.Line);
           break;
         }
-        if (scan.IfToken(L'/'))
+        v.Pos = ld->Positions[pi];
+
+        if(oc.UV)
         {
-          if (scan.Token==sTOK_INT)
+          sInt ti = Wz4ObjResolve(oc.UV,c->FirstUV+of.UV);
+          if(ti<0)
           {
-            tindex=scan.ScanInt()-1;
-            if (tindex<0 || tindex>=uvs.GetCount())
-            {
-              scan.Error(L"invalid texcoord index");
-              break;
-            }
+            c->SetError(L"invalid texcoord index",of.Line);
+            break;
           }
-          if (scan.IfToken(L'/'))
+          v.U0 = ld->UVs[ti].x;
+          v.V0 = ld->UVs[ti].y;
+        }
+        if(oc.Normal)
+        {
+          sInt ni = Wz4ObjResolve(oc.Normal,c->FirstNormal+of.Normal);
+          if(ni<0)
           {
-            nindex=scan.ScanInt()-1;
-            if (nindex<0 || nindex>=normals.GetCount())
-            {
-              scan.Error(L"invalid normal index");
-              break;
-            }
+            c->SetError(L"invalid normal index",of.Line);
+            break;
           }
+          v.Normal = ld->Normals[ni];
         }
+        mf.Vertex[j] = c->FirstVertex+of.FirstCorner+j;
+      }
+    }
+  }
+}
 
-        // create vertex
-        Wz4MeshVertex v;
-        v.Zero();
-        v.Pos=positions[pindex];
-        if (nindex>=0) 
-          v.Normal = normals[nindex];
-        if (tindex>=0)
-        {
-          v.U0 = uvs[tindex].x;
-          v.V0 = uvs[tindex].y;
-        }
-        verts[vcount++]=Vertices.GetCount();
-        Vertices.AddTail(v);
+static sBool Wz4ObjCheckErrors(const sChar *filename,sArray<Wz4ObjChunk *> &chunks)
+{
+  sInt line = 0;
+  Wz4ObjChunk *c;
+  sFORALL(chunks,c)
+  {
+    if(c->Error)
+    {
+      sDPrintF(L"%s(%d): %s\n",filename,line+c->ErrorLine,c->Error);
+      return 0;
+    }
+    line += c->Lines;
+  }
+  return 1;
+}
+
+static void Wz4ObjRun(sStsCode code,void *data,sInt count)
+{
+  if(count==0)
+    return;
+  sStsWorkload *wl = sSched->BeginWorkload();
+  sStsTask *task = wl->NewTask(code,data,count,0);
+  wl->AddTask(task);
+  wl->Start();
+  wl->Sync();
+  wl->End();
+}
+
+/****************************************************************************/
+
+// TODO: support polygons with more than 4 vertices as soon as somebody writes
+// a proper triangulator for non-convex polys
+
+sBool Wz4Mesh::LoadOBJ(const sChar *filename)
+{
+  sFile *file = sCreateFile(filename,sFA_READ);
+  if(!file)
+  {
+    sDPrintF(L"%s: could not open file\n",filename);
+    return 0;
+  }
+
+  sArray<Wz4ObjChunk *> chunks;
+  sBool ok = 1;
+  sU8 *buffer = 0;                // used when the file can't be mapped
+  sS64 size = file->GetSize();
+  sS64 pos = 0;
+
+  // parse one window after the other. windows start at 64k boundaries,
+  // the granularity required for mapping on windows.
+
+  while(ok && pos<size)
+  {
+    sS64 mapofs = pos & ~sS64(0xffff);
+    sDInt mapsize = sDInt(sMin<sS64>(size-mapofs,Wz4ObjWindowSize));
+    const sU8 *data = file->Map(mapofs,mapsize);
+    if(!data)
+    {
+      if(!buffer)
+        buffer = new sU8[Wz4ObjWindowSize];
+      if(!file->SetOffset(mapofs) || !file->Read(buffer,mapsize))
+      {
+        sDPrintF(L"%s: read error\n",filename);
+        ok = 0;
+        break;
       }
+      data = buffer;
+    }
 
-      if (scan.Token==sTOK_INT)
+    const sU8 *start = data + (pos-mapofs);
+    const sU8 *end = data + mapsize;
+    if(mapofs+mapsize<size)       // more to come: stop after last complete line
+    {
+      while(end>start && end[-1]!='\n') end--;
+      if(end==start)
       {
-        scan.Error(L"too many vertices per face (max 4)");
+        sDPrintF(L"%s: line too long\n",filename);
+        ok = 0;
         break;
       }
-      
-      // create face
-      if (!scan.Errors && vcount>2)
+    }
+    pos = mapofs + (end-data);
+
+    sInt first = chunks.GetCount();
+    while(start<end)
+    {
+      const sU8 *ce = start + sMin<sDInt>(end-start,Wz4ObjChunkSize);
+      while(ce<end && ce[-1]!='\n') ce++;
+      chunks.AddTail(new Wz4ObjChunk(start,ce));
+      start = ce;
+    }
+
+    Wz4ObjRun(Wz4ObjParseTask,chunks.GetData()+first,chunks.GetCount()-first);
+    ok = Wz4ObjCheckErrors(filename,chunks);
+  }
+
+  delete[] buffer;
+  delete file;
+
+  // merge: assign base indices and clusters in file order
+
+  sArray<sVector31> positions;
+  sArray<sVector30> normals;
+  sArray<sVector30> uvs;
+
+  if(ok)
+  {
+    sInt basecluster = Clusters.GetCount();
+    sInt curcluster = basecluster-1;
+    sInt npos=0,nuv=0,nnormal=0,nface=Faces.GetCount(),nvertex=Vertices.GetCount();
+
+    Wz4ObjChunk *c;
+    sFORALL(chunks,c)
+    {
+      c->FirstPos = npos;
+      c->FirstUV = nuv;
+      c->FirstNormal = nnormal;
+      c->FirstFace = nface;
+      c->FirstVertex = nvertex;
+      npos += c->Positions.GetCount();
+      nuv += c->UVs.GetCount();
+      nnormal += c->Normals.GetCount();
+      nface += c->Faces.GetCount();
+      nvertex += c->Corners.GetCount();
+
+      // each 'g' starts a cluster, faces before the first group get a default cluster
+
+      sInt face = 0;
+      for(sInt g=0;g<=c->Groups.GetCount();g++)
       {
-        // add default cluster if there's no group yet
-        if (curcluster<basecluster)
+        sInt end = g<c->Groups.GetCount() ? c->Groups[g] : c->Faces.GetCount();
+        if(end>face)
+        {
+          if(curcluster<basecluster)
+          {
+            curcluster++;
+            AddDefaultCluster();
+          }
+          Wz4ObjSegment *seg = c->Segments.AddMany(1);
+          seg->Face = face;
+          seg->Cluster = curcluster;
+          face = end;
+        }
+        if(g<c->Groups.GetCount())
         {
           curcluster++;
           AddDefaultCluster();
+          Clusters.GetTail()->LocalRenderPass=curcluster-basecluster;
         }
-
-        Wz4MeshFace f;
-        f.Init(vcount);
-        f.Cluster = curcluster;
-        for (sInt i=0; i<vcount; i++)
-          f.Vertex[i]=verts[i];
-        Faces.AddTail(f);       
       }
     }
 
-    // consume rest of line (who knows)
-    while (!scan.Errors && scan.Token!=sTOK_END && scan.Token!=sTOK_NEWLINE)
-      scan.Scan();
-    scan.IfToken(sTOK_NEWLINE);
+    positions.AddMany(npos);
+    uvs.AddMany(nuv);
+    normals.AddMany(nnormal);
+    Vertices.AddMany(nvertex-Vertices.GetCount());
+    Faces.AddMany(nface-Faces.GetCount());
+
+    Wz4ObjLoader ld;
+    ld.Mesh = this;
+    ld.Chunks = chunks.GetData();
+    ld.Positions = positions.GetData();
+    ld.UVs = uvs.GetData();
+    ld.Normals = normals.GetData();
+
+    Wz4ObjRun(Wz4ObjGatherTask,&ld,chunks.GetCount());
+    Wz4ObjRun(Wz4ObjFillTask,&ld,chunks.GetCount());
+    ok = Wz4ObjCheckErrors(filename,chunks);
   }
 
-  if (!scan.Errors)
+  sDeleteAll(chunks);
+
+  if(ok)
   {
     RemoveDegenerateFaces();
     MergeVertices();
@@ -173,58 +593,160 @@ sBool Wz4Mesh::LoadOBJ(const sChar *filename)
     CalcTangents();
   }
 
-  return !scan.Errors;
+  return ok;
 }
 
-sBool Wz4Mesh::SaveOBJ(const sChar *file)
+/****************************************************************************/
+/***                                                                      ***/
+/***   OBJ export                                                         ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+// lines are formatted in parallel into 8 bit buffers, which are then written
+// in order. the output is the same as with sTextFileWriter.
+
+enum Wz4ObjSection
 {
-  sInt i;
-  sTextFileWriter tw(file);
-  //tw.Print(L"test%d",10);
-  
-  tw.PrintF(L"#WZ4 Export\n\n");
-    
-  //Vertices
-  tw.PrintF(L"#begin %d vertices\n",Vertices.GetCount());
-  for (i=0;i<Vertices.GetCount();i++)
-  {
-    tw.PrintF(L"v %f %f %f\n",Vertices[i].Pos.x,Vertices[i].Pos.y,Vertices[i].Pos.z);
-  }
-  tw.PrintF(L"#end %d vertices\n\n",Vertices.GetCount());
-  
+  W4OS_POS = 0,
+  W4OS_NORMAL,
+  W4OS_UV,
+  W4OS_FACE,
+};
 
-  //Normals
-  tw.PrintF(L"#begin %d normals\n",Vertices.GetCount());
-  for (i=0;i<Vertices.GetCount();i++)
+struct Wz4ObjSaveJob
+{
+  Wz4Mesh *Mesh;
+  sInt Section;
+  sInt Start;
+  sInt End;
+  sArray<sU8> Out;
+};
+
+static void Wz4ObjAppend(sArray<sU8> &out,const sChar *text)
+{
+  sInt len = sGetStringLen(text);
+  sU8 *d = out.AddMany(len*2);
+  sU8 *s = d;
+  for(sInt i=0;i<len;i++)
   {
-    tw.PrintF(L"vn %f %f %f\n",Vertices[i].Normal.x,Vertices[i].Normal.y,Vertices[i].Normal.z);
+    if(sCONFIG_SYSTEM_WINDOWS && text[i]=='\n' && (i==0 || text[i-1]!='\r'))
+      *d++ = '\r';
+    *d++ = text[i] & 0xff;
   }
-  tw.PrintF(L"#end %d normals\n\n",Vertices.GetCount());
+  out.Resize(out.GetCount()-len*2+sInt(d-s));
+}
 
-  //UV
-  tw.PrintF(L"#begin texture vertices\n");
-  for (i=0;i<Vertices.GetCount();i++)
+static void Wz4ObjSaveTask(sStsManager *,sStsThread *,sInt start,sInt count,void *data)
+{
+  Wz4ObjSaveJob *jobs = (Wz4ObjSaveJob *) data;
+  sString<256> line;
+
+  for(sInt n=start;n<start+count;n++)
   {
-    tw.PrintF(L"vt %f %f 0.00000\n",Vertices[i].U0,Vertices[i].V0);
+    Wz4ObjSaveJob *job = &jobs[n];
+    const Wz4MeshVertex *mv = job->Mesh->Vertices.GetData();
+    const Wz4MeshFace *mf = job->Mesh->Faces.GetData();
+    job->Out.HintSize((job->End-job->Start)*40);
+
+    for(sInt i=job->Start;i<job->End;i++)
+    {
+      switch(job->Section)
+      {
+      case W4OS_POS:
+        sSPrintF(line,L"v %f %f %f\n",mv[i].Pos.x,mv[i].Pos.y,mv[i].Pos.z);
+        break;
+      case W4OS_NORMAL:
+        sSPrintF(line,L"vn %f %f %f\n",mv[i].Normal.x,mv[i].Normal.y,mv[i].Normal.z);
+        break;
+      case W4OS_UV:
+        sSPrintF(line,L"vt %f %f 0.00000\n",mv[i].U0,mv[i].V0);
+        break;
+      case W4OS_FACE:
+        line = L"f";
+        for(sInt j=0;j<mf[i].Count;j++)
+        {
+          sInt t=mf[i].Vertex[j]+1;
+          line.PrintAddF(L" %d/%d/%d",t,t,t);
+        }
+        line.Add(L"\n");
+        break;
+      }
+      Wz4ObjAppend(job->Out,line);
+    }
   }
-  tw.PrintF(L"#end texture vertices\n\n");
+}
+
+static sBool Wz4ObjWriteText(sFile *file,const sChar *text)
+{
+  sArray<sU8> out;
+  Wz4ObjAppend(out,text);
+  return file->Write(out.GetData(),out.GetCount());
+}
+
+static sBool Wz4ObjWriteSection(sFile *file,Wz4Mesh *mesh,sInt section,sInt count)
+{
+  const sInt lines = 0x4000;
+  const sInt batch = sMax(1,sSched->GetThreadCount()*4);
+  sBool ok = 1;
 
-  //faces  
-  tw.PrintF(L"#begin %d faces\n",Faces.GetCount());
-  for (i=0;i<Faces.GetCount();i++)
+  for(sInt start=0;start<count && ok;start+=lines*batch)
   {
-    tw.Print(L"f");
-    for (int j=0;j<Faces[i].Count;j++)
+    sInt n = sMin(batch,(count-start+lines-1)/lines);
+    Wz4ObjSaveJob *jobs = new Wz4ObjSaveJob[n];
+    for(sInt i=0;i<n;i++)
     {
-      sInt t=Faces[i].Vertex[j]+1;
-      tw.PrintF(L" %d/%d/%d",t,t,t);
+      jobs[i].Mesh = mesh;
+      jobs[i].Section = section;
+      jobs[i].Start = start+i*lines;
+      jobs[i].End = sMin(count,jobs[i].Start+lines);
     }
-    tw.Print(L"\n");
+    Wz4ObjRun(Wz4ObjSaveTask,jobs,n);
+    for(sInt i=0;i<n && ok;i++)
+      ok = file->Write(jobs[i].Out.GetData(),jobs[i].Out.GetCount());
+    delete[] jobs;
   }
-  tw.PrintF(L"#end %d faces\n\n",Faces.GetCount());
-  
-  return true;
+  return ok;
 }
 
-/****************************************************************************/
+sBool Wz4Mesh::SaveOBJ(const sChar *filename)
+{
+  sFile *file = sCreateFile(filename,sFA_WRITE);
+  if(!file)
+    return 0;
+
+  sString<256> buffer;
+  sBool ok = Wz4ObjWriteText(file,L"#WZ4 Export\n\n");
+
+  //Vertices
+  sSPrintF(buffer,L"#begin %d vertices\n",Vertices.GetCount());
+  ok = ok && Wz4ObjWriteText(file,buffer);
+  ok = ok && Wz4ObjWriteSection(file,this,W4OS_POS,Vertices.GetCount());
+  sSPrintF(buffer,L"#end %d vertices\n\n",Vertices.GetCount());
+  ok = ok && Wz4ObjWriteText(file,buffer);
+
+  //Normals
+  sSPrintF(buffer,L"#begin %d normals\n",Vertices.GetCount());
+  ok = ok && Wz4ObjWriteText(file,buffer);
+  ok = ok && Wz4ObjWriteSection(file,this,W4OS_NORMAL,Vertices.GetCount());
+  sSPrintF(buffer,L"#end %d normals\n\n",Vertices.GetCount());
+  ok = ok && Wz4ObjWriteText(file,buffer);
+
+  //UV
+  ok = ok && Wz4ObjWriteText(file,L"#begin texture vertices\n");
+  ok = ok && Wz4ObjWriteSection(file,this,W4OS_UV,Vertices.GetCount());
+  ok = ok && Wz4ObjWriteText(file,L"#end texture vertices\n\n");
+
+  //faces
+  sSPrintF(buffer,L"#begin %d faces\n",Faces.GetCount());
+  ok = ok && Wz4ObjWriteText(file,buffer);
+  ok = ok && Wz4ObjWriteSection(file,this,W4OS_FACE,Faces.GetCount());
+  sSPrintF(buffer,L"#end %d faces\n\n",Faces.GetCount());
+  ok = ok && Wz4ObjWriteText(file,buffer);
 
+  if(!file->Close())
+    ok = 0;
+  delete file;
+  return ok;
+}
+
+/****************************************************************************/
@@ -128,6 +128,8 @@ void ModMtrlType_::Init()
   sc->RegPara(L"ZShaderProjB",SCT_FLOAT,sOFFSET(ModEnvNum,ZShaderProjB));
   sc->RegPara(L"RandomDisc",SCT_FLOAT4A4,sOFFSET(ModEnvNum,RandomDisc));
   sc->RegPara(L"ShellExtrude",SCT_FLOAT,sOFFSET(ModEnvNum,ShellExtrude));
+  sc->RegPara(L"PackCenter",SCT_FLOAT3,sOFFSET(ModEnvNum,PackCenter));
+  sc->RegPara(L"PackRadius",SCT_FLOAT3,sOFFSET(ModEnvNum,PackRadius));
 }
 
 void ModMtrlType_::Exit()
@@ -529,6 +531,8 @@ void ModEnvNum::Init()
   ZShaderProjB = 0;
   ClipFarR = 0;
   ShellExtrude = 0;
+  PackCenter.Init(0,0,0);
+  PackRadius.Init(1,1,1);
 }
 
 void ModEnvNum::Calc(sViewport &view)
@@ -849,6 +853,8 @@ void ModMtrl::Set(sInt flags,sInt index,const sMatrix34CM *mat,sInt SkinMatCount
       ModEnvNum *env = ModMtrlType->EnvNum[index];
 
       env->ShellExtrude = ShellExtrude;
+      env->PackCenter = PackBox.Center;
+      env->PackRadius = PackBox.Radius;
 
       sCBufferBase *modelcb;
       if(mat)
@@ -1005,6 +1011,15 @@ sBool ModMtrl::SkipPhase(sInt flags,sInt EnvNum)
 /***                                                                      ***/
 /****************************************************************************/
 
+// unit vector from octahedral encoding, see Wz4PackOct() in wz4_vertexpack.hpp
+
+static void OctDecode(ShaderCreator *sc,const sChar *out,const sChar *in)
+{
+  sc->TB.PrintF(L"  float3 %s = float3(%s.xy,1-abs(%s.x)-abs(%s.y));\n",out,in,in,in);
+  sc->TB.PrintF(L"  %s.xy += (%s.xy>=0 ? -1 : 1)*saturate(-%s.z);\n",out,out,out);
+  sc->TB.PrintF(L"  %s = normalize(%s);\n",out,out);
+}
+
 CachedModShader *ModMtrl::FindShader(const CachedModInfo &info)
 {
   CachedModShader *mod;
@@ -1385,7 +1400,20 @@ CachedModShader *ModMtrl::CreateShader(const CachedModInfo &info)
   for(sInt i=0;i<InputPara.GetSize();i++)
     sc->Output(sPoolF(L"t%d",i),SCT_FLOAT4,SCB_UV,i);
   sc->Output(L"o_ss_pos",SCT_FLOAT4,SCB_POS);
-  sc->BindVS(L"ms_posvert",SCT_FLOAT3,SCB_POSVERT);
+  if(FeatureFlags & MMFF_PackedPos)
+  {
+    sc->FragBegin(L"packed vertex");
+    sc->FragFirst(L"ms_posvert");
+    sc->BindVS(L"ms_posvert_pre",SCT_FLOAT3,SCB_POSVERT);
+    sc->Para(L"PackCenter");
+    sc->Para(L"PackRadius");
+    sc->TB.Print(L"  float3 ms_posvert = PackCenter+ms_posvert_pre*PackRadius;\n");
+    sc->FragEnd();
+  }
+  else
+  {
+    sc->BindVS(L"ms_posvert",SCT_FLOAT3,SCB_POSVERT);
+  }
 
   sc->FragBegin(L"original vertex");
   sc->FragRead(L"ms_posvert");
@@ -1648,10 +1676,18 @@ CachedModShader *ModMtrl::CreateShader(const CachedModInfo &info)
   {
     sc->FragBegin(L"inputs");
     sc->FragFirst(L"ms_normalvert");
-    sc->BindVS(L"ms_normalvert_pre",SCT_FLOAT3,SCB_NORMAL);
-    sc->TB.PrintF(L"  float3 ms_normalvert = ms_normalvert_pre.xyz;\n");
-    if(FeatureFlags & MMFF_NormalI4)
-      sc->TB.PrintF(L"  ms_normalvert = normalize(ms_normalvert/127.0-1);\n",index/4,sc->swizzle[index&3][3]);
+    if(FeatureFlags & MMFF_CompactVertex)
+    {
+      sc->BindVS(L"ms_normalvert_pre",SCT_FLOAT2,SCB_NORMAL);
+      OctDecode(sc,L"ms_normalvert",L"ms_normalvert_pre");
+    }
+    else
+    {
+      sc->BindVS(L"ms_normalvert_pre",SCT_FLOAT3,SCB_NORMAL);
+      sc->TB.PrintF(L"  float3 ms_normalvert = ms_normalvert_pre.xyz;\n");
+      if(FeatureFlags & MMFF_NormalI4)
+        sc->TB.PrintF(L"  ms_normalvert = normalize(ms_normalvert/127.0-1);\n",index/4,sc->swizzle[index&3][3]);
+    }
 
     if(index>=0)
       sc->TB.PrintF(L"  t%d.%s = ms_normalvert;\n",index/4,sc->swizzle[index&3][3]);
@@ -1673,7 +1709,16 @@ CachedModShader *ModMtrl::CreateShader(const CachedModInfo &info)
   if(sc->Requires(L"ms_tangent",index))
   {
     sc->FragBegin(L"inputs");
-    sc->BindVS(L"ms_tangent",SCT_FLOAT3,SCB_TANGENT);
+    if(FeatureFlags & MMFF_CompactVertex)
+    {
+      sc->FragFirst(L"ms_tangent");
+      sc->BindVS(L"ms_tangent_pre",SCT_FLOAT2,SCB_TANGENT);
+      OctDecode(sc,L"ms_tangent",L"ms_tangent_pre");
+    }
+    else
+    {
+      sc->BindVS(L"ms_tangent",SCT_FLOAT3,SCB_TANGENT);
+    }
     if(index>=0)
       sc->TB.PrintF(L"  t%d.%s = ms_tangent;\n",index/4,sc->swizzle[index&3][3]);
     sc->FragEnd();
@@ -1798,17 +1843,25 @@ CachedModShader *ModMtrl::CreateShader(const CachedModInfo &info)
 
   sc->Shift(0,0,0);
 
+  sBool compact = (FeatureFlags & MMFF_CompactVertex)!=0;
   sU32 descdata[32],*desc=descdata;
-  *desc++ = sVF_POSITION|sVF_F3;
+  if(FeatureFlags & MMFF_PackedPos)
+    *desc++ = sVF_POSITION|sVF_S4;
+  else
+    *desc++ = sVF_POSITION|sVF_F3;
   if(sc->Requires(L"ms_normalvert_pre",index))
   {
-    if(FeatureFlags & MMFF_NormalI4)
+    if(compact)
+      *desc++ = sVF_NORMAL|sVF_S2;
+    else if(FeatureFlags & MMFF_NormalI4)
       *desc++ = sVF_NORMAL|sVF_I4;
     else
       *desc++ = sVF_NORMAL|sVF_F3;
   }
   if(sc->Requires(L"ms_tangent",index))
     *desc++ = sVF_TANGENT|sVF_F3;
+  if(sc->Requires(L"ms_tangent_pre",index))
+    *desc++ = sVF_TANGENT|sVF_S2;
   if(sc->Requires(L"ms_bitangent",index))
     *desc++ = sVF_BINORMAL|sVF_F3;
   if(sc->Requires(L"blendindices",index))
@@ -1816,9 +1869,9 @@ CachedModShader *ModMtrl::CreateShader(const CachedModInfo &info)
   if(sc->Requires(L"blendweight",index))
     *desc++ = sVF_BONEWEIGHT|sVF_I4;
   if(sc->Requires(L"uv0",index))
-    *desc++ = sVF_UV0|sVF_F2;
+    *desc++ = sVF_UV0|(compact ? sVF_H2 : sVF_F2);
   if(sc->Requires(L"uv1",index))
-    *desc++ = sVF_UV1|sVF_F2;
+    *desc++ = sVF_UV1|(compact ? sVF_H2 : sVF_F2);
   if(sc->Requires(L"instmat0",index))
     *desc++ = sVF_UV5|sVF_F4|sVF_STREAM1|sVF_INSTANCEDATA;
   if(sc->Requires(L"instmat1",index))
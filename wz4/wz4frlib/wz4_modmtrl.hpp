@@ -50,6 +50,8 @@ enum ModMtrlEnum
   MMFF_ShadowCastToAll= 0x00000200, // cast shadows only in my own light environment, not just all of them
   MMFF_NormalI4       = 0x00000400, // use sVF_I4 for normals instead of sVF_F3
   MMFF_DoubleSidedLight = 0x000800, // use doublesided lighting
+  MMFF_CompactVertex  = 0x00001000, // octahedral sVF_S2 normals and tangents, sVF_H2 uv's
+  MMFF_PackedPos      = 0x00002000, // sVF_S4 positions relative to the cluster bounds
 
   MM_MaxLight         = 16,          // some more constants
   MM_MaxT             = 10,
@@ -186,6 +188,8 @@ struct ModEnvNum                // var environment
   sF32 ZShaderProjB;
 
   sF32 ShellExtrude;
+  sVector31 PackCenter;           // Wz4Mtrl::PackBox of the cluster
+  sVector30 PackRadius;
 };
 
 struct CachedModInfo
@@ -7,6 +7,7 @@
 
 #include "wz4frlib/wz4_mtrl2.hpp"
 #include "wz4frlib/wz4_mtrl2_ops.hpp"
+#include "wz4frlib/wz4_vertexpack.hpp"
 #include "shadercomp/shadercomp.hpp"
 #include "shadercomp/shaderdis.hpp"
 
@@ -15,6 +16,8 @@
 void Wz4MtrlType_::Init()
 {
   MaterialPrimitiveGeo = 0;
+  MaterialPrimitiveBox.Center.Init(0,0,0);
+  MaterialPrimitiveBox.Radius.Init(1,1,1);
 
   sClear(Shaders);
   sClear(Formats);
@@ -143,6 +146,180 @@ void Wz4MtrlType_::Exit()
 }
 
 
+/****************************************************************************/
+
+// sGeometry::LoadTorus() and LoadCube() can not write the packed elements
+// of ModMtrl's compact vertices. for those formats the preview primitives
+// are built here, encoded like Wz4Mesh::ChargeSolid() does, positions
+// relative to the box that is passed to the material as PackBox. elements
+// not listed here are left zero.
+
+static sBool Wz4PreviewPacked(sVertexFormatHandle *fmt)
+{
+  for(const sU32 *desc=fmt->GetDesc();*desc;desc++)
+  {
+    sU32 type = *desc & sVF_TYPEMASK;
+    if(!(*desc & sVF_STREAMMASK) && (type==sVF_S4 || type==sVF_S2 || type==sVF_H2))
+      return 1;
+  }
+  return 0;
+}
+
+struct Wz4PreviewVertex
+{
+  sVector31 Pos;
+  sVector30 Normal;
+  sVector30 Tangent;
+  sF32 U,V;
+};
+
+static void Wz4LoadPreview(sGeometry *geo,const sArray<Wz4PreviewVertex> &verts,const sArray<sU16> &index,const sAABBoxC &box)
+{
+  sVertexFormatHandle *fmt = geo->GetFormat();
+  sInt size = fmt->GetSize(0);
+  sU8 *vp;
+
+  geo->BeginLoadVB(verts.GetCount(),sGD_STATIC,&vp);
+  sSetMem(vp,0,size*verts.GetCount());
+  for(sInt i=0;i<verts.GetCount();i++,vp+=size)
+  {
+    const Wz4PreviewVertex &v = verts[i];
+    sU8 *d = vp;
+    for(const sU32 *desc=fmt->GetDesc();*desc;desc++)
+    {
+      if(*desc & sVF_STREAMMASK)
+        continue;
+      sF32 *fp = (sF32 *) d;
+      sU32 *up = (sU32 *) d;
+      switch(*desc & (sVF_USEMASK|sVF_TYPEMASK))
+      {
+      case sVF_POSITION|sVF_F3:
+        fp[0] = v.Pos.x;
+        fp[1] = v.Pos.y;
+        fp[2] = v.Pos.z;
+        break;
+      case sVF_POSITION|sVF_S4:
+        Wz4PackPos(up,v.Pos,box);
+        break;
+      case sVF_NORMAL|sVF_F3:
+        fp[0] = v.Normal.x;
+        fp[1] = v.Normal.y;
+        fp[2] = v.Normal.z;
+        break;
+      case sVF_NORMAL|sVF_I4:
+        d[0] = sU8(v.Normal.x*127.f+128.f);
+        d[1] = sU8(v.Normal.y*127.f+128.f);
+        d[2] = sU8(v.Normal.z*127.f+128.f);
+        break;
+      case sVF_NORMAL|sVF_S2:
+        *up = Wz4PackOct(v.Normal);
+        break;
+      case sVF_TANGENT|sVF_F3:
+        fp[0] = v.Tangent.x;
+        fp[1] = v.Tangent.y;
+        fp[2] = v.Tangent.z;
+        break;
+      case sVF_TANGENT|sVF_S2:
+        *up = Wz4PackOct(v.Tangent);
+        break;
+      case sVF_BINORMAL|sVF_F3:
+        {
+          sVector30 b;
+          b.Cross(v.Normal,v.Tangent);
+          fp[0] = b.x;
+          fp[1] = b.y;
+          fp[2] = b.z;
+        }
+        break;
+      case sVF_UV0|sVF_F2:
+      case sVF_UV1|sVF_F2:
+        fp[0] = v.U;
+        fp[1] = v.V;
+        break;
+      case sVF_UV0|sVF_H2:
+      case sVF_UV1|sVF_H2:
+        *up = Wz4PackHalf(v.U) | (Wz4PackHalf(v.V)<<16);
+        break;
+      }
+      d += sVertexFormatTypeSizes[(*desc & sVF_TYPEMASK)>>8];
+    }
+  }
+  geo->EndLoadVB();
+
+  sU16 *ip;
+  geo->BeginLoadIB(index.GetCount(),sGD_STATIC,&ip);
+  sCopyMem(ip,index.GetData(),index.GetCount()*sizeof(sU16));
+  geo->EndLoadIB();
+}
+
+// same shape as LoadTorus(tx,ty,ro,ri)
+
+static void Wz4LoadPreviewTorus(sGeometry *geo,sInt tx,sInt ty,sF32 ro,sF32 ri,const sAABBoxC &box)
+{
+  sArray<Wz4PreviewVertex> verts;
+  sArray<sU16> index;
+  for(sInt y=0;y<ty+1;y++)
+  {
+    sF32 fy = y*sPI2F/ty;
+    for(sInt x=0;x<tx+1;x++)
+    {
+      sF32 fx = x*sPI2F/tx;
+      Wz4PreviewVertex *v = verts.AddMany(1);
+      v->Pos.Init(-sFCos(fy)*(ro+sFSin(fx)*ri),sFCos(fx)*ri,sFSin(fy)*(ro+sFSin(fx)*ri));
+      v->Normal.Init(-sFCos(fy)*sFSin(fx),sFCos(fx),sFSin(fy)*sFSin(fx));
+      v->Tangent.Init(sFSin(fy),0,sFCos(fy));
+      v->U = sF32(x)/tx;
+      v->V = sF32(y)/ty;
+    }
+  }
+  sU16 *ip = index.AddMany(tx*ty*6);
+  for(sInt y=0;y<ty;y++)
+    for(sInt x=0;x<tx;x++)
+      sQuad(ip,0,
+        (y+0)*(tx+1) + (x+0),
+        (y+0)*(tx+1) + (x+1),
+        (y+1)*(tx+1) + (x+1),
+        (y+1)*(tx+1) + (x+0));
+
+  Wz4LoadPreview(geo,verts,index,box);
+}
+
+// a cube from -1 to 1, each face wound like LoadCube() does, the uv's are
+// not laid out the same.
+
+static void Wz4LoadPreviewCube(sGeometry *geo,const sAABBoxC &box)
+{
+  static const sF32 corner[4][2] = { { -1,-1 },{ 1,-1 },{ 1,1 },{ -1,1 } };
+
+  sArray<Wz4PreviewVertex> verts;
+  sArray<sU16> index;
+  for(sInt f=0;f<6;f++)
+  {
+    sInt axis = f/2;
+    sF32 s = (f&1) ? 1.0f : -1.0f;
+    sVector30 n(0,0,0),t(0,0,0),b(0,0,0);
+    (&n.x)[axis] = s;
+    (&t.x)[(axis+1)%3] = s;       // t x b = n, so the quads face outwards
+    (&b.x)[(axis+2)%3] = 1;
+    for(sInt i=0;i<4;i++)
+    {
+      Wz4PreviewVertex *v = verts.AddMany(1);
+      v->Pos = sVector31(n+t*corner[i][0]+b*corner[i][1]);
+      v->Normal = n;
+      v->Tangent = t;
+      v->U = corner[i][0]*0.5f+0.5f;
+      v->V = corner[i][1]*0.5f+0.5f;
+    }
+  }
+  sU16 *ip = index.AddMany(6*6);
+  for(sInt i=0;i<6;i++)
+    sQuad(ip,i*4,0,1,2,3);
+
+  Wz4LoadPreview(geo,verts,index,box);
+}
+
+/****************************************************************************/
+
 void Wz4MtrlType_::Show(wObject *obj,wPaintInfo &pi)
 {
   /*
@@ -179,12 +356,22 @@ void Wz4MtrlType_::Show(wObject *obj,wPaintInfo &pi)
         {
           case sMPT_TORUS:
             MaterialPrimitiveGeo = new sGeometry(sGF_INDEX16|sGF_TRILIST,mtrl->GetFormatHandle(sRF_TARGET_MAIN|sRF_MATRIX_ONE));
-            MaterialPrimitiveGeo->LoadTorus(16,24,2,0.5f);
+            MaterialPrimitiveBox.Center.Init(0,0,0);
+            MaterialPrimitiveBox.Radius.Init(2.5f,0.5f,2.5f);
+            if(Wz4PreviewPacked(MaterialPrimitiveGeo->GetFormat()))
+              Wz4LoadPreviewTorus(MaterialPrimitiveGeo,16,24,2,0.5f,MaterialPrimitiveBox);
+            else
+              MaterialPrimitiveGeo->LoadTorus(16,24,2,0.5f);
             break;
 
           case sMPT_CUBE:
             MaterialPrimitiveGeo = new sGeometry(sGF_INDEX16|sGF_TRILIST,mtrl->GetFormatHandle(sRF_TARGET_MAIN|sRF_MATRIX_ONE));
-            MaterialPrimitiveGeo->LoadCube(0,2.0f,2.0f,2.0f);
+            MaterialPrimitiveBox.Center.Init(0,0,0);
+            MaterialPrimitiveBox.Radius.Init(1,1,1);
+            if(Wz4PreviewPacked(MaterialPrimitiveGeo->GetFormat()))
+              Wz4LoadPreviewCube(MaterialPrimitiveGeo,MaterialPrimitiveBox);
+            else
+              MaterialPrimitiveGeo->LoadCube(0,2.0f,2.0f,2.0f);
             break;
 
           case sMPT_SPHERE:
@@ -196,6 +383,7 @@ void Wz4MtrlType_::Show(wObject *obj,wPaintInfo &pi)
       }
 
       Wz4MtrlType->PrepareView(*pi.View);
+      mtrl->PackBox = MaterialPrimitiveBox;
       mtrl->Set(sRF_TARGET_MAIN|sRF_MATRIX_ONE,0,0,0,0,0);
 
       MaterialPrimitiveGeo->Draw();
@@ -407,6 +595,8 @@ Wz4Mtrl::Wz4Mtrl()
 {
   Type = Wz4MtrlType;
   ShellExtrude = 0;
+  PackBox.Center.Init(0,0,0);
+  PackBox.Radius.Init(1,1,1);
 }
 
 /****************************************************************************/
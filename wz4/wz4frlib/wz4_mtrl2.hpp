@@ -56,6 +56,7 @@ public:
   virtual sVertexFormatHandle *GetFormatHandle(sInt flags)=0;
   virtual void Set(sInt flags,sInt index,const sMatrix34CM *mat,sInt SkinMatCount,const sMatrix34CM *SkinMats,sInt *SkinMatMap)=0;
   virtual sBool SkipPhase(sInt flags,sInt EnvNum)=0;
+  virtual sBool CanMatrix(sInt matrix) { return 1; }   // has shaders for this sRF_MATRIX_??? mode
 
   virtual void Serialize(sReader &stream) { sFatal(L"no serialize for this material type yet"); }
   virtual void Serialize(sWriter &stream) { sFatal(L"no serialize for this material type yet"); }
@@ -65,6 +66,7 @@ public:
   // extra parameters. might be used by some material implementations
 
   sF32 ShellExtrude;      // for shell of fur rendering.
+  sAABBoxC PackBox;       // packed vertex positions are relative to this box, set for each cluster
 };
 
 /****************************************************************************/
@@ -136,6 +138,7 @@ public:
 
   sVertexFormatHandle *GetFormatHandle(sInt flags);
   sBool SkipPhase(sInt flags, sInt EnvNum);
+  sBool CanMatrix(sInt matrix) { return matrix==sRF_MATRIX_ONE; }
 
   sTextBuffer Log;
 
@@ -43,6 +43,7 @@ public:
   void Prepare();
   sVertexFormatHandle *GetFormatHandle(sInt flags);
   sBool SkipPhase(sInt flags,sInt EnvNum);
+  sBool CanMatrix(sInt matrix) { return matrix!=sRF_MATRIX_INSTPLUS; }
 };
 
 /****************************************************************************/
@@ -0,0 +1,203 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#ifndef FILE_WZ4FRLIB_WZ4_VERTEXPACK_HPP
+#define FILE_WZ4FRLIB_WZ4_VERTEXPACK_HPP
+
+#include "base/types.hpp"
+#include "base/math.hpp"
+#include "util/simd_float.hpp"
+
+/****************************************************************************/
+
+// packed vertex elements for ModMtrl's compact vertices. sHalfFloat::Set()
+// does not handle zero and small numbers, which are common in uv's.
+// wz4packcheck tests the precision of these.
+
+inline sU32 Wz4PackSNorm(sF32 f)          // sVF_S2 / sVF_S4 component
+{
+  return sU32(sRoundNearInt(sClamp(f,-1.0f,1.0f)*32767)) & 0xffff;
+}
+
+inline sU32 Wz4PackHalf(sF32 f)           // sVF_H2 component, round to nearest even
+{
+  sU32 i = sRawCast<sU32,sF32>(f);
+  sU32 sign = (i>>16) & 0x8000;
+  sInt exp = sInt((i>>23)&0xff)-127+15;
+  sU32 man = i & 0x007fffff;
+  sU32 h,rest,half;
+
+  if(exp>=31)                             // too large, infinity and nan
+    return sign|0x7bff;
+  if(exp<=0)                              // denormal
+  {
+    if(exp<-10)
+      return sign;
+    sInt shift = 14-exp;
+    man |= 0x00800000;
+    h = man>>shift;
+    rest = man & ((1<<shift)-1);
+    half = 1<<(shift-1);
+  }
+  else
+  {
+    h = (exp<<10)|(man>>13);
+    rest = man & 0x1fff;
+    half = 0x1000;
+  }
+  if(rest>half || (rest==half && (h&1)))
+    h++;                                  // a carry into the exponent is right
+  return sign|sMin<sU32>(h,0x7bff);
+}
+
+// unit vector to octahedral sVF_S2: fold the lower hemisphere of the
+// octahedron over the upper, so the surface is a square in x and y.
+// the shader side is OctDecode() in wz4_modmtrl.cpp.
+
+inline sU32 Wz4PackOct(const sVector30 &n)
+{
+  sF32 l = sFAbs(n.x)+sFAbs(n.y)+sFAbs(n.z);
+  if(l<1e-20f)
+    return 0;
+  sF32 x = n.x/l;
+  sF32 y = n.y/l;
+  if(n.z<0)
+  {
+    sF32 fx = (1-sFAbs(y))*(x>=0 ? 1 : -1);
+    sF32 fy = (1-sFAbs(x))*(y>=0 ? 1 : -1);
+    x = fx;
+    y = fy;
+  }
+  return Wz4PackSNorm(x) | (Wz4PackSNorm(y)<<16);
+}
+
+// position relative to a box as sVF_S4, two words. w is always 1. this is
+// done in double, so the error is never more than half a step, even when
+// the box is far from the origin.
+
+inline sU32 Wz4PackPosComponent(sF32 pos,sF32 center,sF32 radius)
+{
+  if(!(radius>0))
+    return 0;
+  sF64 f = (sF64(pos)-center)/radius;
+  f = sClamp<sF64>(f,-1,1)*32767;
+  return sU32(sInt(f<0 ? f-0.5 : f+0.5)) & 0xffff;
+}
+
+inline void Wz4PackPos(sU32 *d,const sVector31 &pos,const sAABBoxC &box)
+{
+  d[0] = Wz4PackPosComponent(pos.x,box.Center.x,box.Radius.x) | (Wz4PackPosComponent(pos.y,box.Center.y,box.Radius.y)<<16);
+  d[1] = Wz4PackPosComponent(pos.z,box.Center.z,box.Radius.z) | (0x7fff<<16);
+}
+
+/****************************************************************************/
+
+// four at a time with SSE2, one component of four vertices in a register.
+// the results are the same as above, wz4packcheck compares them.
+
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+
+inline __m128i Wz4PackSNorm4(sSSE f)
+{
+  f = sVecMin(sVecMax(f,sVecLoadScalar(-1.0f)),sVecLoadScalar(1.0f));
+  f = sVecAdd(sVecMul(f,sVecLoadScalar(32767.0f)),sVecLoadScalar(0.5f));
+  __m128i i = _mm_cvttps_epi32(f);          // floor, like sRoundNearInt()
+  i = _mm_add_epi32(i,_mm_castps_si128(sVecCmpGT(_mm_cvtepi32_ps(i),f)));
+  return _mm_and_si128(i,_mm_set1_epi32(0xffff));
+}
+
+inline __m128i Wz4PackHalf4(sSSE f)
+{
+  __m128i i = _mm_castps_si128(f);
+  __m128i sign = _mm_and_si128(_mm_srli_epi32(i,16),_mm_set1_epi32(0x8000));
+  __m128i a = _mm_and_si128(i,_mm_set1_epi32(0x7fffffff));
+
+  // normal: rebias and round to nearest even on the bits
+
+  __m128i odd = _mm_and_si128(_mm_srli_epi32(a,13),_mm_set1_epi32(1));
+  __m128i n = _mm_add_epi32(a,_mm_set1_epi32(0xfff-((127-15)<<23)));
+  n = _mm_srli_epi32(_mm_add_epi32(n,odd),13);
+
+  // denormal: let the fpu round, adding 0.5 leaves the half mantissa in
+  // the low bits
+
+  __m128i d = _mm_castps_si128(sVecAdd(_mm_castsi128_ps(a),sVecLoadScalar(0.5f)));
+  d = _mm_sub_epi32(d,_mm_set1_epi32(126<<23));
+
+  __m128i den = _mm_cmplt_epi32(a,_mm_set1_epi32(113<<23));
+  __m128i h = _mm_or_si128(_mm_and_si128(den,d),_mm_andnot_si128(den,n));
+  __m128i big = _mm_cmpgt_epi32(h,_mm_set1_epi32(0x7bff));
+  h = _mm_or_si128(_mm_and_si128(big,_mm_set1_epi32(0x7bff)),_mm_andnot_si128(big,h));
+  return _mm_or_si128(h,sign);
+}
+
+inline __m128i Wz4PackOct4(sSSE x,sSSE y,sSSE z)
+{
+  sSSE signbit = sVecLoadScalar(-0.0f);
+  sSSE one = sVecLoadScalar(1.0f);
+  sSSE zero = sVecZero();
+  sSSE l = sVecAdd(sVecAdd(sVecAndC(x,signbit),sVecAndC(y,signbit)),sVecAndC(z,signbit));
+  sSSE ok = _mm_cmpnlt_ps(l,sVecLoadScalar(1e-20f));
+  x = sVecDiv(x,l);
+  y = sVecDiv(y,l);
+  sSSE sx = sVecOr(one,sVecAndC(signbit,sVecCmpGE(x,zero)));
+  sSSE sy = sVecOr(one,sVecAndC(signbit,sVecCmpGE(y,zero)));
+  sSSE fx = sVecMul(sVecSub(one,sVecAndC(y,signbit)),sx);
+  sSSE fy = sVecMul(sVecSub(one,sVecAndC(x,signbit)),sy);
+  sSSE lower = sVecCmpLT(z,zero);
+  x = sVecSel(x,fx,lower);
+  y = sVecSel(y,fy,lower);
+  __m128i r = _mm_or_si128(Wz4PackSNorm4(x),_mm_slli_epi32(Wz4PackSNorm4(y),16));
+  return _mm_and_si128(r,_mm_castps_si128(ok));
+}
+
+// positions in double, two components at a time
+
+struct Wz4PackPosSSE
+{
+  __m128d Center[2];
+  __m128d Radius[2];
+  __m128i Valid;
+
+  Wz4PackPosSSE(const sAABBoxC &box)
+  {
+    Center[0] = _mm_setr_pd(box.Center.x,box.Center.y);
+    Center[1] = _mm_setr_pd(box.Center.z,0);
+    Radius[0] = _mm_setr_pd(box.Radius.x,box.Radius.y);
+    Radius[1] = _mm_setr_pd(box.Radius.z,1);
+    Valid = _mm_setr_epi32(box.Radius.x>0 ? 0xffff : 0,box.Radius.y>0 ? 0xffff : 0,box.Radius.z>0 ? 0xffff : 0,0);
+  }
+
+  void Pack(sU32 *d,const sVector31 &pos) const
+  {
+    __m128d signbit = _mm_set1_pd(-0.0);
+    __m128d p[2];
+    p[0] = _mm_setr_pd(pos.x,pos.y);
+    p[1] = _mm_setr_pd(pos.z,0);
+    __m128i q[2];
+    for(sInt i=0;i<2;i++)
+    {
+      __m128d f = _mm_div_pd(_mm_sub_pd(p[i],Center[i]),Radius[i]);
+      f = _mm_min_pd(_mm_max_pd(f,_mm_set1_pd(-1.0)),_mm_set1_pd(1.0));
+      f = _mm_mul_pd(f,_mm_set1_pd(32767.0));
+      f = _mm_add_pd(f,_mm_or_pd(_mm_and_pd(f,signbit),_mm_set1_pd(0.5)));
+      q[i] = _mm_cvttpd_epi32(f);
+    }
+    __m128i r = _mm_and_si128(_mm_unpacklo_epi64(q[0],q[1]),Valid);
+    sU32 v[4];
+    _mm_storeu_si128((__m128i *)v,r);
+    d[0] = v[0] | (v[1]<<16);
+    d[1] = v[2] | (0x7fff<<16);
+  }
+};
+
+#endif
+
+/****************************************************************************/
+
+#endif // FILE_WZ4FRLIB_WZ4_VERTEXPACK_HPP
+
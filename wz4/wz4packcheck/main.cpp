@@ -0,0 +1,290 @@
+/*+**************************************************************************/
+/***                                                                      ***/
+/***   This file is distributed under a BSD license.                      ***/
+/***   See LICENSE.txt for details.                                       ***/
+/***                                                                      ***/
+/**************************************************************************+*/
+
+#include "base/types.hpp"
+#include "base/math.hpp"
+#include "base/system.hpp"
+#include "wz4frlib/wz4_vertexpack.hpp"
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Precision check for the packed vertex elements of ModMtrl's        ***/
+/***   compact vertices (wz4frlib/wz4_vertexpack.hpp). The decoders here  ***/
+/***   do what the generated vertex shaders do, in double.                ***/
+/***                                                                      ***/
+/***   - half floats are bit exact (round to nearest even)                ***/
+/***   - octahedral normals are within 0.004 degrees                      ***/
+/***   - positions are within half a step of radius/32767                 ***/
+/***   - the SSE2 versions give the same bits as the plain ones           ***/
+/***                                                                      ***/
+/***   Sets the error code when a check fails.                            ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+static sInt Errors;
+
+static void Check(sBool ok,const sChar *what)
+{
+  sPrintF(L"%-40s %s\n",what,ok ? L"ok" : L"FAILED");
+  if(!ok)
+    Errors++;
+}
+
+static sF32 FloatFromBits(sU32 i)
+{
+  return sRawCast<sF32,sU32>(i);
+}
+
+static sU32 BitsFromFloat(sF32 f)
+{
+  return sRawCast<sU32,sF32>(f);
+}
+
+/****************************************************************************/
+
+static sF32 HalfValue(sU32 h)     // exact, positive halves only
+{
+  sU32 exp = (h>>10)&31;
+  sU32 man = h&1023;
+  if(exp==0)
+    return sF32(man)/16777216.0f;
+  return FloatFromBits(((exp-15+127)<<23)|(man<<13));
+}
+
+// every finite half, and the floats around the midpoints to its neighbour
+
+static void CheckHalf()
+{
+  sInt bad = 0;
+  for(sU32 sign=0;sign<=0x8000;sign+=0x8000)
+  {
+    sF32 s = sign ? -1.0f : 1.0f;
+    for(sU32 h=0;h<0x7bff;h++)
+    {
+      sF32 mid = (HalfValue(h)+HalfValue(h+1))*0.5f;   // exact in float
+      sU32 even = (h&1) ? h+1 : h;
+
+      if(Wz4PackHalf(s*HalfValue(h))!=(sign|h)) bad++;
+      if(Wz4PackHalf(s*FloatFromBits(BitsFromFloat(mid)-1))!=(sign|h)) bad++;
+      if(Wz4PackHalf(s*mid)!=(sign|even)) bad++;
+      if(Wz4PackHalf(s*FloatFromBits(BitsFromFloat(mid)+1))!=(sign|(h+1))) bad++;
+    }
+    if(Wz4PackHalf(s*65504.0f)!=(sign|0x7bff)) bad++;
+    if(Wz4PackHalf(s*1e10f)!=(sign|0x7bff)) bad++;      // saturates
+    if(Wz4PackHalf(s*1e-10f)!=sign) bad++;
+  }
+  if(Wz4PackHalf(0.0f)!=0) bad++;
+
+  if(bad)
+    sPrintF(L"half: %d wrong\n",bad);
+  Check(bad==0,L"half floats bit exact");
+}
+
+/****************************************************************************/
+
+static sF64 SNormValue(sU32 s)    // as the vertex fetch does
+{
+  return sF64(sS16(s&0xffff))/32767;
+}
+
+static sF64 OctError(const sVector30 &n)
+{
+  sU32 p = Wz4PackOct(n);
+
+  // OctDecode() in wz4_modmtrl.cpp
+
+  sF64 x = SNormValue(p);
+  sF64 y = SNormValue(p>>16);
+  sF64 z = 1-(x<0 ? -x : x)-(y<0 ? -y : y);
+  if(z<0)
+  {
+    x += (x>=0 ? -1 : 1)*-z;
+    y += (y>=0 ? -1 : 1)*-z;
+  }
+
+  // angle from the cross and dot products, acos is no good for small angles
+
+  sF64 cx = y*n.z-z*n.y;
+  sF64 cy = z*n.x-x*n.z;
+  sF64 cz = x*n.y-y*n.x;
+  sF64 dot = x*n.x+y*n.y+z*n.z;
+  sF32 cross = sFSqrt(sF32(cx*cx+cy*cy+cz*cz));
+  return sFATan2(cross,sF32(dot))*180/sPI;
+}
+
+static void CheckOct()
+{
+  sRandomMT rnd;
+  sF64 max = 0;
+
+  static const sF32 special[][3] =
+  {
+    { 1,0,0 },{ -1,0,0 },{ 0,1,0 },{ 0,-1,0 },{ 0,0,1 },{ 0,0,-1 },
+    { 1,1,0 },{ 1,-1,0 },{ -1,1,0 },{ -1,-1,0 },{ 1,1,1 },{ -1,-1,-1 },
+  };
+  for(sInt i=0;i<sCOUNTOF(special);i++)
+  {
+    sVector30 n(special[i][0],special[i][1],special[i][2]);
+    n.Unit();
+    max = sMax(max,OctError(n));
+  }
+
+  for(sInt i=0;i<1000000;)
+  {
+    sF64 x = rnd.FloatSigned(1);
+    sF64 y = rnd.FloatSigned(1);
+    sF64 z = rnd.FloatSigned(1);
+    sF64 l = x*x+y*y+z*z;
+    if(l>1 || l<0.0001)
+      continue;
+    l = sFSqrt(sF32(l));
+    sVector30 n(sF32(x/l),sF32(y/l),sF32(z/l));
+    max = sMax(max,OctError(n));
+    i++;
+  }
+
+  sPrintF(L"octahedral: max %1.5f degrees\n",max);
+  Check(max<0.004,L"octahedral normals within 0.004 degrees");
+}
+
+/****************************************************************************/
+
+static void CheckPos()
+{
+  sRandomMT rnd;
+  sF64 worst = 0;                 // in steps
+  sInt badw = 0;
+
+  for(sInt i=0;i<1000000;i++)
+  {
+    sAABBoxC box;
+    box.Center.Init(rnd.FloatSigned(1000),rnd.FloatSigned(1000),rnd.FloatSigned(1000));
+    box.Radius.Init(0.001f+rnd.Float(500),0.001f+rnd.Float(500),0.001f+rnd.Float(500));
+    sVector31 pos;
+    pos.x = box.Center.x+rnd.FloatSigned(0.999f)*box.Radius.x;
+    pos.y = box.Center.y+rnd.FloatSigned(0.999f)*box.Radius.y;
+    pos.z = box.Center.z+rnd.FloatSigned(0.999f)*box.Radius.z;
+
+    sU32 d[2];
+    Wz4PackPos(d,pos,box);
+
+    const sF32 *p = &pos.x;
+    const sF32 *c = &box.Center.x;
+    const sF32 *r = &box.Radius.x;
+    sU32 s[3] = { d[0],d[0]>>16,d[1] };
+    for(sInt j=0;j<3;j++)
+    {
+      sF64 decoded = c[j]+SNormValue(s[j])*r[j];
+      sF64 err = decoded-p[j];
+      if(err<0) err = -err;
+      worst = sMax(worst,err/(r[j]/32767));
+    }
+    if((d[1]>>16)!=0x7fff)
+      badw++;
+  }
+
+  sPrintF(L"positions: max %1.5f steps\n",worst);
+  Check(worst<=0.5+1e-9 && badw==0,L"positions within half a step");
+}
+
+/****************************************************************************/
+
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+
+static sBool Same4(__m128i v,const sU32 *ref)
+{
+  sU32 r[4];
+  _mm_storeu_si128((__m128i *) r,v);
+  return r[0]==ref[0] && r[1]==ref[1] && r[2]==ref[2] && r[3]==ref[3];
+}
+
+// random bit patterns for the halves, nan included. the snorm clamps treat
+// nan differently, that is left out.
+
+static void CheckSIMD()
+{
+  sRandomMT rnd;
+  sInt bad = 0;
+
+  for(sInt i=0;i<4000000;i++)
+  {
+    sF32 f[4];
+    sU32 ref[4];
+    for(sInt j=0;j<4;j++)
+    {
+      f[j] = FloatFromBits(rnd.Int32());
+      ref[j] = Wz4PackHalf(f[j]);
+    }
+    if(!Same4(Wz4PackHalf4(sVecLoadU(f)),ref)) bad++;
+
+    for(sInt j=0;j<4;j++)
+    {
+      f[j] = rnd.FloatSigned(1.5f);
+      if(j==i%4) f[j] = sRoundNearInt(f[j]*32767)/32767.0f+0.5f/32767;    // ties
+      ref[j] = Wz4PackSNorm(f[j]);
+    }
+    if(!Same4(Wz4PackSNorm4(sVecLoadU(f)),ref)) bad++;
+  }
+  sPrintF(L"sse2 half and snorm: %d wrong\n",bad);
+  Check(bad==0,L"sse2 half and snorm bit exact");
+
+  bad = 0;
+  for(sInt i=0;i<1000000;i++)
+  {
+    sF32 x[4],y[4],z[4];
+    sU32 ref[4];
+    for(sInt j=0;j<4;j++)
+    {
+      x[j] = rnd.FloatSigned(1);
+      y[j] = rnd.FloatSigned(1);
+      z[j] = rnd.FloatSigned(1);
+      if(j==i%4 && (i&4)) x[j] = y[j] = z[j] = 0;
+      ref[j] = Wz4PackOct(sVector30(x[j],y[j],z[j]));
+    }
+    if(!Same4(Wz4PackOct4(sVecLoadU(x),sVecLoadU(y),sVecLoadU(z)),ref)) bad++;
+  }
+  sPrintF(L"sse2 octahedral: %d wrong\n",bad);
+  Check(bad==0,L"sse2 octahedral bit exact");
+
+  bad = 0;
+  for(sInt i=0;i<1000000;i++)
+  {
+    sAABBoxC box;
+    box.Center.Init(rnd.FloatSigned(1000),rnd.FloatSigned(1000),rnd.FloatSigned(1000));
+    box.Radius.Init(rnd.Float(500),rnd.Float(500),(i&1) ? 0 : rnd.Float(500));
+    sVector31 pos;
+    pos.x = box.Center.x+rnd.FloatSigned(1.2f)*box.Radius.x;
+    pos.y = box.Center.y+rnd.FloatSigned(1.2f)*box.Radius.y;
+    pos.z = box.Center.z+rnd.FloatSigned(1.2f)*box.Radius.z;
+
+    sU32 a[2],b[2];
+    Wz4PackPos(a,pos,box);
+    Wz4PackPosSSE(box).Pack(b,pos);
+    if(a[0]!=b[0] || a[1]!=b[1]) bad++;
+  }
+  sPrintF(L"sse2 positions: %d wrong\n",bad);
+  Check(bad==0,L"sse2 positions bit exact");
+}
+
+#endif
+
+/****************************************************************************/
+
+void sMain()
+{
+  CheckHalf();
+  CheckOct();
+  CheckPos();
+#if sSIMD_INTRINSICS && sSIMD_SSE2
+  CheckSIMD();
+#endif
+
+  if(Errors)
+    sSetErrorCode();
+}
+
+/****************************************************************************/
@@ -9,9 +9,11 @@
 #include "wz4lib/doc.hpp"
 #include "wz4frlib/packfile.hpp"
 #include "wz4frlib/packfilegen.hpp"
+#include "wz4frlib/wz4_classes.hpp"
 #include "wz4lib/version.hpp"
 #include "util/painter.hpp"
 #include "util/taskscheduler.hpp"
+#include "util/audioanalysis.hpp"
 #include "extra/blobheap.hpp"
 #include "extra/freecam.hpp"
 
@@ -29,63 +31,7 @@ static sDemoPackFile *PackFile=0;
 
 void RegisterWZ4Classes()
 {
-  for(sInt i=0;i<2;i++)
-  {
-    sREGOPS(basic,0);
-    sREGOPS(poc,1);
-//    sREGOPS(minmesh,1);           // obsolete wz3
-//    sREGOPS(genspline,1);         // obsolete wz3
-
-    sREGOPS(chaos_font,0);        // should go away soon (detuned)
-    sREGOPS(wz3_bitmap,0);
-    sREGOPS(wz4_anim,0);
-//    sREGOPS(wz4_bitmap,1);        // bitmap system based on new image libarary, never finished
-//    sREGOPS(wz4_cubemap,0);       // bitmap system based on new image libarary, never finished
-    sREGOPS(wz4_mtrl,1);
-    sREGOPS(chaosmesh,1);         // should go away soon (detuned)
-//    sREGOPS(wz4_demo,1);          // old demo system, never worked
-    sREGOPS(wz4_demo2,0);
-    sREGOPS(wz4_mesh,0);
-    sREGOPS(chaosfx,0);
-    sREGOPS(easter,0);
-    sREGOPS(wz4_bsp,0);
-    sREGOPS(wz4_mtrl2,0);
-//    sREGOPS(wz4_rovemtrl,0);      // was never finished
-    sREGOPS(tron,1);
-    sREGOPS(wz4_ipp,0);
-    sREGOPS(wz4_audio,0);         // audio to image -> not usefull (yet)
-    //sREGOPS(wz4_ssao,0);
-    sREGOPS(fxparticle,0);
-    sREGOPS(wz4_modmtrl,0);
-    sREGOPS(wz4_modmtrlmod,0);
-
-//    sREGOPS(fr033,0);   // bp invitation
-    sREGOPS(fr062,0);   // the cube
-    sREGOPS(fr063_chaos,0);   // chaos+tron
-    sREGOPS(fr063_tron,0);   // chaos+tron
-    sREGOPS(fr063_mandelbulb,0);   // chaos+tron
-    sREGOPS(fr063_sph,0);   // chaos+tron
-//    sREGOPS(fr070,0);
-
-    sREGOPS(adf,0);     
-    sREGOPS(pdf,0);
-
-#ifdef sCOMPIL_PHYSX
-    sREGOPS(wz4_physx,0);
-#endif
-  }
-
-  Doc->FindType(L"Scene")->Secondary = 1;
-  Doc->FindType(L"GenBitmap")->Order = 2;
-  Doc->FindType(L"Wz4Mesh")->Order = 3;
-  Doc->FindType(L"Wz4Render")->Order = 4;
-  Doc->FindType(L"Wz4Mtrl")->Order = 5;
-
-  wClass *cl = Doc->FindClass(L"MakeTexture2",L"Texture2D");
-  sVERIFY(cl);
-  Doc->Classes.RemOrder(cl);
-  Doc->Classes.AddHead(cl);   // order preserving!
-
+  Wz4RegisterPlayerClasses();
 }
 
 /****************************************************************************/
@@ -137,6 +83,7 @@ public:
 
   sBool HasMusic;
   bMusicPlayer MusicPlayer;
+  sAudioTrack MusicTrack;
 
   sInt StartFlag;
   sInt StartTime;
@@ -236,6 +183,12 @@ public:
     {
       MusicPlayer.Init(Doc->DocOptions.MusicFile);
       MusicPlayer.SetLoop(Doc->DocOptions.Infinite);
+
+      // analysis track written by the editor, for audio() in scripts
+      sString<sMAXPATH> trackfile;
+      trackfile.PrintF(L"%s.atrk",Doc->DocOptions.MusicFile);
+      if (sCheckFile(trackfile) && MusicTrack.Load(trackfile))
+        sCurrentAudioTrack = &MusicTrack;
     }
 
     sInt t2=sGetTime();
@@ -601,6 +554,22 @@ static void CheckCapsCallback(void *user)
 
 extern void sCollector(sBool exit=sFALSE);
 
+static void AddMusicFile(sArray<sPackFileCreateEntry> &files,const sChar *song)
+{
+  if (!sCheckFile(song))
+    return;
+  files.AddTail(sPackFileCreateEntry(song,sFALSE));
+
+  // analysis track from the editor, if there is one
+  sString<sMAXPATH> trackfile;
+  trackfile.PrintF(L"%s.atrk",song);
+  if (sCheckFile(trackfile))
+  {
+    sPoolString tn=trackfile;
+    files.AddTail(sPackFileCreateEntry(tn));
+  }
+}
+
 static void MakePackfile(const sChar *wz4name, const sChar *packname)
 {
   sArray<sPackFileCreateEntry> files;
@@ -639,11 +608,11 @@ static void MakePackfile(const sChar *wz4name, const sChar *packname)
     }
 
     // add music file if applicable
-    if (!Doc->DocOptions.MusicFile.IsEmpty() && sCheckFile(Doc->DocOptions.MusicFile))
-      files.AddTail(sPackFileCreateEntry(Doc->DocOptions.MusicFile,sFALSE));
+    if (!Doc->DocOptions.MusicFile.IsEmpty())
+      AddMusicFile(files,Doc->DocOptions.MusicFile);
     sFORALL(Doc->DocOptions.HiddenParts,hp)
-      if(!hp->Song.IsEmpty() && sCheckFile(hp->Song))
-        files.AddTail(sPackFileCreateEntry(hp->Song,sFALSE));
+      if(!hp->Song.IsEmpty())
+        AddMusicFile(files,hp->Song);
 
     // add text file with name of wz4 file in it
     sString<sMAXPATH> txtname;